@@ -1,4 +1,3 @@
-gcc -Imodules main.c modules/glad.c modules/image_loaders.c modules/render.c -o SharkPix -std=c11 \
-	-lSDL3 -lSDL3_image -lGL \
-	-lwebp -lheif -ltiff -ljpeg -ljxl -lspng \
+gcc -Imodules main.c modules/glad.c modules/image_loaders.c modules/render.c modules/tile_cache.c modules/file_source.c modules/io_reader.c modules/pipeline.c modules/loader.c modules/gif_decoder.c modules/anim_stream.c modules/flipbook.c modules/gpu_jpeg.c modules/transcode.c modules/probe.c modules/harvest.c modules/sort_key.c modules/parallel.c modules/catalog.c modules/stat_pass.c modules/dir_scan.c modules/dir_watch.c modules/dir_index.c -o SharkPix -std=c11 \
+	-lSDL3 -lGL -ldl \
 	-lpthread -lm -latomic
@@ -4,307 +4,451 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
-#include <stb/stb_image.h>
 #include <SDL3/SDL.h>
-#include <SDL3_image/SDL_image.h>
 
 #include "modules/glad.h"
 #include "modules/main_structs.h"
-#include "modules/image_loaders.h"
 #include "modules/render.h"
+#include "modules/tile_cache.h"
+#include "modules/loader.h"
+#include "modules/catalog.h"
+#include "modules/dir_scan.h"
+#include "modules/dir_watch.h"
+#include "modules/dir_index.h"
+#include "modules/harvest.h"
+#include "modules/stat_pass.h"
+#include "modules/flipbook.h"
+#include "modules/gpu_jpeg.h"
+#include "modules/transcode.h"
 
 AppState g_appState;
 
-void ImageList_init(ImageList* list) {
-	list->items = NULL; list->size = 0; list->capacity = 0;
-}
+static DirScanner* g_scanner;
+static DirWatch* g_watch;
+static bool g_recursive; // -r, subfolders are listed too
+static DirStamp g_dirStamp; // the directory when the listing began, saved with the index
+static bool g_haveStamp;
+static bool g_indexLoaded;
+static bool g_indexStale = true; // written again at exit once the list or its metadata changed
+static size_t g_harvestCursor; // ids below this were handed to the harvester or need nothing
+static int g_harvestOutstanding;
+static bool g_captureTimesChanged; // the date-taken order is redone once the pass catches up
+static StatPass* g_statPass;
+static bool g_statsMissing = true; // images without size and date may be in the list, a metadata sort stats them
+static bool g_verifyIndex; // entries from the saved index are stat'ed once to catch files rewritten in place
 
-void ImageList_add(ImageList* list, ImageMetadata item) {
-	if (list->size >= list->capacity) {
-		size_t n = list->capacity == 0 ? 8 : list->capacity * 2;
-		ImageMetadata* i = (ImageMetadata*)realloc(list->items, n * sizeof(ImageMetadata));
-		if (!i) { SDL_Log("Realloc fail"); return; }
-		list->items = i; list->capacity = n;
+// Leaves the residency set, a load still in flight keeps the image LOADING
+void unloadTexture(int id) {
+	ImageMetadata* img = &g_appState.images.items[id];
+	if (img->textureID != 0) {
+		glDeleteTextures(1, &img->textureID);
+		img->textureID = 0;
+	}
+	ResidentImage* res = ImageCatalog_resident(&g_appState.images, id);
+	if (res && res->anim_stream) {
+		AnimStream_close(res->anim_stream);
+		res->anim_stream = NULL;
+	}
+	if (res) releaseFrameArray(res);
+	if (res && res->palette_texture) {
+		glDeleteTextures(1, &res->palette_texture);
+		res->palette_texture = 0;
+	}
+	if (res && res->reduced_texture) {
+		glDeleteTextures(1, &res->reduced_texture);
+		res->reduced_texture = 0;
+	}
+	if (res && res->chroma_textures[0]) {
+		glDeleteTextures(2, res->chroma_textures);
+		res->chroma_textures[0] = res->chroma_textures[1] = 0;
+	}
+	if (res) Transcoder_forget(id);
+	if (res && res->tiled) {
+		TileTextures_release(res->tiled);
+		TiledImage_close(res->tiled);
+		res->tiled = NULL;
+	}
+	// The size stays, it is the probed header size too and goes into the index
+	if (img->state == IMAGE_STATE_LOADED) {
+		ImageCatalog_setState(&g_appState.images, id, IMAGE_STATE_UNLOADED);
 	}
-	list->items[list->size++] = item;
 }
-void ImageList_free(ImageList* list) {
-	free(list->items); ImageList_init(list);
+
+// Keeps the neighbors of the current image and whatever is still on screen, the rest is kept compressed where it can be.
+// Walks the residency set backwards since unloading swaps the last member into the freed slot.
+void unloadTexturesOutsideWindow(void) {
+	for (size_t i = g_appState.images.residentCount; i-- > 0;) {
+		ResidentImage* res = &g_appState.images.resident[i];
+		int id = (int)res->id;
+		if (id == g_appState.activeTextureIndex || isInPrefetchWindow(id)) continue;
+		if (g_appState.images.items[id].state != IMAGE_STATE_LOADED) continue;
+		// Its full decode was dropped with the window, coming back asks again
+		res->reloading = false;
+		if (res->compressed || Transcoder_pending(id) || Transcoder_begin(id)) continue;
+		unloadTexture(id);
+	}
+	int id;
+	while ((id = Transcoder_overBudget()) >= 0) unloadTexture(id);
 }
 
-void LoadResultQueue_init(LoadResultQueue* queue) {
-	queue->head = NULL; queue->tail = NULL; queue->mutex = SDL_CreateMutex();
+// Compressed copies finished in the background replace full textures outside the window
+void processTranscodeResults() {
+	Transcoder_update();
+	int id;
+	while ((id = Transcoder_overBudget()) >= 0) unloadTexture(id);
 }
 
-void LoadResultQueue_free(LoadResultQueue* queue) {
-	LoadResultNode* c = queue->head;
-	while (c != NULL) {
-		LoadResultNode* n = c->next; free(c); c = n;
+void processLoaderResults() {
+	ImageCatalog* catalog = &g_appState.images;
+	LoadResult result;
+	// A flipbook's frames would otherwise all go up in one frame and stall playback
+	int uploads = Flipbook_active() ? FLIPBOOK_UPLOADS_PER_FRAME : INT_MAX;
+	while (uploads-- > 0 && loader_pollResult(&result)) {
+		int id = result.index;
+		ImageMetadata* img = &catalog->items[id];
+		if (result.fileSize) ImageCatalog_setFileSize(catalog, id, result.fileSize);
+		if (result.captureTime && result.captureTime != catalog->captureTime[id]) {
+			ImageCatalog_setCaptureTime(catalog, id, result.captureTime);
+			g_indexStale = true;
+		}
+		ResidentImage* held = img->state == IMAGE_STATE_LOADED ? ImageCatalog_resident(catalog, id) : NULL;
+		// The full quality decode of an image shown compressed meanwhile
+		bool upgrade = held && held->compressed;
+		// Navigation moved on, or a duplicate of an image that is already resident
+		if (!isInPrefetchWindow(id) || (img->state == IMAGE_STATE_LOADED && !upgrade)) {
+			loader_discardResult(&result);
+			if (img->state == IMAGE_STATE_LOADING) ImageCatalog_setState(catalog, id, IMAGE_STATE_UNLOADED);
+			if (held) held->reloading = false;
+			continue;
+		}
+		bool isCurrent = id == g_appState.currentIndex;
+		if (!result.success) {
+			// The compressed copy stays, the next visit asks for the full decode again
+			if (upgrade) {
+				held->reloading = false;
+				continue;
+			}
+			ImageCatalog_setState(catalog, id, IMAGE_STATE_FAILED);
+			if (g_appState.activeTextureIndex == id) {
+				g_appState.activeTextureIndex = -1;
+			}
+			if (isCurrent) updateWindowTitle();
+			continue;
+		}
+		if (upgrade) unloadTexture(id);
+		ImageCatalog_setState(catalog, id, IMAGE_STATE_LOADED);
+		ResidentImage* res = ImageCatalog_resident(catalog, id);
+		if (!res) {
+			loader_discardResult(&result);
+			ImageCatalog_setState(catalog, id, IMAGE_STATE_FAILED);
+			continue;
+		}
+		if (img->full_width != result.width || img->full_height != result.height) g_indexStale = true;
+		img->full_width = result.width;
+		img->full_height = result.height;
+		res->opaque = result.opaque;
+		res->peak = result.peak;
+		bool gpuFailed = false;
+		if (result.tiled) {
+			res->tiled = result.tiled;
+		} else {
+			res->anim_stream = result.anim_stream;
+			res->anim_frame = 0;
+			res->anim_time_ms = 0;
+			if (res->anim_stream) res->anim_frame_delay = (Uint32)AnimStream_firstDelay(res->anim_stream);
+			if (result.palette) {
+				createIndexedTexture(img, res, result.data, result.palette, result.reduced);
+			} else if (result.yuv) {
+				createYuvTextures(img, res, result.data, result.yuv);
+			} else if (result.coefficients) {
+				// A GPU that fails once leaves this and the following JPEGs to the CPU
+				if (!createCoefficientTexture(img, res, result.coefficients, (const int16_t*)result.data)) {
+					atomic_store(&g_appState.gpuJpeg, false);
+					gpuFailed = true;
+				}
+			} else if (!isAnimated(res) || !createFrameArray(img, res, result.frameCount, result.data)) {
+				createTexture(img, res, result.channels, result.sample, result.data);
+			}
+			free(result.data);
+			free(result.palette);
+			free(result.reduced);
+			free(result.yuv);
+			free(result.coefficients);
+		}
+		if (gpuFailed) {
+			unloadTexture(id);
+			if (g_appState.currentIndex >= 0) loader_request_load(g_appState.currentIndex);
+			continue;
+		}
+		// An upgrade keeps the zoom and pan
+		if (isCurrent && !upgrade) {
+			int previous = g_appState.activeTextureIndex;
+			g_appState.activeTextureIndex = id;
+			if (isAnimated(res)) restartAnimationClock(res);
+			updateWindowTitle();
+			resetViewAfter(previous);
+		}
+		unloadTexturesOutsideWindow();
 	}
-	SDL_DestroyMutex(queue->mutex);
 }
 
-void LoadResultQueue_enqueue(LoadResultQueue* queue, LoadResult result) {
-	LoadResultNode* n = (LoadResultNode*)malloc(sizeof(LoadResultNode));
-	if (!n) return;
-	n->value = result; n->next = NULL;
-	SDL_LockMutex(queue->mutex);
-	if (queue->tail == NULL) queue->head = queue->tail = n;
-	else {
-		queue->tail->next = n; queue->tail = n;
+// Dimensions and capture time came from a file that is no longer there
+static void forgetMetadata(int id) {
+	ImageCatalog* catalog = &g_appState.images;
+	ImageMetadata* img = &catalog->items[id];
+	if (img->state != IMAGE_STATE_LOADED) {
+		img->full_width = 0;
+		img->full_height = 0;
 	}
-	SDL_UnlockMutex(queue->mutex);
+	catalog->captureTime[id] = 0;
+	catalog->orientation[id] = 1;
+	catalog->flags[id] &= (uint8_t)~IMAGE_FLAG_PROBED;
+	if ((size_t)id < g_harvestCursor) g_harvestCursor = (size_t)id;
 }
 
-bool LoadResultQueue_dequeue(LoadResultQueue* queue, LoadResult* result) {
-	SDL_LockMutex(queue->mutex);
-	if (queue->head == NULL) {
-		SDL_UnlockMutex(queue->mutex); return false;
+static void mergeScanBatch(const DirScanBatch* batch) {
+	ImageCatalog* catalog = &g_appState.images;
+	for (size_t i = 0; i < batch->count; ++i) {
+		const char* name = batch->names + batch->offsets[i];
+		// Already known from the command line, the watcher, the saved index or an earlier listing
+		int id = ImageCatalog_find(catalog, name);
+		if (id >= 0) {
+			catalog->flags[id] &= (uint8_t)~IMAGE_FLAG_UNCONFIRMED;
+			continue;
+		}
+		size_t length = strlen(name);
+		const char* key = name + length + 1;
+		if (ImageCatalog_add(catalog, name, length, key, strlen(key)) < 0) break;
+		g_statsMissing = true;
+		g_indexStale = true;
 	}
-	LoadResultNode* t = queue->head;
-	*result = t->value;
-	queue->head = queue->head->next;
-	if (queue->head == NULL) queue->tail = NULL;
-	free(t);
-	SDL_UnlockMutex(queue->mutex);
-	return true;
 }
 
-int loader_thread_func(void* data);
-
-int compareImages(const void* a, const void* b) {
-	const ImageMetadata* metaA = (const ImageMetadata*)a;
-	const ImageMetadata* metaB = (const ImageMetadata*)b;
-	return strverscmp(metaA->path_utf8, metaB->path_utf8);
+// The window around the current image may hold different images after the list changed
+static void refreshAfterListChange(void) {
+	if (g_appState.currentIndex < 0) {
+		// Without a named file the viewer opens on the first image, which is only known at the end
+		if (!g_appState.scanning && g_appState.images.count > 0) setCurrentImage((int)g_appState.images.order[0]);
+		else updateWindowTitle();
+		return;
+	}
+	loader_request_load(g_appState.currentIndex);
+	unloadTexturesOutsideWindow();
+	updateWindowTitle();
 }
 
+static void removeImage(int id);
 
-
-void unloadTexture(ImageMetadata* img) {
-	if (img->textureID != 0) {
-		glDeleteTextures(1, &img->textureID);
-		img->textureID = 0;
-	}
-	if (img->gif_animation) {
-		IMG_FreeAnimation(img->gif_animation);
-		img->gif_animation = NULL;
-	}
-	if (img->state == IMAGE_STATE_LOADED) {
-		img->state = IMAGE_STATE_UNLOADED;
+// Saved entries the listing did not find again were deleted while we were not running
+static void dropUnconfirmed(void) {
+	ImageCatalog* catalog = &g_appState.images;
+	for (size_t id = 0; id < catalog->size; ++id) {
+		if (!(catalog->flags[id] & IMAGE_FLAG_UNCONFIRMED)) continue;
+		catalog->flags[id] &= (uint8_t)~IMAGE_FLAG_UNCONFIRMED;
+		if (catalog->position[id] == IMAGE_REMOVED) continue;
+		removeImage((int)id);
+		g_indexStale = true;
 	}
-	img->full_width = 0;
-	img->full_height = 0;
 }
 
-void unloadAllTexturesExcept(int exceptionIndex) {
-	for (size_t i = 0; i < g_appState.images.size; ++i) {
-	if ((int)i == exceptionIndex) continue;
-		unloadTexture(&g_appState.images.items[i]);
+// Batches from the background scan, the current image keeps its id while the list grows around it
+void processScanResults() {
+	if (!g_scanner) return;
+	ImageCatalog* catalog = &g_appState.images;
+	size_t sorted = catalog->count;
+	DirScanBatch batch;
+	int batches = 0;
+	// Bounded so a deep archive keeps the frame rate while it streams in
+	while (batches < DIR_SCANNER_MAX_WALKERS && DirScanner_poll(g_scanner, &batch)) {
+		mergeScanBatch(&batch);
+		DirScanBatch_free(&batch);
+		batches++;
 	}
-}
-
-void loader_start() {
-	atomic_store(&g_appState.loader_running, true);
-	atomic_store(&g_appState.loader_nextImageToLoad, -1);
-	g_appState.loader_mutex = SDL_CreateMutex();
-	g_appState.loader_cv = SDL_CreateCondition();
-	LoadResultQueue_init(&g_appState.loader_results);
-	g_appState.loader_thread = SDL_CreateThread(loader_thread_func, "ImageLoader", NULL);
-}
-
-void loader_stop() {
-	if (atomic_exchange(&g_appState.loader_running, false)) {
-		SDL_LockMutex(g_appState.loader_mutex);
-		SDL_SignalCondition(g_appState.loader_cv);
-		SDL_UnlockMutex(g_appState.loader_mutex);
-		SDL_WaitThread(g_appState.loader_thread, NULL);
-		SDL_DestroyMutex(g_appState.loader_mutex);
-		SDL_DestroyCondition(g_appState.loader_cv);
-		LoadResultQueue_free(&g_appState.loader_results);
+	// A lone batch is already in name order, several from the walker threads are sorted together once
+	if (batches > 0) ImageCatalog_sortNew(catalog, sorted, batches == 1);
+	bool changed = batches > 0;
+	if (DirScanner_finished(g_scanner)) {
+		DirScanner_stop(g_scanner);
+		g_scanner = NULL;
+		g_appState.scanning = false;
+		if (g_indexLoaded) dropUnconfirmed();
+		changed = true;
 	}
+	if (changed) refreshAfterListChange();
 }
 
-typedef unsigned char* (*ImageLoader)(const char*, int*, int*);
-
-static unsigned char* stbi_load_simple(const char* path, int* width, int* height) {
-	int channels;
-	return stbi_load(path, width, height, &channels, 4); //all return 4 channels
+static void removeImage(int id) {
+	ImageCatalog* catalog = &g_appState.images;
+	size_t at = catalog->position[id];
+	unloadTexture(id);
+	ImageCatalog_setState(catalog, id, IMAGE_STATE_UNLOADED);
+	if (g_appState.activeTextureIndex == id) g_appState.activeTextureIndex = -1;
+	ImageCatalog_remove(catalog, id);
+	if (g_appState.currentIndex == id) {
+		// The image that moved up into its place is shown instead
+		g_appState.currentIndex = -1;
+		if (catalog->count > 0) setCurrentImage((int)catalog->order[at < catalog->count ? at : catalog->count - 1]);
+	}
 }
 
-int loader_thread_func(void* data) {
-	(void)data;
-	while (atomic_load(&g_appState.loader_running)) {
-		SDL_LockMutex(g_appState.loader_mutex);
-		while (atomic_load(&g_appState.loader_nextImageToLoad) == -1 && 
-               atomic_load(&g_appState.loader_running)) {
-			SDL_WaitCondition(g_appState.loader_cv, g_appState.loader_mutex);
-		}
-		if (!atomic_load(&g_appState.loader_running)) {
-			SDL_UnlockMutex(g_appState.loader_mutex);
-			break;
+// Files appearing, changing and disappearing while we run, e.g. a tethered camera writing into the folder
+void processWatchEvents() {
+	if (!g_watch) return;
+	ImageCatalog* catalog = &g_appState.images;
+	DirWatchEventType type;
+	const char* name;
+	bool changed = false;
+	while (DirWatch_next(g_watch, &type, &name)) {
+		if (type == DIR_WATCH_OVERFLOW) {
+			SDL_Log("Directory watch overflowed, listing again");
+			if (!g_scanner) g_scanner = DirScanner_start(".", g_recursive);
+			g_appState.scanning = g_scanner != NULL;
+			continue;
 		}
-		int indexToLoad = atomic_exchange(&g_appState.loader_nextImageToLoad, -1);
-		SDL_UnlockMutex(g_appState.loader_mutex);
-		if (indexToLoad == -1) continue;
-
-		ImageMetadata* meta = &g_appState.images.items[indexToLoad];
-		LoadResult result = {0};
-		
-		struct stat fileStat;
-		if (stat(meta->path_utf8, &fileStat) == 0) {
-			ImageMetadata_setFileSize(meta, fileStat.st_size);
+		int id = ImageCatalog_find(catalog, name);
+		g_indexStale = true;
+		if (type == DIR_WATCH_REMOVED) {
+			if (id >= 0) removeImage(id);
+		} else if (id >= 0) {
+			// Rewritten in place, the next request decodes it again
+			unloadTexture(id);
+			ImageCatalog_setState(catalog, id, IMAGE_STATE_UNLOADED);
+			if (g_appState.activeTextureIndex == id) g_appState.activeTextureIndex = -1;
+			// The header may have changed with the pixels
+			catalog->flags[id] &= (uint8_t)~(IMAGE_FLAG_UNCONFIRMED | IMAGE_FLAG_PROBED);
+			catalog->flags[id] |= IMAGE_FLAG_REWRITTEN;
+			if ((size_t)id < g_harvestCursor) g_harvestCursor = (size_t)id;
+			if (catalog->sortMode != SORT_BY_NAME) ImageCatalog_refresh(catalog, id);
+		} else {
+			id = ImageCatalog_insert(catalog, name);
+			if (id >= 0) catalog->flags[id] |= IMAGE_FLAG_REWRITTEN;
+			if (id >= 0 && (size_t)id < g_harvestCursor) g_harvestCursor = (size_t)id;
 		}
+		changed = true;
+	}
+	if (changed) refreshAfterListChange();
+}
 
-		const char* ext = strrchr(meta->path_utf8, '.');
-		if (ext && strcasecmp(ext, ".gif") == 0) {
-			meta->gif_animation = IMG_LoadAnimation(meta->path_utf8);
-			if (meta->gif_animation) {
-				for (int i = 0; i < meta->gif_animation->count; i++) {
-					SDL_Surface* originalFrame = meta->gif_animation->frames[i];
-					SDL_Surface* convertedFrame = SDL_ConvertSurface(originalFrame, SDL_PIXELFORMAT_ABGR8888);
-					if (convertedFrame) {
-						SDL_DestroySurface(originalFrame);
-						meta->gif_animation->frames[i] = convertedFrame;
-					}
-				}
-				
-				meta->gif_current_frame = 0;
-				meta->gif_next_frame_time = SDL_GetTicks() + meta->gif_animation->delays[0];
-				result.width = meta->gif_animation->w;
-				result.height = meta->gif_animation->h;
-				SDL_Surface* firstFrame = meta->gif_animation->frames[0];
-				size_t dataSize = firstFrame->w * firstFrame->h * 4; // RGBA
-				result.data = (unsigned char*)malloc(dataSize);
-				if (result.data) {
-					SDL_LockSurface(firstFrame);
-					memcpy(result.data, firstFrame->pixels, dataSize);
-					SDL_UnlockSurface(firstFrame);
-					result.success = true;
-				} else {
-					IMG_FreeAnimation(meta->gif_animation);
-					meta->gif_animation = NULL;
-					result.success = false;
-				}
-				
-				result.index = indexToLoad;
-				LoadResultQueue_enqueue(&g_appState.loader_results, result);
-				continue;
-			}
+// Sizes and dates for the metadata sorts and the check of the saved index, stat'ed off the main thread
+// in one pass once the listing is done
+void processStatResults() {
+	ImageCatalog* catalog = &g_appState.images;
+	if (g_statPass) {
+		if (!StatPass_finished(g_statPass)) return;
+		size_t count;
+		const StatResult* results = StatPass_results(g_statPass, &count);
+		bool changed = false;
+		for (size_t i = 0; i < count; ++i) {
+			const StatResult* result = &results[i];
+			int id = (int)result->id;
+			if (!result->ok || catalog->position[id] == IMAGE_REMOVED) continue;
+			bool known = catalog->flags[id] & IMAGE_FLAG_STAT_KNOWN;
+			if (known && catalog->mtime[id] == result->mtime && catalog->fileSizeKB[id] == (uint32_t)(result->size / 1024)) continue;
+			// Rewritten in place since the index was saved, its header is read again
+			if (known) forgetMetadata(id);
+			ImageCatalog_setStat(catalog, id, result->mtime, result->size);
+			changed = true;
 		}
-		ImageLoader loader = stbi_load_simple;
-		if (ext) {
-			static const struct {
-				const char* ext;
-				ImageLoader loader;
-			} loaders[] = {
-				{".png",  loadImage_SPNG},
-				{".jpg",  loadImage_JpegTurbo},
-				{".jpeg", loadImage_JpegTurbo},
-				{".webp", loadImage_WebP},
-				{".heif", loadImage_HeifAvif},
-				{".heic", loadImage_HeifAvif},
-				{".avif", loadImage_HeifAvif},
-				{".tiff", loadImage_Tiff},
-				{".tif",  loadImage_Tiff},
-				{".jxl",  loadImage_Jxl}
-			};
-			for (size_t i = 0; i < sizeof(loaders)/sizeof(loaders[0]); ++i) {
-				if (strcasecmp(ext, loaders[i].ext) == 0) {
-					loader = loaders[i].loader;
-					break;
-				}
-			}
+		StatPass_stop(g_statPass);
+		g_statPass = NULL;
+		if (changed) g_indexStale = true;
+		// Images placed before their size and date were known move to their place once
+		if (changed && catalog->sortMode != SORT_BY_NAME) {
+			ImageCatalog_setSortMode(catalog, catalog->sortMode);
+			refreshAfterListChange();
+		} else if (changed) {
+			updateWindowTitle();
 		}
-
-		int width = 0, height = 0;
-		unsigned char* img_data = loader(meta->path_utf8, &width, &height);
-		result = (LoadResult){
-			.index = indexToLoad,
-			.data = img_data,
-			.width = width,
-			.height = height,
-			.success = (img_data != NULL)
-		};
-		LoadResultQueue_enqueue(&g_appState.loader_results, result);
 	}
-	return 0;
+	bool wanted = g_statsMissing && catalog->sortMode != SORT_BY_NAME;
+	if ((!wanted && !g_verifyIndex) || g_appState.scanning) return;
+	uint32_t* ids = (uint32_t*)malloc((catalog->count ? catalog->count : 1) * sizeof(uint32_t));
+	if (!ids) return;
+	size_t count = 0;
+	for (size_t p = 0; p < catalog->count; ++p) {
+		uint32_t id = catalog->order[p];
+		if (g_verifyIndex || !(catalog->flags[id] & IMAGE_FLAG_STAT_KNOWN)) ids[count++] = id;
+	}
+	g_statsMissing = false;
+	g_verifyIndex = false;
+	if (count > 0) g_statPass = StatPass_start(catalog, ids, count);
+	free(ids);
 }
 
-void processLoaderResults() {
-	LoadResult result;
-	while(LoadResultQueue_dequeue(&g_appState.loader_results, &result)) {
-		ImageMetadata* img = &g_appState.images.items[result.index];
-		if (result.index != g_appState.currentIndex) {
-			if (result.success && result.data) {
-				free(result.data);
-			}
-			if (img->state == IMAGE_STATE_LOADING) img->state = IMAGE_STATE_UNLOADED;
-			continue;
+// Headers of the whole list are read in the background, the title and metadata sorts do not wait for decodes
+void processHarvestResults() {
+	ImageCatalog* catalog = &g_appState.images;
+	HarvestResult result;
+	bool currentChanged = false;
+	while (Harvester_poll(&result)) {
+		int id = result.id;
+		g_harvestOutstanding--;
+		catalog->flags[id] |= IMAGE_FLAG_PROBED;
+		g_indexStale = true;
+		if (!result.ok) continue;
+		ImageMetadata* img = &catalog->items[id];
+		// A decoded image already knows its size
+		if (img->state != IMAGE_STATE_LOADED) {
+			img->full_width = result.probe.width;
+			img->full_height = result.probe.height;
 		}
-		if (result.success) {
-			img->full_width = result.width;
-			img->full_height = result.height;
-			glGenTextures(1, &img->textureID);
-			glBindTexture(GL_TEXTURE_2D, img->textureID);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			
-			if (img->gif_animation) {
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			} else {
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			}
-           
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, result.width, result.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, result.data);
-			glGenerateMipmap(GL_TEXTURE_2D);
-			free(result.data);
-			img->state = IMAGE_STATE_LOADED;
-			g_appState.activeTextureIndex = result.index;
-			unloadAllTexturesExcept(g_appState.activeTextureIndex);
-			updateWindowTitle();
-			resetView(true);
-		} else {
-			img->state = IMAGE_STATE_FAILED;
-			if (g_appState.activeTextureIndex == result.index) {
-				g_appState.activeTextureIndex = -1;
-			}
-			updateWindowTitle();
+		catalog->orientation[id] = (uint8_t)result.probe.orientation;
+		if (result.probe.captureTime && result.probe.captureTime != catalog->captureTime[id]) {
+			ImageCatalog_setCaptureTime(catalog, id, result.probe.captureTime);
+			g_captureTimesChanged = true;
 		}
+		if (id == g_appState.currentIndex) currentChanged = true;
 	}
+	while (g_harvestCursor < catalog->size) {
+		size_t id = g_harvestCursor;
+		if (!(catalog->flags[id] & IMAGE_FLAG_PROBED) && catalog->position[id] != IMAGE_REMOVED) {
+			if (!Harvester_submit((int)id, catalog->paths[id])) break;
+			g_harvestOutstanding++;
+		}
+		g_harvestCursor++;
+	}
+	// Re-sorting on every result would keep moving the neighbors around
+	if (g_captureTimesChanged && g_harvestOutstanding == 0 && g_harvestCursor == catalog->size && !g_appState.scanning) {
+		g_captureTimesChanged = false;
+		if (catalog->sortMode == SORT_BY_CAPTURE) {
+			ImageCatalog_setSortMode(catalog, SORT_BY_CAPTURE);
+			refreshAfterListChange();
+			currentChanged = false;
+		}
+	}
+	if (currentChanged) updateWindowTitle();
 }
 
-void findImagesInDirectory() {
-	const char* extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif", ".webp", ".heif", ".heic", ".avif", ".tiff", ".tif", ".jxl" };
-	size_t num_extensions = sizeof(extensions) / sizeof(extensions[0]);
-	DIR* d;
-	struct dirent* dir;
-	d = opendir(".");
-	if (d) {
-		while ((dir = readdir(d)) != NULL) {
-			if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-			struct stat st;
-			if (stat(dir->d_name, &st) == 0 && S_ISREG(st.st_mode)) {
-				const char* ext = strrchr(dir->d_name, '.');
-				if (ext) {
-					for (size_t i = 0; i < num_extensions; ++i) {
-						if (strcasecmp(ext, extensions[i]) == 0) {
-							ImageMetadata meta = {0};
-							strncpy(meta.path_utf8, dir->d_name, PATH_MAX - 1);
-							ImageList_add(&g_appState.images, meta);
-							break;
-						}
-					}
-				}
-			}
+// A directory becomes the working directory, a file additionally becomes the first image
+static int openArgument(const char* arg) {
+	struct stat st;
+	if (stat(arg, &st) != 0) {
+		SDL_Log("Cannot open %s", arg);
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode)) {
+		if (chdir(arg) != 0) SDL_Log("Cannot enter %s", arg);
+		return -1;
+	}
+	const char* name = arg;
+	const char* slash = strrchr(arg, '/');
+	if (slash) {
+		char dir[4096];
+		size_t length = slash == arg ? 1 : (size_t)(slash - arg);
+		if (length >= sizeof(dir)) return -1;
+		memcpy(dir, arg, length);
+		dir[length] = '\0';
+		if (chdir(dir) != 0) {
+			SDL_Log("Cannot enter %s", dir);
+			return -1;
 		}
-		closedir(d);
+		name = slash + 1;
 	}
-	qsort(g_appState.images.items, g_appState.images.size, sizeof(ImageMetadata), compareImages);
+	return ImageCatalog_insert(&g_appState.images, name);
 }
 
 void init_app_state() {
@@ -312,11 +456,12 @@ void init_app_state() {
 	g_appState.windowWidth = 1280;
 	g_appState.windowHeight = 720;
 	g_appState.zoom = 1.0f;
+	g_appState.toneMapping = true;
 	g_appState.modelDirty = true;
 	g_appState.projectionDirty = true;
 	g_appState.currentIndex = -1;
 	g_appState.activeTextureIndex = -1;
-	ImageList_init(&g_appState.images);
+	ImageCatalog_init(&g_appState.images);
 }
 
 const char* vertexShaderSource =
@@ -336,12 +481,69 @@ const char* fragmentShaderSource =
 	"out vec4 FragColor;\n"
 	"in vec2 TexCoord;\n"
 	"uniform sampler2D ourTexture;\n"
+	"uniform sampler2DArray frames;\n"
+	"uniform sampler2D palette;\n"
+	"uniform sampler2D cbPlane;\n"
+	"uniform sampler2D crPlane;\n"
+	"uniform sampler2D reduced;\n" // colors of indexed images from half size down, empty when there are none
+	"uniform float layer;\n" // animation frame in `frames`, negative for ourTexture
+	"uniform bool indexed;\n" // ourTexture holds indices into `palette`
+	"uniform bool yuv;\n" // ourTexture holds luma, the chroma planes are at their own resolution
+	"uniform mat3 yuvMatrix;\n"
+	"uniform vec3 yuvOffset;\n"
+	"uniform bool linearLight;\n" // ourTexture holds half floats in linear light
+	"uniform float exposure;\n" // linear scale
+	"uniform float whitePoint;\n" // brightest value after exposure, rolled off to 1.0 when above it, 0 clips instead
+	"vec3 toLinear(vec3 c) {\n"
+	"return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(0.04045, c));\n"
+	"}\n"
+	"vec3 toDisplay(vec3 c) {\n"
+	"return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, step(0.0031308, c));\n"
+	"}\n"
+	"vec3 develop(vec3 c) {\n"
+	"vec3 light = (linearLight ? max(c, 0.0) : toLinear(c)) * exposure;\n"
+	// Extended Reinhard on luminance keeps the hue, the white point lands on 1.0
+	"if (whitePoint > 1.0) {\n"
+	"float l = dot(light, vec3(0.2126, 0.7152, 0.0722));\n"
+	"light *= (1.0 + l / (whitePoint * whitePoint)) / (1.0 + l);\n"
+	"}\n"
+	"return toDisplay(clamp(light, 0.0, 1.0));\n"
+	"}\n"
+	"vec4 paletteColor(ivec2 at) {\n"
+	"return texelFetch(palette, ivec2(int(texelFetch(ourTexture, at, 0).r * 255.0 + 0.5), 0), 0);\n"
+	"}\n"
 	"void main() {\n"
+	"if (layer >= 0.0) {\n"
+	"FragColor = texture(frames, vec3(TexCoord, layer));\n"
+	"} else if (indexed) {\n"
+	"ivec2 size = textureSize(ourTexture, 0);\n"
+	"vec2 footprint = fwidth(TexCoord * vec2(size));\n"
+	// Zoomed out the lookup would alias, the color mip chain takes over
+	"if (max(footprint.x, footprint.y) > 1.0 && textureSize(reduced, 0).x > 0) {\n"
+	"FragColor = texture(reduced, TexCoord);\n"
+	"} else {\n"
+	// Bilinear after the lookup, filtering the indices themselves would blend unrelated entries
+	"vec2 p = TexCoord * vec2(size) - 0.5;\n"
+	"ivec2 i = ivec2(floor(p));\n"
+	"vec2 f = p - floor(p);\n"
+	"ivec2 hi = size - 1;\n"
+	"vec4 c00 = paletteColor(clamp(i, ivec2(0), hi));\n"
+	"vec4 c10 = paletteColor(clamp(i + ivec2(1, 0), ivec2(0), hi));\n"
+	"vec4 c01 = paletteColor(clamp(i + ivec2(0, 1), ivec2(0), hi));\n"
+	"vec4 c11 = paletteColor(clamp(i + ivec2(1, 1), ivec2(0), hi));\n"
+	"FragColor = mix(mix(c00, c10, f.x), mix(c01, c11, f.x), f.y);\n"
+	"}\n"
+	"} else if (yuv) {\n"
+	"vec3 ycc = vec3(texture(ourTexture, TexCoord).r, texture(cbPlane, TexCoord).r, texture(crPlane, TexCoord).r);\n"
+	"FragColor = vec4(clamp(yuvMatrix * (ycc - yuvOffset), 0.0, 1.0), 1.0);\n"
+	"} else {\n"
 	"FragColor = texture(ourTexture, TexCoord);\n"
+	"}\n"
+	// 8-bit images at 0 EV come out exactly as decoded
+	"if (linearLight || exposure != 1.0) FragColor.rgb = develop(FragColor.rgb);\n"
 	"}\n";
 
 int main(int argc, char* argv[]) {
-	(void)argc; (void)argv;
 	init_app_state();
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
@@ -351,7 +553,12 @@ int main(int argc, char* argv[]) {
 	g_appState.glContext = SDL_GL_CreateContext(g_appState.window);
 	if (!g_appState.glContext) return -1;
 	SDL_GL_SetSwapInterval(1);
+	updateRefreshInterval();
 	if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) return -1;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &g_appState.maxTextureSize);
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &g_appState.maxArrayLayers);
+	const char* gpuJpeg = getenv("SHARKPIX_GPU_JPEG");
+	atomic_store(&g_appState.gpuJpeg, gpuJpeg && strcmp(gpuJpeg, "1") == 0 && GpuJpeg_init());
 	glClearColor(0.12f, 0.12f, 0.12f, 1.0f);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -365,8 +572,21 @@ int main(int argc, char* argv[]) {
 	glDeleteShader(fs);
 	g_appState.modelLoc = glGetUniformLocation(g_appState.shaderProgram, "model");
 	g_appState.projLoc = glGetUniformLocation(g_appState.shaderProgram, "projection");
+	g_appState.layerLoc = glGetUniformLocation(g_appState.shaderProgram, "layer");
+	g_appState.indexedLoc = glGetUniformLocation(g_appState.shaderProgram, "indexed");
+	g_appState.yuvLoc = glGetUniformLocation(g_appState.shaderProgram, "yuv");
+	g_appState.yuvMatrixLoc = glGetUniformLocation(g_appState.shaderProgram, "yuvMatrix");
+	g_appState.yuvOffsetLoc = glGetUniformLocation(g_appState.shaderProgram, "yuvOffset");
+	g_appState.linearLightLoc = glGetUniformLocation(g_appState.shaderProgram, "linearLight");
+	g_appState.exposureLoc = glGetUniformLocation(g_appState.shaderProgram, "exposure");
+	g_appState.whitePointLoc = glGetUniformLocation(g_appState.shaderProgram, "whitePoint");
 	glUseProgram(g_appState.shaderProgram);
 	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "ourTexture"), 0);
+	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "frames"), 1);
+	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "palette"), 2);
+	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "cbPlane"), 3);
+	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "crPlane"), 4);
+	glUniform1i(glGetUniformLocation(g_appState.shaderProgram, "reduced"), 5);
 	float vertices[] = {
 		1.0f, 0.0f, 1.0f, 0.0f,
 		0.0f, 0.0f, 0.0f, 0.0f,
@@ -388,27 +608,58 @@ int main(int argc, char* argv[]) {
 	glEnableVertexAttribArray(1);
 
 	loader_start();
-	findImagesInDirectory();
-	if (g_appState.images.size > 0) setCurrentImage(0);
+	Harvester_start();
+	Transcoder_start();
+	const char* argument = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--recursive") == 0) g_recursive = true;
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) Flipbook_setFps(atof(argv[++i]));
+		else if (!argument) argument = argv[i];
+	}
+	int argumentImage = argument ? openArgument(argument) : -1;
+	// Watching starts first so nothing written during the listing is missed
+	g_watch = DirWatch_open(".");
+	if (!g_watch) SDL_Log("Directory watching unavailable, new files show up after a restart");
+	// The saved index shows the folder at once, the listing then only applies what changed since
+	// and is skipped when nothing was added, removed or renamed
+	g_haveStamp = DirStamp_read(".", &g_dirStamp);
+	bool upToDate = false;
+	g_indexLoaded = DirIndex_load(&g_appState.images, g_recursive, &upToDate);
+	g_indexStale = !g_indexLoaded;
+	g_verifyIndex = g_indexLoaded;
+	if (!upToDate) g_scanner = DirScanner_start(".", g_recursive);
+	g_appState.scanning = g_scanner != NULL;
+	if (argumentImage >= 0) setCurrentImage(argumentImage);
+	else if (g_indexLoaded && g_appState.images.count > 0) setCurrentImage((int)g_appState.images.order[0]);
 	updateProjectionMatrix();
 	glUniformMatrix4fv(g_appState.projLoc, 1, GL_FALSE, g_appState.projectionMatrix);
 	while (atomic_load(&g_appState.loader_running)) {
 		handleEvents();
+		processScanResults();
+		processWatchEvents();
 		processLoaderResults();
+		processTranscodeResults();
+		processHarvestResults();
+		processStatResults();
+		Flipbook_update();
 		renderFrame();
 		SDL_GL_SwapWindow(g_appState.window);
 	}
+	Harvester_stop();
 	loader_stop();
+	Transcoder_stop();
+	StatPass_stop(g_statPass);
+	DirScanner_stop(g_scanner);
+	DirWatch_close(g_watch);
+	// An unfinished listing would save a partial list
+	if (g_indexStale && g_haveStamp && !g_appState.scanning) DirIndex_save(&g_appState.images, g_recursive, &g_dirStamp);
 	
-	for (size_t i = 0; i < g_appState.images.size; ++i) {
-		if (g_appState.images.items[i].textureID != 0) {
-			glDeleteTextures(1, &g_appState.images.items[i].textureID);
-		}
-		if (g_appState.images.items[i].gif_animation) {
-			IMG_FreeAnimation(g_appState.images.items[i].gif_animation);
-		}
+	while (g_appState.images.residentCount > 0) {
+		int id = (int)g_appState.images.resident[g_appState.images.residentCount - 1].id;
+		unloadTexture(id);
+		ImageCatalog_setState(&g_appState.images, id, IMAGE_STATE_UNLOADED);
 	}
-	ImageList_free(&g_appState.images);
+	ImageCatalog_free(&g_appState.images);
 	glDeleteVertexArrays(1, &g_appState.vao);
 	glDeleteBuffers(1, &g_appState.vbo);
 	glDeleteBuffers(1, &g_appState.ebo);
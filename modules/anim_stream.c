@@ -0,0 +1,190 @@
+#include "anim_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <SDL3/SDL.h>
+
+typedef struct {
+	AnimFrame frame;
+	uint8_t* pixels;
+	size_t capacity;
+} AnimStreamSlot;
+
+struct AnimStream {
+	FileSource src;
+	const AnimBackend* backend;
+	void* decoder; // only the decode thread touches it after the first frame
+	int width, height;
+	int firstDelay;
+	bool fullFrames;
+	atomic_uint_fast64_t clockMs;
+	AnimStreamSlot slots[ANIM_STREAM_RING_FRAMES]; // decoded frames waiting for playback, oldest at `head`
+	int head, count;
+	bool stopping;
+	SDL_Mutex* mutex;
+	SDL_Condition* cv;
+	SDL_Thread* thread;
+};
+
+AnimRect AnimRect_union(AnimRect a, AnimRect b) {
+	if (a.w == 0) return b;
+	if (b.w == 0) return a;
+	int x0 = a.x < b.x ? a.x : b.x, y0 = a.y < b.y ? a.y : b.y;
+	int x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+	int y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+	return (AnimRect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+static int playbackDelay(int delayMs) {
+	return delayMs <= 10 ? ANIM_DEFAULT_DELAY_MS : delayMs;
+}
+
+static bool fillSlot(AnimStreamSlot* slot, const AnimStream* stream, const uint8_t* canvas, AnimRect dirty, uint64_t timeMs, int delay) {
+	size_t bytes = (size_t)dirty.w * dirty.h * 4;
+	if (bytes > slot->capacity) {
+		uint8_t* grown = (uint8_t*)realloc(slot->pixels, bytes);
+		if (!grown) return false;
+		slot->pixels = grown;
+		slot->capacity = bytes;
+	}
+	for (int y = 0; y < dirty.h; ++y) {
+		memcpy(slot->pixels + (size_t)y * dirty.w * 4, canvas + ((size_t)(dirty.y + y) * stream->width + dirty.x) * 4, (size_t)dirty.w * 4);
+	}
+	slot->frame = (AnimFrame){ dirty.x, dirty.y, dirty.w, dirty.h, slot->pixels, timeMs, delay };
+	return true;
+}
+
+// Stays a few frames ahead of playback and sleeps while the ring is full
+static int animStreamThread(void* data) {
+	AnimStream* stream = (AnimStream*)data;
+	int framesThisLoop = 1; // the first one came with the open
+	uint64_t timeMs = (uint64_t)stream->firstDelay; // start of the frame decoded next
+	AnimRect dropped = { 0, 0, 0, 0 }; // changed by frames that were never queued, goes out with the next one
+	int droppedInRow = 0;
+	for (;;) {
+		SDL_LockMutex(stream->mutex);
+		while (stream->count == ANIM_STREAM_RING_FRAMES && !stream->stopping) SDL_WaitCondition(stream->cv, stream->mutex);
+		bool stopping = stream->stopping;
+		AnimStreamSlot* slot = &stream->slots[(stream->head + stream->count) % ANIM_STREAM_RING_FRAMES];
+		SDL_UnlockMutex(stream->mutex);
+		if (stopping) break;
+
+		const uint8_t* canvas;
+		AnimRect dirty;
+		int delay;
+		if (!stream->backend->next(stream->decoder, &canvas, &dirty, &delay)) {
+			// A damaged first frame would loop forever without producing anything
+			if (framesThisLoop == 0 || !stream->backend->rewind(stream->decoder)) break;
+			framesThisLoop = 0;
+			continue;
+		}
+		delay = playbackDelay(delay);
+		// The canvas was cleared for the new loop, the whole of it changed
+		if (framesThisLoop++ == 0 || stream->fullFrames) dirty = (AnimRect){ 0, 0, stream->width, stream->height };
+		dirty = AnimRect_union(dropped, dirty);
+		uint64_t start = timeMs;
+		timeMs += (uint64_t)delay;
+		// Playback already moved past it, the upload would be overwritten before it reached the screen
+		if (!stream->fullFrames && timeMs <= atomic_load(&stream->clockMs) && droppedInRow < ANIM_STREAM_MAX_DROPPED) {
+			dropped = dirty;
+			droppedInRow++;
+			continue;
+		}
+		dropped = (AnimRect){ 0, 0, 0, 0 };
+		droppedInRow = 0;
+		if (!fillSlot(slot, stream, canvas, dirty, start, delay)) break;
+
+		SDL_LockMutex(stream->mutex);
+		stream->count++;
+		SDL_UnlockMutex(stream->mutex);
+	}
+	return 0;
+}
+
+AnimStream* AnimStream_open(const AnimBackend* backend, FileSource* src, bool fullFrames, unsigned char** firstFrame, int* width, int* height) {
+	*firstFrame = NULL;
+	AnimStream* stream = (AnimStream*)calloc(1, sizeof(AnimStream));
+	if (!stream) return NULL;
+	stream->backend = backend;
+	stream->fullFrames = fullFrames;
+	const uint8_t* canvas;
+	AnimRect dirty;
+	stream->decoder = backend->open(src->data, src->size, &stream->width, &stream->height);
+	if (!stream->decoder || !backend->next(stream->decoder, &canvas, &dirty, &stream->firstDelay)) goto fail;
+	stream->firstDelay = playbackDelay(stream->firstDelay);
+	size_t canvasBytes = (size_t)stream->width * stream->height * 4;
+	*firstFrame = (unsigned char*)malloc(canvasBytes);
+	if (!*firstFrame) goto fail;
+	memcpy(*firstFrame, canvas, canvasBytes);
+	stream->mutex = SDL_CreateMutex();
+	stream->cv = SDL_CreateCondition();
+	if (!stream->mutex || !stream->cv) goto fail;
+	// The decoder keeps pointing into the mapping, which moves into the stream with it
+	stream->src = *src;
+	src->data = NULL;
+	src->size = 0;
+	src->fd = -1;
+	stream->thread = SDL_CreateThread(animStreamThread, "AnimStream", stream);
+	if (!stream->thread) {
+		*src = stream->src;
+		goto fail;
+	}
+	*width = stream->width;
+	*height = stream->height;
+	return stream;
+
+fail:
+	if (stream->mutex) SDL_DestroyMutex(stream->mutex);
+	if (stream->cv) SDL_DestroyCondition(stream->cv);
+	free(*firstFrame);
+	*firstFrame = NULL;
+	if (stream->decoder) backend->close(stream->decoder);
+	free(stream);
+	return NULL;
+}
+
+void AnimStream_close(AnimStream* stream) {
+	if (!stream) return;
+	SDL_LockMutex(stream->mutex);
+	stream->stopping = true;
+	SDL_SignalCondition(stream->cv);
+	SDL_UnlockMutex(stream->mutex);
+	SDL_WaitThread(stream->thread, NULL);
+	for (int i = 0; i < ANIM_STREAM_RING_FRAMES; ++i) free(stream->slots[i].pixels);
+	stream->backend->close(stream->decoder);
+	FileSource_close(&stream->src);
+	SDL_DestroyMutex(stream->mutex);
+	SDL_DestroyCondition(stream->cv);
+	free(stream);
+}
+
+int AnimStream_firstDelay(const AnimStream* stream) {
+	return stream->firstDelay;
+}
+
+bool AnimStream_fullFrames(const AnimStream* stream) {
+	return stream->fullFrames;
+}
+
+void AnimStream_setClock(AnimStream* stream, uint64_t timeMs) {
+	atomic_store(&stream->clockMs, timeMs);
+}
+
+bool AnimStream_peek(AnimStream* stream, AnimFrame* frame) {
+	SDL_LockMutex(stream->mutex);
+	bool ready = stream->count > 0;
+	if (ready) *frame = stream->slots[stream->head].frame;
+	SDL_UnlockMutex(stream->mutex);
+	return ready;
+}
+
+void AnimStream_pop(AnimStream* stream) {
+	SDL_LockMutex(stream->mutex);
+	if (stream->count > 0) {
+		stream->head = (stream->head + 1) % ANIM_STREAM_RING_FRAMES;
+		stream->count--;
+		SDL_SignalCondition(stream->cv);
+	}
+	SDL_UnlockMutex(stream->mutex);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "file_source.h"
+
+// Animations of every format are decoded one frame at a time on their own thread, a few frames ahead of playback
+#define ANIM_STREAM_RING_FRAMES 4
+#define ANIM_DEFAULT_DELAY_MS 100 // what browsers play delays of 0 and 10 ms at
+#define ANIM_STREAM_MAX_DROPPED 8 // late frames dropped in a row before one is queued anyway
+
+typedef struct {
+	int x, y, w, h;
+} AnimRect;
+
+// The bounding rect of both, an empty rect adds nothing
+AnimRect AnimRect_union(AnimRect a, AnimRect b);
+
+// One per format. `next` composites the following frame onto a canvas the decoder keeps, tightly packed
+// RGBA8 of the full size, and reports the rect that changed since the previous frame.
+// False past the last frame or at damage, `rewind` then goes back to the first one.
+typedef struct {
+	void* (*open)(const uint8_t* data, size_t size, int* width, int* height);
+	bool (*next)(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs);
+	bool (*rewind)(void* decoder);
+	void (*close)(void* decoder);
+} AnimBackend;
+
+typedef struct AnimStream AnimStream;
+
+// The part of the canvas that changed since the previous frame, tightly packed RGBA8.
+// Empty when the frame only holds the previous one up longer.
+typedef struct {
+	int x, y, w, h;
+	const uint8_t* rgba;
+	uint64_t timeMs; // when it goes on screen, counted from the first frame and on across loops
+	int delayMs; // how long it stays there
+} AnimFrame;
+
+// Decodes the first frame into `firstFrame` (the full canvas, freed by the caller) and starts
+// decoding the rest in the background. Takes `src` over on success, it is left closed.
+// With `fullFrames` every frame comes as the whole canvas and none is dropped, for filling the layers of a texture array.
+AnimStream* AnimStream_open(const AnimBackend* backend, FileSource* src, bool fullFrames, unsigned char** firstFrame, int* width, int* height);
+void AnimStream_close(AnimStream* stream);
+int AnimStream_firstDelay(const AnimStream* stream);
+bool AnimStream_fullFrames(const AnimStream* stream);
+// Where playback is on the timeline of AnimFrame.timeMs. Frames over by then are still decoded,
+// since the next ones build on them, but never queued or uploaded.
+void AnimStream_setClock(AnimStream* stream, uint64_t timeMs);
+// The frame after the one on screen once the decoder has it, never blocks
+bool AnimStream_peek(AnimStream* stream, AnimFrame* frame);
+// Hands the frame from AnimStream_peek back to the decoder after the upload
+void AnimStream_pop(AnimStream* stream);
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include "catalog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "sort_key.h"
+#include "parallel.h"
+
+static const char* StringArena_intern(StringArena* arena, const char* text, size_t length) {
+	StringChunk* chunk = arena->head;
+	if (!chunk || chunk->size - chunk->used < length + 1) {
+		size_t size = length + 1 > STRING_CHUNK_BYTES ? length + 1 : STRING_CHUNK_BYTES;
+		chunk = (StringChunk*)malloc(sizeof(StringChunk) + size);
+		if (!chunk) return NULL;
+		chunk->next = arena->head;
+		chunk->used = 0;
+		chunk->size = size;
+		arena->head = chunk;
+	}
+	char* copy = chunk->data + chunk->used;
+	memcpy(copy, text, length);
+	copy[length] = '\0';
+	chunk->used += length + 1;
+	return copy;
+}
+
+static void StringArena_free(StringArena* arena) {
+	StringChunk* chunk = arena->head;
+	while (chunk) {
+		StringChunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->head = NULL;
+}
+
+void ImageCatalog_init(ImageCatalog* catalog) {
+	memset(catalog, 0, sizeof(*catalog));
+}
+
+void ImageCatalog_free(ImageCatalog* catalog) {
+	free(catalog->items);
+	free(catalog->paths);
+	free(catalog->sortKeys);
+	free(catalog->keyPrefix);
+	free(catalog->fileSizeKB);
+	free(catalog->mtime);
+	free(catalog->captureTime);
+	free(catalog->orientation);
+	free(catalog->flags);
+	free(catalog->order);
+	free(catalog->position);
+	free(catalog->nameIndex);
+	free(catalog->resident);
+	StringArena_free(&catalog->arena);
+	ImageCatalog_init(catalog);
+}
+
+static bool growArray(void** array, size_t count, size_t elementSize) {
+	void* grown = realloc(*array, count * elementSize);
+	if (!grown) return false;
+	*array = grown;
+	return true;
+}
+
+static uint64_t hashPath(const char* path) {
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (const unsigned char* c = (const unsigned char*)path; *c; ++c) {
+		hash ^= *c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void indexName(ImageCatalog* catalog, uint32_t id) {
+	size_t mask = catalog->nameIndexCapacity - 1;
+	size_t slot = (size_t)hashPath(catalog->paths[id]) & mask;
+	while (catalog->nameIndex[slot] != 0) slot = (slot + 1) & mask;
+	catalog->nameIndex[slot] = id + 1;
+}
+
+// Kept at most half full so probes stay short
+static bool growNameIndex(ImageCatalog* catalog) {
+	size_t capacity = catalog->nameIndexCapacity ? catalog->nameIndexCapacity * 2 : 2048;
+	uint32_t* index = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+	if (!index) return false;
+	free(catalog->nameIndex);
+	catalog->nameIndex = index;
+	catalog->nameIndexCapacity = capacity;
+	for (size_t id = 0; id < catalog->size; ++id) indexName(catalog, (uint32_t)id);
+	return true;
+}
+
+// Any id ever given to `name`, removed ones included
+static int lookupName(const ImageCatalog* catalog, const char* name) {
+	if (catalog->nameIndexCapacity == 0) return -1;
+	size_t mask = catalog->nameIndexCapacity - 1;
+	for (size_t slot = (size_t)hashPath(name) & mask; catalog->nameIndex[slot] != 0; slot = (slot + 1) & mask) {
+		uint32_t id = catalog->nameIndex[slot] - 1;
+		if (strcmp(catalog->paths[id], name) == 0) return (int)id;
+	}
+	return -1;
+}
+
+int ImageCatalog_add(ImageCatalog* catalog, const char* name, size_t length, const char* key, size_t keyLength) {
+	if (catalog->size >= catalog->capacity) {
+		size_t n = catalog->capacity == 0 ? 1024 : catalog->capacity * 2;
+		if (!growArray((void**)&catalog->items, n, sizeof(ImageMetadata)) ||
+		    !growArray((void**)&catalog->paths, n, sizeof(const char*)) ||
+		    !growArray((void**)&catalog->sortKeys, n, sizeof(const char*)) ||
+		    !growArray((void**)&catalog->keyPrefix, n, sizeof(uint64_t)) ||
+		    !growArray((void**)&catalog->fileSizeKB, n, sizeof(uint32_t)) ||
+		    !growArray((void**)&catalog->mtime, n, sizeof(int64_t)) ||
+		    !growArray((void**)&catalog->captureTime, n, sizeof(int64_t)) ||
+		    !growArray((void**)&catalog->orientation, n, sizeof(uint8_t)) ||
+		    !growArray((void**)&catalog->flags, n, sizeof(uint8_t)) ||
+		    !growArray((void**)&catalog->order, n, sizeof(uint32_t)) ||
+		    !growArray((void**)&catalog->position, n, sizeof(uint32_t))) {
+			SDL_Log("Realloc fail");
+			return -1;
+		}
+		catalog->capacity = n;
+	}
+	if ((catalog->size + 1) * 2 > catalog->nameIndexCapacity && !growNameIndex(catalog)) return -1;
+	char* built = NULL;
+	if (!key) {
+		built = (char*)malloc(SORT_KEY_MAX_BYTES(length));
+		if (!built) return -1;
+		keyLength = SortKey_build(name, length, built);
+		key = built;
+	}
+	const char* path = StringArena_intern(&catalog->arena, name, length);
+	const char* internedKey = path ? StringArena_intern(&catalog->arena, key, keyLength) : NULL;
+	free(built);
+	if (!internedKey) return -1;
+	size_t id = catalog->size++;
+	catalog->items[id] = (ImageMetadata){ .state = IMAGE_STATE_UNLOADED, .residentSlot = -1 };
+	catalog->paths[id] = path;
+	catalog->sortKeys[id] = internedKey;
+	catalog->keyPrefix[id] = SortKey_prefix(internedKey, keyLength);
+	catalog->fileSizeKB[id] = 0;
+	catalog->mtime[id] = 0;
+	catalog->captureTime[id] = 0;
+	catalog->orientation[id] = 1;
+	catalog->flags[id] = 0;
+	catalog->order[catalog->count] = (uint32_t)id;
+	catalog->position[id] = (uint32_t)catalog->count++;
+	indexName(catalog, (uint32_t)id);
+	return (int)id;
+}
+
+static int compareNames(const ImageCatalog* catalog, uint32_t a, uint32_t b) {
+	if (catalog->keyPrefix[a] != catalog->keyPrefix[b]) return catalog->keyPrefix[a] < catalog->keyPrefix[b] ? -1 : 1;
+	int cmp = strcmp(catalog->sortKeys[a], catalog->sortKeys[b]);
+	return cmp ? cmp : strcmp(catalog->paths[a], catalog->paths[b]); // "007" and "7" have equal keys
+}
+
+static int compareValues(int64_t a, int64_t b) {
+	return (a > b) - (a < b);
+}
+
+static int compareIds(uint32_t a, uint32_t b, void* user) {
+	const ImageCatalog* catalog = (const ImageCatalog*)user;
+	int cmp = 0;
+	switch (catalog->sortMode) {
+		case SORT_BY_MTIME:
+			cmp = compareValues(catalog->mtime[a], catalog->mtime[b]);
+			break;
+		case SORT_BY_SIZE:
+			cmp = compareValues(catalog->fileSizeKB[a], catalog->fileSizeKB[b]);
+			break;
+		case SORT_BY_CAPTURE:
+			cmp = compareValues(catalog->captureTime[a] ? catalog->captureTime[a] : catalog->mtime[a],
+			                    catalog->captureTime[b] ? catalog->captureTime[b] : catalog->mtime[b]);
+			break;
+		default:
+			break;
+	}
+	return cmp ? cmp : compareNames(catalog, a, b);
+}
+
+static void statImage(ImageCatalog* catalog, uint32_t id) {
+	struct stat st;
+	if (stat(catalog->paths[id], &st) == 0) ImageCatalog_setStat(catalog, (int)id, (int64_t)st.st_mtime, (uint64_t)st.st_size);
+}
+
+static void updatePositions(ImageCatalog* catalog, size_t from, size_t to) {
+	for (size_t p = from; p < to; ++p) catalog->position[catalog->order[p]] = (uint32_t)p;
+}
+
+void ImageCatalog_sortNew(ImageCatalog* catalog, size_t firstNew, bool presorted) {
+	size_t total = catalog->count;
+	if (firstNew >= total) return;
+	if (!presorted || catalog->sortMode != SORT_BY_NAME) {
+		Parallel_sortIndices(catalog->order + firstNew, total - firstNew, compareIds, catalog);
+	}
+	uint32_t* merged = (uint32_t*)malloc(total * sizeof(uint32_t));
+	if (!merged) return;
+	size_t i = 0, j = firstNew, k = 0;
+	while (i < firstNew && j < total) {
+		if (compareIds(catalog->order[j], catalog->order[i], catalog) < 0) merged[k++] = catalog->order[j++];
+		else merged[k++] = catalog->order[i++];
+	}
+	while (i < firstNew) merged[k++] = catalog->order[i++];
+	while (j < total) merged[k++] = catalog->order[j++];
+	memcpy(catalog->order, merged, total * sizeof(uint32_t));
+	free(merged);
+	updatePositions(catalog, 0, total);
+}
+
+int ImageCatalog_find(const ImageCatalog* catalog, const char* name) {
+	int id = lookupName(catalog, name);
+	return id >= 0 && catalog->position[id] != IMAGE_REMOVED ? id : -1;
+}
+
+int ImageCatalog_insert(ImageCatalog* catalog, const char* name) {
+	int id = lookupName(catalog, name);
+	if (id >= 0 && catalog->position[id] != IMAGE_REMOVED) return id;
+	if (id < 0) {
+		id = ImageCatalog_add(catalog, name, strlen(name), NULL, 0);
+		if (id < 0) return -1;
+		catalog->count--; // placed below like a revived id
+	}
+	// A rewritten file may have a new size and date
+	catalog->flags[id] &= (uint8_t)~(IMAGE_FLAG_STAT_KNOWN | IMAGE_FLAG_UNCONFIRMED | IMAGE_FLAG_PROBED);
+	catalog->order[catalog->count] = (uint32_t)id;
+	statImage(catalog, (uint32_t)id);
+	size_t low = 0, high = catalog->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (compareIds(catalog->order[mid], (uint32_t)id, catalog) < 0) low = mid + 1;
+		else high = mid;
+	}
+	memmove(catalog->order + low + 1, catalog->order + low, (catalog->count - low) * sizeof(uint32_t));
+	catalog->order[low] = (uint32_t)id;
+	catalog->count++;
+	updatePositions(catalog, low, catalog->count);
+	return id;
+}
+
+void ImageCatalog_remove(ImageCatalog* catalog, int id) {
+	size_t at = catalog->position[id];
+	if (at == IMAGE_REMOVED) return;
+	memmove(catalog->order + at, catalog->order + at + 1, (catalog->count - 1 - at) * sizeof(uint32_t));
+	catalog->count--;
+	catalog->position[id] = IMAGE_REMOVED;
+	updatePositions(catalog, at, catalog->count);
+}
+
+void ImageCatalog_refresh(ImageCatalog* catalog, int id) {
+	if (catalog->position[id] == IMAGE_REMOVED) return;
+	ImageCatalog_remove(catalog, id);
+	ImageCatalog_insert(catalog, catalog->paths[id]);
+}
+
+void ImageCatalog_setSortMode(ImageCatalog* catalog, SortMode mode) {
+	catalog->sortMode = mode;
+	Parallel_sortIndices(catalog->order, catalog->count, compareIds, catalog);
+	updatePositions(catalog, 0, catalog->count);
+}
+
+static int compareNameIds(uint32_t a, uint32_t b, void* user) {
+	return compareNames((const ImageCatalog*)user, a, b);
+}
+
+size_t ImageCatalog_nameOrder(const ImageCatalog* catalog, uint32_t* ids) {
+	memcpy(ids, catalog->order, catalog->count * sizeof(uint32_t));
+	if (catalog->sortMode != SORT_BY_NAME) Parallel_sortIndices(ids, catalog->count, compareNameIds, (void*)catalog);
+	return catalog->count;
+}
+
+const char* SortMode_name(SortMode mode) {
+	static const char* names[SORT_MODE_COUNT] = { "name", "date modified", "size", "date taken" };
+	return mode < SORT_MODE_COUNT ? names[mode] : "";
+}
+
+void ImageCatalog_setFileSize(ImageCatalog* catalog, int id, uint64_t bytes) {
+	catalog->fileSizeKB[id] = (uint32_t)(bytes / 1024);
+}
+
+void ImageCatalog_setStat(ImageCatalog* catalog, int id, int64_t mtime, uint64_t bytes) {
+	catalog->mtime[id] = mtime;
+	catalog->fileSizeKB[id] = (uint32_t)(bytes / 1024);
+	catalog->flags[id] |= IMAGE_FLAG_STAT_KNOWN;
+}
+
+float ImageCatalog_fileSizeMB(const ImageCatalog* catalog, int id) {
+	return catalog->fileSizeKB[id] / 1024.0f;
+}
+
+void ImageCatalog_setCaptureTime(ImageCatalog* catalog, int id, int64_t captureTime) {
+	catalog->captureTime[id] = captureTime;
+}
+
+void ImageCatalog_setState(ImageCatalog* catalog, int id, ImageState state) {
+	ImageMetadata* img = &catalog->items[id];
+	bool member = state == IMAGE_STATE_LOADING || state == IMAGE_STATE_LOADED;
+	if (member && img->residentSlot < 0) {
+		if (catalog->residentCount == catalog->residentCapacity) {
+			size_t n = catalog->residentCapacity == 0 ? 16 : catalog->residentCapacity * 2;
+			if (!growArray((void**)&catalog->resident, n, sizeof(ResidentImage))) {
+				SDL_Log("Realloc fail");
+				return;
+			}
+			catalog->residentCapacity = n;
+		}
+		img->residentSlot = (int32_t)catalog->residentCount;
+		catalog->resident[catalog->residentCount++] = (ResidentImage){ .id = (uint32_t)id };
+	} else if (!member && img->residentSlot >= 0) {
+		// Swap-remove, the last member takes over the freed slot
+		ResidentImage* last = &catalog->resident[--catalog->residentCount];
+		catalog->resident[img->residentSlot] = *last;
+		catalog->items[last->id].residentSlot = img->residentSlot;
+		img->residentSlot = -1;
+	}
+	img->state = state;
+}
+
+ResidentImage* ImageCatalog_resident(ImageCatalog* catalog, int id) {
+	int32_t slot = catalog->items[id].residentSlot;
+	return slot >= 0 ? &catalog->resident[slot] : NULL;
+}
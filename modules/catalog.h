@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "main_structs.h"
+
+#define STRING_CHUNK_BYTES ((size_t)1 << 20)
+
+void ImageCatalog_init(ImageCatalog* catalog);
+void ImageCatalog_free(ImageCatalog* catalog);
+
+// Appends at the end of the display order and returns the new id, -1 when out of memory.
+// `key` is the name's SortKey when the caller already built it, NULL to build it here.
+// ImageCatalog_sortNew moves appended images into place.
+int ImageCatalog_add(ImageCatalog* catalog, const char* name, size_t length, const char* key, size_t keyLength);
+// Display positions from `firstNew` on were appended, `presorted` when they already are in name order.
+// The run is sorted if needed and merged among the rest.
+void ImageCatalog_sortNew(ImageCatalog* catalog, size_t firstNew, bool presorted);
+// Hash lookup by path, -1 if absent or removed
+int ImageCatalog_find(const ImageCatalog* catalog, const char* name);
+// Inserts one image at its sorted place without touching the others' ids, -1 on failure.
+// A name removed earlier gets its old id back.
+int ImageCatalog_insert(ImageCatalog* catalog, const char* name);
+// Takes the image out of the display order, its id stays behind as a tombstone
+void ImageCatalog_remove(ImageCatalog* catalog, int id);
+// The file changed on disk, its size and dates are read again and it moves to its new place
+void ImageCatalog_refresh(ImageCatalog* catalog, int id);
+// Re-sorts the display order by the sizes and dates known so far, nothing is stat'ed here
+void ImageCatalog_setSortMode(ImageCatalog* catalog, SortMode mode);
+const char* SortMode_name(SortMode mode);
+// Ids of the displayed images in name order whatever the sort mode, `ids` holds `count` entries
+size_t ImageCatalog_nameOrder(const ImageCatalog* catalog, uint32_t* ids);
+
+static inline const char* ImageCatalog_path(const ImageCatalog* catalog, int id) {
+	return catalog->paths[id];
+}
+void ImageCatalog_setFileSize(ImageCatalog* catalog, int id, uint64_t bytes);
+void ImageCatalog_setStat(ImageCatalog* catalog, int id, int64_t mtime, uint64_t bytes);
+float ImageCatalog_fileSizeMB(const ImageCatalog* catalog, int id);
+void ImageCatalog_setCaptureTime(ImageCatalog* catalog, int id, int64_t captureTime);
+
+// Keeps the residency set in step, LOADING and LOADED images are members.
+// The caller releases textures and resident data before leaving the set.
+void ImageCatalog_setState(ImageCatalog* catalog, int id, ImageState state);
+// NULL unless the image is in the residency set, invalidated by the next state change
+ResidentImage* ImageCatalog_resident(ImageCatalog* catalog, int id);
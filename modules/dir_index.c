@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include "dir_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "catalog.h"
+#include "sort_key.h"
+
+static const char DIR_INDEX_MAGIC[8] = { 'S', 'P', 'X', 'I', 'N', 'D', 'E', 'X' };
+
+#define DIR_INDEX_RECURSIVE 0x01
+
+typedef struct {
+	char magic[8];
+	uint32_t version, flags;
+	DirStamp dir;
+	uint64_t count;       // entries following the header, in name order
+	uint64_t stringBytes; // after the entries, every path followed by its SortKey, both NUL-terminated
+} DirIndexHeader;
+
+typedef struct {
+	uint32_t path; // offset into the strings
+	uint32_t fileSizeKB;
+	int64_t mtime, captureTime;
+	int32_t width, height; // 0 until the image was decoded or probed
+	uint8_t flags; // DIR_INDEX_ENTRY_FLAGS
+	uint8_t orientation;
+	uint8_t reserved[6];
+} DirIndexEntry;
+
+#define DIR_INDEX_ENTRY_FLAGS (IMAGE_FLAG_STAT_KNOWN | IMAGE_FLAG_PROBED)
+
+bool DirStamp_read(const char* path, DirStamp* stamp) {
+	struct stat st;
+	if (stat(path, &st) != 0) return false;
+	stamp->dev = (uint64_t)st.st_dev;
+	stamp->ino = (uint64_t)st.st_ino;
+	stamp->mtimeSec = (int64_t)st.st_mtim.tv_sec;
+	stamp->mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+	return true;
+}
+
+// $XDG_CACHE_HOME/sharkpix/<hash of the absolute path>.idx, the image folder itself is never written to
+static bool indexPath(bool recursive, bool create, char* out, size_t size) {
+	char* cwd = realpath(".", NULL);
+	if (!cwd) return false;
+	uint64_t hash = 14695981039346656037ull; // FNV-1a
+	for (const unsigned char* c = (const unsigned char*)cwd; *c; ++c) {
+		hash ^= *c;
+		hash *= 1099511628211ull;
+	}
+	free(cwd);
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int n;
+	if (cache && cache[0]) n = snprintf(out, size, "%s", cache);
+	else if (home && home[0]) n = snprintf(out, size, "%s/.cache", home);
+	else return false;
+	if (n < 0 || (size_t)n >= size) return false;
+	if (create && mkdir(out, 0700) != 0 && errno != EEXIST) return false;
+	size_t used = (size_t)n;
+	n = snprintf(out + used, size - used, "/sharkpix");
+	if (n < 0 || (size_t)n >= size - used) return false;
+	if (create && mkdir(out, 0700) != 0 && errno != EEXIST) return false;
+	used += (size_t)n;
+	n = snprintf(out + used, size - used, "/%016llx%s.idx", (unsigned long long)hash, recursive ? "-r" : "");
+	return n >= 0 && (size_t)n < size - used;
+}
+
+bool DirIndex_load(ImageCatalog* catalog, bool recursive, bool* upToDate) {
+	bool ok = false;
+	int fd = -1;
+	void* map = MAP_FAILED;
+	size_t mapSize = 0;
+	char path[4096];
+	DirStamp now;
+	*upToDate = false;
+	if (!indexPath(recursive, false, path, sizeof(path)) || !DirStamp_read(".", &now)) goto cleanup;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) goto cleanup;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DirIndexHeader)) goto cleanup;
+	mapSize = (size_t)st.st_size;
+	map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) goto cleanup;
+	madvise(map, mapSize, MADV_SEQUENTIAL);
+
+	const DirIndexHeader* header = (const DirIndexHeader*)map;
+	if (memcmp(header->magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC)) != 0 || header->version != DIR_INDEX_VERSION) goto cleanup;
+	if (header->flags != (recursive ? DIR_INDEX_RECURSIVE : 0u)) goto cleanup;
+	// Same path, but a different directory was mounted or recreated there
+	if (header->dir.dev != now.dev || header->dir.ino != now.ino) goto cleanup;
+	if (header->count > (mapSize - sizeof(DirIndexHeader)) / sizeof(DirIndexEntry)) goto cleanup;
+	const DirIndexEntry* entries = (const DirIndexEntry*)(header + 1);
+	const char* strings = (const char*)(entries + header->count);
+	if (header->stringBytes != mapSize - sizeof(DirIndexHeader) - header->count * sizeof(DirIndexEntry)) goto cleanup;
+	if (header->stringBytes > 0 && strings[header->stringBytes - 1] != '\0') goto cleanup;
+
+	// A zero mtime was saved for a directory too young to trust
+	bool unchanged = !recursive && header->dir.mtimeSec != 0 &&
+	                 header->dir.mtimeSec == now.mtimeSec && header->dir.mtimeNsec == now.mtimeNsec;
+
+	// Checked before anything is added, a damaged index leaves the catalog as it was
+	for (uint64_t i = 0; i < header->count; ++i) {
+		if (entries[i].path >= header->stringBytes) goto cleanup;
+		if (entries[i].path + strlen(strings + entries[i].path) + 1 >= header->stringBytes) goto cleanup;
+	}
+
+	size_t sorted = catalog->count;
+	for (uint64_t i = 0; i < header->count; ++i) {
+		const DirIndexEntry* entry = &entries[i];
+		const char* name = strings + entry->path;
+		size_t length = strlen(name);
+		const char* key = name + length + 1;
+		if (ImageCatalog_find(catalog, name) >= 0) continue;
+		int id = ImageCatalog_add(catalog, name, length, key, strlen(key));
+		if (id < 0) break;
+		catalog->fileSizeKB[id] = entry->fileSizeKB;
+		catalog->mtime[id] = entry->mtime;
+		catalog->captureTime[id] = entry->captureTime;
+		catalog->orientation[id] = entry->orientation >= 1 && entry->orientation <= 8 ? entry->orientation : 1;
+		catalog->flags[id] = (uint8_t)((entry->flags & DIR_INDEX_ENTRY_FLAGS) | (unchanged ? 0 : IMAGE_FLAG_UNCONFIRMED));
+		catalog->items[id].full_width = entry->width;
+		catalog->items[id].full_height = entry->height;
+	}
+	ImageCatalog_sortNew(catalog, sorted, true);
+	*upToDate = unchanged;
+	ok = true;
+
+cleanup:
+	if (map != MAP_FAILED) munmap(map, mapSize);
+	if (fd >= 0) close(fd);
+	return ok;
+}
+
+bool DirIndex_save(const ImageCatalog* catalog, bool recursive, const DirStamp* stamp) {
+	bool ok = false;
+	uint32_t* ids = NULL;
+	FILE* file = NULL;
+	char path[4096], temp[4096 + 16] = "";
+	if (!indexPath(recursive, true, path, sizeof(path))) goto cleanup;
+	snprintf(temp, sizeof(temp), "%s.%d", path, (int)getpid());
+	ids = (uint32_t*)malloc((catalog->count ? catalog->count : 1) * sizeof(uint32_t));
+	if (!ids) goto cleanup;
+	size_t count = ImageCatalog_nameOrder(catalog, ids);
+	file = fopen(temp, "wb");
+	if (!file) goto cleanup;
+
+	DirIndexHeader header = { .version = DIR_INDEX_VERSION, .flags = recursive ? DIR_INDEX_RECURSIVE : 0u, .dir = *stamp, .count = count };
+	struct timespec now;
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0 || stamp->mtimeSec >= (int64_t)now.tv_sec - DIR_INDEX_RACY_SECONDS) {
+		header.dir.mtimeSec = 0;
+		header.dir.mtimeNsec = 0;
+	}
+	memcpy(header.magic, DIR_INDEX_MAGIC, sizeof(DIR_INDEX_MAGIC));
+	for (size_t i = 0; i < count; ++i) {
+		header.stringBytes += strlen(catalog->paths[ids[i]]) + 1 + strlen(catalog->sortKeys[ids[i]]) + 1;
+	}
+	if (header.stringBytes > UINT32_MAX) goto cleanup;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) goto cleanup;
+	uint32_t offset = 0;
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t id = ids[i];
+		const ImageMetadata* img = &catalog->items[id];
+		DirIndexEntry entry = {
+			.path = offset,
+			.fileSizeKB = catalog->fileSizeKB[id],
+			.mtime = catalog->mtime[id],
+			.captureTime = catalog->captureTime[id],
+			.width = img->full_width,
+			.height = img->full_height,
+			.flags = (uint8_t)(catalog->flags[id] & DIR_INDEX_ENTRY_FLAGS),
+			.orientation = catalog->orientation[id]
+		};
+		if (fwrite(&entry, sizeof(entry), 1, file) != 1) goto cleanup;
+		offset += (uint32_t)(strlen(catalog->paths[id]) + 1 + strlen(catalog->sortKeys[id]) + 1);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const char* name = catalog->paths[ids[i]];
+		const char* key = catalog->sortKeys[ids[i]];
+		if (fwrite(name, strlen(name) + 1, 1, file) != 1 || fwrite(key, strlen(key) + 1, 1, file) != 1) goto cleanup;
+	}
+	if (fclose(file) != 0) {
+		file = NULL;
+		goto cleanup;
+	}
+	file = NULL;
+	// Readers never see a half-written index
+	ok = rename(temp, path) == 0;
+
+cleanup:
+	if (file) fclose(file);
+	if (!ok) {
+		if (temp[0]) unlink(temp);
+		SDL_Log("Could not save the directory index");
+	}
+	free(ids);
+	return ok;
+}
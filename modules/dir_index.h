@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "main_structs.h"
+
+#define DIR_INDEX_VERSION 1
+#define DIR_INDEX_RACY_SECONDS 2
+
+// Identifies the directory and its state, any entry added, removed or renamed changes the mtime
+typedef struct {
+	uint64_t dev, ino;
+	int64_t mtimeSec, mtimeNsec;
+} DirStamp;
+
+bool DirStamp_read(const char* path, DirStamp* stamp);
+
+// Maps the index saved for the working directory and appends its images in name order with
+// their size, dates and dimensions, false when there is none or it does not match.
+// `upToDate` is set when no file was added, removed or renamed since and the listing can be skipped,
+// a recursive index never is since subfolders change on their own. Otherwise the entries are marked
+// IMAGE_FLAG_UNCONFIRMED for the listing to confirm. Images the caller already added are kept.
+// Files rewritten in place leave the directory mtime alone, the caller checks each entry's own size and mtime.
+bool DirIndex_load(ImageCatalog* catalog, bool recursive, bool* upToDate);
+// Writes the displayed images under the cache directory for the next start, `stamp` is the
+// directory as it was when the listing began so anything that changed later shows up as a delta.
+// A stamp younger than DIR_INDEX_RACY_SECONDS is not trusted, a change within the same timestamp tick would go unseen.
+bool DirIndex_save(const ImageCatalog* catalog, bool recursive, const DirStamp* stamp);
@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+#include "dir_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <SDL3/SDL.h>
+#include "sort_key.h"
+
+#define EXT_TABLE_BITS 5
+#define EXT_TABLE_SIZE (1 << EXT_TABLE_BITS)
+#define EXT_MAX_LENGTH 7
+
+typedef struct {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} LinuxDirent64;
+
+static const struct {
+	const char* ext;
+	ImageFormat format;
+} knownExtensions[] = {
+	{"png", IMAGE_FORMAT_PNG}, {"jpg", IMAGE_FORMAT_JPEG}, {"jpeg", IMAGE_FORMAT_JPEG},
+	{"bmp", IMAGE_FORMAT_BMP}, {"tga", IMAGE_FORMAT_TGA}, {"gif", IMAGE_FORMAT_GIF},
+	{"webp", IMAGE_FORMAT_WEBP}, {"heif", IMAGE_FORMAT_HEIF}, {"heic", IMAGE_FORMAT_HEIF},
+	{"avif", IMAGE_FORMAT_AVIF}, {"tiff", IMAGE_FORMAT_TIFF}, {"tif", IMAGE_FORMAT_TIFF},
+	{"jxl", IMAGE_FORMAT_JXL}
+};
+
+// Lowercased extension packed into one integer, a probe is then a multiply and a compare
+static uint64_t extTable[EXT_TABLE_SIZE];
+static uint8_t extFormats[EXT_TABLE_SIZE];
+static pthread_once_t extTableOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t packExtension(const char* ext, size_t length) {
+	uint64_t key = 0;
+	for (size_t i = 0; i < length; ++i) {
+		unsigned char c = (unsigned char)ext[i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		key |= (uint64_t)c << (8 * i);
+	}
+	return key;
+}
+
+static unsigned extSlot(uint64_t key) {
+	return (unsigned)((key * 0x9E3779B97F4A7C15ull) >> (64 - EXT_TABLE_BITS));
+}
+
+static void buildExtTable(void) {
+	for (size_t i = 0; i < sizeof(knownExtensions)/sizeof(knownExtensions[0]); ++i) {
+		uint64_t key = packExtension(knownExtensions[i].ext, strlen(knownExtensions[i].ext));
+		unsigned slot = extSlot(key);
+		while (extTable[slot] != 0) slot = (slot + 1) & (EXT_TABLE_SIZE - 1);
+		extTable[slot] = key;
+		extFormats[slot] = (uint8_t)knownExtensions[i].format;
+	}
+}
+
+ImageFormat ImageFormat_fromName(const char* name, size_t length) {
+	const char* dot = memrchr(name, '.', length);
+	if (!dot) return IMAGE_FORMAT_NONE;
+	size_t extLength = length - (size_t)(dot + 1 - name);
+	if (extLength == 0 || extLength > EXT_MAX_LENGTH) return IMAGE_FORMAT_NONE;
+	pthread_once(&extTableOnce, buildExtTable);
+	uint64_t key = packExtension(dot + 1, extLength);
+	for (unsigned slot = extSlot(key); extTable[slot] != 0; slot = (slot + 1) & (EXT_TABLE_SIZE - 1)) {
+		if (extTable[slot] == key) return (ImageFormat)extFormats[slot];
+	}
+	return IMAGE_FORMAT_NONE;
+}
+
+// Lists an open directory, `visitDir` is NULL when subdirectories are not wanted
+static bool scanDirectory(int fd, char* buffer, DirScanVisit visit, DirScanVisitDir visitDir, void* user) {
+	for (;;) {
+		long n = syscall(SYS_getdents64, fd, buffer, DIR_SCAN_BUFFER_BYTES);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return false;
+		if (n == 0) return true;
+		for (long offset = 0; offset < n;) {
+			LinuxDirent64* entry = (LinuxDirent64*)(buffer + offset);
+			offset += entry->d_reclen;
+			// The name is checked first, so even DT_UNKNOWN filesystems only stat image candidates
+			size_t length = strlen(entry->d_name);
+			ImageFormat format = ImageFormat_fromName(entry->d_name, length);
+			unsigned char type = entry->d_type;
+			// Hidden directories hold thumbnail caches and VCS data, not photos
+			bool dirCandidate = visitDir && entry->d_name[0] != '.';
+			if (format == IMAGE_FORMAT_NONE && !(dirCandidate && (type == DT_DIR || type == DT_UNKNOWN || type == DT_LNK))) continue;
+			if (type == DT_UNKNOWN || type == DT_LNK) {
+				struct stat st;
+				if (fstatat(fd, entry->d_name, &st, 0) != 0) continue;
+				type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+			}
+			bool keepGoing = true;
+			if (type == DT_DIR && dirCandidate) keepGoing = visitDir(user, entry->d_name, length);
+			else if (type == DT_REG && format != IMAGE_FORMAT_NONE) keepGoing = visit(user, entry->d_name, length, format);
+			if (!keepGoing) return true;
+		}
+	}
+}
+
+bool DirScan_images(const char* path, DirScanVisit visit, void* user) {
+	bool ok = false;
+	char* buffer = NULL;
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) goto cleanup;
+	buffer = (char*)malloc(DIR_SCAN_BUFFER_BYTES);
+	if (!buffer) goto cleanup;
+	ok = scanDirectory(fd, buffer, visit, NULL, user);
+
+cleanup:
+	free(buffer);
+	if (fd >= 0) close(fd);
+	return ok;
+}
+
+typedef struct DirScanBatchNode {
+	DirScanBatch batch;
+	struct DirScanBatchNode* next;
+} DirScanBatchNode;
+
+// Directories waiting to be listed, the owner works at the back and thieves take from the front
+typedef struct {
+	SDL_Mutex* mutex;
+	char** dirs; // ring buffer of paths relative to the scan root
+	size_t head, count, capacity;
+} DirQueue;
+
+typedef struct {
+	DirScanner* scanner;
+	SDL_Thread* thread;
+	DirQueue queue;
+	char* buffer; // getdents64 batch
+	const char* dir; // being listed, "" for the root
+	size_t dirLength;
+	DirScanBatch current;
+	size_t namesUsed, namesCapacity, offsetsCapacity, batchLimit;
+	unsigned victim; // next queue to steal from
+} DirScanWalker;
+
+typedef struct {
+	uint64_t dev, ino; // ino 0 marks an empty slot
+} DirId;
+
+struct DirScanner {
+	int rootFd;
+	bool recursive;
+	SDL_Mutex* mutex;
+	DirScanBatchNode* head;
+	DirScanBatchNode* tail;
+	atomic_bool stopping;
+	atomic_bool listed;
+	atomic_size_t pendingDirs; // queued or being listed, the walk is over once this drops to zero
+	atomic_int runningWalkers;
+	// Every directory listed so far, symlinks back up the tree and bind mounts are entered once
+	SDL_Mutex* visitedMutex;
+	DirId* visited;
+	size_t visitedCount, visitedCapacity;
+	DirScanWalker* walkers;
+	int walkerCount;
+};
+
+// Compares the keys stored after each name, the same order ImageCatalog keeps
+static int compareNames(const void* a, const void* b, void* names) {
+	const char* nameA = (const char*)names + *(const uint32_t*)a;
+	const char* nameB = (const char*)names + *(const uint32_t*)b;
+	size_t lengthA = strlen(nameA), lengthB = strlen(nameB);
+	int cmp = strcmp(nameA + lengthA + 1, nameB + lengthB + 1);
+	return cmp ? cmp : strcmp(nameA, nameB);
+}
+
+static void publishBatch(DirScanWalker* walker) {
+	DirScanner* scanner = walker->scanner;
+	DirScanBatch* batch = &walker->current;
+	if (batch->count == 0) return;
+	qsort_r(batch->offsets, batch->count, sizeof(uint32_t), compareNames, batch->names);
+	DirScanBatchNode* node = (DirScanBatchNode*)malloc(sizeof(DirScanBatchNode));
+	if (!node) {
+		DirScanBatch_free(batch);
+	} else {
+		node->batch = *batch;
+		node->next = NULL;
+		SDL_LockMutex(scanner->mutex);
+		if (scanner->tail) scanner->tail->next = node;
+		else scanner->head = node;
+		scanner->tail = node;
+		SDL_UnlockMutex(scanner->mutex);
+	}
+	memset(batch, 0, sizeof(*batch));
+	walker->namesUsed = walker->namesCapacity = walker->offsetsCapacity = 0;
+	if (walker->batchLimit < ((size_t)1 << 16)) walker->batchLimit *= 2;
+}
+
+static bool collectName(void* user, const char* name, size_t length, ImageFormat format) {
+	(void)format;
+	DirScanWalker* walker = (DirScanWalker*)user;
+	if (atomic_load(&walker->scanner->stopping)) return false;
+	DirScanBatch* batch = &walker->current;
+	// Names below the root carry their directory, the catalog and the loader take them as relative paths
+	size_t prefix = walker->dirLength ? walker->dirLength + 1 : 0;
+	size_t pathLength = prefix + length;
+	size_t needed = walker->namesUsed + pathLength + 1 + SORT_KEY_MAX_BYTES(pathLength);
+	if (needed > walker->namesCapacity) {
+		size_t capacity = walker->namesCapacity ? walker->namesCapacity * 2 : 16384;
+		while (capacity < needed) capacity *= 2;
+		char* names = (char*)realloc(batch->names, capacity);
+		if (!names) return false;
+		batch->names = names;
+		walker->namesCapacity = capacity;
+	}
+	if (batch->count == walker->offsetsCapacity) {
+		size_t capacity = walker->offsetsCapacity ? walker->offsetsCapacity * 2 : 256;
+		uint32_t* offsets = (uint32_t*)realloc(batch->offsets, capacity * sizeof(uint32_t));
+		if (!offsets) return false;
+		batch->offsets = offsets;
+		walker->offsetsCapacity = capacity;
+	}
+	char* stored = batch->names + walker->namesUsed;
+	if (prefix) {
+		memcpy(stored, walker->dir, walker->dirLength);
+		stored[walker->dirLength] = '/';
+	}
+	memcpy(stored + prefix, name, length + 1);
+	// Built here, off the main thread, so merging a batch only copies it
+	size_t keyLength = SortKey_build(stored, pathLength, stored + pathLength + 1);
+	batch->offsets[batch->count++] = (uint32_t)walker->namesUsed;
+	walker->namesUsed += pathLength + 1 + keyLength + 1;
+	if (batch->count >= walker->batchLimit) publishBatch(walker);
+	return true;
+}
+
+static bool DirQueue_push(DirQueue* queue, char* dir) {
+	SDL_LockMutex(queue->mutex);
+	if (queue->count == queue->capacity) {
+		size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+		char** dirs = (char**)malloc(capacity * sizeof(char*));
+		if (!dirs) {
+			SDL_UnlockMutex(queue->mutex);
+			return false;
+		}
+		for (size_t i = 0; i < queue->count; ++i) dirs[i] = queue->dirs[(queue->head + i) % queue->capacity];
+		free(queue->dirs);
+		queue->dirs = dirs;
+		queue->head = 0;
+		queue->capacity = capacity;
+	}
+	queue->dirs[(queue->head + queue->count) % queue->capacity] = dir;
+	queue->count++;
+	SDL_UnlockMutex(queue->mutex);
+	return true;
+}
+
+// The owner takes the newest directory and stays deep in one subtree, a thief takes the
+// oldest one, which sits near the root and usually has the most work below it
+static char* DirQueue_take(DirQueue* queue, bool steal) {
+	char* dir = NULL;
+	SDL_LockMutex(queue->mutex);
+	if (queue->count > 0) {
+		if (steal) {
+			dir = queue->dirs[queue->head];
+			queue->head = (queue->head + 1) % queue->capacity;
+		} else {
+			dir = queue->dirs[(queue->head + queue->count - 1) % queue->capacity];
+		}
+		queue->count--;
+	}
+	SDL_UnlockMutex(queue->mutex);
+	return dir;
+}
+
+static bool enqueueDirectory(void* user, const char* name, size_t length) {
+	DirScanWalker* walker = (DirScanWalker*)user;
+	if (atomic_load(&walker->scanner->stopping)) return false;
+	size_t prefix = walker->dirLength ? walker->dirLength + 1 : 0;
+	char* dir = (char*)malloc(prefix + length + 1);
+	if (!dir) return true;
+	if (prefix) {
+		memcpy(dir, walker->dir, walker->dirLength);
+		dir[walker->dirLength] = '/';
+	}
+	memcpy(dir + prefix, name, length + 1);
+	atomic_fetch_add(&walker->scanner->pendingDirs, 1);
+	if (!DirQueue_push(&walker->queue, dir)) {
+		atomic_fetch_sub(&walker->scanner->pendingDirs, 1);
+		free(dir);
+	}
+	return true;
+}
+
+static size_t DirId_slot(uint64_t dev, uint64_t ino, size_t capacity) {
+	return (size_t)(((ino * 0x9E3779B97F4A7C15ull) ^ dev) & (capacity - 1));
+}
+
+// False when the directory was listed before or cannot be recorded
+static bool markVisited(DirScanner* scanner, const struct stat* st) {
+	bool fresh = true;
+	SDL_LockMutex(scanner->visitedMutex);
+	if ((scanner->visitedCount + 1) * 2 > scanner->visitedCapacity) {
+		size_t capacity = scanner->visitedCapacity ? scanner->visitedCapacity * 2 : 1024;
+		DirId* visited = (DirId*)calloc(capacity, sizeof(DirId));
+		if (visited) {
+			for (size_t i = 0; i < scanner->visitedCapacity; ++i) {
+				DirId id = scanner->visited[i];
+				if (id.ino == 0) continue;
+				size_t slot = DirId_slot(id.dev, id.ino, capacity);
+				while (visited[slot].ino != 0) slot = (slot + 1) & (capacity - 1);
+				visited[slot] = id;
+			}
+			free(scanner->visited);
+			scanner->visited = visited;
+			scanner->visitedCapacity = capacity;
+		}
+	}
+	if (scanner->visitedCount + 1 < scanner->visitedCapacity) {
+		uint64_t dev = (uint64_t)st->st_dev, ino = (uint64_t)st->st_ino;
+		size_t slot = DirId_slot(dev, ino, scanner->visitedCapacity);
+		while (scanner->visited[slot].ino != 0) {
+			if (scanner->visited[slot].dev == dev && scanner->visited[slot].ino == ino) {
+				fresh = false;
+				break;
+			}
+			slot = (slot + 1) & (scanner->visitedCapacity - 1);
+		}
+		if (fresh) {
+			scanner->visited[slot].dev = dev;
+			scanner->visited[slot].ino = ino;
+			scanner->visitedCount++;
+		}
+	} else {
+		// Out of memory, a directory that cannot be recorded might lead back into the tree
+		fresh = false;
+	}
+	SDL_UnlockMutex(scanner->visitedMutex);
+	return fresh;
+}
+
+static void listDirectory(DirScanWalker* walker, const char* dir) {
+	DirScanner* scanner = walker->scanner;
+	int fd = openat(scanner->rootFd, dir[0] ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		SDL_Log("Could not list %s", dir[0] ? dir : ".");
+		return;
+	}
+	struct stat st;
+	if (scanner->recursive && (fstat(fd, &st) != 0 || !markVisited(scanner, &st))) {
+		close(fd);
+		return;
+	}
+	walker->dir = dir;
+	walker->dirLength = strlen(dir);
+	if (!scanDirectory(fd, walker->buffer, collectName, scanner->recursive ? enqueueDirectory : NULL, walker)) {
+		SDL_Log("Could not list %s", dir[0] ? dir : ".");
+	}
+	close(fd);
+}
+
+static char* nextDirectory(DirScanWalker* walker) {
+	DirScanner* scanner = walker->scanner;
+	for (;;) {
+		char* dir = DirQueue_take(&walker->queue, false);
+		if (dir) return dir;
+		for (int i = 0; i < scanner->walkerCount && !dir; ++i) {
+			walker->victim = (walker->victim + 1) % (unsigned)scanner->walkerCount;
+			if (&scanner->walkers[walker->victim] == walker) continue;
+			dir = DirQueue_take(&scanner->walkers[walker->victim].queue, true);
+		}
+		if (dir) return dir;
+		// Nothing queued anywhere, but a directory being listed may still push subdirectories
+		if (atomic_load(&scanner->pendingDirs) == 0 || atomic_load(&scanner->stopping)) return NULL;
+		SDL_Delay(1);
+	}
+}
+
+static int walk_thread_func(void* data) {
+	DirScanWalker* walker = (DirScanWalker*)data;
+	DirScanner* scanner = walker->scanner;
+	char* dir;
+	while (!atomic_load(&scanner->stopping) && (dir = nextDirectory(walker)) != NULL) {
+		listDirectory(walker, dir);
+		free(dir);
+		atomic_fetch_sub(&scanner->pendingDirs, 1);
+	}
+	publishBatch(walker);
+	DirScanBatch_free(&walker->current);
+	if (atomic_fetch_sub(&scanner->runningWalkers, 1) == 1) atomic_store(&scanner->listed, true);
+	return 0;
+}
+
+DirScanner* DirScanner_start(const char* path, bool recursive) {
+	DirScanner* scanner = (DirScanner*)calloc(1, sizeof(DirScanner));
+	if (!scanner) return NULL;
+	scanner->recursive = recursive;
+	scanner->rootFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	scanner->mutex = SDL_CreateMutex();
+	scanner->visitedMutex = SDL_CreateMutex();
+	int cores = SDL_GetNumLogicalCPUCores();
+	scanner->walkerCount = !recursive ? 1 : cores < 1 ? 1 : cores > DIR_SCANNER_MAX_WALKERS ? DIR_SCANNER_MAX_WALKERS : cores;
+	scanner->walkers = (DirScanWalker*)calloc((size_t)scanner->walkerCount, sizeof(DirScanWalker));
+	if (scanner->rootFd < 0 || !scanner->mutex || !scanner->visitedMutex || !scanner->walkers) goto fail;
+	for (int i = 0; i < scanner->walkerCount; ++i) {
+		DirScanWalker* walker = &scanner->walkers[i];
+		walker->scanner = scanner;
+		walker->batchLimit = DIR_SCANNER_FIRST_BATCH;
+		walker->victim = (unsigned)i;
+		walker->queue.mutex = SDL_CreateMutex();
+		walker->buffer = (char*)malloc(DIR_SCAN_BUFFER_BYTES);
+		if (!walker->queue.mutex || !walker->buffer) goto fail;
+	}
+	char* root = strdup("");
+	if (!root || !DirQueue_push(&scanner->walkers[0].queue, root)) {
+		free(root);
+		goto fail;
+	}
+	atomic_store(&scanner->pendingDirs, 1);
+	atomic_store(&scanner->runningWalkers, scanner->walkerCount);
+	for (int i = 0; i < scanner->walkerCount; ++i) {
+		scanner->walkers[i].thread = SDL_CreateThread(walk_thread_func, "DirScan", &scanner->walkers[i]);
+		if (!scanner->walkers[i].thread) goto fail;
+	}
+	return scanner;
+
+fail:
+	SDL_Log("Could not list %s", path);
+	DirScanner_stop(scanner);
+	return NULL;
+}
+
+bool DirScanner_poll(DirScanner* scanner, DirScanBatch* batch) {
+	SDL_LockMutex(scanner->mutex);
+	DirScanBatchNode* node = scanner->head;
+	if (node) {
+		scanner->head = node->next;
+		if (!scanner->head) scanner->tail = NULL;
+	}
+	SDL_UnlockMutex(scanner->mutex);
+	if (!node) return false;
+	*batch = node->batch;
+	free(node);
+	return true;
+}
+
+bool DirScanner_finished(DirScanner* scanner) {
+	if (!atomic_load(&scanner->listed)) return false;
+	SDL_LockMutex(scanner->mutex);
+	bool empty = scanner->head == NULL;
+	SDL_UnlockMutex(scanner->mutex);
+	return empty;
+}
+
+void DirScanner_stop(DirScanner* scanner) {
+	if (!scanner) return;
+	atomic_store(&scanner->stopping, true);
+	for (int i = 0; scanner->walkers && i < scanner->walkerCount; ++i) {
+		if (scanner->walkers[i].thread) SDL_WaitThread(scanner->walkers[i].thread, NULL);
+	}
+	for (int i = 0; scanner->walkers && i < scanner->walkerCount; ++i) {
+		DirScanWalker* walker = &scanner->walkers[i];
+		char* dir;
+		while (walker->queue.mutex && (dir = DirQueue_take(&walker->queue, false)) != NULL) free(dir);
+		free(walker->queue.dirs);
+		SDL_DestroyMutex(walker->queue.mutex);
+		free(walker->buffer);
+		DirScanBatch_free(&walker->current);
+	}
+	DirScanBatch batch;
+	while (scanner->mutex && DirScanner_poll(scanner, &batch)) DirScanBatch_free(&batch);
+	SDL_DestroyMutex(scanner->mutex);
+	SDL_DestroyMutex(scanner->visitedMutex);
+	if (scanner->rootFd >= 0) close(scanner->rootFd);
+	free(scanner->visited);
+	free(scanner->walkers);
+	free(scanner);
+}
+
+void DirScanBatch_free(DirScanBatch* batch) {
+	free(batch->names);
+	free(batch->offsets);
+	memset(batch, 0, sizeof(*batch));
+}
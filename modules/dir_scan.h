@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define DIR_SCAN_BUFFER_BYTES ((size_t)1 << 20) // getdents64 batch, a few thousand entries per syscall
+
+typedef enum {
+	IMAGE_FORMAT_NONE,
+	IMAGE_FORMAT_PNG,
+	IMAGE_FORMAT_JPEG,
+	IMAGE_FORMAT_BMP,
+	IMAGE_FORMAT_TGA,
+	IMAGE_FORMAT_GIF,
+	IMAGE_FORMAT_WEBP,
+	IMAGE_FORMAT_HEIF,
+	IMAGE_FORMAT_AVIF,
+	IMAGE_FORMAT_TIFF,
+	IMAGE_FORMAT_JXL
+} ImageFormat;
+
+// Extension lookup through a hash table, IMAGE_FORMAT_NONE for anything we do not open
+ImageFormat ImageFormat_fromName(const char* name, size_t length);
+
+// Called for every regular file with a known image extension, return false to stop the scan
+typedef bool (*DirScanVisit)(void* user, const char* name, size_t length, ImageFormat format);
+
+// Called for every subdirectory in a recursive scan, return false to stop the scan
+typedef bool (*DirScanVisitDir)(void* user, const char* name, size_t length);
+
+// Lists `path` with large getdents64 batches, file types come from d_type and
+// only entries the filesystem reports as DT_UNKNOWN are stat'ed
+bool DirScan_images(const char* path, DirScanVisit visit, void* user);
+
+#define DIR_SCANNER_FIRST_BATCH 256 // small so the first names show up at once, later batches double
+#define DIR_SCANNER_MAX_WALKERS 8 // threads listing subdirectories in a recursive scan
+
+// One sorted run of names, the main thread merges it into the list
+typedef struct {
+	char* names; // each NUL-terminated name is followed by its NUL-terminated SortKey, `offsets` point at the names
+	uint32_t* offsets;
+	size_t count;
+} DirScanBatch;
+
+typedef struct DirScanner DirScanner;
+
+// Enumerates `path` on a background thread, batches are sorted by natural-order key.
+// `recursive` also lists every subdirectory, walker threads steal directories from each other's
+// queues, names come as paths relative to `path` and each directory is listed once even
+// when symlinks lead back into the tree.
+DirScanner* DirScanner_start(const char* path, bool recursive);
+// Next finished batch, never blocks
+bool DirScanner_poll(DirScanner* scanner, DirScanBatch* batch);
+// True once the listing ended and every batch has been polled
+bool DirScanner_finished(DirScanner* scanner);
+void DirScanner_stop(DirScanner* scanner);
+void DirScanBatch_free(DirScanBatch* batch);
@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+#include "dir_watch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define DIR_WATCH_BUFFER_BYTES 65536
+
+// Files written in place show up on close, renames cover tools that write a temp file first
+#define DIR_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR)
+
+struct DirWatch {
+	int fd;
+	size_t used, offset;
+	char buffer[DIR_WATCH_BUFFER_BYTES] __attribute__((aligned(__alignof__(struct inotify_event))));
+};
+
+DirWatch* DirWatch_open(const char* path) {
+	DirWatch* watch = (DirWatch*)calloc(1, sizeof(DirWatch));
+	if (!watch) return NULL;
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0 || inotify_add_watch(watch->fd, path, DIR_WATCH_MASK) < 0) {
+		DirWatch_close(watch);
+		return NULL;
+	}
+	return watch;
+}
+
+bool DirWatch_next(DirWatch* watch, DirWatchEventType* type, const char** name) {
+	for (;;) {
+		if (watch->offset >= watch->used) {
+			ssize_t n = read(watch->fd, watch->buffer, sizeof(watch->buffer));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			watch->used = (size_t)n;
+			watch->offset = 0;
+		}
+		const struct inotify_event* event = (const struct inotify_event*)(watch->buffer + watch->offset);
+		watch->offset += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			*type = DIR_WATCH_OVERFLOW;
+			*name = NULL;
+			return true;
+		}
+		if (event->len == 0 || (event->mask & IN_ISDIR)) continue;
+		if (ImageFormat_fromName(event->name, strlen(event->name)) == IMAGE_FORMAT_NONE) continue;
+		*type = (event->mask & (IN_MOVED_FROM | IN_DELETE)) ? DIR_WATCH_REMOVED : DIR_WATCH_WRITTEN;
+		*name = event->name;
+		return true;
+	}
+}
+
+void DirWatch_close(DirWatch* watch) {
+	if (!watch) return;
+	if (watch->fd >= 0) close(watch->fd);
+	free(watch);
+}
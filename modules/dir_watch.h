@@ -0,0 +1,18 @@
+#pragma once
+#include <stdbool.h>
+
+#include "dir_scan.h"
+
+typedef enum {
+	DIR_WATCH_WRITTEN, // a new or rewritten file is complete
+	DIR_WATCH_REMOVED, // deleted or renamed away
+	DIR_WATCH_OVERFLOW // the kernel dropped events, the directory has to be listed again
+} DirWatchEventType;
+
+typedef struct DirWatch DirWatch;
+
+// inotify on one directory, only image names are reported
+DirWatch* DirWatch_open(const char* path);
+// Never blocks, `name` stays valid until the next call
+bool DirWatch_next(DirWatch* watch, DirWatchEventType* type, const char** name);
+void DirWatch_close(DirWatch* watch);
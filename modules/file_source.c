@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include "file_source.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool readWhole(int fd, uint8_t* buffer, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = pread(fd, buffer + done, size - done, (off_t)done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		done += (size_t)n;
+	}
+	return true;
+}
+
+bool FileSource_open(FileSource* src, const char* path, bool map) {
+	memset(src, 0, sizeof(*src));
+	src->fd = -1;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = (size_t)st.st_size;
+
+	void* view = map ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (view != MAP_FAILED) {
+		// Decoders walk the file front to back, the head is requested up front
+		madvise(view, size, MADV_SEQUENTIAL);
+		madvise(view, size < FILE_SOURCE_WILLNEED_BYTES ? size : FILE_SOURCE_WILLNEED_BYTES, MADV_WILLNEED);
+		src->data = (const uint8_t*)view;
+		src->mapped = true;
+	} else {
+		uint8_t* buffer = (uint8_t*)malloc(size);
+		if (!buffer || !readWhole(fd, buffer, size)) {
+			free(buffer);
+			close(fd);
+			return false;
+		}
+		src->data = buffer;
+	}
+	src->size = size;
+	src->fd = fd;
+	return true;
+}
+
+static void releaseSource(FileSource* src, bool dropCache) {
+	if (src->data) {
+		if (src->mapped) munmap((void*)src->data, src->size);
+		else free((void*)src->data);
+	}
+	if (src->fd >= 0) {
+		// Pages still mapped cannot be evicted, so this has to follow munmap
+		if (dropCache) posix_fadvise(src->fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(src->fd);
+	}
+	memset(src, 0, sizeof(*src));
+	src->fd = -1;
+}
+
+void FileSource_close(FileSource* src) {
+	releaseSource(src, false);
+}
+
+void FileSource_closeDropCache(FileSource* src) {
+	releaseSource(src, true);
+}
+
+void FileSource_willNeed(const char* path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0) return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
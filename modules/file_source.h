@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FILE_SOURCE_WILLNEED_BYTES ((size_t)64 * 1024 * 1024) // prefix prefetched right after mapping
+
+// Read-only view of a whole file that decoders consume in place
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	int fd;
+	bool mapped; // mmap of fd, otherwise a malloc'd copy for filesystems that refuse mmap
+} FileSource;
+
+// `map` false reads the file into memory, for files that may be truncated while mapped (SIGBUS)
+bool FileSource_open(FileSource* src, const char* path, bool map);
+void FileSource_close(FileSource* src);
+// Closes the source and evicts the file from the page cache, for files we are done with
+void FileSource_closeDropCache(FileSource* src);
+// Starts asynchronous readahead of a file that is likely to be opened soon
+void FileSource_willNeed(const char* path);
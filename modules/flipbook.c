@@ -0,0 +1,328 @@
+#include "flipbook.h"
+#include "main_structs.h"
+#include "render.h"
+#include "catalog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+extern AppState g_appState;
+
+typedef struct {
+	uint64_t number;
+	uint32_t id;
+} SequenceFrame;
+
+static struct {
+	bool active, playing;
+	uint32_t* frames; // ids in frame number order
+	size_t count;
+	size_t cursor; // frame on screen
+	int step; // only every step-th frame is shown, doubled while decoding falls behind
+	double fps;
+	Uint64 dueNs; // when the frame after the one on screen goes up
+	Uint64 aheadSinceNs; // since when the whole window is decoded, 0 while it is not
+	int window[FLIPBOOK_MAX_AHEAD + 1];
+	int windowCount;
+	int readahead[READAHEAD_COUNT];
+	int readaheadCount;
+	int shown; // frames put on screen since measureStartNs
+	Uint64 measureStartNs;
+	double achievedFps;
+} flipbook = { .fps = FLIPBOOK_DEFAULT_FPS, .step = 1 };
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// The last run of digits in the file name is the frame number, what is around it names the sequence
+static bool splitNumbered(const char* path, size_t* prefixLength, size_t* digitsLength) {
+	const char* name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	const char* end = NULL;
+	for (const char* p = name; *p; ++p) {
+		if (isDigit(*p)) end = p + 1;
+	}
+	if (!end) return false;
+	const char* start = end;
+	while (start > name && isDigit(start[-1])) --start;
+	*prefixLength = (size_t)(start - path);
+	*digitsLength = (size_t)(end - start);
+	return true;
+}
+
+// Padding may differ, shot_999 is followed by shot_1000
+static bool frameNumber(const char* candidate, const char* path, size_t prefixLength, const char* suffix, size_t suffixLength, uint64_t* number) {
+	size_t length = strlen(candidate);
+	if (length <= prefixLength + suffixLength) return false;
+	if (memcmp(candidate, path, prefixLength) != 0 || memcmp(candidate + length - suffixLength, suffix, suffixLength) != 0) return false;
+	uint64_t value = 0;
+	for (size_t i = prefixLength; i < length - suffixLength; ++i) {
+		if (!isDigit(candidate[i])) return false;
+		value = value * 10 + (uint64_t)(candidate[i] - '0');
+	}
+	*number = value;
+	return true;
+}
+
+static int compareFrames(const void* a, const void* b) {
+	const SequenceFrame* fa = (const SequenceFrame*)a;
+	const SequenceFrame* fb = (const SequenceFrame*)b;
+	if (fa->number != fb->number) return fa->number < fb->number ? -1 : 1;
+	return fa->id < fb->id ? -1 : fa->id > fb->id;
+}
+
+// Every displayed image named like `id` with another number, in number order whatever the sort mode
+static bool findSequence(int id) {
+	ImageCatalog* catalog = &g_appState.images;
+	const char* path = ImageCatalog_path(catalog, id);
+	size_t prefixLength, digitsLength;
+	if (!splitNumbered(path, &prefixLength, &digitsLength)) return false;
+	const char* suffix = path + prefixLength + digitsLength;
+	size_t suffixLength = strlen(suffix);
+
+	SequenceFrame* found = (SequenceFrame*)malloc(sizeof(SequenceFrame) * (catalog->count ? catalog->count : 1));
+	if (!found) return false;
+	size_t count = 0;
+	for (size_t i = 0; i < catalog->count; ++i) {
+		uint32_t candidate = catalog->order[i];
+		uint64_t number;
+		if (frameNumber(ImageCatalog_path(catalog, (int)candidate), path, prefixLength, suffix, suffixLength, &number)) {
+			found[count++] = (SequenceFrame){ number, candidate };
+		}
+	}
+	uint32_t* frames = count >= 2 ? (uint32_t*)malloc(sizeof(uint32_t) * count) : NULL;
+	if (!frames) {
+		free(found);
+		return false;
+	}
+	qsort(found, count, sizeof(SequenceFrame), compareFrames);
+	for (size_t i = 0; i < count; ++i) {
+		frames[i] = found[i].id;
+		if (found[i].id == (uint32_t)id) flipbook.cursor = i;
+	}
+	free(found);
+	free(flipbook.frames);
+	flipbook.frames = frames;
+	flipbook.count = count;
+	return true;
+}
+
+// Multiples of the step from the first frame, so which frames are dropped does not depend on timing
+static size_t nextFrame(size_t frame) {
+	size_t next = (frame / (size_t)flipbook.step + 1) * (size_t)flipbook.step;
+	return next < flipbook.count ? next : 0;
+}
+
+static Uint64 frameNs(void) {
+	return (Uint64)(1e9 / flipbook.fps);
+}
+
+// As many frames as their textures fit in the budget, mipmaps included
+static int aheadCount(void) {
+	const ImageMetadata* img = &g_appState.images.items[flipbook.frames[flipbook.cursor]];
+	uint64_t bytes = (uint64_t)img->full_width * img->full_height * 16 / 3;
+	if (bytes == 0) return FLIPBOOK_MIN_AHEAD;
+	uint64_t ahead = FLIPBOOK_VRAM_BUDGET / bytes;
+	if (ahead > FLIPBOOK_MAX_AHEAD) return FLIPBOOK_MAX_AHEAD;
+	return ahead < FLIPBOOK_MIN_AHEAD ? FLIPBOOK_MIN_AHEAD : (int)ahead;
+}
+
+static void refreshWindow(void) {
+	int ahead = aheadCount();
+	flipbook.windowCount = 0;
+	flipbook.readaheadCount = 0;
+	flipbook.window[flipbook.windowCount++] = (int)flipbook.frames[flipbook.cursor];
+	size_t first = nextFrame(flipbook.cursor);
+	size_t frame = first;
+	for (int n = 0; n < ahead + READAHEAD_COUNT; ++n, frame = nextFrame(frame)) {
+		// The whole loop fits
+		if (frame == flipbook.cursor || (n > 0 && frame == first)) break;
+		int id = (int)flipbook.frames[frame];
+		if (g_appState.images.position[id] == IMAGE_REMOVED) continue;
+		if (n < ahead) flipbook.window[flipbook.windowCount++] = id;
+		else flipbook.readahead[flipbook.readaheadCount++] = id;
+	}
+}
+
+static void showFrame(size_t frame) {
+	flipbook.cursor = frame;
+	refreshWindow();
+	setCurrentImage((int)flipbook.frames[frame]);
+}
+
+static void setStep(int step, Uint64 now) {
+	flipbook.step = step;
+	flipbook.aheadSinceNs = 0;
+	flipbook.dueNs = now;
+	refreshWindow();
+	loader_request_load((int)flipbook.frames[flipbook.cursor]);
+	updateWindowTitle();
+}
+
+bool Flipbook_start(int id) {
+	if (id < 0 || !findSequence(id)) return false;
+	Uint64 now = SDL_GetTicksNS();
+	flipbook.active = true;
+	flipbook.playing = true;
+	flipbook.step = 1;
+	flipbook.dueNs = now + frameNs();
+	flipbook.aheadSinceNs = 0;
+	flipbook.shown = 0;
+	flipbook.measureStartNs = now;
+	flipbook.achievedFps = 0.0;
+	refreshWindow();
+	loader_request_load(id);
+	updateWindowTitle();
+	return true;
+}
+
+void Flipbook_stop(void) {
+	if (!flipbook.active) return;
+	flipbook.active = false;
+	free(flipbook.frames);
+	flipbook.frames = NULL;
+	flipbook.count = 0;
+	// Back to the neighbors of the image on screen
+	if (g_appState.currentIndex >= 0) loader_request_load(g_appState.currentIndex);
+	updateWindowTitle();
+}
+
+bool Flipbook_active(void) {
+	return flipbook.active;
+}
+
+void Flipbook_setFps(double fps) {
+	if (fps > 0.0) flipbook.fps = fps;
+}
+
+void Flipbook_togglePause(void) {
+	if (!flipbook.active) return;
+	flipbook.playing = !flipbook.playing;
+	Uint64 now = SDL_GetTicksNS();
+	flipbook.dueNs = now + frameNs() * (Uint64)flipbook.step;
+	flipbook.aheadSinceNs = 0;
+	flipbook.shown = 0;
+	flipbook.measureStartNs = now;
+	updateWindowTitle();
+}
+
+void Flipbook_stepFrames(int step) {
+	if (!flipbook.active) return;
+	flipbook.playing = false;
+	long long frame = ((long long)flipbook.cursor + step) % (long long)flipbook.count;
+	if (frame < 0) frame += (long long)flipbook.count;
+	showFrame((size_t)frame);
+	updateWindowTitle();
+}
+
+// The image on screen was changed by something else, playback follows it within the sequence
+static bool followCurrent(void) {
+	for (size_t i = 0; i < flipbook.count; ++i) {
+		if ((int)flipbook.frames[i] != g_appState.currentIndex) continue;
+		flipbook.cursor = i;
+		refreshWindow();
+		return true;
+	}
+	return false;
+}
+
+// A frame that failed to decode is skipped, waiting for it would stop playback for good
+static bool frameSkipped(int id) {
+	return g_appState.images.position[id] == IMAGE_REMOVED || g_appState.images.items[id].state == IMAGE_STATE_FAILED;
+}
+
+static bool windowDecoded(void) {
+	for (int i = 0; i < flipbook.windowCount; ++i) {
+		ImageState state = g_appState.images.items[flipbook.window[i]].state;
+		if (state != IMAGE_STATE_LOADED && state != IMAGE_STATE_FAILED) return false;
+	}
+	return true;
+}
+
+// Frames whose job found the loader's pending list full are UNLOADED again and asked for once more,
+// inside the window nothing else would unload or request them
+static void requestMissing(void) {
+	for (int i = 0; i < flipbook.windowCount; ++i) {
+		if (g_appState.images.items[flipbook.window[i]].state != IMAGE_STATE_UNLOADED) continue;
+		loader_request_load((int)flipbook.frames[flipbook.cursor]);
+		return;
+	}
+}
+
+void Flipbook_update(void) {
+	if (!flipbook.active) return;
+	if (g_appState.currentIndex != (int)flipbook.frames[flipbook.cursor] && !followCurrent()) {
+		// Navigated out of the sequence
+		Flipbook_stop();
+		return;
+	}
+	requestMissing();
+	if (!flipbook.playing) return;
+	Uint64 now = SDL_GetTicksNS();
+	if (now - flipbook.measureStartNs >= 1000000000) {
+		flipbook.achievedFps = flipbook.shown * 1e9 / (double)(now - flipbook.measureStartNs);
+		flipbook.shown = 0;
+		flipbook.measureStartNs = now;
+		updateWindowTitle();
+	}
+	// What is drawn now reaches the screen at the coming vblank, half a refresh away on average
+	Uint64 present = now + g_appState.refreshNs / 2;
+	if (present < flipbook.dueNs) return;
+
+	Uint64 slotNs = frameNs() * (Uint64)flipbook.step;
+	size_t next = nextFrame(flipbook.cursor);
+	for (size_t n = 0; n < flipbook.count && frameSkipped((int)flipbook.frames[next]); ++n) next = nextFrame(next);
+	if (g_appState.images.items[flipbook.frames[next]].state != IMAGE_STATE_LOADED) {
+		// Decoding cannot hold the rate, half as many frames are asked for from now on.
+		// The frame on screen stays up meanwhile, the schedule slips instead of catching up later.
+		if (present - flipbook.dueNs > FLIPBOOK_STALL_FRAMES * slotNs && flipbook.step < FLIPBOOK_MAX_STEP) {
+			setStep(flipbook.step * 2, present);
+		}
+		return;
+	}
+	// On time the schedule keeps its own pace, rounding to vblanks does not add up
+	flipbook.dueNs = present - flipbook.dueNs > slotNs ? present + slotNs : flipbook.dueNs + slotNs;
+	flipbook.shown++;
+	showFrame(next);
+
+	if (!windowDecoded()) {
+		flipbook.aheadSinceNs = 0;
+	} else if (flipbook.aheadSinceNs == 0) {
+		flipbook.aheadSinceNs = now;
+	} else if (flipbook.step > 1 && now - flipbook.aheadSinceNs > FLIPBOOK_RECOVER_NS) {
+		setStep(flipbook.step / 2, flipbook.dueNs);
+	}
+}
+
+int Flipbook_window(const int** ids) {
+	*ids = flipbook.window;
+	return flipbook.active ? flipbook.windowCount : 0;
+}
+
+int Flipbook_readahead(const int** ids) {
+	*ids = flipbook.readahead;
+	return flipbook.active ? flipbook.readaheadCount : 0;
+}
+
+bool Flipbook_inWindow(int id) {
+	for (int i = 0; i < flipbook.windowCount; ++i) {
+		if (flipbook.window[i] == id) return true;
+	}
+	return false;
+}
+
+void Flipbook_describe(char* text, size_t size) {
+	if (!flipbook.active) {
+		if (size > 0) text[0] = '\0';
+		return;
+	}
+	if (!flipbook.playing) {
+		snprintf(text, size, " | Flipbook paused at %zu/%zu", flipbook.cursor + 1, flipbook.count);
+	} else if (flipbook.step > 1) {
+		snprintf(text, size, " | Flipbook %.1f/%g fps, 1 of %d frames", flipbook.achievedFps, flipbook.fps, flipbook.step);
+	} else {
+		snprintf(text, size, " | Flipbook %.1f/%g fps", flipbook.achievedFps, flipbook.fps);
+	}
+}
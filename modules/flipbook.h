@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Numbered image sequences (shot_0001.png, shot_0002.png, ...) played back like video
+#define FLIPBOOK_DEFAULT_FPS 24.0
+#define FLIPBOOK_MIN_AHEAD 4
+#define FLIPBOOK_MAX_AHEAD 32 // frames decoded ahead of the one on screen
+#define FLIPBOOK_VRAM_BUDGET ((unsigned long long)1024 * 1024 * 1024) // what the frames ahead may take as textures
+#define FLIPBOOK_UPLOADS_PER_FRAME 2 // decoded frames uploaded per vblank, more at once would stall playback
+#define FLIPBOOK_MAX_STEP 8 // at most every 8th frame is shown when decoding cannot keep up
+#define FLIPBOOK_STALL_FRAMES 2 // frame slots missed in a row before every other frame is dropped
+#define FLIPBOOK_RECOVER_NS ((unsigned long long)3 * 1000 * 1000 * 1000) // decoder ahead this long before frames are dropped less
+
+// Finds the sequence `id` belongs to and starts playing it from there, false when it is not numbered
+bool Flipbook_start(int id);
+void Flipbook_stop(void);
+bool Flipbook_active(void);
+void Flipbook_setFps(double fps);
+void Flipbook_togglePause(void);
+// Pauses and moves by whole frames, for scrubbing
+void Flipbook_stepFrames(int step);
+// Moves to the frame due at the coming vblank once it is decoded, called once per rendered frame
+void Flipbook_update(void);
+
+// The frame on screen first, then the ones shown after it, for the loader to keep decoded
+int Flipbook_window(const int** ids);
+// Past the window, pulled into the page cache
+int Flipbook_readahead(const int** ids);
+bool Flipbook_inWindow(int id);
+// Playback state for the window title, empty while inactive
+void Flipbook_describe(char* text, size_t size);
@@ -0,0 +1,376 @@
+#include "gif_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GIF_LZW_CODES 4096
+
+// Composites one frame after the other onto a single canvas, nothing but the canvas is kept
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	int width, height;
+	uint32_t globalPalette[256]; // RGBA8 as it sits in memory
+	uint32_t localPalette[256];
+	int globalColors;
+	const uint32_t* palette; // of the last frame, global or local
+	int colors, transparent;
+	size_t firstBlock; // right after the global palette, where every loop starts over
+	size_t at;
+	uint32_t* canvas;
+	uint8_t* indices; // instead of the canvas when only the first frame is wanted as palette indices
+	bool uncovered; // indices the first frame left alone, with no palette entry free to make them transparent
+	uint32_t* previous; // canvas under the current frame when it is to be restored, packed to its rect
+	AnimRect disposeRect;
+	int disposal; // of the frame on the canvas
+	uint16_t prefix[GIF_LZW_CODES];
+	uint8_t suffix[GIF_LZW_CODES];
+	uint8_t stack[GIF_LZW_CODES + 1];
+} GifDecoder;
+
+// LZW codes straight out of the length-prefixed sub-blocks
+typedef struct {
+	const uint8_t* data;
+	size_t size, at, blockEnd;
+	bool done;
+	uint32_t bits;
+	int bitCount;
+} GifBitReader;
+
+// Places decoded indices on the canvas in frame order, interlaced frames arrive in four passes
+typedef struct {
+	uint32_t* canvas;
+	uint8_t* indices;
+	int canvasWidth, canvasHeight;
+	AnimRect frame;
+	const uint32_t* palette;
+	int colors, transparent;
+	bool interlaced;
+	int x, y, pass;
+	bool finished;
+} GifPixelWriter;
+
+static const int interlaceStart[4] = { 0, 4, 2, 1 };
+static const int interlaceStep[4] = { 8, 8, 4, 2 };
+
+static uint16_t le16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+static size_t skipSubBlocks(const uint8_t* data, size_t size, size_t at) {
+	while (at < size) {
+		uint8_t length = data[at++];
+		if (length == 0) break;
+		at += length;
+	}
+	return at < size ? at : size;
+}
+
+static void readPalette(uint32_t* palette, const uint8_t* rgb, int colors) {
+	for (int i = 0; i < colors; ++i) {
+		uint8_t rgba[4] = { rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2], 255 };
+		memcpy(&palette[i], rgba, 4);
+	}
+}
+
+static int readCode(GifBitReader* reader, int codeSize) {
+	while (reader->bitCount < codeSize) {
+		if (reader->at == reader->blockEnd) {
+			if (reader->done || reader->at >= reader->size) return -1;
+			uint8_t length = reader->data[reader->at++];
+			if (length == 0) {
+				reader->done = true;
+				return -1;
+			}
+			reader->blockEnd = reader->at + length;
+			if (reader->blockEnd > reader->size) reader->blockEnd = reader->size; // truncated file
+			continue;
+		}
+		reader->bits |= (uint32_t)reader->data[reader->at++] << reader->bitCount;
+		reader->bitCount += 8;
+	}
+	int code = (int)(reader->bits & ((1u << codeSize) - 1));
+	reader->bits >>= codeSize;
+	reader->bitCount -= codeSize;
+	return code;
+}
+
+static void writePixel(GifPixelWriter* writer, uint8_t index) {
+	int cx = writer->frame.x + writer->x, cy = writer->frame.y + writer->y;
+	if (index != writer->transparent && cx < writer->canvasWidth && cy < writer->canvasHeight) {
+		// Indices past the palette have a transparent entry in the palette texture
+		if (writer->indices) writer->indices[(size_t)cy * writer->canvasWidth + cx] = index;
+		else if (index < writer->colors) writer->canvas[(size_t)cy * writer->canvasWidth + cx] = writer->palette[index];
+	}
+	if (++writer->x < writer->frame.w) return;
+	writer->x = 0;
+	if (!writer->interlaced) {
+		writer->finished = ++writer->y >= writer->frame.h;
+		return;
+	}
+	writer->y += interlaceStep[writer->pass];
+	while (writer->y >= writer->frame.h && writer->pass < 3) {
+		writer->y = interlaceStart[++writer->pass];
+	}
+	writer->finished = writer->y >= writer->frame.h;
+}
+
+// Stops at the end code, at damage, or once the frame is full, whatever was decoded stays on the canvas
+static void decodeImageData(GifDecoder* dec, GifBitReader* reader, int minCodeSize, GifPixelWriter* writer) {
+	if (minCodeSize < 1 || minCodeSize > 11) return;
+	int clear = 1 << minCodeSize, end = clear + 1;
+	int codeSize = minCodeSize + 1, next = clear + 2, old = -1;
+	uint8_t first = 0;
+	for (int i = 0; i < clear; ++i) dec->suffix[i] = (uint8_t)i;
+	while (!writer->finished) {
+		int code = readCode(reader, codeSize);
+		if (code < 0 || code == end) break;
+		if (code == clear) {
+			codeSize = minCodeSize + 1;
+			next = clear + 2;
+			old = -1;
+			continue;
+		}
+		if (old < 0) {
+			if (code >= clear) break;
+			writePixel(writer, (uint8_t)code);
+			old = code;
+			first = (uint8_t)code;
+			continue;
+		}
+		int in = code;
+		size_t depth = 0;
+		if (code >= next) {
+			// The one code that may arrive before its entry exists: the previous string plus its first index
+			if (code > next) break;
+			dec->stack[depth++] = first;
+			code = old;
+		}
+		while (code >= clear) {
+			dec->stack[depth++] = dec->suffix[code];
+			code = dec->prefix[code];
+		}
+		first = (uint8_t)code;
+		dec->stack[depth++] = first;
+		if (next < GIF_LZW_CODES) {
+			dec->prefix[next] = (uint16_t)old;
+			dec->suffix[next] = first;
+			if (++next == (1 << codeSize) && codeSize < 12) ++codeSize;
+		}
+		old = in;
+		while (depth > 0 && !writer->finished) writePixel(writer, dec->stack[--depth]);
+	}
+}
+
+static AnimRect clipRect(const GifDecoder* dec, AnimRect rect) {
+	if (rect.x >= dec->width || rect.y >= dec->height) return (AnimRect){ 0, 0, 0, 0 };
+	if (rect.w > dec->width - rect.x) rect.w = dec->width - rect.x;
+	if (rect.h > dec->height - rect.y) rect.h = dec->height - rect.y;
+	if (rect.w <= 0 || rect.h <= 0) return (AnimRect){ 0, 0, 0, 0 };
+	return rect;
+}
+
+// Copies a rect between the canvas and a buffer packed to the rect
+static void copyRect(GifDecoder* dec, AnimRect rect, uint32_t* packed, bool toCanvas) {
+	for (int y = 0; y < rect.h; ++y) {
+		uint32_t* row = dec->canvas + (size_t)(rect.y + y) * dec->width + rect.x;
+		uint32_t* other = packed + (size_t)y * rect.w;
+		if (toCanvas) memcpy(row, other, (size_t)rect.w * 4);
+		else memcpy(other, row, (size_t)rect.w * 4);
+	}
+}
+
+// What the frame on the canvas leaves behind for the next one, the rect it touched
+static AnimRect disposeFrame(GifDecoder* dec) {
+	AnimRect rect = dec->disposeRect;
+	if (rect.w == 0) return rect;
+	if (dec->disposal == 2) {
+		for (int y = 0; y < rect.h; ++y) {
+			memset(dec->canvas + (size_t)(rect.y + y) * dec->width + rect.x, 0, (size_t)rect.w * 4);
+		}
+		return rect;
+	}
+	if (dec->disposal == 3 && dec->previous) {
+		copyRect(dec, rect, dec->previous, true);
+		return rect;
+	}
+	return (AnimRect){ 0, 0, 0, 0 };
+}
+
+static bool GifDecoder_init(GifDecoder* dec, const uint8_t* data, size_t size, bool indexed) {
+	memset(dec, 0, sizeof(*dec));
+	if (size < 13 || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0)) return false;
+	dec->data = data;
+	dec->size = size;
+	dec->width = le16(data + 6);
+	dec->height = le16(data + 8);
+	if (dec->width == 0 || dec->height == 0) return false;
+	size_t at = 13;
+	if (data[10] & 0x80) {
+		dec->globalColors = 2 << (data[10] & 7);
+		if (at + (size_t)dec->globalColors * 3 > size) return false;
+		readPalette(dec->globalPalette, data + at, dec->globalColors);
+		at += (size_t)dec->globalColors * 3;
+	}
+	dec->firstBlock = dec->at = at;
+	if (indexed) {
+		dec->indices = (uint8_t*)malloc((size_t)dec->width * dec->height);
+		return dec->indices != NULL;
+	}
+	dec->canvas = (uint32_t*)calloc((size_t)dec->width * dec->height, 4);
+	return dec->canvas != NULL;
+}
+
+static void GifDecoder_free(GifDecoder* dec) {
+	free(dec->canvas);
+	free(dec->indices);
+	free(dec->previous);
+	dec->canvas = dec->previous = NULL;
+	dec->indices = NULL;
+}
+
+// Back to the first frame on a cleared canvas
+static void GifDecoder_rewind(GifDecoder* dec) {
+	memset(dec->canvas, 0, (size_t)dec->width * dec->height * 4);
+	dec->at = dec->firstBlock;
+	dec->disposal = 0;
+	dec->disposeRect = (AnimRect){ 0, 0, 0, 0 };
+}
+
+// Composites the next frame onto the canvas, false at the trailer or at damage between frames
+static bool GifDecoder_next(GifDecoder* dec, AnimRect* dirty, int* delayMs) {
+	const uint8_t* data = dec->data;
+	size_t size = dec->size, at = dec->at;
+	int delay = 0, transparent = -1, disposal = 0;
+	while (at < size) {
+		uint8_t block = data[at++];
+		if (block == 0x21) {
+			if (at >= size) return false;
+			uint8_t label = data[at++];
+			// Graphics Control Extension, applies to the image that follows
+			if (label == 0xF9 && at + 5 <= size && data[at] >= 4) {
+				uint8_t flags = data[at + 1];
+				disposal = (flags >> 2) & 7;
+				delay = le16(data + at + 2) * 10;
+				transparent = (flags & 1) ? data[at + 4] : -1;
+			}
+			at = skipSubBlocks(data, size, at);
+			continue;
+		}
+		if (block != 0x2C || at + 9 > size) return false;
+		AnimRect rect = { le16(data + at), le16(data + at + 2), le16(data + at + 4), le16(data + at + 6) };
+		uint8_t flags = data[at + 8];
+		at += 9;
+		const uint32_t* palette = dec->globalPalette;
+		int colors = dec->globalColors;
+		if (flags & 0x80) {
+			colors = 2 << (flags & 7);
+			if (at + (size_t)colors * 3 > size) return false;
+			readPalette(dec->localPalette, data + at, colors);
+			palette = dec->localPalette;
+			at += (size_t)colors * 3;
+		}
+		if (at >= size) return false;
+		int minCodeSize = data[at++];
+
+		AnimRect disposed = disposeFrame(dec);
+		AnimRect drawn = clipRect(dec, rect);
+		if (dec->indices) {
+			// Only the first frame comes as indices, what it does not cover needs a transparent index
+			int clear = transparent >= 0 ? transparent : colors < 256 ? colors : 0;
+			bool covered = drawn.w == dec->width && drawn.h == dec->height;
+			dec->uncovered = !covered && transparent < 0 && colors >= 256;
+			memset(dec->indices, clear, (size_t)dec->width * dec->height);
+		} else if (disposal == 3 && drawn.w > 0) {
+			if (!dec->previous) dec->previous = (uint32_t*)malloc((size_t)dec->width * dec->height * 4);
+			if (dec->previous) copyRect(dec, drawn, dec->previous, false);
+		}
+		GifPixelWriter writer = {
+			.canvas = dec->canvas, .indices = dec->indices, .canvasWidth = dec->width, .canvasHeight = dec->height,
+			.frame = rect, .palette = palette, .colors = colors, .transparent = transparent,
+			.interlaced = (flags & 0x40) != 0, .finished = rect.w == 0 || rect.h == 0
+		};
+		GifBitReader reader = { .data = data, .size = size, .at = at, .blockEnd = at };
+		decodeImageData(dec, &reader, minCodeSize, &writer);
+		dec->at = reader.done ? reader.at : skipSubBlocks(data, size, reader.blockEnd);
+		dec->disposal = disposal;
+		dec->disposeRect = drawn;
+		dec->palette = palette;
+		dec->colors = colors;
+		dec->transparent = transparent;
+		*dirty = AnimRect_union(disposed, drawn);
+		*delayMs = delay;
+		return true;
+	}
+	return false;
+}
+
+unsigned char* loadImage_Gif(const FileSource* src, int* width, int* height, int* channels) {
+	GifDecoder* dec = (GifDecoder*)malloc(sizeof(GifDecoder));
+	if (!dec) return NULL;
+	unsigned char* pixels = NULL;
+	AnimRect dirty;
+	int delay;
+	if (!GifDecoder_init(dec, src->data, src->size, false) || !GifDecoder_next(dec, &dirty, &delay)) goto cleanup;
+	*width = dec->width;
+	*height = dec->height;
+	*channels = 4;
+	pixels = (unsigned char*)dec->canvas;
+	dec->canvas = NULL;
+
+cleanup:
+	GifDecoder_free(dec);
+	free(dec);
+	return pixels;
+}
+
+unsigned char* loadImage_GifIndexed(const FileSource* src, int* width, int* height, uint8_t* palette) {
+	GifDecoder* dec = (GifDecoder*)malloc(sizeof(GifDecoder));
+	if (!dec) return NULL;
+	unsigned char* indices = NULL;
+	AnimRect dirty;
+	int delay;
+	if (!GifDecoder_init(dec, src->data, src->size, true) || !GifDecoder_next(dec, &dirty, &delay) || dec->uncovered) goto cleanup;
+	// Entries past the frame's colors and the transparent one stay zero, fully transparent
+	memcpy(palette, dec->palette, (size_t)dec->colors * 4);
+	if (dec->transparent >= 0) memset(palette + dec->transparent * 4, 0, 4);
+	*width = dec->width;
+	*height = dec->height;
+	indices = dec->indices;
+	dec->indices = NULL;
+
+cleanup:
+	GifDecoder_free(dec);
+	free(dec);
+	return indices;
+}
+
+static void* gifOpen(const uint8_t* data, size_t size, int* width, int* height) {
+	GifDecoder* dec = (GifDecoder*)malloc(sizeof(GifDecoder));
+	if (!dec) return NULL;
+	if (!GifDecoder_init(dec, data, size, false)) {
+		GifDecoder_free(dec);
+		free(dec);
+		return NULL;
+	}
+	*width = dec->width;
+	*height = dec->height;
+	return dec;
+}
+
+static bool gifNext(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs) {
+	GifDecoder* dec = (GifDecoder*)decoder;
+	if (!GifDecoder_next(dec, dirty, delayMs)) return false;
+	*canvas = (const uint8_t*)dec->canvas;
+	return true;
+}
+
+static bool gifRewind(void* decoder) {
+	GifDecoder_rewind((GifDecoder*)decoder);
+	return true;
+}
+
+static void gifClose(void* decoder) {
+	GifDecoder_free((GifDecoder*)decoder);
+	free(decoder);
+}
+
+const AnimBackend AnimBackend_Gif = { gifOpen, gifNext, gifRewind, gifClose };
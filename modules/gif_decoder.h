@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include "file_source.h"
+#include "anim_stream.h"
+
+// Animated GIFs play through anim_stream.h, composited one frame after the other onto a single canvas
+extern const AnimBackend AnimBackend_Gif;
+
+// The first frame only, for GIFs that are not animated
+unsigned char* loadImage_Gif(const FileSource* src, int* width, int* height, int* channels);
+// The same as one palette index per pixel and the 256 RGBA8 entries of `palette`, zeroed by the caller.
+// NULL when the image cannot be shown that way.
+unsigned char* loadImage_GifIndexed(const FileSource* src, int* width, int* height, uint8_t* palette);
@@ -0,0 +1,246 @@
+#include "gpu_jpeg.h"
+#include "render.h"
+
+#include <SDL3/SDL.h>
+
+// Integer math in the same order and with the same constants as jidctint.c and jdsample.c of libjpeg-turbo,
+// floats would be off by one here and there
+#define GLSL_HEADER "#version 330 core\n"
+
+static const char* vertexSource =
+	GLSL_HEADER
+	// One triangle covering the viewport, no vertex buffer
+	"void main() {\n"
+	"vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+	"gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+	"}\n";
+
+#define GLSL_IDCT \
+	"int idct(int x[8], int n, int shift) {\n" \
+	"int z1 = (x[2] + x[6]) * 4433;\n" \
+	"int tmp2 = z1 - x[6] * 15137;\n" \
+	"int tmp3 = z1 + x[2] * 6270;\n" \
+	"int tmp0 = (x[0] + x[4]) << 13;\n" \
+	"int tmp1 = (x[0] - x[4]) << 13;\n" \
+	"int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3, tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;\n" \
+	"tmp0 = x[7]; tmp1 = x[5]; tmp2 = x[3]; tmp3 = x[1];\n" \
+	"z1 = tmp0 + tmp3;\n" \
+	"int z2 = tmp1 + tmp2, z3 = tmp0 + tmp2, z4 = tmp1 + tmp3;\n" \
+	"int z5 = (z3 + z4) * 9633;\n" \
+	"tmp0 *= 2446; tmp1 *= 16819; tmp2 *= 25172; tmp3 *= 12299;\n" \
+	"z1 *= -7373; z2 *= -20995; z3 *= -16069; z4 *= -3196;\n" \
+	"z3 += z5; z4 += z5;\n" \
+	"tmp0 += z1 + z3; tmp1 += z2 + z4; tmp2 += z2 + z3; tmp3 += z1 + z4;\n" \
+	"int y[8] = int[8](tmp10 + tmp3, tmp11 + tmp2, tmp12 + tmp1, tmp13 + tmp0,\n" \
+	"tmp13 - tmp0, tmp12 - tmp1, tmp11 - tmp2, tmp10 - tmp3);\n" \
+	"return (y[n] + (1 << (shift - 1))) >> shift;\n" \
+	"}\n"
+
+// Dequantization and the column pass, into the workspace at 2 extra bits of precision
+static const char* columnSource =
+	GLSL_HEADER
+	"uniform isampler2D coefficients;\n"
+	"uniform int quant[64];\n"
+	"out int workspace;\n"
+	GLSL_IDCT
+	"void main() {\n"
+	"ivec2 at = ivec2(gl_FragCoord.xy);\n"
+	"ivec2 block = at & ~7;\n"
+	"int u = at.x & 7;\n"
+	"int x[8];\n"
+	"for (int k = 0; k < 8; ++k) x[k] = texelFetch(coefficients, block + ivec2(u, k), 0).r * quant[k * 8 + u];\n"
+	"workspace = idct(x, at.y & 7, 11);\n"
+	"}\n";
+
+// The row pass and libjpeg's range limit, wrapping around like its table for garbage input
+static const char* rowSource =
+	GLSL_HEADER
+	"uniform isampler2D workspace;\n"
+	"out uint sampleValue;\n"
+	GLSL_IDCT
+	"void main() {\n"
+	"ivec2 at = ivec2(gl_FragCoord.xy);\n"
+	"ivec2 block = at & ~7;\n"
+	"int v = at.y & 7;\n"
+	"int x[8];\n"
+	"for (int k = 0; k < 8; ++k) x[k] = texelFetch(workspace, block + ivec2(k, v), 0).r;\n"
+	"int value = idct(x, at.x & 7, 18) & 1023;\n"
+	"if (value >= 512) value -= 1024;\n"
+	"sampleValue = uint(clamp(value + 128, 0, 255));\n"
+	"}\n";
+
+// Fancy upsampling, a triangle filter with libjpeg's alternating rounding, then its fixed point YCbCr to RGB
+static const char* colorSource =
+	GLSL_HEADER
+	"uniform usampler2D lumaPlane;\n"
+	"uniform usampler2D cbPlane;\n"
+	"uniform usampler2D crPlane;\n"
+	"uniform ivec2 cbUpsample, crUpsample;\n"
+	"uniform ivec2 cbSize, crSize;\n"
+	"uniform bool gray;\n"
+	"out vec4 color;\n"
+	"int fetch(usampler2D plane, ivec2 at) {\n"
+	"return int(texelFetch(plane, at, 0).r);\n"
+	"}\n"
+	"int chroma(usampler2D plane, ivec2 at, ivec2 upsample, ivec2 size) {\n"
+	"ivec2 i = at / upsample;\n"
+	"if (upsample == ivec2(1)) return fetch(plane, i);\n"
+	// Toward the neighbor on the side of the output sample, edges repeat
+	"ivec2 odd = at & (upsample - 1);\n"
+	"ivec2 n = clamp(i + odd * 2 - 1, ivec2(0), size - 1);\n"
+	"if (upsample.y == 1) return (3 * fetch(plane, i) + fetch(plane, ivec2(n.x, i.y)) + 1 + odd.x) >> 2;\n"
+	"if (upsample.x == 1) return (3 * fetch(plane, i) + fetch(plane, ivec2(i.x, n.y)) + 1 + odd.y) >> 2;\n"
+	"int here = 3 * fetch(plane, i) + fetch(plane, ivec2(i.x, n.y));\n"
+	"int there = 3 * fetch(plane, ivec2(n.x, i.y)) + fetch(plane, n);\n"
+	"return (3 * here + there + 8 - odd.x) >> 4;\n"
+	"}\n"
+	"void main() {\n"
+	"ivec2 at = ivec2(gl_FragCoord.xy);\n"
+	"int y = fetch(lumaPlane, at);\n"
+	"if (gray) {\n"
+	"color = vec4(vec3(float(y) / 255.0), 1.0);\n"
+	"return;\n"
+	"}\n"
+	"int cb = chroma(cbPlane, at, cbUpsample, cbSize) - 128;\n"
+	"int cr = chroma(crPlane, at, crUpsample, crSize) - 128;\n"
+	"ivec3 rgb = ivec3(y + ((91881 * cr + 32768) >> 16),\n"
+	"y + ((-22554 * cb + 32768 - 46802 * cr) >> 16),\n"
+	"y + ((116130 * cb + 32768) >> 16));\n"
+	"color = vec4(vec3(clamp(rgb, 0, 255)) / 255.0, 1.0);\n"
+	"}\n";
+
+static struct {
+	bool ready;
+	GLuint columnProgram, rowProgram, colorProgram;
+	GLint quantLoc;
+	GLint cbUpsampleLoc, crUpsampleLoc, cbSizeLoc, crSizeLoc, grayLoc;
+	GLuint vao, framebuffer;
+} gpuJpeg;
+
+static GLuint linkProgram(const char* fragmentSource) {
+	GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+	GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vs);
+	glAttachShader(program, fs);
+	glLinkProgram(program);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+	GLint linked;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+bool GpuJpeg_init(void) {
+	gpuJpeg.columnProgram = linkProgram(columnSource);
+	gpuJpeg.rowProgram = linkProgram(rowSource);
+	gpuJpeg.colorProgram = linkProgram(colorSource);
+	if (!gpuJpeg.columnProgram || !gpuJpeg.rowProgram || !gpuJpeg.colorProgram) {
+		SDL_Log("GPU JPEG decoding is not available, JPEGs are decoded on the CPU");
+		return false;
+	}
+	gpuJpeg.quantLoc = glGetUniformLocation(gpuJpeg.columnProgram, "quant");
+	gpuJpeg.cbUpsampleLoc = glGetUniformLocation(gpuJpeg.colorProgram, "cbUpsample");
+	gpuJpeg.crUpsampleLoc = glGetUniformLocation(gpuJpeg.colorProgram, "crUpsample");
+	gpuJpeg.cbSizeLoc = glGetUniformLocation(gpuJpeg.colorProgram, "cbSize");
+	gpuJpeg.crSizeLoc = glGetUniformLocation(gpuJpeg.colorProgram, "crSize");
+	gpuJpeg.grayLoc = glGetUniformLocation(gpuJpeg.colorProgram, "gray");
+	glUseProgram(gpuJpeg.colorProgram);
+	glUniform1i(glGetUniformLocation(gpuJpeg.colorProgram, "lumaPlane"), 0);
+	glUniform1i(glGetUniformLocation(gpuJpeg.colorProgram, "cbPlane"), 1);
+	glUniform1i(glGetUniformLocation(gpuJpeg.colorProgram, "crPlane"), 2);
+	glGenVertexArrays(1, &gpuJpeg.vao);
+	glGenFramebuffers(1, &gpuJpeg.framebuffer);
+	gpuJpeg.ready = true;
+	return true;
+}
+
+static GLuint integerTexture(GLint internalFormat, GLenum format, GLenum type, int width, int height, const void* data) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// Integer textures are incomplete with anything but nearest
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+	return texture;
+}
+
+static bool drawInto(GLuint texture, int width, int height) {
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) return false;
+	glViewport(0, 0, width, height);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	return true;
+}
+
+GLuint GpuJpeg_decode(const JpegCoefficients* coefficients, const int16_t* data, int width, int height) {
+	if (!gpuJpeg.ready) return 0;
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, gpuJpeg.framebuffer);
+	glBindVertexArray(gpuJpeg.vao);
+	glDisable(GL_BLEND);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLuint planes[3] = {0};
+	GLuint output = 0;
+	bool ok = true;
+	for (int c = 0; c < coefficients->components && ok; ++c) {
+		const JpegPlane* plane = &coefficients->planes[c];
+		int w = plane->blocksWide * 8, h = plane->blocksHigh * 8;
+		GLuint coefficientTexture = integerTexture(GL_R16I, GL_RED_INTEGER, GL_SHORT, w, h, data + plane->offset);
+		GLuint workspace = integerTexture(GL_R32I, GL_RED_INTEGER, GL_INT, w, h, NULL);
+		planes[c] = integerTexture(GL_R8UI, GL_RED_INTEGER, GL_UNSIGNED_BYTE, w, h, NULL);
+
+		GLint quant[64];
+		for (int k = 0; k < 64; ++k) quant[k] = plane->quant[k];
+		glUseProgram(gpuJpeg.columnProgram);
+		glUniform1iv(gpuJpeg.quantLoc, 64, quant);
+		glBindTexture(GL_TEXTURE_2D, coefficientTexture);
+		ok = drawInto(workspace, w, h);
+		glUseProgram(gpuJpeg.rowProgram);
+		glBindTexture(GL_TEXTURE_2D, workspace);
+		ok = ok && drawInto(planes[c], w, h);
+		glDeleteTextures(1, &coefficientTexture);
+		glDeleteTextures(1, &workspace);
+	}
+
+	if (ok) {
+		glGenTextures(1, &output);
+		glBindTexture(GL_TEXTURE_2D, output);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		bool gray = coefficients->components == 1;
+		glUseProgram(gpuJpeg.colorProgram);
+		glUniform1i(gpuJpeg.grayLoc, gray);
+		if (!gray) {
+			const JpegPlane* cb = &coefficients->planes[1];
+			const JpegPlane* cr = &coefficients->planes[2];
+			glUniform2i(gpuJpeg.cbUpsampleLoc, cb->upsampleX, cb->upsampleY);
+			glUniform2i(gpuJpeg.crUpsampleLoc, cr->upsampleX, cr->upsampleY);
+			glUniform2i(gpuJpeg.cbSizeLoc, cb->sampledWidth, cb->sampledHeight);
+			glUniform2i(gpuJpeg.crSizeLoc, cr->sampledWidth, cr->sampledHeight);
+		}
+		for (int c = 0; c < 3; ++c) {
+			glActiveTexture(GL_TEXTURE0 + c);
+			glBindTexture(GL_TEXTURE_2D, planes[gray ? 0 : c]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		if (!drawInto(output, width, height)) {
+			glDeleteTextures(1, &output);
+			output = 0;
+		}
+	}
+	glDeleteTextures(coefficients->components, planes);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	if (!output) SDL_Log("GPU JPEG decoding failed");
+	return output;
+}
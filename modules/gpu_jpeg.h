@@ -0,0 +1,14 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "glad.h"
+#include "image_loaders.h"
+
+// JPEG decoding split between CPU and GPU, turned on with SHARKPIX_GPU_JPEG=1.
+// libjpeg-turbo does the entropy decoding on the decode threads, fragment shader passes do dequantization,
+// IDCT, chroma upsampling and color conversion, matching its islow IDCT and fancy upsampling bit for bit.
+
+// Compiles the passes, main thread, false when the GPU cannot run them
+bool GpuJpeg_init(void);
+// RGBA8 texture of the decoded image without mipmaps, 0 on failure. Main thread, leaves the default framebuffer bound.
+GLuint GpuJpeg_decode(const JpegCoefficients* coefficients, const int16_t* data, int width, int height);
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "harvest.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <SDL3/SDL.h>
+
+#include "pipeline.h"
+#include "loader.h"
+
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct {
+	int id;
+	const char* path;
+	ImageProbe probe;
+	bool ok;
+} HarvestItem;
+
+static struct {
+	bool started;
+	atomic_bool stopping;
+	BoundedQueue input, results;
+	Stage stage;
+} harvest;
+
+// CPU and disk both go to the loader first, the idle I/O class only gets the disk when nobody else wants it
+static void lowerThreadPriority(void) {
+	static _Thread_local bool lowered;
+	if (lowered) return;
+	lowered = true;
+	SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+static bool probeFile(const char* path, ImageProbe* probe) {
+	bool ok = false;
+	uint8_t* buffer = NULL;
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+	if (fd < 0) fd = open(path, O_RDONLY | O_CLOEXEC); // O_NOATIME needs to own the file
+	if (fd < 0) goto cleanup;
+	ImageFormat hint = ImageFormat_fromName(path, strlen(path));
+	for (size_t size = HARVEST_HEADER_BYTES; size <= HARVEST_MAX_HEADER_BYTES; size *= 16) {
+		uint8_t* grown = (uint8_t*)realloc(buffer, size);
+		if (!grown) goto cleanup;
+		buffer = grown;
+		ssize_t n = pread(fd, buffer, size, 0);
+		if (n <= 0) goto cleanup;
+		ok = Probe_image(buffer, (size_t)n, hint, probe);
+		// A short read was the whole file, reading further would not help
+		if (ok || (size_t)n < size) break;
+	}
+
+cleanup:
+	free(buffer);
+	if (fd >= 0) close(fd);
+	return ok;
+}
+
+static void harvestStage(void* data) {
+	HarvestItem* item = (HarvestItem*)data;
+	lowerThreadPriority();
+	while (loader_busy() && !atomic_load(&harvest.stopping)) SDL_Delay(HARVEST_YIELD_MS);
+	if (!atomic_load(&harvest.stopping)) item->ok = probeFile(item->path, &item->probe);
+	if (!BoundedQueue_push(&harvest.results, item)) free(item);
+}
+
+void Harvester_start(void) {
+	memset(&harvest, 0, sizeof(harvest));
+	if (!BoundedQueue_init(&harvest.input, HARVEST_QUEUE_CAPACITY)) return;
+	if (!BoundedQueue_init(&harvest.results, HARVEST_QUEUE_CAPACITY)) {
+		BoundedQueue_destroy(&harvest.input);
+		return;
+	}
+	// Half the cores at most, the probes are mostly waiting on the disk anyway
+	int threads = SDL_GetNumLogicalCPUCores() / 2;
+	if (threads < 1) threads = 1;
+	if (threads > HARVEST_MAX_THREADS) threads = HARVEST_MAX_THREADS;
+	Stage_start(&harvest.stage, "Harvest", threads, &harvest.input, harvestStage);
+	harvest.started = true;
+}
+
+static void drainQueue(BoundedQueue* queue) {
+	void* item;
+	while (BoundedQueue_tryPop(queue, &item)) free(item);
+}
+
+void Harvester_stop(void) {
+	if (!harvest.started) return;
+	atomic_store(&harvest.stopping, true);
+	BoundedQueue_close(&harvest.input);
+	BoundedQueue_close(&harvest.results);
+	Stage_join(&harvest.stage);
+	drainQueue(&harvest.input);
+	drainQueue(&harvest.results);
+	BoundedQueue_destroy(&harvest.input);
+	BoundedQueue_destroy(&harvest.results);
+	harvest.started = false;
+}
+
+bool Harvester_submit(int id, const char* path) {
+	// Only the main thread pushes, so room seen here is still there for the push
+	if (!harvest.started || BoundedQueue_count(&harvest.input) >= HARVEST_QUEUE_CAPACITY) return false;
+	HarvestItem* item = (HarvestItem*)calloc(1, sizeof(HarvestItem));
+	if (!item) return false;
+	item->id = id;
+	item->path = path;
+	if (!BoundedQueue_push(&harvest.input, item)) {
+		free(item);
+		return false;
+	}
+	return true;
+}
+
+bool Harvester_poll(HarvestResult* result) {
+	void* data;
+	if (!harvest.started || !BoundedQueue_tryPop(&harvest.results, &data)) return false;
+	HarvestItem* item = (HarvestItem*)data;
+	result->id = item->id;
+	result->probe = item->probe;
+	result->ok = item->ok;
+	free(item);
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdbool.h>
+#include "probe.h"
+
+// Low-priority pass probing the header of every image in the list, in the background of browsing
+#define HARVEST_QUEUE_CAPACITY 64
+#define HARVEST_MAX_THREADS 4
+#define HARVEST_HEADER_BYTES ((size_t)64 * 1024) // EXIF and the frame header fit in this almost always
+#define HARVEST_MAX_HEADER_BYTES ((size_t)1024 * 1024) // read once more up to this when they do not
+#define HARVEST_YIELD_MS 10 // wait while the loader decodes what the user is looking at
+
+typedef struct {
+	int id;
+	ImageProbe probe;
+	bool ok;
+} HarvestResult;
+
+void Harvester_start(void);
+void Harvester_stop(void);
+// Queues a probe of `path`, which must stay valid until the result is polled.
+// False when the queue is full, never blocks.
+bool Harvester_submit(int id, const char* path);
+bool Harvester_poll(HarvestResult* result);
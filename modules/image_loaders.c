@@ -4,17 +4,201 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include <setjmp.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <SDL3/SDL.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 #include <webp/decode.h>
+#include <webp/demux.h>
+#include <avif/avif.h>
 #include <libheif/heif.h>
 #include <tiffio.h>
 #include <jxl/decode.h>
+#include <jxl/version.h>
 #include <spng.h>
 #include <jpeglib.h>
 
+// Entry points of each decoder library, resolved with dlsym the first time its format is decoded.
+// Only the headers are used at build time, nothing here is linked.
+#define SPNG_SYMBOLS(X) \
+	X(spng_ctx_new) X(spng_ctx_free) X(spng_set_crc_action) X(spng_set_png_buffer) X(spng_get_ihdr) \
+	X(spng_decoded_image_size) X(spng_decode_image) X(spng_get_row_info) X(spng_decode_row) \
+	X(spng_get_plte) X(spng_get_trns)
+#define JPEG_SYMBOLS(X) \
+	X(jpeg_std_error) X(jpeg_CreateDecompress) X(jpeg_mem_src) X(jpeg_read_header) \
+	X(jpeg_start_decompress) X(jpeg_read_scanlines) X(jpeg_read_raw_data) X(jpeg_read_coefficients) \
+	X(jpeg_finish_decompress) X(jpeg_destroy_decompress)
+#define WEBP_SYMBOLS(X) \
+	X(WebPGetFeaturesInternal) X(WebPDecodeRGBAInto) X(WebPDecodeRGBInto)
+// The Internal entry points are what the inline WebPAnimDecoderNew and OptionsInit wrap
+#define WEBP_DEMUX_SYMBOLS(X) \
+	X(WebPAnimDecoderOptionsInitInternal) X(WebPAnimDecoderNewInternal) X(WebPAnimDecoderGetInfo) \
+	X(WebPAnimDecoderGetNext) X(WebPAnimDecoderReset) X(WebPAnimDecoderDelete)
+#define HEIF_SYMBOLS(X) \
+	X(heif_context_alloc) X(heif_context_free) X(heif_context_read_from_memory_without_copy) \
+	X(heif_context_get_primary_image_handle) X(heif_decode_image) X(heif_image_get_width) \
+	X(heif_image_get_height) X(heif_image_get_plane_readonly) X(heif_image_release) X(heif_image_handle_release) \
+	X(heif_image_handle_has_alpha_channel) X(heif_image_handle_get_luma_bits_per_pixel) \
+	X(heif_image_handle_get_chroma_bits_per_pixel) X(heif_image_handle_get_nclx_color_profile) \
+	X(heif_nclx_color_profile_free) X(heif_image_get_colorspace) X(heif_image_get_chroma_format) \
+	X(heif_image_get_bits_per_pixel_range)
+#define TIFF_SYMBOLS(X) \
+	X(TIFFClientOpen) X(TIFFClose) X(TIFFGetField) X(TIFFGetFieldDefaulted) X(TIFFIsTiled) \
+	X(TIFFReadRGBAImage) X(TIFFReadRGBAStrip) X(TIFFReadRGBATile) X(TIFFReadScanline) X(TIFFScanlineSize) \
+	X(_TIFFmalloc) X(_TIFFfree)
+#define JXL_SYMBOLS(X) \
+	X(JxlDecoderCreate) X(JxlDecoderDestroy) X(JxlDecoderSubscribeEvents) X(JxlDecoderSetInput) \
+	X(JxlDecoderCloseInput) X(JxlDecoderProcessInput) X(JxlDecoderGetBasicInfo) \
+	X(JxlDecoderImageOutBufferSize) X(JxlDecoderSetImageOutBuffer) X(JxlDecoderRewind) X(JxlDecoderGetFrameHeader) \
+	X(JxlDecoderVersion) X(JxlDecoderGetColorAsEncodedProfile) X(JxlDecoderSetPreferredColorProfile)
+#define AVIF_SYMBOLS(X) \
+	X(avifDecoderCreate) X(avifDecoderDestroy) X(avifDecoderSetIOMemory) X(avifDecoderParse) \
+	X(avifDecoderNextImage) X(avifDecoderReset) X(avifRGBImageSetDefaults) X(avifImageYUVToRGB) X(avifVersion)
+
+#define DECLARE_SYMBOL(name) __typeof__(&name) name;
+#define SYMBOL_NAME(name) #name,
+#define CODEC_SYMBOL_TABLE(table, SYMBOLS) \
+	static struct { SYMBOLS(DECLARE_SYMBOL) } table; \
+	static const char* const table##Names[] = { SYMBOLS(SYMBOL_NAME) }; \
+	_Static_assert(sizeof(table) == sizeof(table##Names), #table " holds one pointer per name");
+
+CODEC_SYMBOL_TABLE(spngLib, SPNG_SYMBOLS)
+CODEC_SYMBOL_TABLE(jpegLib, JPEG_SYMBOLS)
+CODEC_SYMBOL_TABLE(webpLib, WEBP_SYMBOLS)
+CODEC_SYMBOL_TABLE(webpDemuxLib, WEBP_DEMUX_SYMBOLS)
+CODEC_SYMBOL_TABLE(heifLib, HEIF_SYMBOLS)
+CODEC_SYMBOL_TABLE(tiffLib, TIFF_SYMBOLS)
+CODEC_SYMBOL_TABLE(jxlLib, JXL_SYMBOLS)
+CODEC_SYMBOL_TABLE(avifLib, AVIF_SYMBOLS)
+
+#define CODEC_LIB_MAX_FILES 2
+#define SONAME_STR(x) #x
+#define SONAME(x) SONAME_STR(x)
+
+typedef struct {
+	const char* name;
+	const char* files[CODEC_LIB_MAX_FILES]; // the soname of the ABI the headers describe, an unversioned link only where there never was another
+	const char* const* symbols;
+	void** slots; // the table, filled in the order of `symbols`
+	size_t count;
+	bool (*compatible)(void); // runtime version check after the symbols resolved, NULL when the soname says it all
+} CodecLibInfo;
+
+#define CODEC_LIB_INFO(libName, table, check, ...) \
+	{ libName, { __VA_ARGS__ }, table##Names, (void**)&table, sizeof(table##Names) / sizeof(table##Names[0]), check }
+
+// Sonames follow from the version macros of the headers the build used, a library of another ABI
+// loads as missing and PNG and JPEG fall back to the built-in decoder instead of failing every file
+#if JPEG_LIB_VERSION >= 80
+#define JPEG_SONAME "libjpeg.so.8"
+#elif JPEG_LIB_VERSION >= 70
+#define JPEG_SONAME "libjpeg.so.7"
+#else
+#define JPEG_SONAME "libjpeg.so.62"
+#endif
+// 4.5.0 raised the soname from 5 to 6
+#if TIFFLIB_VERSION >= 20221213
+#define TIFF_SONAME "libtiff.so.6"
+#else
+#define TIFF_SONAME "libtiff.so.5"
+#endif
+// Every 0.x minor release is an ABI of its own
+#if JPEGXL_MAJOR_VERSION == 0
+#define JXL_SONAME "libjxl.so.0." SONAME(JPEGXL_MINOR_VERSION)
+#else
+#define JXL_SONAME "libjxl.so." SONAME(JPEGXL_MAJOR_VERSION)
+#endif
+// avifDecoder and avifRGBImage are read field by field, their layout changed with every soname
+#if AVIF_VERSION_MAJOR >= 1
+#define AVIF_SONAME "libavif.so.16"
+#elif AVIF_VERSION_MINOR == 11
+#define AVIF_SONAME "libavif.so.15"
+#elif AVIF_VERSION_MINOR == 10
+#define AVIF_SONAME "libavif.so.14"
+#else
+#define AVIF_SONAME "libavif.so.13"
+#endif
+
+// A distribution may patch the soname, the version the library reports settles it
+static bool jxlCompatible(void) {
+	uint32_t version = jxlLib.JxlDecoderVersion();
+	return version / 1000000 == JPEGXL_MAJOR_VERSION && (JPEGXL_MAJOR_VERSION > 0 || version / 1000 % 1000 == JPEGXL_MINOR_VERSION);
+}
+
+static bool avifCompatible(void) {
+	int major = 0, minor = 0;
+	if (sscanf(avifLib.avifVersion(), "%d.%d", &major, &minor) != 2) return false;
+	return major == AVIF_VERSION_MAJOR && (AVIF_VERSION_MAJOR > 0 || minor == AVIF_VERSION_MINOR);
+}
+
+static const CodecLibInfo codecLibs[CODEC_LIB_COUNT] = {
+	[CODEC_LIB_SPNG] = CODEC_LIB_INFO("libspng", spngLib, NULL, "libspng.so.0", "libspng.so"),
+	[CODEC_LIB_JPEG] = CODEC_LIB_INFO("libjpeg", jpegLib, NULL, JPEG_SONAME),
+	[CODEC_LIB_WEBP] = CODEC_LIB_INFO("libwebp", webpLib, NULL, "libwebp.so.7", "libwebp.so"),
+	[CODEC_LIB_WEBP_DEMUX] = CODEC_LIB_INFO("libwebpdemux", webpDemuxLib, NULL, "libwebpdemux.so.2", "libwebpdemux.so"),
+	[CODEC_LIB_HEIF] = CODEC_LIB_INFO("libheif", heifLib, NULL, "libheif.so.1", "libheif.so"),
+	[CODEC_LIB_TIFF] = CODEC_LIB_INFO("libtiff", tiffLib, NULL, TIFF_SONAME),
+	[CODEC_LIB_JXL]  = CODEC_LIB_INFO("libjxl", jxlLib, jxlCompatible, JXL_SONAME),
+	[CODEC_LIB_AVIF] = CODEC_LIB_INFO("libavif", avifLib, avifCompatible, AVIF_SONAME)
+};
+
+enum { CODEC_LIB_UNTRIED, CODEC_LIB_LOADED, CODEC_LIB_MISSING };
+
+static pthread_mutex_t codecLibMutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int codecLibState[CODEC_LIB_COUNT];
+
+static bool openCodecLib(const CodecLibInfo* info) {
+	Uint64 start = SDL_GetTicksNS();
+	void* handle = NULL;
+	const char* file = NULL;
+	for (int i = 0; i < CODEC_LIB_MAX_FILES && info->files[i] && !handle; ++i) {
+		file = info->files[i];
+		handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+	}
+	if (!handle) {
+		SDL_Log("%s is not installed, its formats are disabled", info->name);
+		return false;
+	}
+	for (size_t i = 0; i < info->count; ++i) {
+		void* symbol = dlsym(handle, info->symbols[i]);
+		if (!symbol) {
+			SDL_Log("%s has no %s, its formats are disabled", file, info->symbols[i]);
+			dlclose(handle);
+			return false;
+		}
+		// POSIX guarantees function pointers survive the trip through void*
+		info->slots[i] = symbol;
+	}
+	if (info->compatible && !info->compatible()) {
+		SDL_Log("%s is not the version SharkPix was built for, its formats are disabled", file);
+		dlclose(handle);
+		return false;
+	}
+	SDL_Log("Loaded %s in %.2f ms", file, (double)(SDL_GetTicksNS() - start) / 1e6);
+	return true;
+}
+
+bool CodecLib_load(CodecLib lib) {
+	if (lib <= CODEC_LIB_NONE || lib >= CODEC_LIB_COUNT) return true;
+	int state = atomic_load_explicit(&codecLibState[lib], memory_order_acquire);
+	if (state == CODEC_LIB_UNTRIED) {
+		// Decode threads asking at once wait for the one doing the load
+		pthread_mutex_lock(&codecLibMutex);
+		state = atomic_load_explicit(&codecLibState[lib], memory_order_relaxed);
+		if (state == CODEC_LIB_UNTRIED) {
+			state = openCodecLib(&codecLibs[lib]) ? CODEC_LIB_LOADED : CODEC_LIB_MISSING;
+			atomic_store_explicit(&codecLibState[lib], state, memory_order_release);
+		}
+		pthread_mutex_unlock(&codecLibMutex);
+	}
+	return state == CODEC_LIB_LOADED;
+}
+
 struct my_error_mgr {
 	struct jpeg_error_mgr pub;
 	jmp_buf setjmp_buffer;
@@ -25,168 +209,545 @@ static void my_error_exit(j_common_ptr cinfo) {
 	longjmp(myerr->setjmp_buffer, 1);
 }
 
-static uint8_t* readFileToBuffer(const char* path, size_t* size) {
-	FILE* f = fopen(path, "rb");
-	if (!f) {
-		// perror("readFileToBuffer: fopen"); // for debug
-		return NULL;
-	}
-	fseek(f, 0, SEEK_END);
-	long file_size_long = ftell(f);
-	if (file_size_long < 0) {
-		fclose(f);
-		return NULL;
-	}
-	*size = (size_t)file_size_long;
-	fseek(f, 0, SEEK_SET);
-	uint8_t* buffer = (uint8_t*)malloc(*size);
-	if (!buffer) {
-		fclose(f);
-		return NULL;
-	}
-	if (fread(buffer, 1, *size, f) != *size) {
-		free(buffer);
-		fclose(f);
-		return NULL;
+typedef struct {
+	const FileSource* src;
+	size_t pos;
+} TiffMemoryStream;
+
+static tmsize_t tiffRead(thandle_t handle, void* buffer, tmsize_t size) {
+	TiffMemoryStream* stream = (TiffMemoryStream*)handle;
+	size_t available = stream->src->size - stream->pos;
+	size_t n = (size_t)size < available ? (size_t)size : available;
+	memcpy(buffer, stream->src->data + stream->pos, n);
+	stream->pos += n;
+	return (tmsize_t)n;
+}
+
+static tmsize_t tiffWrite(thandle_t handle, void* buffer, tmsize_t size) {
+	(void)handle; (void)buffer; (void)size;
+	return -1;
+}
+
+static toff_t tiffSeek(thandle_t handle, toff_t offset, int whence) {
+	TiffMemoryStream* stream = (TiffMemoryStream*)handle;
+	uint64_t base = whence == SEEK_CUR ? stream->pos : whence == SEEK_END ? stream->src->size : 0;
+	uint64_t pos = base + offset;
+	if (pos > stream->src->size) return (toff_t)-1;
+	stream->pos = (size_t)pos;
+	return pos;
+}
+
+static int tiffClose(thandle_t handle) {
+	(void)handle;
+	return 0;
+}
+
+static toff_t tiffSize(thandle_t handle) {
+	return ((TiffMemoryStream*)handle)->src->size;
+}
+
+// Hands libtiff the mapping itself so strips are read in place
+static int tiffMap(thandle_t handle, void** base, toff_t* size) {
+	TiffMemoryStream* stream = (TiffMemoryStream*)handle;
+	*base = (void*)stream->src->data;
+	*size = stream->src->size;
+	return 1;
+}
+
+static void tiffUnmap(thandle_t handle, void* base, toff_t size) {
+	(void)handle; (void)base; (void)size;
+}
+
+static TIFF* openTiff(const FileSource* src, TiffMemoryStream* stream) {
+	stream->src = src;
+	stream->pos = 0;
+	return tiffLib.TIFFClientOpen("memory", "r", (thandle_t)stream,
+		tiffRead, tiffWrite, tiffSeek, tiffClose, tiffSize, tiffMap, tiffUnmap);
+}
+
+// Round to nearest, too large values and NaN become the largest finite half
+static uint16_t floatToHalf(float value) {
+	union { float f; uint32_t u; } bits = { value };
+	uint32_t sign = (bits.u >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits.u >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits.u & 0x7fffff;
+	if (exponent <= 0) {
+		if (exponent < -10) return (uint16_t)sign;
+		mantissa = (mantissa | 0x800000) >> (1 - exponent);
+		return (uint16_t)(sign | ((mantissa + 0x1000) >> 13));
 	}
-	fclose(f);
-	return buffer;
+	// A carry out of the mantissa moves into the exponent, which is still the right value
+	uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+	half += (mantissa >> 12) & 1;
+	if (exponent >= 31 || (half & 0x7fff) >= 0x7c00) half = sign | 0x7bff;
+	return (uint16_t)half;
 }
 
-unsigned char* loadImage_WebP(const char* path, int* width, int* height) {
-	size_t data_size = 0;
-	uint8_t* file_data = readFileToBuffer(path, &data_size);
-	if (!file_data) {
-		return NULL;
+static float halfToFloat(uint16_t half) {
+	int exponent = (half >> 10) & 0x1f;
+	float magnitude = exponent == 0 ? ldexpf((float)(half & 0x3ff), -24) : ldexpf((float)((half & 0x3ff) | 0x400), exponent - 25);
+	return half & 0x8000 ? -magnitude : magnitude;
+}
+
+// Brightest color sample, alpha left out. Positive finite halves order like their bit patterns.
+static float halfPeak(const uint16_t* pixels, size_t count, int channels) {
+	int colors = channels == 2 || channels == 4 ? channels - 1 : channels;
+	uint16_t peak = 0;
+	for (size_t i = 0; i < count; ++i, pixels += channels) {
+		for (int c = 0; c < colors; ++c) {
+			if (pixels[c] < 0x7c00 && pixels[c] > peak) peak = pixels[c];
+		}
 	}
-	if (!WebPGetInfo(file_data, data_size, width, height)) {
-		free(file_data);
+	return halfToFloat(peak);
+}
+
+unsigned char* loadImage_WebP(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_WEBP)) return NULL;
+	// WebPGetFeatures is an inline wrapper around the Internal entry point
+	WebPBitstreamFeatures features;
+	if (webpLib.WebPGetFeaturesInternal(src->data, src->size, &features, WEBP_DECODER_ABI_VERSION) != VP8_STATUS_OK) {
 		return NULL;
 	}
-	size_t image_size = (size_t)(*width) * (size_t)(*height) * 4;
+	*width = features.width;
+	*height = features.height;
+	*channels = features.has_alpha ? 4 : 3;
+	int stride = (*width) * (*channels);
+	size_t image_size = (size_t)stride * (size_t)(*height);
 	uint8_t* output_buffer = (uint8_t*)malloc(image_size);
 	if (!output_buffer) {
-		free(file_data);
 		return NULL;
 	}
-	if (!WebPDecodeRGBAInto(file_data, data_size, output_buffer, image_size, (*width) * 4)) {
+	uint8_t* decoded = features.has_alpha ?
+		webpLib.WebPDecodeRGBAInto(src->data, src->size, output_buffer, image_size, stride) :
+		webpLib.WebPDecodeRGBInto(src->data, src->size, output_buffer, image_size, stride);
+	if (!decoded) {
 		free(output_buffer);
 		output_buffer = NULL; // if error
 	}
-	free(file_data);
 	return output_buffer;
 }
 
-unsigned char* loadImage_HeifAvif(const char* path, int* width, int* height) {
-	struct heif_context* ctx = heif_context_alloc();
+unsigned char* loadImage_HeifAvif(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_HEIF)) return NULL;
+	struct heif_context* ctx = heifLib.heif_context_alloc();
 	if (!ctx) return NULL;
 	struct heif_image_handle* handle = NULL;
 	struct heif_image* img = NULL;
 	uint8_t* output_buffer = NULL;
 	struct heif_error err;
 
-	err = heif_context_read_from_file(ctx, path, NULL);
+	err = heifLib.heif_context_read_from_memory_without_copy(ctx, src->data, src->size, NULL);
 	if (err.code) goto cleanup;
 
-	err = heif_context_get_primary_image_handle(ctx, &handle);
+	err = heifLib.heif_context_get_primary_image_handle(ctx, &handle);
 	if (err.code) goto cleanup;
 
-	err = heif_decode_image(handle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA, NULL);
+	bool alpha = heifLib.heif_image_handle_has_alpha_channel(handle);
+	err = heifLib.heif_decode_image(handle, &img, heif_colorspace_RGB,
+		alpha ? heif_chroma_interleaved_RGBA : heif_chroma_interleaved_RGB, NULL);
 	if (err.code) goto cleanup;
+	*channels = alpha ? 4 : 3;
 
-	*width = heif_image_get_width(img, heif_channel_interleaved);
-	*height = heif_image_get_height(img, heif_channel_interleaved);
+	*width = heifLib.heif_image_get_width(img, heif_channel_interleaved);
+	*height = heifLib.heif_image_get_height(img, heif_channel_interleaved);
 	int stride;
-	const uint8_t* data = heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+	const uint8_t* data = heifLib.heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
 	if (!data) goto cleanup;
 
-	size_t tight_size = (size_t)(*width) * (size_t)(*height) * 4;
+	size_t row_bytes = (size_t)(*width) * (*channels);
+	size_t tight_size = row_bytes * (size_t)(*height);
 	output_buffer = (uint8_t*)malloc(tight_size);
 	if (!output_buffer) goto cleanup;
 
 	// If the stride is equal to the width in bytes,
 	// all data can be copied with a single memcpy call
-	if (stride == (*width) * 4) {
+	if ((size_t)stride == row_bytes) {
 		memcpy(output_buffer, data, tight_size);
 	} else {
 		// Otherwise, copy line by line, as before
 		const uint8_t* src_ptr = data;
 		uint8_t* dest_ptr = output_buffer;
 		for (int y = 0; y < *height; ++y) {
-			memcpy(dest_ptr, src_ptr, (size_t)(*width) * 4);
+			memcpy(dest_ptr, src_ptr, row_bytes);
 			src_ptr += stride;
-			dest_ptr += (*width) * 4;
+			dest_ptr += row_bytes;
 		}
 	}
 
 cleanup:
-	if (img) heif_image_release(img);
-	if (handle) heif_image_handle_release(handle);
-	if (ctx) heif_context_free(ctx);
+	if (img) heifLib.heif_image_release(img);
+	if (handle) heifLib.heif_image_handle_release(handle);
+	if (ctx) heifLib.heif_context_free(ctx);
 
 	return output_buffer;
 }
 
-unsigned char* loadImage_Tiff(const char* path, int* width, int* height) {
-	TIFF* tif = TIFFOpen(path, "r");
+// Plane sizes and offsets for planes stored one after another, returns the total size
+static size_t YuvLayout_pack(YuvLayout* layout, int width, int height, int chromaWidth, int chromaHeight) {
+	layout->width[0] = width;
+	layout->height[0] = height;
+	layout->width[1] = layout->width[2] = chromaWidth;
+	layout->height[1] = layout->height[2] = chromaHeight;
+	size_t offset = 0;
+	for (int p = 0; p < 3; ++p) {
+		layout->offset[p] = offset;
+		offset += (size_t)layout->width[p] * (size_t)layout->height[p];
+	}
+	return offset;
+}
+
+static YuvMatrix yuvMatrixFromNclx(int matrixCoefficients) {
+	switch (matrixCoefficients) {
+		case 1: return YUV_MATRIX_BT709;
+		case 9:
+		case 10: return YUV_MATRIX_BT2020;
+		default: return YUV_MATRIX_BT601; // 5 and 6, and what leaves it unspecified
+	}
+}
+
+unsigned char* loadImage_HeifAvifYuv(const FileSource* src, int* width, int* height, YuvLayout* layout) {
+	if (!CodecLib_load(CODEC_LIB_HEIF)) return NULL;
+	struct heif_context* ctx = heifLib.heif_context_alloc();
+	if (!ctx) return NULL;
+	struct heif_image_handle* handle = NULL;
+	struct heif_image* img = NULL;
+	struct heif_color_profile_nclx* nclx = NULL;
+	uint8_t* output_buffer = NULL;
+	struct heif_error err;
+
+	err = heifLib.heif_context_read_from_memory_without_copy(ctx, src->data, src->size, NULL);
+	if (err.code) goto cleanup;
+	err = heifLib.heif_context_get_primary_image_handle(ctx, &handle);
+	if (err.code) goto cleanup;
+	// Alpha, deep color and RGB coded images go through the RGB loader
+	if (heifLib.heif_image_handle_has_alpha_channel(handle) ||
+		heifLib.heif_image_handle_get_luma_bits_per_pixel(handle) != 8 ||
+		heifLib.heif_image_handle_get_chroma_bits_per_pixel(handle) != 8) goto cleanup;
+	// Without a profile libheif assumes full range BT.601
+	layout->matrix = YUV_MATRIX_BT601;
+	layout->fullRange = true;
+	err = heifLib.heif_image_handle_get_nclx_color_profile(handle, &nclx);
+	if (!err.code && nclx) {
+		if (nclx->matrix_coefficients == 0) goto cleanup;
+		layout->matrix = yuvMatrixFromNclx(nclx->matrix_coefficients);
+		layout->fullRange = nclx->full_range_flag != 0;
+	}
+
+	// Whatever the codec produced, no conversion or upsampling in libheif
+	err = heifLib.heif_decode_image(handle, &img, heif_colorspace_undefined, heif_chroma_undefined, NULL);
+	if (err.code) goto cleanup;
+	enum heif_chroma chroma = heifLib.heif_image_get_chroma_format(img);
+	if (heifLib.heif_image_get_colorspace(img) != heif_colorspace_YCbCr ||
+		(chroma != heif_chroma_420 && chroma != heif_chroma_422 && chroma != heif_chroma_444)) goto cleanup;
+
+	*width = heifLib.heif_image_get_width(img, heif_channel_Y);
+	*height = heifLib.heif_image_get_height(img, heif_channel_Y);
+	size_t size = YuvLayout_pack(layout, *width, *height,
+		heifLib.heif_image_get_width(img, heif_channel_Cb), heifLib.heif_image_get_height(img, heif_channel_Cb));
+	output_buffer = (uint8_t*)malloc(size);
+	if (!output_buffer) goto cleanup;
+
+	static const enum heif_channel planes[3] = {heif_channel_Y, heif_channel_Cb, heif_channel_Cr};
+	for (int p = 0; p < 3; ++p) {
+		int stride;
+		const uint8_t* data = heifLib.heif_image_get_plane_readonly(img, planes[p], &stride);
+		if (!data) {
+			free(output_buffer);
+			output_buffer = NULL;
+			goto cleanup;
+		}
+		uint8_t* dest = output_buffer + layout->offset[p];
+		for (int y = 0; y < layout->height[p]; ++y) {
+			memcpy(dest, data, (size_t)layout->width[p]);
+			data += stride;
+			dest += layout->width[p];
+		}
+	}
+
+cleanup:
+	if (nclx) heifLib.heif_nclx_color_profile_free(nclx);
+	if (img) heifLib.heif_image_release(img);
+	if (handle) heifLib.heif_image_handle_release(handle);
+	if (ctx) heifLib.heif_context_free(ctx);
+
+	return output_buffer;
+}
+
+// PQ (16) signal to linear light, 1.0 at the 203 nit reference white of BT.2408.
+// HLG (18) only goes through the inverse OETF, its OOTF needs the luminance of the whole pixel.
+static float hdrToLinear(int transfer, float signal) {
+	if (transfer == 16) {
+		float p = powf(signal, 1.0f / 78.84375f);
+		float nits = 10000.0f * powf(fmaxf(p - 0.8359375f, 0.0f) / (18.8515625f - 18.6875f * p), 1.0f / 0.1593017578125f);
+		return nits / 203.0f;
+	}
+	return signal <= 0.5f ? signal * signal / 3.0f : (expf((signal - 0.55991073f) / 0.17883277f) + 0.28466892f) / 12.0f;
+}
+
+// The rest of hdrToLinear on a whole pixel, then BT.2020 (9) primaries to BT.709
+static void hdrPixelToLinear(int transfer, int primaries, float* r, float* g, float* b) {
+	if (transfer == 18) {
+		// OOTF of a 1000 nit display on scene luminance, per channel it would shift the hue of bright colors
+		float ys = primaries == 9 ? 0.2627f * *r + 0.6780f * *g + 0.0593f * *b : 0.2126f * *r + 0.7152f * *g + 0.0722f * *b;
+		float gain = 1000.0f / 203.0f * powf(ys, 0.2f);
+		*r *= gain;
+		*g *= gain;
+		*b *= gain;
+	}
+	if (primaries == 9) {
+		// Colors outside BT.709 go negative and are clipped by the shader
+		float r709 = 1.6605f * *r - 0.5876f * *g - 0.0728f * *b;
+		float g709 = -0.1246f * *r + 1.1329f * *g - 0.0083f * *b;
+		float b709 = -0.0182f * *r - 0.1006f * *g + 1.1187f * *b;
+		*r = r709;
+		*g = g709;
+		*b = b709;
+	}
+}
+
+uint16_t* loadImage_HeifAvifDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format) {
+	if (!CodecLib_load(CODEC_LIB_HEIF)) return NULL;
+	struct heif_context* ctx = heifLib.heif_context_alloc();
+	if (!ctx) return NULL;
+	struct heif_image_handle* handle = NULL;
+	struct heif_image* img = NULL;
+	struct heif_color_profile_nclx* nclx = NULL;
+	uint16_t* output_buffer = NULL;
+	float* curve = NULL;
+	struct heif_error err;
+
+	err = heifLib.heif_context_read_from_memory_without_copy(ctx, src->data, src->size, NULL);
+	if (err.code) goto cleanup;
+	err = heifLib.heif_context_get_primary_image_handle(ctx, &handle);
+	if (err.code) goto cleanup;
+	if (heifLib.heif_image_handle_get_luma_bits_per_pixel(handle) <= 8) goto cleanup;
+	int transfer = 0, primaries = 0;
+	err = heifLib.heif_image_handle_get_nclx_color_profile(handle, &nclx);
+	if (!err.code && nclx) {
+		transfer = nclx->transfer_characteristics;
+		primaries = nclx->color_primaries;
+	}
+
+	bool alpha = heifLib.heif_image_handle_has_alpha_channel(handle);
+	err = heifLib.heif_decode_image(handle, &img, heif_colorspace_RGB,
+		alpha ? heif_chroma_interleaved_RRGGBBAA_LE : heif_chroma_interleaved_RRGGBB_LE, NULL);
+	if (err.code) goto cleanup;
+	int bits = heifLib.heif_image_get_bits_per_pixel_range(img, heif_channel_interleaved);
+	if (bits <= 8 || bits > 16) goto cleanup;
+	*channels = alpha ? 4 : 3;
+	*width = heifLib.heif_image_get_width(img, heif_channel_interleaved);
+	*height = heifLib.heif_image_get_height(img, heif_channel_interleaved);
+	int stride;
+	const uint8_t* data = heifLib.heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
+	if (!data) goto cleanup;
+
+	// PQ and HLG carry brightness past SDR white and are linearized, the rest is stretched to 16 bits
+	bool hdr = transfer == 16 || transfer == 18;
+	uint32_t max = (1u << bits) - 1;
+	if (hdr) {
+		curve = (float*)malloc(sizeof(float) * (max + 1));
+		if (!curve) goto cleanup;
+		for (uint32_t code = 0; code <= max; ++code) curve[code] = hdrToLinear(transfer, (float)code / (float)max);
+	}
+	size_t pixels = (size_t)(*width) * (size_t)(*height);
+	output_buffer = (uint16_t*)malloc(pixels * (size_t)(*channels) * sizeof(uint16_t));
+	if (!output_buffer) goto cleanup;
+	uint16_t* out = output_buffer;
+	for (int y = 0; y < *height; ++y) {
+		const uint8_t* p = data + (size_t)y * stride;
+		for (int x = 0; x < *width; ++x, out += *channels) {
+			uint32_t code[4];
+			for (int c = 0; c < *channels; ++c, p += 2) {
+				code[c] = (uint32_t)p[0] | (uint32_t)p[1] << 8;
+				if (code[c] > max) code[c] = max;
+			}
+			if (!hdr) {
+				for (int c = 0; c < *channels; ++c) out[c] = (uint16_t)((code[c] * 65535u + max / 2) / max);
+				continue;
+			}
+			float r = curve[code[0]], g = curve[code[1]], b = curve[code[2]];
+			hdrPixelToLinear(transfer, primaries, &r, &g, &b);
+			out[0] = floatToHalf(r);
+			out[1] = floatToHalf(g);
+			out[2] = floatToHalf(b);
+			if (alpha) out[3] = floatToHalf((float)code[3] / (float)max);
+		}
+	}
+	format->sample = hdr ? SAMPLE_FLOAT16 : SAMPLE_UINT16;
+	format->peak = hdr ? halfPeak(output_buffer, pixels, *channels) : 1.0f;
+
+cleanup:
+	free(curve);
+	if (nclx) heifLib.heif_nclx_color_profile_free(nclx);
+	if (img) heifLib.heif_image_release(img);
+	if (handle) heifLib.heif_image_handle_release(handle);
+	if (ctx) heifLib.heif_context_free(ctx);
+
+	return output_buffer;
+}
+
+unsigned char* loadImage_Tiff(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_TIFF)) return NULL;
+	TiffMemoryStream stream;
+	TIFF* tif = openTiff(src, &stream);
 	if (!tif) return NULL;
 
 	uint32_t* raster = NULL;
 	uint8_t* output_buffer = NULL;
 
-	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, width);
-	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, height);
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, width);
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGELENGTH, height);
 
 	uint32_t npixels = (uint32_t)(*width) * (uint32_t)(*height);
 
-	raster = (uint32_t*)_TIFFmalloc(npixels * sizeof(uint32_t));
+	raster = (uint32_t*)tiffLib._TIFFmalloc(npixels * sizeof(uint32_t));
 	if (!raster) goto cleanup;
 
-	if (!TIFFReadRGBAImage(tif, *width, *height, raster, 0)) {
+	if (!tiffLib.TIFFReadRGBAImage(tif, *width, *height, raster, 0)) {
 		goto cleanup;
 	}
 
-	size_t image_size = (size_t)npixels * 4;
-	output_buffer = (uint8_t*)malloc(image_size);
+	// libtiff expands everything to RGBA, bilevel and gray scans are packed back to what they hold
+	uint16_t photometric = PHOTOMETRIC_RGB, extra_count = 0;
+	uint16_t* extra_types;
+	tiffLib.TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_EXTRASAMPLES, &extra_count, &extra_types);
+	int colors = photometric == PHOTOMETRIC_MINISBLACK || photometric == PHOTOMETRIC_MINISWHITE ? 1 : 3;
+	*channels = colors + (extra_count > 0 ? 1 : 0);
+
+	const size_t raster_row = (size_t)(*width) * 4;
+	const size_t row_bytes = (size_t)(*width) * (*channels);
+	output_buffer = (uint8_t*)malloc(row_bytes * (size_t)(*height));
 	if (!output_buffer) goto cleanup;
-	const size_t row_bytes = (size_t)(*width) * 4;
-	uint8_t* src_row = (uint8_t*)raster + image_size - row_bytes;
+	const uint8_t* src_row = (const uint8_t*)raster + raster_row * (size_t)(*height - 1);
 	uint8_t* dest_row = output_buffer;
 
 	for (int y = 0; y < *height; ++y) {
-		memcpy(dest_row, src_row, row_bytes);
+		if (*channels == 4) {
+			memcpy(dest_row, src_row, row_bytes);
+		} else {
+			uint8_t* out = dest_row;
+			for (int x = 0; x < *width; ++x) {
+				const uint8_t* pixel = src_row + (size_t)x * 4;
+				for (int c = 0; c < colors; ++c) *out++ = pixel[c];
+				if (extra_count > 0) *out++ = pixel[3];
+			}
+		}
 		dest_row += row_bytes;
-		src_row -= row_bytes;
+		src_row -= raster_row;
 	}
 
 cleanup:
-	if (raster) _TIFFfree(raster);
-	TIFFClose(tif);
+	if (raster) tiffLib._TIFFfree(raster);
+	tiffLib.TIFFClose(tif);
 	return output_buffer;
 }
 
-unsigned char* loadImage_Jxl(const char* path, int* width, int* height) {
-	size_t file_size = 0;
-	uint8_t* file_data = readFileToBuffer(path, &file_size);
-	if (!file_data) return NULL;
+// Divides associated alpha back out of a 16-bit pixel, colors of fully transparent pixels stay 0
+static void unpremultiply(uint16_t* pixel, int colors, bool half) {
+	if (half) {
+		float alpha = halfToFloat(pixel[colors]);
+		if (alpha <= 0.0f) return;
+		for (int c = 0; c < colors; ++c) pixel[c] = floatToHalf(halfToFloat(pixel[c]) / alpha);
+		return;
+	}
+	uint32_t alpha = pixel[colors];
+	if (alpha == 0) return;
+	for (int c = 0; c < colors; ++c) {
+		uint32_t value = ((uint32_t)pixel[c] * 65535u + alpha / 2) / alpha;
+		pixel[c] = (uint16_t)(value > 65535u ? 65535u : value);
+	}
+}
+
+uint16_t* loadImage_TiffDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format) {
+	if (!CodecLib_load(CODEC_LIB_TIFF)) return NULL;
+	TiffMemoryStream stream;
+	TIFF* tif = openTiff(src, &stream);
+	if (!tif) return NULL;
+
+	uint16_t* output_buffer = NULL;
+	uint8_t* scanline = NULL;
+	uint16_t bits = 8, sample_format = SAMPLEFORMAT_UINT, samples = 1, planar = PLANARCONFIG_CONTIG, photometric = PHOTOMETRIC_RGB;
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &sample_format);
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+	tiffLib.TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric);
+	bool is_float = sample_format == SAMPLEFORMAT_IEEEFP;
+	// 16-bit integers and 16 or 32-bit floats in strips, the rest goes through TIFFReadRGBAImage
+	if ((is_float ? (bits != 16 && bits != 32) : (bits != 16 || sample_format != SAMPLEFORMAT_UINT)) ||
+		planar != PLANARCONFIG_CONTIG || tiffLib.TIFFIsTiled(tif)) goto cleanup;
+	int colors = photometric == PHOTOMETRIC_MINISBLACK || photometric == PHOTOMETRIC_MINISWHITE ? 1 :
+		photometric == PHOTOMETRIC_RGB ? 3 : 0;
+	if (colors == 0 || samples < colors) goto cleanup;
+	// The first extra sample is taken as alpha, like the 8-bit path does
+	*channels = colors + (samples > colors ? 1 : 0);
+	uint16_t extra_count = 0, orientation = ORIENTATION_TOPLEFT;
+	uint16_t* extra_types = NULL;
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_EXTRASAMPLES, &extra_count, &extra_types);
+	tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &orientation);
+	bool associated = samples > colors && extra_count > 0 && extra_types && extra_types[0] == EXTRASAMPLE_ASSOCALPHA;
+	// Flipped like TIFFReadRGBAImage does, which also leaves the transposed orientations 5-8 unrotated
+	bool flip_x = orientation == 2 || orientation == 3 || orientation == 6 || orientation == 7;
+	bool flip_y = orientation == 3 || orientation == 4 || orientation == 7 || orientation == 8;
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, width);
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGELENGTH, height);
 
-	JxlDecoder* dec = JxlDecoderCreate(NULL);
+	size_t pixels = (size_t)(*width) * (size_t)(*height);
+	output_buffer = (uint16_t*)malloc(pixels * (size_t)(*channels) * sizeof(uint16_t));
+	scanline = (uint8_t*)malloc((size_t)tiffLib.TIFFScanlineSize(tif));
+	if (!output_buffer || !scanline) goto fail;
+	for (int y = 0; y < *height; ++y) {
+		if (tiffLib.TIFFReadScanline(tif, scanline, (uint32_t)y, 0) < 0) goto fail;
+		uint16_t* row = output_buffer + (size_t)(flip_y ? *height - 1 - y : y) * (size_t)(*width) * (size_t)(*channels);
+		for (int x = 0; x < *width; ++x) {
+			uint16_t* out = row + (size_t)(flip_x ? *width - 1 - x : x) * (size_t)(*channels);
+			size_t at = (size_t)x * samples;
+			for (int c = 0; c < *channels; ++c) {
+				size_t s = at + (size_t)(c < colors ? c : colors);
+				if (bits == 32) {
+					out[c] = floatToHalf(((const float*)scanline)[s]);
+				} else {
+					uint16_t value = ((const uint16_t*)scanline)[s];
+					out[c] = !is_float && photometric == PHOTOMETRIC_MINISWHITE && c < colors ? (uint16_t)(65535 - value) : value;
+				}
+			}
+			if (associated) unpremultiply(out, colors, is_float);
+		}
+	}
+	// Float TIFFs are scene-referred linear light
+	format->sample = is_float ? SAMPLE_FLOAT16 : SAMPLE_UINT16;
+	format->peak = is_float ? halfPeak(output_buffer, pixels, *channels) : 1.0f;
+	goto cleanup;
+
+fail:
+	free(output_buffer);
+	output_buffer = NULL;
+cleanup:
+	free(scanline);
+	tiffLib.TIFFClose(tif);
+	return output_buffer;
+}
+
+unsigned char* loadImage_Jxl(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_JXL)) return NULL;
+	JxlDecoder* dec = jxlLib.JxlDecoderCreate(NULL);
 	if (!dec) {
-		free(file_data);
 		return NULL;
 	}
 	
 	uint8_t* output_buffer = NULL;
+	JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
 	
-	if (JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+	if (jxlLib.JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
 		goto cleanup;
 	}
 	
-	JxlDecoderSetInput(dec, file_data, file_size);
-	JxlDecoderCloseInput(dec);
+	jxlLib.JxlDecoderSetInput(dec, src->data, src->size);
+	jxlLib.JxlDecoderCloseInput(dec);
 
 	for (;;) {
-		JxlDecoderStatus status = JxlDecoderProcessInput(dec);
+		JxlDecoderStatus status = jxlLib.JxlDecoderProcessInput(dec);
 		switch (status) {
 		case JXL_DEC_ERROR:
 			free(output_buffer);
@@ -196,24 +757,26 @@ unsigned char* loadImage_Jxl(const char* path, int* width, int* height) {
 			goto cleanup;
 		case JXL_DEC_BASIC_INFO: {
 			JxlBasicInfo info;
-			if (JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS) {
+			if (jxlLib.JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS) {
 				goto cleanup;
 			}
 			*width = info.xsize;
 			*height = info.ysize;
+			// Gray and gray with alpha come out as they are stored
+			format.num_channels = (info.num_color_channels == 1 ? 1 : 3) + (info.alpha_bits > 0 ? 1 : 0);
+			*channels = (int)format.num_channels;
 			break;
 		}
 		case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
 			size_t buffer_size;
-			JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
-			if (JxlDecoderImageOutBufferSize(dec, &format, &buffer_size) != JXL_DEC_SUCCESS) {
+			if (jxlLib.JxlDecoderImageOutBufferSize(dec, &format, &buffer_size) != JXL_DEC_SUCCESS) {
 				goto cleanup;
 			}
 			output_buffer = (uint8_t*)malloc(buffer_size);
 			if (!output_buffer) {
 				goto cleanup;
 			}
-			if (JxlDecoderSetImageOutBuffer(dec, &format, output_buffer, buffer_size) != JXL_DEC_SUCCESS) {
+			if (jxlLib.JxlDecoderSetImageOutBuffer(dec, &format, output_buffer, buffer_size) != JXL_DEC_SUCCESS) {
 				free(output_buffer);
 				output_buffer = NULL;
 				goto cleanup;
@@ -228,73 +791,326 @@ unsigned char* loadImage_Jxl(const char* path, int* width, int* height) {
 	}
 
 cleanup:
-	JxlDecoderDestroy(dec);
-	free(file_data);
+	jxlLib.JxlDecoderDestroy(dec);
 	return output_buffer;
 }
 
-unsigned char* loadImage_SPNG(const char* path, int* width, int* height) {
-	FILE* f = fopen(path, "rb");
-	if (!f) return NULL;
-	spng_ctx* ctx = spng_ctx_new(0);
+// libjxl 0.9 dropped the unused pixel format argument
+#if JPEGXL_MAJOR_VERSION == 0 && JPEGXL_MINOR_VERSION < 9
+#define JXL_ENCODED_PROFILE(dec, target, encoding) jxlLib.JxlDecoderGetColorAsEncodedProfile(dec, NULL, target, encoding)
+#else
+#define JXL_ENCODED_PROFILE(dec, target, encoding) jxlLib.JxlDecoderGetColorAsEncodedProfile(dec, target, encoding)
+#endif
+
+uint16_t* loadImage_JxlDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format) {
+	if (!CodecLib_load(CODEC_LIB_JXL)) return NULL;
+	JxlDecoder* dec = jxlLib.JxlDecoderCreate(NULL);
+	if (!dec) {
+		return NULL;
+	}
+
+	uint16_t* output_buffer = NULL;
+	size_t buffer_size = 0;
+	JxlPixelFormat pixel_format = {4, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+	JxlBasicInfo info;
+	// PQ (16) or HLG (18), linearized by libjxl or, where it cannot convert without a CMS, afterwards
+	int transfer = 0, primaries = 0;
+	bool linearized = false;
+
+	if (jxlLib.JxlDecoderSubscribeEvents(dec, JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+		goto cleanup;
+	}
+
+	jxlLib.JxlDecoderSetInput(dec, src->data, src->size);
+	jxlLib.JxlDecoderCloseInput(dec);
+
+	for (;;) {
+		JxlDecoderStatus status = jxlLib.JxlDecoderProcessInput(dec);
+		switch (status) {
+		case JXL_DEC_ERROR:
+			free(output_buffer);
+			output_buffer = NULL;
+			goto cleanup;
+		case JXL_DEC_SUCCESS:
+			goto done;
+		case JXL_DEC_BASIC_INFO: {
+			if (jxlLib.JxlDecoderGetBasicInfo(dec, &info) != JXL_DEC_SUCCESS) {
+				goto cleanup;
+			}
+			*width = info.xsize;
+			*height = info.ysize;
+			pixel_format.num_channels = (info.num_color_channels == 1 ? 1 : 3) + (info.alpha_bits > 0 ? 1 : 0);
+			// libjxl hands out float samples in linear light, integers stay display-referred
+			pixel_format.data_type = info.exponent_bits_per_sample > 0 ? JXL_TYPE_FLOAT16 : JXL_TYPE_UINT16;
+			*channels = (int)pixel_format.num_channels;
+			break;
+		}
+		case JXL_DEC_COLOR_ENCODING: {
+			JxlColorEncoding encoding;
+			if (JXL_ENCODED_PROFILE(dec, JXL_COLOR_PROFILE_TARGET_ORIGINAL, &encoding) == JXL_DEC_SUCCESS &&
+				(encoding.transfer_function == JXL_TRANSFER_FUNCTION_PQ || encoding.transfer_function == JXL_TRANSFER_FUNCTION_HLG)) {
+				transfer = (int)encoding.transfer_function;
+				primaries = (int)encoding.primaries;
+			}
+			// HDR is worth the float path at any bit depth
+			if (!transfer && info.bits_per_sample <= 8) {
+				goto cleanup;
+			}
+			if (transfer) {
+				pixel_format.data_type = JXL_TYPE_FLOAT16;
+				JxlColorEncoding linear = {0};
+				linear.color_space = info.num_color_channels == 1 ? JXL_COLOR_SPACE_GRAY : JXL_COLOR_SPACE_RGB;
+				linear.white_point = JXL_WHITE_POINT_D65;
+				linear.primaries = JXL_PRIMARIES_SRGB;
+				linear.transfer_function = JXL_TRANSFER_FUNCTION_LINEAR;
+				linear.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
+				JxlColorEncoding data;
+				linearized = jxlLib.JxlDecoderSetPreferredColorProfile(dec, &linear) == JXL_DEC_SUCCESS &&
+					JXL_ENCODED_PROFILE(dec, JXL_COLOR_PROFILE_TARGET_DATA, &data) == JXL_DEC_SUCCESS &&
+					data.transfer_function == JXL_TRANSFER_FUNCTION_LINEAR;
+			}
+			break;
+		}
+		case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
+			if (jxlLib.JxlDecoderImageOutBufferSize(dec, &pixel_format, &buffer_size) != JXL_DEC_SUCCESS) {
+				goto cleanup;
+			}
+			output_buffer = (uint16_t*)malloc(buffer_size);
+			if (!output_buffer) {
+				goto cleanup;
+			}
+			if (jxlLib.JxlDecoderSetImageOutBuffer(dec, &pixel_format, output_buffer, buffer_size) != JXL_DEC_SUCCESS) {
+				free(output_buffer);
+				output_buffer = NULL;
+				goto cleanup;
+			}
+			break;
+		}
+		case JXL_DEC_FULL_IMAGE:
+			break;
+		default:
+			goto cleanup;
+		}
+	}
+
+done:
+	if (output_buffer && transfer) {
+		// Linear output has 1.0 at the intensity target, the shader wants it at the 203 nit reference white
+		float scale = info.intensity_target > 0.0f ? info.intensity_target / 203.0f : 1.0f;
+		int colors = info.num_color_channels == 1 ? 1 : 3;
+		uint16_t* p = output_buffer;
+		for (size_t i = (size_t)(*width) * (size_t)(*height); i > 0; --i, p += *channels) {
+			float rgb[3];
+			for (int c = 0; c < 3; ++c) {
+				float value = halfToFloat(p[c < colors ? c : 0]);
+				rgb[c] = linearized ? value * scale : hdrToLinear(transfer, fmaxf(value, 0.0f));
+			}
+			if (!linearized) hdrPixelToLinear(transfer, primaries, &rgb[0], &rgb[1], &rgb[2]);
+			for (int c = 0; c < colors; ++c) p[c] = floatToHalf(rgb[c]);
+		}
+	}
+	if (output_buffer) {
+		bool is_float = pixel_format.data_type == JXL_TYPE_FLOAT16;
+		format->sample = is_float ? SAMPLE_FLOAT16 : SAMPLE_UINT16;
+		format->peak = is_float ? halfPeak(output_buffer, (size_t)(*width) * (size_t)(*height), *channels) : 1.0f;
+	}
+cleanup:
+	jxlLib.JxlDecoderDestroy(dec);
+	return output_buffer;
+}
+
+unsigned char* loadImage_SPNG(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_SPNG)) return NULL;
+	spng_ctx* ctx = spngLib.spng_ctx_new(0);
 	uint8_t* output_buffer = NULL;
 
 	if (!ctx) {
-		fclose(f);
 		return NULL;
 	}
 	
-	spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
-	spng_set_png_file(ctx, f);
+	spngLib.spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
+	spngLib.spng_set_png_buffer(ctx, src->data, src->size);
 
 	struct spng_ihdr ihdr;
-	if (spng_get_ihdr(ctx, &ihdr)) goto cleanup;
+	if (spngLib.spng_get_ihdr(ctx, &ihdr)) goto cleanup;
+
+	// The layout stored in the file, tRNS and 16-bit gray take the RGBA8 path
+	int format = SPNG_FMT_RGBA8;
+	int format_channels = 4;
+	struct spng_trns trns;
+	if (spngLib.spng_get_trns(ctx, &trns) != 0) {
+		if (ihdr.color_type == SPNG_COLOR_TYPE_GRAYSCALE && ihdr.bit_depth <= 8) {
+			format = SPNG_FMT_G8;
+			format_channels = 1;
+		} else if (ihdr.color_type == SPNG_COLOR_TYPE_GRAYSCALE_ALPHA && ihdr.bit_depth <= 8) {
+			format = SPNG_FMT_GA8;
+			format_channels = 2;
+		} else if (ihdr.color_type == SPNG_COLOR_TYPE_TRUECOLOR || ihdr.color_type == SPNG_COLOR_TYPE_INDEXED) {
+			format = SPNG_FMT_RGB8;
+			format_channels = 3;
+		}
+	}
 
 	size_t image_size;
-	if (spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &image_size)) goto cleanup;
+	if (spngLib.spng_decoded_image_size(ctx, format, &image_size)) goto cleanup;
 	
 	output_buffer = (uint8_t*)malloc(image_size);
 	if (!output_buffer) goto cleanup;
 
-	if (spng_decode_image(ctx, output_buffer, image_size, SPNG_FMT_RGBA8, 0)) {
+	if (spngLib.spng_decode_image(ctx, output_buffer, image_size, format, 0)) {
 		free(output_buffer);
 		output_buffer = NULL;
 	} else {
 		*width = ihdr.width;
 		*height = ihdr.height;
+		*channels = format_channels;
+	}
+
+cleanup:
+	spngLib.spng_ctx_free(ctx);
+	return output_buffer;
+}
+
+uint16_t* loadImage_SPNGDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format) {
+	if (!CodecLib_load(CODEC_LIB_SPNG)) return NULL;
+	spng_ctx* ctx = spngLib.spng_ctx_new(0);
+	uint16_t* output_buffer = NULL;
+
+	if (!ctx) {
+		return NULL;
+	}
+
+	spngLib.spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
+	spngLib.spng_set_png_buffer(ctx, src->data, src->size);
+
+	struct spng_ihdr ihdr;
+	if (spngLib.spng_get_ihdr(ctx, &ihdr) || ihdr.bit_depth != 16) goto cleanup;
+
+	// The samples as stored, big-endian, only tRNS needs the host-endian RGBA16 expansion
+	static const int stored_channels[] = {1, 0, 3, 0, 2, 0, 4}; // by color type
+	if (ihdr.color_type > SPNG_COLOR_TYPE_TRUECOLOR_ALPHA || stored_channels[ihdr.color_type] == 0) goto cleanup;
+	int decode_format = SPNG_FMT_PNG;
+	int flags = 0;
+	int format_channels = stored_channels[ihdr.color_type];
+	struct spng_trns trns;
+	if (spngLib.spng_get_trns(ctx, &trns) == 0) {
+		decode_format = SPNG_FMT_RGBA16;
+		flags = SPNG_DECODE_TRNS;
+		format_channels = 4;
+	}
+
+	size_t image_size;
+	if (spngLib.spng_decoded_image_size(ctx, decode_format, &image_size)) goto cleanup;
+
+	output_buffer = (uint16_t*)malloc(image_size);
+	if (!output_buffer) goto cleanup;
+
+	if (spngLib.spng_decode_image(ctx, output_buffer, image_size, decode_format, flags)) {
+		free(output_buffer);
+		output_buffer = NULL;
+		goto cleanup;
+	}
+	if (decode_format == SPNG_FMT_PNG) {
+		const uint8_t* bytes = (const uint8_t*)output_buffer;
+		for (size_t i = 0; i < image_size / 2; ++i) output_buffer[i] = (uint16_t)(bytes[i * 2] << 8 | bytes[i * 2 + 1]);
+	}
+	*width = ihdr.width;
+	*height = ihdr.height;
+	*channels = format_channels;
+	format->sample = SAMPLE_UINT16;
+	format->peak = 1.0f;
+
+cleanup:
+	spngLib.spng_ctx_free(ctx);
+	return output_buffer;
+}
+
+unsigned char* loadImage_SPNGIndexed(const FileSource* src, int* width, int* height, uint8_t* palette) {
+	if (!CodecLib_load(CODEC_LIB_SPNG)) return NULL;
+	spng_ctx* ctx = spngLib.spng_ctx_new(0);
+	uint8_t* packed = NULL;
+	uint8_t* output_buffer = NULL;
+	bool ok = false;
+
+	if (!ctx) {
+		return NULL;
+	}
+	spngLib.spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
+	spngLib.spng_set_png_buffer(ctx, src->data, src->size);
+
+	struct spng_ihdr ihdr;
+	if (spngLib.spng_get_ihdr(ctx, &ihdr) || ihdr.color_type != SPNG_COLOR_TYPE_INDEXED) goto cleanup;
+	struct spng_plte plte;
+	if (spngLib.spng_get_plte(ctx, &plte)) goto cleanup;
+	struct spng_trns trns;
+	uint32_t alphas = spngLib.spng_get_trns(ctx, &trns) == 0 ? trns.n_type3_entries : 0;
+	for (uint32_t i = 0; i < plte.n_entries && i < 256; ++i) {
+		palette[i * 4] = plte.entries[i].red;
+		palette[i * 4 + 1] = plte.entries[i].green;
+		palette[i * 4 + 2] = plte.entries[i].blue;
+		palette[i * 4 + 3] = i < alphas ? trns.type3_alpha[i] : 255;
+	}
+
+	// SPNG_FMT_PNG keeps the indices as stored, rows of 1, 2 and 4 bit depths are unpacked below
+	size_t packed_size;
+	if (spngLib.spng_decoded_image_size(ctx, SPNG_FMT_PNG, &packed_size)) goto cleanup;
+	size_t pixels = (size_t)ihdr.width * ihdr.height;
+	output_buffer = (uint8_t*)malloc(pixels);
+	if (!output_buffer) goto cleanup;
+	if (ihdr.bit_depth == 8) {
+		if (packed_size != pixels || spngLib.spng_decode_image(ctx, output_buffer, pixels, SPNG_FMT_PNG, 0)) goto cleanup;
+	} else {
+		packed = (uint8_t*)malloc(packed_size);
+		if (!packed || spngLib.spng_decode_image(ctx, packed, packed_size, SPNG_FMT_PNG, 0)) goto cleanup;
+		size_t row_bytes = packed_size / ihdr.height;
+		int depth = ihdr.bit_depth, per_byte = 8 / depth, mask = (1 << depth) - 1;
+		for (uint32_t y = 0; y < ihdr.height; ++y) {
+			const uint8_t* row = packed + y * row_bytes;
+			uint8_t* out = output_buffer + (size_t)y * ihdr.width;
+			for (uint32_t x = 0; x < ihdr.width; ++x) {
+				int shift = 8 - depth * (int)(x % per_byte + 1);
+				out[x] = (uint8_t)((row[x / per_byte] >> shift) & mask);
+			}
+		}
 	}
+	*width = ihdr.width;
+	*height = ihdr.height;
+	ok = true;
 
 cleanup:
-	spng_ctx_free(ctx);
-	fclose(f);
+	if (!ok) {
+		free(output_buffer);
+		output_buffer = NULL;
+	}
+	free(packed);
+	spngLib.spng_ctx_free(ctx);
 	return output_buffer;
 }
 
-unsigned char* loadImage_JpegTurbo(const char* path, int* width, int* height) {
-	size_t data_size = 0;
-	uint8_t* file_data = readFileToBuffer(path, &data_size);
-	if (!file_data) return NULL;
+unsigned char* loadImage_JpegTurbo(const FileSource* src, int* width, int* height, int* channels) {
+	if (!CodecLib_load(CODEC_LIB_JPEG)) return NULL;
 	struct jpeg_decompress_struct cinfo;
 	struct my_error_mgr jerr;
 	uint8_t* output_buffer = NULL;
 
-	cinfo.err = jpeg_std_error(&jerr.pub);
+	cinfo.err = jpegLib.jpeg_std_error(&jerr.pub);
 	jerr.pub.error_exit = my_error_exit;
 
 	if (setjmp(jerr.setjmp_buffer)) {
-		jpeg_destroy_decompress(&cinfo);
-		free(file_data);
+		jpegLib.jpeg_destroy_decompress(&cinfo);
 		free(output_buffer); 
 		return NULL;
 	}
 
-	jpeg_create_decompress(&cinfo);
-	jpeg_mem_src(&cinfo, file_data, data_size);
-	jpeg_read_header(&cinfo, TRUE);
-	cinfo.out_color_space = JCS_EXT_RGBA;
-	jpeg_start_decompress(&cinfo);
+	jpegLib.jpeg_CreateDecompress(&cinfo, JPEG_LIB_VERSION, sizeof(cinfo));
+	jpegLib.jpeg_mem_src(&cinfo, src->data, src->size);
+	jpegLib.jpeg_read_header(&cinfo, TRUE);
+	// Never any alpha, gray scans stay one byte per pixel
+	cinfo.out_color_space = cinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+	jpegLib.jpeg_start_decompress(&cinfo);
 	*width = cinfo.output_width;
 	*height = cinfo.output_height;
+	*channels = cinfo.output_components;
 	int row_stride = (*width) * cinfo.output_components;
 	size_t image_size = (size_t)(*height) * row_stride;
 	output_buffer = (uint8_t*)malloc(image_size);
@@ -305,12 +1121,754 @@ unsigned char* loadImage_JpegTurbo(const char* path, int* width, int* height) {
 	
 	while (cinfo.output_scanline < cinfo.output_height) {
 		JSAMPROW row_pointer = &output_buffer[cinfo.output_scanline * row_stride];
-		jpeg_read_scanlines(&cinfo, &row_pointer, 1);
+		jpegLib.jpeg_read_scanlines(&cinfo, &row_pointer, 1);
+	}
+
+	jpegLib.jpeg_finish_decompress(&cinfo);
+	jpegLib.jpeg_destroy_decompress(&cinfo);
+
+	return output_buffer;
+}
+
+unsigned char* loadImage_JpegTurboYuv(const FileSource* src, int* width, int* height, YuvLayout* layout) {
+	if (!CodecLib_load(CODEC_LIB_JPEG)) return NULL;
+	struct jpeg_decompress_struct cinfo;
+	struct my_error_mgr jerr;
+	uint8_t* volatile output_buffer = NULL;
+
+	cinfo.err = jpegLib.jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+
+	if (setjmp(jerr.setjmp_buffer)) {
+		jpegLib.jpeg_destroy_decompress(&cinfo);
+		free(output_buffer); 
+		return NULL;
+	}
+
+	jpegLib.jpeg_CreateDecompress(&cinfo, JPEG_LIB_VERSION, sizeof(cinfo));
+	jpegLib.jpeg_mem_src(&cinfo, src->data, src->size);
+	jpegLib.jpeg_read_header(&cinfo, TRUE);
+	// Luma at full size and both chroma planes at the same subsampling, e.g. 4:2:0, 4:2:2 or 4:4:4
+	jpeg_component_info* comp = cinfo.comp_info;
+	if (cinfo.jpeg_color_space != JCS_YCbCr || cinfo.num_components != 3 ||
+		comp[0].h_samp_factor != cinfo.max_h_samp_factor || comp[0].v_samp_factor != cinfo.max_v_samp_factor ||
+		comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 ||
+		comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) {
+		jpegLib.jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+	cinfo.raw_data_out = TRUE;
+	jpegLib.jpeg_start_decompress(&cinfo);
+	*width = cinfo.output_width;
+	*height = cinfo.output_height;
+	layout->matrix = YUV_MATRIX_BT601; // JFIF
+	layout->fullRange = true;
+
+	// Whole blocks are written, planes are decoded padded to them and packed afterwards
+	size_t stride[3], offset[3], size = 0;
+	for (int p = 0; p < 3; ++p) {
+		stride[p] = (size_t)comp[p].width_in_blocks * DCTSIZE;
+		offset[p] = size;
+		size += stride[p] * cinfo.total_iMCU_rows * comp[p].v_samp_factor * DCTSIZE;
+	}
+	output_buffer = (uint8_t*)malloc(size);
+	if (!output_buffer) {
+		longjmp(jerr.setjmp_buffer, 1);
+	}
+
+	JSAMPROW rows[3][MAX_SAMP_FACTOR * DCTSIZE];
+	JSAMPARRAY planes[3] = {rows[0], rows[1], rows[2]};
+	JDIMENSION lines = (JDIMENSION)cinfo.max_v_samp_factor * DCTSIZE;
+	for (JDIMENSION imcu = 0; imcu < cinfo.total_iMCU_rows; ++imcu) {
+		for (int p = 0; p < 3; ++p) {
+			int planeLines = comp[p].v_samp_factor * DCTSIZE;
+			for (int r = 0; r < planeLines; ++r) {
+				rows[p][r] = output_buffer + offset[p] + ((size_t)imcu * planeLines + r) * stride[p];
+			}
+		}
+		if (jpegLib.jpeg_read_raw_data(&cinfo, planes, lines) != lines) {
+			longjmp(jerr.setjmp_buffer, 1);
+		}
+	}
+	// comp_info goes away with the decompressor
+	size_t packed = YuvLayout_pack(layout, *width, *height, (int)comp[1].downsampled_width, (int)comp[1].downsampled_height);
+	jpegLib.jpeg_finish_decompress(&cinfo);
+	jpegLib.jpeg_destroy_decompress(&cinfo);
+
+	// Rows only ever move down, packing in place is safe
+	for (int p = 0; p < 3; ++p) {
+		for (int y = 0; y < layout->height[p]; ++y) {
+			memmove(output_buffer + layout->offset[p] + (size_t)y * layout->width[p],
+				output_buffer + offset[p] + (size_t)y * stride[p], (size_t)layout->width[p]);
+		}
+	}
+	uint8_t* smaller = (uint8_t*)realloc(output_buffer, packed);
+	return smaller ? smaller : output_buffer;
+}
+
+int16_t* loadImage_JpegTurboCoefficients(const FileSource* src, int* width, int* height, JpegCoefficients* coefficients) {
+	if (!CodecLib_load(CODEC_LIB_JPEG)) return NULL;
+	struct jpeg_decompress_struct cinfo;
+	struct my_error_mgr jerr;
+	int16_t* volatile output_buffer = NULL;
+
+	cinfo.err = jpegLib.jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+
+	if (setjmp(jerr.setjmp_buffer)) {
+		jpegLib.jpeg_destroy_decompress(&cinfo);
+		free(output_buffer); 
+		return NULL;
 	}
 
-	jpeg_finish_decompress(&cinfo);
-	jpeg_destroy_decompress(&cinfo);
-	free(file_data);
+	jpegLib.jpeg_CreateDecompress(&cinfo, JPEG_LIB_VERSION, sizeof(cinfo));
+	jpegLib.jpeg_mem_src(&cinfo, src->data, src->size);
+	jpegLib.jpeg_read_header(&cinfo, TRUE);
+	// Progressive scans are smoothed by libjpeg-turbo after the coefficients, odd subsamplings and
+	// chroma only 1 or 2 samples wide take upsamplers the shaders do not reproduce
+	jpeg_component_info* comp = cinfo.comp_info;
+	bool supported = !cinfo.progressive_mode &&
+		((cinfo.num_components == 1 && cinfo.jpeg_color_space == JCS_GRAYSCALE) ||
+		(cinfo.num_components == 3 && cinfo.jpeg_color_space == JCS_YCbCr));
+	for (int c = 0; supported && c < cinfo.num_components; ++c) {
+		int h = cinfo.max_h_samp_factor / comp[c].h_samp_factor;
+		int v = cinfo.max_v_samp_factor / comp[c].v_samp_factor;
+		int sampledWidth = (int)((cinfo.image_width * comp[c].h_samp_factor + cinfo.max_h_samp_factor - 1) / cinfo.max_h_samp_factor);
+		supported = h * comp[c].h_samp_factor == cinfo.max_h_samp_factor && v * comp[c].v_samp_factor == cinfo.max_v_samp_factor &&
+			h <= 2 && v <= 2 && (c == 0 ? h == 1 && v == 1 : h == 1 || sampledWidth > 2);
+	}
+	if (!supported) {
+		jpegLib.jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+	jvirt_barray_ptr* arrays = jpegLib.jpeg_read_coefficients(&cinfo);
+	*width = cinfo.image_width;
+	*height = cinfo.image_height;
+	coefficients->components = cinfo.num_components;
+	size_t size = 0;
+	for (int c = 0; c < cinfo.num_components; ++c) {
+		JpegPlane* plane = &coefficients->planes[c];
+		plane->blocksWide = (int)comp[c].width_in_blocks;
+		plane->blocksHigh = (int)comp[c].height_in_blocks;
+		plane->sampledWidth = (int)((cinfo.image_width * comp[c].h_samp_factor + cinfo.max_h_samp_factor - 1) / cinfo.max_h_samp_factor);
+		plane->sampledHeight = (int)((cinfo.image_height * comp[c].v_samp_factor + cinfo.max_v_samp_factor - 1) / cinfo.max_v_samp_factor);
+		plane->upsampleX = cinfo.max_h_samp_factor / comp[c].h_samp_factor;
+		plane->upsampleY = cinfo.max_v_samp_factor / comp[c].v_samp_factor;
+		plane->offset = size;
+		// Tables are latched by the time the last scan is read
+		memcpy(plane->quant, comp[c].quant_table->quantval, sizeof(plane->quant));
+		size += (size_t)plane->blocksWide * plane->blocksHigh * DCTSIZE2;
+	}
+	output_buffer = (int16_t*)malloc(size * sizeof(int16_t));
+	if (!output_buffer) {
+		longjmp(jerr.setjmp_buffer, 1);
+	}
 
+	// Each block becomes an 8x8 patch of the plane, coefficient (u, v) at texel (u, v) of its patch
+	for (int c = 0; c < cinfo.num_components; ++c) {
+		const JpegPlane* plane = &coefficients->planes[c];
+		size_t stride = (size_t)plane->blocksWide * DCTSIZE;
+		for (int by = 0; by < plane->blocksHigh; ++by) {
+			JBLOCKARRAY row = (*cinfo.mem->access_virt_barray)((j_common_ptr)&cinfo, arrays[c], (JDIMENSION)by, 1, FALSE);
+			int16_t* dest = output_buffer + plane->offset + (size_t)by * DCTSIZE * stride;
+			for (int bx = 0; bx < plane->blocksWide; ++bx) {
+				for (int v = 0; v < DCTSIZE; ++v) {
+					memcpy(dest + v * stride + bx * DCTSIZE, &row[0][bx][v * DCTSIZE], DCTSIZE * sizeof(int16_t));
+				}
+			}
+		}
+	}
+	jpegLib.jpeg_finish_decompress(&cinfo);
+	jpegLib.jpeg_destroy_decompress(&cinfo);
 	return output_buffer;
 }
+
+bool streamImage_SPNG(const FileSource* src, PixelRectSink sink, void* user) {
+	if (!CodecLib_load(CODEC_LIB_SPNG)) return false;
+	spng_ctx* ctx = spngLib.spng_ctx_new(0);
+	uint8_t* row = NULL;
+	bool ok = false;
+
+	if (!ctx) {
+		return false;
+	}
+	spngLib.spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
+	spngLib.spng_set_png_buffer(ctx, src->data, src->size);
+
+	struct spng_ihdr ihdr;
+	if (spngLib.spng_get_ihdr(ctx, &ihdr)) goto cleanup;
+	// Interlaced rows arrive per Adam7 pass and cannot be streamed into tiles
+	if (ihdr.interlace_method != 0) goto cleanup;
+
+	size_t row_size = (size_t)ihdr.width * 4;
+	row = (uint8_t*)malloc(row_size);
+	if (!row) goto cleanup;
+	if (spngLib.spng_decode_image(ctx, NULL, 0, SPNG_FMT_RGBA8, SPNG_DECODE_PROGRESSIVE)) goto cleanup;
+
+	int ret;
+	do {
+		struct spng_row_info row_info;
+		ret = spngLib.spng_get_row_info(ctx, &row_info);
+		if (ret) break;
+		ret = spngLib.spng_decode_row(ctx, row, row_size);
+		if (ret != 0 && ret != SPNG_EOI) break;
+		if (!sink(user, 0, (int)row_info.row_num, (int)ihdr.width, 1, row, (ptrdiff_t)row_size)) {
+			ret = -1;
+			break;
+		}
+	} while (ret == 0);
+	ok = (ret == SPNG_EOI);
+
+cleanup:
+	free(row);
+	spngLib.spng_ctx_free(ctx);
+	return ok;
+}
+
+bool streamImage_JpegTurbo(const FileSource* src, PixelRectSink sink, void* user) {
+	if (!CodecLib_load(CODEC_LIB_JPEG)) return false;
+	struct jpeg_decompress_struct cinfo;
+	struct my_error_mgr jerr;
+	uint8_t* volatile row = NULL;
+
+	cinfo.err = jpegLib.jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = my_error_exit;
+	if (setjmp(jerr.setjmp_buffer)) {
+		jpegLib.jpeg_destroy_decompress(&cinfo);
+		free(row);
+		return false;
+	}
+
+	jpegLib.jpeg_CreateDecompress(&cinfo, JPEG_LIB_VERSION, sizeof(cinfo));
+	jpegLib.jpeg_mem_src(&cinfo, src->data, src->size);
+	jpegLib.jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_EXT_RGBA;
+	jpegLib.jpeg_start_decompress(&cinfo);
+	size_t row_stride = (size_t)cinfo.output_width * 4;
+	row = (uint8_t*)malloc(row_stride);
+	if (!row) longjmp(jerr.setjmp_buffer, 1);
+
+	while (cinfo.output_scanline < cinfo.output_height) {
+		int y = (int)cinfo.output_scanline;
+		JSAMPROW row_pointer = row;
+		jpegLib.jpeg_read_scanlines(&cinfo, &row_pointer, 1);
+		if (!sink(user, 0, y, (int)cinfo.output_width, 1, row, (ptrdiff_t)row_stride)) {
+			longjmp(jerr.setjmp_buffer, 1);
+		}
+	}
+
+	jpegLib.jpeg_finish_decompress(&cinfo);
+	jpegLib.jpeg_destroy_decompress(&cinfo);
+	free(row);
+	return true;
+}
+
+bool streamImage_Tiff(const FileSource* src, PixelRectSink sink, void* user) {
+	if (!CodecLib_load(CODEC_LIB_TIFF)) return false;
+	TiffMemoryStream stream;
+	TIFF* tif = openTiff(src, &stream);
+	if (!tif) return false;
+	uint32_t w = 0, h = 0;
+	uint32_t* raster = NULL;
+	bool ok = false;
+
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+	tiffLib.TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+	if (w == 0 || h == 0) goto cleanup;
+
+	// RGBA strips and tiles come back bottom-up, hence the negative stride from the last row
+	if (tiffLib.TIFFIsTiled(tif)) {
+		uint32_t tw = 0, th = 0;
+		tiffLib.TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+		tiffLib.TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+		if (tw == 0 || th == 0) goto cleanup;
+		raster = (uint32_t*)tiffLib._TIFFmalloc((tmsize_t)tw * th * sizeof(uint32_t));
+		if (!raster) goto cleanup;
+		for (uint32_t y = 0; y < h; y += th) {
+			for (uint32_t x = 0; x < w; x += tw) {
+				if (!tiffLib.TIFFReadRGBATile(tif, x, y, raster)) goto cleanup;
+				uint32_t rw = (x + tw > w) ? w - x : tw;
+				uint32_t rh = (y + th > h) ? h - y : th;
+				const uint8_t* top = (const uint8_t*)(raster + (size_t)(th - 1) * tw);
+				if (!sink(user, (int)x, (int)y, (int)rw, (int)rh, top, -(ptrdiff_t)tw * 4)) goto cleanup;
+			}
+		}
+	} else {
+		uint32_t rows_per_strip = h;
+		tiffLib.TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+		if (rows_per_strip == 0 || rows_per_strip > h) rows_per_strip = h;
+		raster = (uint32_t*)tiffLib._TIFFmalloc((tmsize_t)w * rows_per_strip * sizeof(uint32_t));
+		if (!raster) goto cleanup;
+		for (uint32_t y = 0; y < h; y += rows_per_strip) {
+			if (!tiffLib.TIFFReadRGBAStrip(tif, y, raster)) goto cleanup;
+			uint32_t rh = (y + rows_per_strip > h) ? h - y : rows_per_strip;
+			const uint8_t* top = (const uint8_t*)(raster + (size_t)(rh - 1) * w);
+			if (!sink(user, 0, (int)y, (int)w, (int)rh, top, -(ptrdiff_t)w * 4)) goto cleanup;
+		}
+	}
+	ok = true;
+
+cleanup:
+	if (raster) tiffLib._TIFFfree(raster);
+	tiffLib.TIFFClose(tif);
+	return ok;
+}
+
+typedef struct {
+	WebPAnimDecoder* decoder;
+	int width, height;
+	int timestamp; // end of the last frame, libwebp counts from the start of the loop
+} WebPAnimation;
+
+static void webpAnimClose(void* decoder) {
+	WebPAnimation* anim = (WebPAnimation*)decoder;
+	if (anim->decoder) webpDemuxLib.WebPAnimDecoderDelete(anim->decoder);
+	free(anim);
+}
+
+static void* webpAnimOpen(const uint8_t* data, size_t size, int* width, int* height) {
+	if (!CodecLib_load(CODEC_LIB_WEBP_DEMUX)) return NULL;
+	WebPAnimDecoderOptions options;
+	if (!webpDemuxLib.WebPAnimDecoderOptionsInitInternal(&options, WEBP_DEMUX_ABI_VERSION)) return NULL;
+	options.color_mode = MODE_RGBA;
+	options.use_threads = 0; // the stream already runs on a thread of its own
+	WebPAnimation* anim = (WebPAnimation*)calloc(1, sizeof(WebPAnimation));
+	if (!anim) return NULL;
+	WebPData webp = { data, size };
+	WebPAnimInfo info;
+	anim->decoder = webpDemuxLib.WebPAnimDecoderNewInternal(&webp, &options, WEBP_DEMUX_ABI_VERSION);
+	if (!anim->decoder || !webpDemuxLib.WebPAnimDecoderGetInfo(anim->decoder, &info)) {
+		webpAnimClose(anim);
+		return NULL;
+	}
+	*width = anim->width = (int)info.canvas_width;
+	*height = anim->height = (int)info.canvas_height;
+	return anim;
+}
+
+static bool webpAnimNext(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs) {
+	WebPAnimation* anim = (WebPAnimation*)decoder;
+	uint8_t* buffer;
+	int timestamp;
+	if (!webpDemuxLib.WebPAnimDecoderGetNext(anim->decoder, &buffer, &timestamp)) return false;
+	*canvas = buffer;
+	*dirty = (AnimRect){ 0, 0, anim->width, anim->height };
+	*delayMs = timestamp - anim->timestamp;
+	anim->timestamp = timestamp;
+	return true;
+}
+
+static bool webpAnimRewind(void* decoder) {
+	WebPAnimation* anim = (WebPAnimation*)decoder;
+	webpDemuxLib.WebPAnimDecoderReset(anim->decoder);
+	anim->timestamp = 0;
+	return true;
+}
+
+const AnimBackend AnimBackend_WebP = { webpAnimOpen, webpAnimNext, webpAnimRewind, webpAnimClose };
+
+#define PNG_CHUNK(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+#define APNG_FIRST_CHUNK 33 // after the signature and IHDR
+
+static const uint8_t pngSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// libspng only reads the default image, so every frame is cut out as a PNG of its own:
+// IHDR with the frame size, the chunks all frames share, and its fdAT data as IDAT
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	int width, height;
+	uint8_t ihdr[13];
+	uint8_t* shared; // PLTE, tRNS and the other chunks before the first IDAT, as stored
+	size_t sharedSize;
+	size_t at; // next chunk to look at
+	bool firstThisLoop;
+	uint8_t* png;
+	size_t pngCapacity;
+	uint8_t* frame; // the decoded frame, RGBA8 of its own size
+	size_t frameCapacity;
+	uint8_t* canvas;
+	uint8_t* previous; // canvas under the frame on it when that is to be restored, packed to its rect
+	AnimRect disposeRect;
+	int disposal; // of the frame on the canvas
+} ApngDecoder;
+
+static uint32_t readBe32(const uint8_t* p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void writeBe32(uint8_t* p, uint32_t value) {
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+static bool apngChunk(const ApngDecoder* dec, size_t at, uint32_t* type, const uint8_t** body, uint32_t* length) {
+	if (at + 12 > dec->size) return false;
+	*length = readBe32(dec->data + at);
+	if (*length > dec->size - at - 12) return false;
+	*type = readBe32(dec->data + at + 4);
+	*body = dec->data + at + 8;
+	return true;
+}
+
+// The CRC is left zero, libspng is told to skip the check
+static void appendChunk(uint8_t* out, size_t* used, uint32_t type, const uint8_t* body, uint32_t length) {
+	writeBe32(out + *used, length);
+	writeBe32(out + *used + 4, type);
+	if (length > 0) memcpy(out + *used + 8, body, length);
+	writeBe32(out + *used + 8 + length, 0);
+	*used += 12 + (size_t)length;
+}
+
+static void apngClose(void* decoder) {
+	ApngDecoder* dec = (ApngDecoder*)decoder;
+	free(dec->shared);
+	free(dec->png);
+	free(dec->frame);
+	free(dec->canvas);
+	free(dec->previous);
+	free(dec);
+}
+
+static void* apngOpen(const uint8_t* data, size_t size, int* width, int* height) {
+	if (!CodecLib_load(CODEC_LIB_SPNG)) return NULL;
+	if (size < APNG_FIRST_CHUNK || memcmp(data, pngSignature, 8) != 0) return NULL;
+	ApngDecoder* dec = (ApngDecoder*)calloc(1, sizeof(ApngDecoder));
+	if (!dec) return NULL;
+	dec->data = data;
+	dec->size = size;
+	dec->at = APNG_FIRST_CHUNK;
+	dec->firstThisLoop = true;
+	uint32_t type, length;
+	const uint8_t* body;
+	if (!apngChunk(dec, 8, &type, &body, &length) || type != PNG_CHUNK('I','H','D','R') || length != 13) goto fail;
+	memcpy(dec->ihdr, body, 13);
+	dec->width = (int)readBe32(body);
+	dec->height = (int)readBe32(body + 4);
+	if (dec->width <= 0 || dec->height <= 0) goto fail;
+
+	// Measured first and copied second, the chunks are interleaved with acTL and fcTL
+	size_t at = APNG_FIRST_CHUNK;
+	while (apngChunk(dec, at, &type, &body, &length) && type != PNG_CHUNK('I','D','A','T')) {
+		if (type != PNG_CHUNK('a','c','T','L') && type != PNG_CHUNK('f','c','T','L')) dec->sharedSize += 12 + (size_t)length;
+		at += 12 + (size_t)length;
+	}
+	dec->shared = (uint8_t*)malloc(dec->sharedSize ? dec->sharedSize : 1);
+	dec->canvas = (uint8_t*)calloc((size_t)dec->width * dec->height, 4);
+	if (!dec->shared || !dec->canvas) goto fail;
+	size_t used = 0;
+	for (at = APNG_FIRST_CHUNK; apngChunk(dec, at, &type, &body, &length) && type != PNG_CHUNK('I','D','A','T');) {
+		if (type != PNG_CHUNK('a','c','T','L') && type != PNG_CHUNK('f','c','T','L')) appendChunk(dec->shared, &used, type, body, length);
+		at += 12 + (size_t)length;
+	}
+	*width = dec->width;
+	*height = dec->height;
+	return dec;
+
+fail:
+	apngClose(dec);
+	return NULL;
+}
+
+// Decodes the image data chunks from `at` on as a PNG of the frame's size, into dec->frame
+static bool apngDecodeFrame(ApngDecoder* dec, size_t* at, uint32_t frameWidth, uint32_t frameHeight) {
+	uint32_t type, length;
+	const uint8_t* body;
+	// Chunks are allowed between the fcTL and the data it heads
+	while (apngChunk(dec, *at, &type, &body, &length) && type != PNG_CHUNK('I','D','A','T') && type != PNG_CHUNK('f','d','A','T') &&
+		type != PNG_CHUNK('f','c','T','L') && type != PNG_CHUNK('I','E','N','D')) {
+		*at += 12 + (size_t)length;
+	}
+	size_t end = *at;
+	while (apngChunk(dec, end, &type, &body, &length) && (type == PNG_CHUNK('I','D','A','T') || type == PNG_CHUNK('f','d','A','T'))) {
+		end += 12 + (size_t)length;
+	}
+	// fdAT loses its sequence number on the way, so the frame's chunks are an upper bound
+	size_t bound = sizeof(pngSignature) + 25 + dec->sharedSize + (end - *at) + 12;
+	if (bound > dec->pngCapacity) {
+		uint8_t* grown = (uint8_t*)realloc(dec->png, bound);
+		if (!grown) return false;
+		dec->png = grown;
+		dec->pngCapacity = bound;
+	}
+	size_t used = sizeof(pngSignature);
+	memcpy(dec->png, pngSignature, sizeof(pngSignature));
+	uint8_t ihdr[13];
+	memcpy(ihdr, dec->ihdr, 13);
+	writeBe32(ihdr, frameWidth);
+	writeBe32(ihdr + 4, frameHeight);
+	appendChunk(dec->png, &used, PNG_CHUNK('I','H','D','R'), ihdr, 13);
+	memcpy(dec->png + used, dec->shared, dec->sharedSize);
+	used += dec->sharedSize;
+	for (; *at < end; *at += 12 + (size_t)length) {
+		apngChunk(dec, *at, &type, &body, &length);
+		if (type == PNG_CHUNK('I','D','A','T')) appendChunk(dec->png, &used, type, body, length);
+		else if (length >= 4) appendChunk(dec->png, &used, PNG_CHUNK('I','D','A','T'), body + 4, length - 4);
+	}
+	appendChunk(dec->png, &used, PNG_CHUNK('I','E','N','D'), NULL, 0);
+
+	bool ok = false;
+	spng_ctx* ctx = spngLib.spng_ctx_new(0);
+	if (!ctx) return false;
+	spngLib.spng_set_crc_action(ctx, SPNG_CRC_USE, SPNG_CRC_USE);
+	spngLib.spng_set_png_buffer(ctx, dec->png, used);
+	size_t bytes;
+	if (spngLib.spng_decoded_image_size(ctx, SPNG_FMT_RGBA8, &bytes) || bytes != (size_t)frameWidth * frameHeight * 4) goto cleanup;
+	if (bytes > dec->frameCapacity) {
+		uint8_t* grown = (uint8_t*)realloc(dec->frame, bytes);
+		if (!grown) goto cleanup;
+		dec->frame = grown;
+		dec->frameCapacity = bytes;
+	}
+	ok = spngLib.spng_decode_image(ctx, dec->frame, bytes, SPNG_FMT_RGBA8, SPNG_DECODE_TRNS) == 0;
+
+cleanup:
+	spngLib.spng_ctx_free(ctx);
+	return ok;
+}
+
+static void apngCopyRect(ApngDecoder* dec, AnimRect rect, uint8_t* packed, bool toCanvas) {
+	for (int y = 0; y < rect.h; ++y) {
+		uint8_t* row = dec->canvas + ((size_t)(rect.y + y) * dec->width + rect.x) * 4;
+		uint8_t* other = packed + (size_t)y * rect.w * 4;
+		if (toCanvas) memcpy(row, other, (size_t)rect.w * 4);
+		else memcpy(other, row, (size_t)rect.w * 4);
+	}
+}
+
+// What the frame on the canvas leaves behind for the next one, the rect it touched
+static AnimRect apngDispose(ApngDecoder* dec) {
+	AnimRect rect = dec->disposeRect;
+	if (rect.w == 0) return rect;
+	if (dec->disposal == 1) {
+		for (int y = 0; y < rect.h; ++y) {
+			memset(dec->canvas + ((size_t)(rect.y + y) * dec->width + rect.x) * 4, 0, (size_t)rect.w * 4);
+		}
+		return rect;
+	}
+	if (dec->disposal == 2 && dec->previous) {
+		apngCopyRect(dec, rect, dec->previous, true);
+		return rect;
+	}
+	return (AnimRect){ 0, 0, 0, 0 };
+}
+
+// Straight alpha over straight alpha
+static void blendOver(uint8_t* dst, const uint8_t* src, int pixels) {
+	for (int i = 0; i < pixels; ++i, dst += 4, src += 4) {
+		int sa = src[3];
+		if (sa == 255) {
+			memcpy(dst, src, 4);
+			continue;
+		}
+		if (sa == 0) continue;
+		int da = dst[3] * (255 - sa) / 255;
+		int a = sa + da;
+		for (int c = 0; c < 3; ++c) dst[c] = (uint8_t)((src[c] * sa + dst[c] * da) / a);
+		dst[3] = (uint8_t)a;
+	}
+}
+
+static bool apngNext(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs) {
+	ApngDecoder* dec = (ApngDecoder*)decoder;
+	uint32_t type, length;
+	const uint8_t* body;
+	while (apngChunk(dec, dec->at, &type, &body, &length)) {
+		dec->at += 12 + (size_t)length;
+		// IDAT without an fcTL in front is a default image that is not part of the animation
+		if (type == PNG_CHUNK('I','E','N','D')) return false;
+		if (type != PNG_CHUNK('f','c','T','L')) continue;
+		if (length < 26) return false;
+		uint32_t w = readBe32(body + 4), h = readBe32(body + 8);
+		uint32_t x = readBe32(body + 12), y = readBe32(body + 16);
+		if (w == 0 || h == 0 || x > (uint32_t)dec->width || y > (uint32_t)dec->height ||
+			w > (uint32_t)dec->width - x || h > (uint32_t)dec->height - y) return false;
+		int delayNum = (body[20] << 8) | body[21], delayDen = (body[22] << 8) | body[23];
+		int disposal = body[24], blend = body[25];
+		// Nothing to go back to before the first frame, it is cleared instead
+		if (disposal == 2 && dec->firstThisLoop) disposal = 1;
+		if (!apngDecodeFrame(dec, &dec->at, w, h)) return false;
+
+		AnimRect rect = { (int)x, (int)y, (int)w, (int)h };
+		AnimRect disposed = apngDispose(dec);
+		if (disposal == 2) {
+			if (!dec->previous) dec->previous = (uint8_t*)malloc((size_t)dec->width * dec->height * 4);
+			if (dec->previous) apngCopyRect(dec, rect, dec->previous, false);
+		}
+		for (uint32_t row = 0; row < h; ++row) {
+			uint8_t* dst = dec->canvas + ((size_t)(y + row) * dec->width + x) * 4;
+			const uint8_t* src = dec->frame + (size_t)row * w * 4;
+			if (blend == 0) memcpy(dst, src, (size_t)w * 4);
+			else blendOver(dst, src, (int)w);
+		}
+		dec->disposal = disposal;
+		dec->disposeRect = rect;
+		dec->firstThisLoop = false;
+		*canvas = dec->canvas;
+		*dirty = AnimRect_union(disposed, rect);
+		*delayMs = delayNum * 1000 / (delayDen ? delayDen : 100);
+		return true;
+	}
+	return false;
+}
+
+static bool apngRewind(void* decoder) {
+	ApngDecoder* dec = (ApngDecoder*)decoder;
+	memset(dec->canvas, 0, (size_t)dec->width * dec->height * 4);
+	dec->at = APNG_FIRST_CHUNK;
+	dec->firstThisLoop = true;
+	dec->disposal = 0;
+	dec->disposeRect = (AnimRect){ 0, 0, 0, 0 };
+	return true;
+}
+
+const AnimBackend AnimBackend_Apng = { apngOpen, apngNext, apngRewind, apngClose };
+
+typedef struct {
+	avifDecoder* decoder;
+	int width, height;
+	uint8_t* canvas;
+} AvifAnimation;
+
+static void avifAnimClose(void* decoder) {
+	AvifAnimation* anim = (AvifAnimation*)decoder;
+	if (anim->decoder) avifLib.avifDecoderDestroy(anim->decoder);
+	free(anim->canvas);
+	free(anim);
+}
+
+static void* avifAnimOpen(const uint8_t* data, size_t size, int* width, int* height) {
+	if (!CodecLib_load(CODEC_LIB_AVIF)) return NULL;
+	AvifAnimation* anim = (AvifAnimation*)calloc(1, sizeof(AvifAnimation));
+	if (!anim) return NULL;
+	anim->decoder = avifLib.avifDecoderCreate();
+	if (!anim->decoder) goto fail;
+	if (avifLib.avifDecoderSetIOMemory(anim->decoder, data, size) != AVIF_RESULT_OK) goto fail;
+	if (avifLib.avifDecoderParse(anim->decoder) != AVIF_RESULT_OK) goto fail;
+	anim->width = (int)anim->decoder->image->width;
+	anim->height = (int)anim->decoder->image->height;
+	if (anim->width <= 0 || anim->height <= 0) goto fail;
+	anim->canvas = (uint8_t*)malloc((size_t)anim->width * anim->height * 4);
+	if (!anim->canvas) goto fail;
+	*width = anim->width;
+	*height = anim->height;
+	return anim;
+
+fail:
+	avifAnimClose(anim);
+	return NULL;
+}
+
+static bool avifAnimNext(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs) {
+	AvifAnimation* anim = (AvifAnimation*)decoder;
+	if (avifLib.avifDecoderNextImage(anim->decoder) != AVIF_RESULT_OK) return false;
+	const avifImage* image = anim->decoder->image;
+	if ((int)image->width != anim->width || (int)image->height != anim->height) return false;
+	avifRGBImage rgb;
+	avifLib.avifRGBImageSetDefaults(&rgb, image);
+	rgb.format = AVIF_RGB_FORMAT_RGBA;
+	rgb.depth = 8;
+	rgb.pixels = anim->canvas;
+	rgb.rowBytes = (uint32_t)anim->width * 4;
+	if (avifLib.avifImageYUVToRGB(image, &rgb) != AVIF_RESULT_OK) return false;
+	*canvas = anim->canvas;
+	*dirty = (AnimRect){ 0, 0, anim->width, anim->height };
+	*delayMs = (int)(anim->decoder->imageTiming.duration * 1000.0 + 0.5);
+	return true;
+}
+
+static bool avifAnimRewind(void* decoder) {
+	return avifLib.avifDecoderReset(((AvifAnimation*)decoder)->decoder) == AVIF_RESULT_OK;
+}
+
+const AnimBackend AnimBackend_Avif = { avifAnimOpen, avifAnimNext, avifAnimRewind, avifAnimClose };
+
+// libjxl coalesces the frames itself, every FULL_IMAGE is the whole canvas
+typedef struct {
+	JxlDecoder* decoder;
+	const uint8_t* data;
+	size_t size;
+	int width, height;
+	double msPerTick;
+	int delayMs; // of the frame being decoded
+	uint8_t* canvas;
+} JxlAnimation;
+
+static bool jxlAnimStart(JxlAnimation* anim) {
+	jxlLib.JxlDecoderRewind(anim->decoder);
+	if (jxlLib.JxlDecoderSubscribeEvents(anim->decoder, JXL_DEC_BASIC_INFO | JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) return false;
+	if (jxlLib.JxlDecoderSetInput(anim->decoder, anim->data, anim->size) != JXL_DEC_SUCCESS) return false;
+	jxlLib.JxlDecoderCloseInput(anim->decoder);
+	return true;
+}
+
+static void jxlAnimClose(void* decoder) {
+	JxlAnimation* anim = (JxlAnimation*)decoder;
+	if (anim->decoder) jxlLib.JxlDecoderDestroy(anim->decoder);
+	free(anim->canvas);
+	free(anim);
+}
+
+static void* jxlAnimOpen(const uint8_t* data, size_t size, int* width, int* height) {
+	if (!CodecLib_load(CODEC_LIB_JXL)) return NULL;
+	JxlAnimation* anim = (JxlAnimation*)calloc(1, sizeof(JxlAnimation));
+	if (!anim) return NULL;
+	anim->data = data;
+	anim->size = size;
+	anim->decoder = jxlLib.JxlDecoderCreate(NULL);
+	if (!anim->decoder || !jxlAnimStart(anim)) goto fail;
+	JxlBasicInfo info;
+	if (jxlLib.JxlDecoderProcessInput(anim->decoder) != JXL_DEC_BASIC_INFO) goto fail;
+	if (jxlLib.JxlDecoderGetBasicInfo(anim->decoder, &info) != JXL_DEC_SUCCESS) goto fail;
+	if (!info.have_animation || info.animation.tps_numerator == 0) goto fail;
+	anim->width = (int)info.xsize;
+	anim->height = (int)info.ysize;
+	anim->msPerTick = 1000.0 * info.animation.tps_denominator / info.animation.tps_numerator;
+	anim->canvas = (uint8_t*)malloc((size_t)anim->width * anim->height * 4);
+	if (!anim->canvas) goto fail;
+	*width = anim->width;
+	*height = anim->height;
+	return anim;
+
+fail:
+	jxlAnimClose(anim);
+	return NULL;
+}
+
+static bool jxlAnimNext(void* decoder, const uint8_t** canvas, AnimRect* dirty, int* delayMs) {
+	JxlAnimation* anim = (JxlAnimation*)decoder;
+	for (;;) {
+		switch (jxlLib.JxlDecoderProcessInput(anim->decoder)) {
+		case JXL_DEC_BASIC_INFO:
+			break; // again after a rewind
+		case JXL_DEC_FRAME: {
+			JxlFrameHeader header;
+			if (jxlLib.JxlDecoderGetFrameHeader(anim->decoder, &header) != JXL_DEC_SUCCESS) return false;
+			anim->delayMs = (int)(header.duration * anim->msPerTick + 0.5);
+			break;
+		}
+		case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
+			JxlPixelFormat format = {4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0};
+			size_t bytes = (size_t)anim->width * anim->height * 4, needed;
+			if (jxlLib.JxlDecoderImageOutBufferSize(anim->decoder, &format, &needed) != JXL_DEC_SUCCESS || needed != bytes) return false;
+			if (jxlLib.JxlDecoderSetImageOutBuffer(anim->decoder, &format, anim->canvas, bytes) != JXL_DEC_SUCCESS) return false;
+			break;
+		}
+		case JXL_DEC_FULL_IMAGE:
+			*canvas = anim->canvas;
+			*dirty = (AnimRect){ 0, 0, anim->width, anim->height };
+			*delayMs = anim->delayMs;
+			return true;
+		default:
+			return false; // JXL_DEC_SUCCESS past the last frame, or damage
+		}
+	}
+}
+
+static bool jxlAnimRewind(void* decoder) {
+	return jxlAnimStart((JxlAnimation*)decoder);
+}
+
+const AnimBackend AnimBackend_Jxl = { jxlAnimOpen, jxlAnimNext, jxlAnimRewind, jxlAnimClose };
@@ -1,12 +1,107 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 
-unsigned char* loadImage_WebP(const char* path, int* width, int* height);
-unsigned char* loadImage_HeifAvif(const char* path, int* width, int* height);
-unsigned char* loadImage_Tiff(const char* path, int* width, int* height);
-unsigned char* loadImage_Jxl(const char* path, int* width, int* height);
-unsigned char* loadImage_SPNG(const char* path, int* width, int* height);
-unsigned char* loadImage_JpegTurbo(const char* path, int* width, int* height);
+#include "file_source.h"
+#include "anim_stream.h"
 
+// Receives decoded RGBA8 pixels a rectangle at a time, stride may be negative for bottom-up rasters.
+// Returning false aborts the stream.
+typedef bool (*PixelRectSink)(void* user, int x, int y, int w, int h, const uint8_t* rgba, ptrdiff_t stride);
+typedef bool (*ImageStreamer)(const FileSource* src, PixelRectSink sink, void* user);
+
+// Shared libraries behind the decoders, opened with dlopen the first time a format needs them
+typedef enum {
+	CODEC_LIB_NONE, // stb and the GIF decoder, always linked
+	CODEC_LIB_SPNG,
+	CODEC_LIB_JPEG,
+	CODEC_LIB_WEBP,
+	CODEC_LIB_HEIF,
+	CODEC_LIB_TIFF,
+	CODEC_LIB_JXL,
+	CODEC_LIB_WEBP_DEMUX, // animated WebP
+	CODEC_LIB_AVIF, // AVIF image sequences, libheif only reads the stills
+	CODEC_LIB_COUNT
+} CodecLib;
+
+// Safe from any thread, only the first call for a library pays for loading it.
+// False when it is not installed, which disables only the formats it decodes.
+bool CodecLib_load(CodecLib lib);
+
+// Pixels come tightly packed in the layout the file stores, `channels` is 1 (gray), 2 (gray and alpha),
+// 3 (RGB) or 4 (RGBA), 8 bits each
+unsigned char* loadImage_WebP(const FileSource* src, int* width, int* height, int* channels);
+unsigned char* loadImage_HeifAvif(const FileSource* src, int* width, int* height, int* channels);
+unsigned char* loadImage_Tiff(const FileSource* src, int* width, int* height, int* channels);
+unsigned char* loadImage_Jxl(const FileSource* src, int* width, int* height, int* channels);
+unsigned char* loadImage_SPNG(const FileSource* src, int* width, int* height, int* channels);
+unsigned char* loadImage_JpegTurbo(const FileSource* src, int* width, int* height, int* channels);
+typedef enum {
+	SAMPLE_UINT8,
+	SAMPLE_UINT16, // display-referred like 8-bit, in finer steps
+	SAMPLE_FLOAT16 // half floats in linear light, 1.0 is diffuse white and highlights go past it
+} SampleType;
+
+typedef struct {
+	SampleType sample;
+	float peak; // brightest color sample of SAMPLE_FLOAT16 data
+} DeepFormat;
+
+// More than 8 bits per sample, kept at 16 bits in the channel layout of the file.
+// NULL for 8-bit images, which then go through the 8-bit loaders.
+uint16_t* loadImage_SPNGDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format);
+uint16_t* loadImage_TiffDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format);
+// PQ and HLG are converted to linear light with BT.709 primaries, at any bit depth for JPEG XL
+uint16_t* loadImage_JxlDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format);
+uint16_t* loadImage_HeifAvifDeep(const FileSource* src, int* width, int* height, int* channels, DeepFormat* format);
+typedef enum {
+	YUV_MATRIX_BT601,
+	YUV_MATRIX_BT709,
+	YUV_MATRIX_BT2020
+} YuvMatrix;
+
+// Y, Cb and Cr planes stored one after another, tightly packed, chroma at the subsampling of the file
+typedef struct {
+	int width[3], height[3];
+	size_t offset[3];
+	YuvMatrix matrix;
+	bool fullRange; // 0-255, limited range otherwise
+} YuvLayout;
+
+// 8-bit YCbCr without alpha as the codec produced it, the fragment shader converts to RGB.
+// NULL for anything else, which then goes through the RGB loader.
+unsigned char* loadImage_JpegTurboYuv(const FileSource* src, int* width, int* height, YuvLayout* layout);
+unsigned char* loadImage_HeifAvifYuv(const FileSource* src, int* width, int* height, YuvLayout* layout);
+typedef struct {
+	int blocksWide, blocksHigh;
+	int sampledWidth, sampledHeight; // samples that are part of the image, the rest of the blocks is padding
+	int upsampleX, upsampleY; // 1 or 2, to the luma resolution
+	size_t offset; // of the plane's coefficients in the data
+	uint16_t quant[64]; // natural order
+} JpegPlane;
+
+// Quantized DCT coefficients of a baseline JPEG, see gpu_jpeg.h
+typedef struct {
+	int components; // 1 gray, 3 YCbCr
+	JpegPlane planes[3];
+} JpegCoefficients;
+
+// Entropy decoding only, gray and YCbCr baseline JPEGs with 4:4:4, 4:2:2, 4:4:0 or 4:2:0 chroma.
+// NULL for anything else.
+int16_t* loadImage_JpegTurboCoefficients(const FileSource* src, int* width, int* height, JpegCoefficients* coefficients);
+// Palette images as one index per pixel plus the 256 RGBA8 entries of `palette`, zeroed by the caller.
+// NULL for anything else, which then goes through the RGBA loader.
+unsigned char* loadImage_SPNGIndexed(const FileSource* src, int* width, int* height, uint8_t* palette);
+
+// Row streaming for the formats gigapixel scans come in, dimensions come from probe.h beforehand
+bool streamImage_SPNG(const FileSource* src, PixelRectSink sink, void* user);
+bool streamImage_JpegTurbo(const FileSource* src, PixelRectSink sink, void* user);
+bool streamImage_Tiff(const FileSource* src, PixelRectSink sink, void* user);
+
+// Animation decoders for anim_stream.h, each opens its library itself
+extern const AnimBackend AnimBackend_WebP;
+extern const AnimBackend AnimBackend_Apng;
+extern const AnimBackend AnimBackend_Avif;
+extern const AnimBackend AnimBackend_Jxl;
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include "io_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define IO_RING_ENTRIES 32
+#define IO_READ_CHUNK ((size_t)1 << 30)
+
+typedef enum {
+	REQUEST_UNUSED,
+	REQUEST_QUEUED,   // not yet read, fallback path reads it on demand
+	REQUEST_INFLIGHT,
+	REQUEST_READY,
+	REQUEST_FAILED
+} RequestStatus;
+
+typedef struct {
+	int tag;
+	char* path;
+	bool map; // mapped with readahead on the ring, copied through the ring otherwise
+	RequestStatus status;
+	FileSource src;
+	uint8_t* buffer;
+	size_t done;
+} ReadRequest;
+
+typedef struct {
+	int fd;
+	unsigned sqEntries;
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void* sqRing;
+	void* cqRing;
+	size_t sqRingSize, cqRingSize, sqesSize;
+	unsigned localTail;
+} IoRing;
+
+struct IoReader {
+	bool ringAvailable;
+	IoRing ring;
+	ReadRequest requests[IO_READER_MAX_BATCH];
+	int count;
+	int inflight;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static bool IoRing_init(IoRing* ring, unsigned entries) {
+	memset(ring, 0, sizeof(*ring));
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = sys_io_uring_setup(entries, &params);
+	if (ring->fd < 0) return false;
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap) {
+		if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) goto fail;
+	if (singleMap) {
+		ring->cqRing = ring->sqRing;
+	} else {
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED) goto fail;
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) goto fail;
+
+	uint8_t* sq = (uint8_t*)ring->sqRing;
+	uint8_t* cq = (uint8_t*)ring->cqRing;
+	ring->sqEntries = params.sq_entries;
+	ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+	ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+	ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	ring->localTail = *ring->sqTail;
+	return true;
+
+fail:
+	if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+	if (ring->sqRing && ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+	return false;
+}
+
+static void IoRing_destroy(IoRing* ring) {
+	munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->fd);
+}
+
+static struct io_uring_sqe* IoRing_getSqe(IoRing* ring) {
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->localTail - head >= ring->sqEntries) return NULL;
+	unsigned slot = ring->localTail & *ring->sqMask;
+	ring->sqArray[slot] = slot;
+	ring->localTail++;
+	struct io_uring_sqe* sqe = &ring->sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static bool IoRing_submit(IoRing* ring) {
+	unsigned toSubmit = ring->localTail - *ring->sqTail;
+	__atomic_store_n(ring->sqTail, ring->localTail, __ATOMIC_RELEASE);
+	while (toSubmit > 0) {
+		int n = sys_io_uring_enter(ring->fd, toSubmit, 0, 0);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		toSubmit -= (unsigned)n;
+	}
+	return true;
+}
+
+static bool IoRing_wait(IoRing* ring, struct io_uring_cqe* out) {
+	for (;;) {
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		if (head != tail) {
+			*out = ring->cqes[head & *ring->cqMask];
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		if (sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return false;
+	}
+}
+
+IoReader* IoReader_create(void) {
+	IoReader* reader = (IoReader*)calloc(1, sizeof(IoReader));
+	if (!reader) return NULL;
+	reader->ringAvailable = IoRing_init(&reader->ring, IO_RING_ENTRIES);
+	return reader;
+}
+
+bool IoReader_usesRing(const IoReader* reader) {
+	return reader->ringAvailable;
+}
+
+static bool queueRead(IoReader* reader, ReadRequest* request) {
+	struct io_uring_sqe* sqe = IoRing_getSqe(&reader->ring);
+	if (!sqe) return false;
+	size_t remaining = request->src.size - request->done;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = request->src.fd;
+	sqe->addr = (uint64_t)(uintptr_t)(request->buffer + request->done);
+	sqe->len = (uint32_t)(remaining < IO_READ_CHUNK ? remaining : IO_READ_CHUNK);
+	sqe->off = request->done;
+	sqe->user_data = (uint64_t)(request - reader->requests);
+	return true;
+}
+
+// The whole head of a mapped file at once, decoders then find it in the page cache instead of faulting it in page by page
+static bool queueReadahead(IoReader* reader, ReadRequest* request) {
+	struct io_uring_sqe* sqe = IoRing_getSqe(&reader->ring);
+	if (!sqe) return false;
+	size_t size = request->src.size;
+	sqe->opcode = IORING_OP_FADVISE;
+	sqe->fd = request->src.fd;
+	sqe->off = 0;
+	sqe->len = (uint32_t)(size < FILE_SOURCE_WILLNEED_BYTES ? size : FILE_SOURCE_WILLNEED_BYTES);
+	sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+	sqe->user_data = (uint64_t)(request - reader->requests);
+	return true;
+}
+
+// Frees what prepareRequest set up, the request goes back to the blocking path
+static void dropPrepared(ReadRequest* request) {
+	if (request->src.mapped) {
+		FileSource_close(&request->src);
+	} else {
+		free(request->buffer);
+		if (request->src.fd >= 0) close(request->src.fd);
+	}
+	request->buffer = NULL;
+	memset(&request->src, 0, sizeof(request->src));
+	request->src.fd = -1;
+}
+
+// Opens the file and either maps it with readahead on the ring or prepares a buffer for a ring read
+static void prepareRequest(IoReader* reader, ReadRequest* request) {
+	int fd = open(request->path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		if (fd >= 0) close(fd);
+		request->status = REQUEST_FAILED;
+		return;
+	}
+	size_t size = (size_t)st.st_size;
+	// Zero-copy, a filesystem refusing mmap gets the copy below
+	void* view = request->map ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (view != MAP_FAILED) {
+		madvise(view, size, MADV_SEQUENTIAL);
+		request->src = (FileSource){ .data = (const uint8_t*)view, .size = size, .fd = fd, .mapped = true };
+		if (queueReadahead(reader, request)) {
+			request->status = REQUEST_INFLIGHT;
+			reader->inflight++;
+		} else {
+			madvise(view, size < FILE_SOURCE_WILLNEED_BYTES ? size : FILE_SOURCE_WILLNEED_BYTES, MADV_WILLNEED);
+			request->status = REQUEST_READY;
+		}
+		return;
+	}
+	request->buffer = (uint8_t*)malloc(size);
+	if (!request->buffer) {
+		close(fd);
+		request->status = REQUEST_FAILED;
+		return;
+	}
+	request->src.fd = fd;
+	request->src.size = size;
+	request->done = 0;
+	if (queueRead(reader, request)) {
+		request->status = REQUEST_INFLIGHT;
+		reader->inflight++;
+	} else {
+		request->status = REQUEST_QUEUED;
+	}
+}
+
+static void releaseRequest(ReadRequest* request) {
+	if (request->status == REQUEST_READY || request->status == REQUEST_QUEUED || request->status == REQUEST_INFLIGHT) {
+		if (request->buffer) {
+			free(request->buffer);
+			if (request->src.fd >= 0) close(request->src.fd);
+		} else {
+			FileSource_close(&request->src);
+		}
+	}
+	free(request->path);
+	memset(request, 0, sizeof(*request));
+	request->src.fd = -1;
+}
+
+void IoReader_submit(IoReader* reader, const char* const* paths, const int* tags, const bool* map, int count) {
+	IoReader_cancel(reader);
+	if (count > IO_READER_MAX_BATCH) count = IO_READER_MAX_BATCH;
+	for (int i = 0; i < count; ++i) {
+		ReadRequest* request = &reader->requests[i];
+		memset(request, 0, sizeof(*request));
+		request->src.fd = -1;
+		request->tag = tags[i];
+		request->map = map[i];
+		request->path = strdup(paths[i]);
+		request->status = request->path ? REQUEST_QUEUED : REQUEST_FAILED;
+	}
+	reader->count = count;
+	if (!reader->ringAvailable) return;
+
+	for (int i = 0; i < count; ++i) {
+		if (reader->requests[i].status == REQUEST_QUEUED) prepareRequest(reader, &reader->requests[i]);
+	}
+	if (reader->inflight > 0 && !IoRing_submit(&reader->ring)) {
+		// The ring refused the batch, nothing reached the kernel
+		reader->ringAvailable = false;
+		reader->inflight = 0;
+		for (int i = 0; i < count; ++i) {
+			ReadRequest* request = &reader->requests[i];
+			if (request->status != REQUEST_INFLIGHT) continue;
+			dropPrepared(request);
+			request->status = REQUEST_QUEUED;
+		}
+		IoRing_destroy(&reader->ring);
+	}
+}
+
+static void completeRequest(IoReader* reader, const struct io_uring_cqe* cqe) {
+	if (cqe->user_data >= (uint64_t)reader->count) return;
+	ReadRequest* request = &reader->requests[cqe->user_data];
+	reader->inflight--;
+	// Readahead is only a hint, a kernel without IORING_OP_FADVISE still has the mapping
+	if (request->src.mapped) {
+		request->status = REQUEST_READY;
+		return;
+	}
+	if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+		// Kernels without IORING_OP_READ and odd filesystems take the blocking path
+		free(request->buffer);
+		close(request->src.fd);
+		request->buffer = NULL;
+		request->status = FileSource_open(&request->src, request->path, request->map) ? REQUEST_READY : REQUEST_FAILED;
+		return;
+	}
+	if (cqe->res == 0 && request->done < request->src.size) {
+		request->status = REQUEST_FAILED; // truncated while reading
+		free(request->buffer);
+		close(request->src.fd);
+		request->buffer = NULL;
+		return;
+	}
+	if (cqe->res > 0) request->done += (size_t)cqe->res;
+	if (request->done >= request->src.size) {
+		request->src.data = request->buffer;
+		request->src.mapped = false;
+		request->buffer = NULL;
+		request->status = REQUEST_READY;
+		return;
+	}
+	// Short read, ask for the rest
+	if (queueRead(reader, request) && IoRing_submit(&reader->ring)) {
+		reader->inflight++;
+	} else {
+		request->status = REQUEST_FAILED;
+		free(request->buffer);
+		close(request->src.fd);
+		request->buffer = NULL;
+	}
+}
+
+static bool takeFinished(IoReader* reader, int* tag, FileSource* src, bool* ok) {
+	for (int i = 0; i < reader->count; ++i) {
+		ReadRequest* request = &reader->requests[i];
+		if (request->status != REQUEST_READY && request->status != REQUEST_FAILED) continue;
+		*tag = request->tag;
+		*ok = request->status == REQUEST_READY;
+		if (*ok) {
+			*src = request->src;
+		}
+		free(request->path);
+		memset(request, 0, sizeof(*request));
+		request->src.fd = -1;
+		request->status = REQUEST_UNUSED;
+		return true;
+	}
+	return false;
+}
+
+bool IoReader_next(IoReader* reader, int* tag, FileSource* src, bool* ok) {
+	memset(src, 0, sizeof(*src));
+	src->fd = -1;
+	for (;;) {
+		if (takeFinished(reader, tag, src, ok)) return true;
+		if (reader->ringAvailable && reader->inflight > 0) {
+			struct io_uring_cqe cqe;
+			if (IoRing_wait(&reader->ring, &cqe)) {
+				completeRequest(reader, &cqe);
+				continue;
+			}
+		}
+		// Blocking fallback, one file at a time in submission order
+		ReadRequest* queued = NULL;
+		for (int i = 0; i < reader->count && !queued; ++i) {
+			if (reader->requests[i].status == REQUEST_QUEUED) queued = &reader->requests[i];
+		}
+		if (!queued) return false;
+		if (queued->buffer) {
+			free(queued->buffer);
+			close(queued->src.fd);
+			queued->buffer = NULL;
+		}
+		queued->status = FileSource_open(&queued->src, queued->path, queued->map) ? REQUEST_READY : REQUEST_FAILED;
+	}
+}
+
+void IoReader_cancel(IoReader* reader) {
+	// Buffers of reads in flight still belong to the kernel
+	while (reader->ringAvailable && reader->inflight > 0) {
+		struct io_uring_cqe cqe;
+		if (!IoRing_wait(&reader->ring, &cqe)) break;
+		if (cqe.user_data < (uint64_t)reader->count) {
+			reader->requests[cqe.user_data].status = REQUEST_QUEUED;
+		}
+		reader->inflight--;
+	}
+	for (int i = 0; i < reader->count; ++i) {
+		releaseRequest(&reader->requests[i]);
+	}
+	reader->count = 0;
+	reader->inflight = 0;
+}
+
+void IoReader_destroy(IoReader* reader) {
+	if (!reader) return;
+	IoReader_cancel(reader);
+	if (reader->ringAvailable) IoRing_destroy(&reader->ring);
+	free(reader);
+}
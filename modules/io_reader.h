@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "file_source.h"
+
+#define IO_READER_MAX_BATCH 16
+
+typedef struct IoReader IoReader;
+
+// Falls back to blocking reads when io_uring is unavailable, never returns NULL unless out of memory
+IoReader* IoReader_create(void);
+void IoReader_destroy(IoReader* reader);
+bool IoReader_usesRing(const IoReader* reader);
+
+// Opens every file and hands all reads to the kernel in a single submission.
+// Files with `map` true are mapped and the ring only starts their readahead, the others are copied through it.
+void IoReader_submit(IoReader* reader, const char* const* paths, const int* tags, const bool* map, int count);
+// Next file of the batch in completion order, false once the batch is drained.
+// On success the caller owns src and must FileSource_close it.
+bool IoReader_next(IoReader* reader, int* tag, FileSource* src, bool* ok);
+// Waits for reads still in flight and drops the rest of the batch
+void IoReader_cancel(IoReader* reader);
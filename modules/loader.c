@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include "loader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <stb/stb_image.h>
+#include <SDL3/SDL.h>
+
+#include "pipeline.h"
+#include "io_reader.h"
+#include "image_loaders.h"
+#include "tile_cache.h"
+#include "render.h"
+#include "catalog.h"
+#include "probe.h"
+#include "gif_decoder.h"
+#include "anim_stream.h"
+
+typedef unsigned char* (*ImageLoader)(const FileSource*, int*, int*, int* channels);
+typedef unsigned char* (*IndexedLoader)(const FileSource*, int*, int*, uint8_t* palette);
+typedef unsigned char* (*YuvLoader)(const FileSource*, int*, int*, YuvLayout* layout);
+typedef uint16_t* (*DeepLoader)(const FileSource*, int*, int*, int* channels, DeepFormat* format);
+
+typedef struct {
+	ImageFormat format;
+	ImageLoader loader;
+	IndexedLoader indexed; // tried first, NULL when the image has no palette
+	DeepLoader deep; // tried next, NULL when the format is never more than 8 bits
+	YuvLoader yuv; // tried then, NULL when the format is never YCbCr
+	ImageStreamer stream;
+	CodecLib lib;
+	const AnimBackend* animation; // NULL for formats that are only ever still
+} DecoderEntry;
+
+typedef struct {
+	int index;
+	char* path;
+	bool map; // false once the watcher saw the file rewritten, a truncation under a mapping raises SIGBUS
+	FileSource src;
+	const DecoderEntry* decoder;
+	ImageProbe probe;
+	bool animated;
+	bool buildTiles;
+	LoadResult result;
+} LoadJob;
+
+static unsigned char* stbi_load_simple(const FileSource* src, int* width, int* height, int* channels) {
+	if (src->size > INT32_MAX) return NULL;
+	return stbi_load_from_memory(src->data, (int)src->size, width, height, channels, 0); // as many channels as the file has
+}
+
+// BMP and TGA go to the stb fallback
+static const DecoderEntry decoders[] = {
+	{IMAGE_FORMAT_GIF,  loadImage_Gif,       loadImage_GifIndexed,  NULL,                   NULL,                   NULL,                  CODEC_LIB_NONE, &AnimBackend_Gif},
+	{IMAGE_FORMAT_PNG,  loadImage_SPNG,      loadImage_SPNGIndexed, loadImage_SPNGDeep,     NULL,                   streamImage_SPNG,      CODEC_LIB_SPNG, &AnimBackend_Apng},
+	{IMAGE_FORMAT_JPEG, loadImage_JpegTurbo, NULL,                  NULL,                   loadImage_JpegTurboYuv, streamImage_JpegTurbo, CODEC_LIB_JPEG, NULL},
+	{IMAGE_FORMAT_WEBP, loadImage_WebP,      NULL,                  NULL,                   NULL,                   NULL,                  CODEC_LIB_WEBP, &AnimBackend_WebP},
+	{IMAGE_FORMAT_HEIF, loadImage_HeifAvif,  NULL,                  loadImage_HeifAvifDeep, loadImage_HeifAvifYuv,  NULL,                  CODEC_LIB_HEIF, NULL},
+	{IMAGE_FORMAT_AVIF, loadImage_HeifAvif,  NULL,                  loadImage_HeifAvifDeep, loadImage_HeifAvifYuv,  NULL,                  CODEC_LIB_HEIF, &AnimBackend_Avif},
+	{IMAGE_FORMAT_TIFF, loadImage_Tiff,      NULL,                  loadImage_TiffDeep,     NULL,                   streamImage_Tiff,      CODEC_LIB_TIFF, NULL},
+	{IMAGE_FORMAT_JXL,  loadImage_Jxl,       NULL,                  loadImage_JxlDeep,      NULL,                   NULL,                  CODEC_LIB_JXL,  &AnimBackend_Jxl}
+};
+static const DecoderEntry fallbackDecoder = { IMAGE_FORMAT_NONE, stbi_load_simple, NULL, NULL, NULL, NULL, CODEC_LIB_NONE, NULL };
+
+static struct {
+	bool started;
+	atomic_bool stopping;
+	atomic_int inFlight; // jobs created and not yet freed, background work waits for zero
+	SDL_Thread* readThread;
+	SDL_Mutex* pendingMutex;
+	SDL_Condition* pendingCv;
+	int wanted[LOADER_MAX_WANTED]; // guarded by pendingMutex, most urgent first
+	int wantedCount;
+	LoadJob* pending[LOADER_MAX_PENDING];
+	int pendingCount;
+	char* readahead[READAHEAD_COUNT];
+	int readaheadCount;
+	BoundedQueue probeQueue, decodeQueue, postQueue, readyQueue;
+	Stage probeStage, decodeStage, postStage;
+} loader;
+
+// Position in the wanted set, -1 once navigation moved away from the image
+static int wantedRankLocked(int index) {
+	for (int i = 0; i < loader.wantedCount; ++i) {
+		if (loader.wanted[i] == index) return i;
+	}
+	return -1;
+}
+
+static bool isStale(const LoadJob* job) {
+	if (atomic_load(&loader.stopping)) return true;
+	SDL_LockMutex(loader.pendingMutex);
+	bool stale = wantedRankLocked(job->index) < 0;
+	SDL_UnlockMutex(loader.pendingMutex);
+	return stale;
+}
+
+void loader_discardResult(LoadResult* result) {
+	free(result->data);
+	free(result->palette);
+	free(result->reduced);
+	free(result->yuv);
+	free(result->coefficients);
+	TiledImage_close(result->tiled);
+	AnimStream_close(result->anim_stream);
+	memset(result, 0, sizeof(*result));
+}
+
+static void freeJob(LoadJob* job) {
+	FileSource_close(&job->src);
+	loader_discardResult(&job->result);
+	free(job->path);
+	free(job);
+	atomic_fetch_sub(&loader.inFlight, 1);
+}
+
+static void forward(BoundedQueue* queue, LoadJob* job) {
+	if (!BoundedQueue_push(queue, job)) freeJob(job);
+}
+
+static const DecoderEntry* decoderForFormat(ImageFormat format) {
+	for (size_t i = 0; i < sizeof(decoders)/sizeof(decoders[0]); ++i) {
+		if (decoders[i].format == format) return &decoders[i];
+	}
+	return &fallbackDecoder;
+}
+
+// Nearest jobs first, stale ones are dropped on the way
+static int takePending(LoadJob** batch, char** readahead, int* readaheadCount) {
+	SDL_LockMutex(loader.pendingMutex);
+	while (loader.pendingCount == 0 && !atomic_load(&loader.stopping)) {
+		SDL_WaitCondition(loader.pendingCv, loader.pendingMutex);
+	}
+	if (atomic_load(&loader.stopping)) {
+		SDL_UnlockMutex(loader.pendingMutex);
+		return -1;
+	}
+	int kept = 0;
+	for (int i = 0; i < loader.pendingCount; ++i) {
+		LoadJob* job = loader.pending[i];
+		int rank = wantedRankLocked(job->index);
+		if (rank < 0) {
+			freeJob(job);
+			continue;
+		}
+		int j = kept++;
+		while (j > 0 && wantedRankLocked(loader.pending[j - 1]->index) > rank) {
+			loader.pending[j] = loader.pending[j - 1];
+			--j;
+		}
+		loader.pending[j] = job;
+	}
+	int count = kept < IO_READER_MAX_BATCH ? kept : IO_READER_MAX_BATCH;
+	memcpy(batch, loader.pending, sizeof(LoadJob*) * count);
+	memmove(loader.pending, loader.pending + count, sizeof(LoadJob*) * (kept - count));
+	loader.pendingCount = kept - count;
+	*readaheadCount = 0;
+	if (loader.pendingCount == 0) {
+		memcpy(readahead, loader.readahead, sizeof(char*) * loader.readaheadCount);
+		*readaheadCount = loader.readaheadCount;
+		loader.readaheadCount = 0;
+	}
+	SDL_UnlockMutex(loader.pendingMutex);
+	return count;
+}
+
+// Stage 1: stat and read, the whole batch is in flight at once and files move on in completion order
+static int read_thread_func(void* data) {
+	(void)data;
+	IoReader* reader = IoReader_create();
+	if (!reader) {
+		SDL_Log("Image loader could not start");
+		return -1;
+	}
+	if (!IoReader_usesRing(reader)) SDL_Log("io_uring unavailable, reading files synchronously");
+
+	for (;;) {
+		LoadJob* batch[IO_READER_MAX_BATCH];
+		char* readahead[READAHEAD_COUNT];
+		int readaheadCount;
+		int count = takePending(batch, readahead, &readaheadCount);
+		if (count < 0) break;
+
+		const char* paths[IO_READER_MAX_BATCH];
+		int tags[IO_READER_MAX_BATCH];
+		bool map[IO_READER_MAX_BATCH];
+		for (int i = 0; i < count; ++i) {
+			paths[i] = batch[i]->path;
+			tags[i] = i;
+			map[i] = batch[i]->map;
+		}
+		IoReader_submit(reader, paths, tags, map, count);
+		int tag;
+		FileSource src;
+		bool ok;
+		while (IoReader_next(reader, &tag, &src, &ok)) {
+			LoadJob* job = batch[tag];
+			batch[tag] = NULL;
+			if (ok) {
+				job->src = src;
+				job->result.fileSize = src.size;
+				forward(&loader.probeQueue, job);
+			} else {
+				forward(&loader.readyQueue, job);
+			}
+		}
+
+		// Warm the files after the window once it no longer competes for the disk
+		for (int i = 0; i < readaheadCount; ++i) {
+			if (!atomic_load(&loader.stopping)) FileSource_willNeed(readahead[i]);
+			free(readahead[i]);
+		}
+	}
+	IoReader_destroy(reader);
+	return 0;
+}
+
+// Stage 2: sniff the content, read the header and decide between a texture and the out-of-core tile cache
+static void probeStage(void* item) {
+	LoadJob* job = (LoadJob*)item;
+	if (isStale(job)) {
+		freeJob(job);
+		return;
+	}
+	// The extension only matters for TGA, which has no magic bytes
+	ImageFormat hint = ImageFormat_fromName(job->path, strlen(job->path));
+	if (!Probe_image(job->src.data, job->src.size, hint, &job->probe)) {
+		// Not an image we know or a damaged header, no decoder gets to see it
+		forward(&loader.readyQueue, job);
+		return;
+	}
+	job->result.captureTime = job->probe.captureTime;
+	job->result.frameCount = job->probe.frameCount;
+	job->decoder = decoderForFormat(job->probe.format);
+	// The first image of a format opens its library here, off the main thread
+	if (!CodecLib_load(job->decoder->lib)) {
+		if (job->probe.format == IMAGE_FORMAT_PNG || job->probe.format == IMAGE_FORMAT_JPEG) {
+			// stb still reads PNG and JPEG, only without the tile cache and animation
+			job->decoder = &fallbackDecoder;
+		} else if (!job->decoder->animation || job->probe.frameCount == 1) {
+			forward(&loader.readyQueue, job);
+			return;
+		}
+	}
+	// Animation backends open libraries of their own, libavif for AVIF sequences
+	job->animated = job->decoder->animation && job->probe.frameCount != 1;
+	if (job->decoder->stream) {
+		TiledImage* tiled = TileCache_find(job->path);
+		if (tiled) {
+			job->result.tiled = tiled;
+			job->result.width = (int)tiled->width;
+			job->result.height = (int)tiled->height;
+			job->result.success = true;
+		} else {
+			job->buildTiles = TileCache_shouldUse(job->probe.width, job->probe.height, g_appState.maxTextureSize);
+		}
+	}
+	if (!job->result.tiled && !job->buildTiles && (uint64_t)job->probe.width * job->probe.height * 4 > LOADER_MAX_DECODE_BYTES) {
+		SDL_Log("%s is %dx%d, too large to decode", job->path, job->probe.width, job->probe.height);
+		forward(&loader.readyQueue, job);
+		return;
+	}
+	forward(&loader.decodeQueue, job);
+}
+
+// Stage 3: the CPU-heavy part, runs on most cores
+static void decodeStage(void* item) {
+	LoadJob* job = (LoadJob*)item;
+	if (isStale(job)) {
+		freeJob(job);
+		return;
+	}
+	LoadResult* result = &job->result;
+	if (result->tiled) {
+		// Tile cache hit, nothing to decode
+	} else if (job->buildTiles) {
+		result->tiled = TileCache_build(job->path, &job->src, job->probe.width, job->probe.height,
+			job->decoder->stream, &g_appState.loader_running);
+		if (result->tiled) {
+			result->width = (int)result->tiled->width;
+			result->height = (int)result->tiled->height;
+			result->channels = 4;
+			result->success = true;
+		}
+	} else {
+		if (job->animated) {
+			// Frames of an animation that will be packed into a texture array come whole,
+			// sequences whose length only a full walk would tell are always streamed
+			uint64_t arrayBytes = (uint64_t)job->probe.width * job->probe.height * 4 * job->probe.frameCount;
+			bool fullFrames = job->probe.frameCount > 0 && job->probe.frameCount <= g_appState.maxArrayLayers &&
+				arrayBytes <= ANIMATION_VRAM_BUDGET;
+			result->anim_stream = AnimStream_open(job->decoder->animation, &job->src, fullFrames,
+				&result->data, &result->width, &result->height);
+			result->channels = 4;
+			result->success = result->anim_stream != NULL;
+		}
+		if (!result->success && job->decoder->indexed) {
+			// A quarter of the RGBA size in RAM and VRAM, the shader looks the colors up
+			result->palette = (uint8_t*)calloc(256, 4);
+			if (result->palette) result->data = job->decoder->indexed(&job->src, &result->width, &result->height, result->palette);
+			result->channels = 1;
+			result->success = (result->data != NULL);
+			if (!result->success) {
+				free(result->palette);
+				result->palette = NULL;
+			}
+		}
+		if (!result->success && atomic_load(&g_appState.gpuJpeg) && job->probe.format == IMAGE_FORMAT_JPEG &&
+			job->probe.width + 16 <= g_appState.maxTextureSize && job->probe.height + 16 <= g_appState.maxTextureSize) {
+			// Entropy decoding only, the rest happens on the GPU at upload, block padding included in the limit
+			result->coefficients = (JpegCoefficients*)calloc(1, sizeof(JpegCoefficients));
+			if (result->coefficients) {
+				result->data = (unsigned char*)loadImage_JpegTurboCoefficients(&job->src, &result->width, &result->height, result->coefficients);
+			}
+			result->success = (result->data != NULL);
+			if (!result->success) {
+				free(result->coefficients);
+				result->coefficients = NULL;
+			}
+		}
+		if (!result->success && job->decoder->deep &&
+			(uint64_t)job->probe.width * job->probe.height * 8 <= LOADER_MAX_DECODE_BYTES) {
+			// 16-bit and HDR files keep their precision, the shader does exposure and tone mapping
+			DeepFormat format = { SAMPLE_UINT8, 1.0f };
+			result->data = (unsigned char*)job->decoder->deep(&job->src, &result->width, &result->height, &result->channels, &format);
+			result->success = (result->data != NULL);
+			result->sample = format.sample;
+			result->peak = format.peak;
+		}
+		if (!result->success && job->decoder->yuv) {
+			// Half the RGB size for 4:2:0, the shader does the color conversion and chroma upsampling
+			result->yuv = (YuvLayout*)calloc(1, sizeof(YuvLayout));
+			if (result->yuv) result->data = job->decoder->yuv(&job->src, &result->width, &result->height, result->yuv);
+			result->success = (result->data != NULL);
+			if (!result->success) {
+				free(result->yuv);
+				result->yuv = NULL;
+			}
+		}
+		if (!result->success) {
+			ImageLoader load = job->decoder->loader ? job->decoder->loader : fallbackDecoder.loader;
+			result->data = load(&job->src, &result->width, &result->height, &result->channels);
+			result->success = (result->data != NULL);
+		}
+	}
+	// Decoded pixels live on as a texture, the file pages would only evict someone else's
+	FileSource_closeDropCache(&job->src);
+	forward(&loader.postQueue, job);
+}
+
+// Drops an alpha channel that is 255 everywhere and the color of an image that is gray everywhere,
+// decoders that only know RGBA still end up with the smallest texture
+static void reduceChannels(LoadResult* result) {
+	int channels = result->channels;
+	bool hasAlpha = channels == 2 || channels == 4;
+	bool hasColor = channels >= 3;
+	bool opaque = true, gray = true;
+	size_t pixels = (size_t)result->width * (size_t)result->height;
+	const uint8_t* p = result->data;
+	for (size_t i = 0; i < pixels && ((hasAlpha && opaque) || (hasColor && gray)); ++i, p += channels) {
+		if (hasAlpha && p[channels - 1] != 255) opaque = false;
+		if (hasColor && (p[0] != p[1] || p[0] != p[2])) gray = false;
+	}
+	int reduced = (hasColor && !gray ? 3 : 1) + (hasAlpha && !opaque ? 1 : 0);
+	if (reduced != channels) {
+		// Every pixel moves to a lower address, packing in place is safe
+		const uint8_t* src = result->data;
+		uint8_t* dest = result->data;
+		int colors = reduced - (hasAlpha && !opaque ? 1 : 0);
+		for (size_t i = 0; i < pixels; ++i, src += channels) {
+			for (int c = 0; c < colors; ++c) *dest++ = src[c];
+			if (reduced != colors) *dest++ = src[channels - 1];
+		}
+		unsigned char* smaller = (unsigned char*)realloc(result->data, pixels * (size_t)reduced);
+		if (smaller) result->data = smaller;
+		result->channels = reduced;
+	}
+	result->opaque = !hasAlpha || opaque;
+}
+
+// Half-size colors for zoomed-out views of indexed data, which cannot have mipmaps of its own since
+// averaging indices would mix unrelated entries. An odd last row or column is clamped to the edge.
+static unsigned char* reducePalette(const LoadResult* result) {
+	int width = result->width, height = result->height;
+	int reducedWidth = (width + 1) / 2, reducedHeight = (height + 1) / 2;
+	unsigned char* reduced = (unsigned char*)malloc((size_t)reducedWidth * reducedHeight * 4);
+	if (!reduced) return NULL;
+	unsigned char* dest = reduced;
+	for (int y = 0; y < reducedHeight; ++y) {
+		const uint8_t* row0 = result->data + (size_t)(2 * y) * width;
+		const uint8_t* row1 = 2 * y + 1 < height ? row0 + width : row0;
+		for (int x = 0; x < reducedWidth; ++x) {
+			int x0 = 2 * x, x1 = x0 + 1 < width ? x0 + 1 : x0;
+			const uint8_t* c00 = result->palette + row0[x0] * 4;
+			const uint8_t* c10 = result->palette + row0[x1] * 4;
+			const uint8_t* c01 = result->palette + row1[x0] * 4;
+			const uint8_t* c11 = result->palette + row1[x1] * 4;
+			for (int c = 0; c < 4; ++c) *dest++ = (unsigned char)((c00[c] + c10[c] + c01[c] + c11[c] + 2) / 4);
+		}
+	}
+	return reduced;
+}
+
+// Stage 4: bring pixels into the layout the upload expects, as few channels as the image needs
+static void postStage(void* item) {
+	LoadJob* job = (LoadJob*)item;
+	if (isStale(job)) {
+		freeJob(job);
+		return;
+	}
+	LoadResult* result = &job->result;
+	if (result->yuv || result->coefficients) {
+		result->opaque = true;
+	} else if (result->sample != SAMPLE_UINT8) {
+		// Deep pixels keep the layout of the file
+		result->opaque = result->channels == 1 || result->channels == 3;
+	} else if (result->palette && result->data) {
+		result->reduced = reducePalette(result);
+	} else if (result->success && result->data && !result->anim_stream && !result->tiled) {
+		reduceChannels(result);
+	} else if (result->tiled) {
+		// Tiles are RGBA, but a JPEG never has alpha in them
+		result->opaque = job->probe.format == IMAGE_FORMAT_JPEG;
+	}
+	// Stage 5 is the GL upload on the main thread
+	forward(&loader.readyQueue, job);
+}
+
+bool loader_pollResult(LoadResult* result) {
+	void* item;
+	if (!loader.started || !BoundedQueue_tryPop(&loader.readyQueue, &item)) return false;
+	LoadJob* job = (LoadJob*)item;
+	*result = job->result;
+	result->index = job->index;
+	memset(&job->result, 0, sizeof(job->result));
+	freeJob(job);
+	return true;
+}
+
+// A job that found no room, the next request queues the image again, or the full decode of a compressed one
+static void unqueue(int index) {
+	ImageCatalog* catalog = &g_appState.images;
+	if (catalog->items[index].state == IMAGE_STATE_LOADING) ImageCatalog_setState(catalog, index, IMAGE_STATE_UNLOADED);
+	ResidentImage* res = catalog->items[index].state == IMAGE_STATE_LOADED ? ImageCatalog_resident(catalog, index) : NULL;
+	if (res) res->reloading = false;
+}
+
+void loader_submit(const int* wanted, int wantedCount, const int* jobs, int jobCount, const int* readahead, int readaheadCount) {
+	if (!loader.started) return;
+	SDL_LockMutex(loader.pendingMutex);
+	if (wantedCount > LOADER_MAX_WANTED) wantedCount = LOADER_MAX_WANTED;
+	memcpy(loader.wanted, wanted, sizeof(int) * wantedCount);
+	loader.wantedCount = wantedCount;
+	// Jobs the new window no longer wants make room before the limit is checked
+	int kept = 0;
+	for (int i = 0; i < loader.pendingCount; ++i) {
+		if (wantedRankLocked(loader.pending[i]->index) < 0) freeJob(loader.pending[i]);
+		else loader.pending[kept++] = loader.pending[i];
+	}
+	loader.pendingCount = kept;
+	for (int i = 0; i < jobCount; ++i) {
+		LoadJob* job = loader.pendingCount < LOADER_MAX_PENDING ? (LoadJob*)calloc(1, sizeof(LoadJob)) : NULL;
+		if (job) {
+			job->index = jobs[i];
+			job->path = strdup(ImageCatalog_path(&g_appState.images, jobs[i]));
+			job->map = !(g_appState.images.flags[jobs[i]] & IMAGE_FLAG_REWRITTEN);
+			job->src.fd = -1;
+		}
+		if (!job || !job->path) {
+			free(job);
+			unqueue(jobs[i]);
+			continue;
+		}
+		loader.pending[loader.pendingCount++] = job;
+		atomic_fetch_add(&loader.inFlight, 1);
+	}
+	for (int i = 0; i < loader.readaheadCount; ++i) free(loader.readahead[i]);
+	loader.readaheadCount = 0;
+	for (int i = 0; i < readaheadCount && i < READAHEAD_COUNT; ++i) {
+		char* path = strdup(ImageCatalog_path(&g_appState.images, readahead[i]));
+		if (path) loader.readahead[loader.readaheadCount++] = path;
+	}
+	SDL_SignalCondition(loader.pendingCv);
+	SDL_UnlockMutex(loader.pendingMutex);
+}
+
+bool loader_busy(void) {
+	return loader.started && atomic_load(&loader.inFlight) > 0;
+}
+
+void loader_start() {
+	memset(&loader, 0, sizeof(loader));
+	atomic_store(&g_appState.loader_running, true);
+	atomic_store(&loader.stopping, false);
+	loader.pendingMutex = SDL_CreateMutex();
+	loader.pendingCv = SDL_CreateCondition();
+	BoundedQueue_init(&loader.probeQueue, LOADER_QUEUE_CAPACITY);
+	BoundedQueue_init(&loader.decodeQueue, LOADER_QUEUE_CAPACITY);
+	BoundedQueue_init(&loader.postQueue, LOADER_QUEUE_CAPACITY);
+	BoundedQueue_init(&loader.readyQueue, LOADER_QUEUE_CAPACITY);
+
+	// Decoding gets every core the other stages and the render thread leave over
+	int cores = SDL_GetNumLogicalCPUCores();
+	int decodeThreads = cores - 1 - LOADER_PROBE_THREADS - LOADER_POST_THREADS;
+	if (decodeThreads < 1) decodeThreads = 1;
+	Stage_start(&loader.probeStage, "ImageProbe", LOADER_PROBE_THREADS, &loader.probeQueue, probeStage);
+	Stage_start(&loader.decodeStage, "ImageDecode", decodeThreads, &loader.decodeQueue, decodeStage);
+	Stage_start(&loader.postStage, "ImagePost", LOADER_POST_THREADS, &loader.postQueue, postStage);
+	loader.readThread = SDL_CreateThread(read_thread_func, "ImageRead", NULL);
+	loader.started = true;
+}
+
+static void drainQueue(BoundedQueue* queue) {
+	void* item;
+	while (BoundedQueue_tryPop(queue, &item)) freeJob((LoadJob*)item);
+}
+
+void loader_stop() {
+	if (!loader.started) return;
+	atomic_store(&g_appState.loader_running, false);
+	atomic_store(&loader.stopping, true);
+	// Close everything before joining, a producer blocked on a full queue would never return otherwise
+	SDL_LockMutex(loader.pendingMutex);
+	SDL_BroadcastCondition(loader.pendingCv);
+	SDL_UnlockMutex(loader.pendingMutex);
+	BoundedQueue_close(&loader.probeQueue);
+	BoundedQueue_close(&loader.decodeQueue);
+	BoundedQueue_close(&loader.postQueue);
+	BoundedQueue_close(&loader.readyQueue);
+	SDL_WaitThread(loader.readThread, NULL);
+	Stage_join(&loader.probeStage);
+	Stage_join(&loader.decodeStage);
+	Stage_join(&loader.postStage);
+
+	for (int i = 0; i < loader.pendingCount; ++i) freeJob(loader.pending[i]);
+	for (int i = 0; i < loader.readaheadCount; ++i) free(loader.readahead[i]);
+	drainQueue(&loader.probeQueue);
+	drainQueue(&loader.decodeQueue);
+	drainQueue(&loader.postQueue);
+	drainQueue(&loader.readyQueue);
+	BoundedQueue_destroy(&loader.probeQueue);
+	BoundedQueue_destroy(&loader.decodeQueue);
+	BoundedQueue_destroy(&loader.postQueue);
+	BoundedQueue_destroy(&loader.readyQueue);
+	SDL_DestroyMutex(loader.pendingMutex);
+	SDL_DestroyCondition(loader.pendingCv);
+	loader.started = false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include "main_structs.h"
+#include "flipbook.h"
+
+// Stage graph: read (io_uring batches) -> probe -> decode -> post-process -> upload-ready,
+// every arrow a bounded queue so a slow stage throttles the ones feeding it
+#define LOADER_QUEUE_CAPACITY 4
+#define LOADER_PROBE_THREADS 1
+#define LOADER_POST_THREADS 1
+#define LOADER_MAX_PENDING 64
+#define LOADER_MAX_WANTED (FLIPBOOK_MAX_AHEAD + 1) // a flipbook's window, the prefetch window takes 2 * PREFETCH_RADIUS + 1
+#define LOADER_MAX_DECODE_BYTES ((uint64_t)2 << 30) // RGBA8 size past which an image that cannot be tiled is refused before decoding
+
+void loader_start(void);
+void loader_stop(void);
+// Replaces the wanted set, current image first, and queues `jobs` out of it.
+// Queued or in-flight jobs for images no longer wanted are dropped by whichever stage sees them next.
+// Jobs that find the pending list full leave their image UNLOADED for the next call, main thread only.
+void loader_submit(const int* wanted, int wantedCount, const int* jobs, int jobCount, const int* readahead, int readaheadCount);
+// Upload-ready results for the main thread, never blocks
+bool loader_pollResult(LoadResult* result);
+void loader_discardResult(LoadResult* result);
+// True while any requested image is still being read or decoded
+bool loader_busy(void);
@@ -5,8 +5,18 @@
 #include <stdbool.h>
 #include "glad.h"
 #include <SDL3/SDL.h>
-#include <SDL3_image/SDL_image.h> 
 #include <stdatomic.h>
+#include "tile_cache.h"
+#include "anim_stream.h"
+#include "image_loaders.h"
+
+#define PREFETCH_RADIUS 2 // neighbors on each side read, decoded and kept as textures
+#define READAHEAD_COUNT 4 // files past the window, in navigation order, pulled into the page cache
+#define ANIMATION_VRAM_BUDGET ((uint64_t)512 * 1024 * 1024) // animations kept whole as texture arrays, larger ones are streamed
+#define ANIMATION_RESYNC_NS ((Uint64)1000 * 1000 * 1000) // playback further behind than this restarts from the frame on screen
+#define EXPOSURE_MAX_STOPS 8.0f // either way from the pixels as decoded
+
+#define IMAGE_REMOVED UINT32_MAX
 
 typedef enum {
 	IMAGE_STATE_UNLOADED, 
@@ -15,61 +25,128 @@ typedef enum {
 	IMAGE_STATE_FAILED
 } ImageState;
 
+// Hot per-image fields, walked by navigation and rendering
 typedef struct {
-	char path_utf8[4096]; 
-	int32_t full_width, full_height; 
-	uint32_t fileSizeKB; 
 	ImageState state; 
+	int32_t residentSlot; // index into the residency set while LOADING or LOADED, -1 otherwise
 	GLuint textureID; 
-	
-	IMG_Animation* gif_animation;  // Gif
-	int gif_current_frame;
-	Uint32 gif_next_frame_time; 
-	SDL_Surface* converted_frame;
+	int32_t full_width, full_height; 
 } ImageMetadata;
 
+// What only an image in the residency set needs
 typedef struct {
-	ImageMetadata* items; 
+	uint32_t id;
+	AnimStream* anim_stream; // frames arrive as the changed rect only, or whole while filling a texture array
+	GLuint palette_texture; // 256x1 RGBA8 when textureID holds palette indices
+	GLuint reduced_texture; // RGBA8 mip chain from half the size of the indices, drawn when zoomed out
+	GLuint chroma_textures[2]; // Cb and Cr planes when textureID holds luma only
+	YuvMatrix yuv_matrix;
+	bool yuv_full_range;
+	int layer_count; // frames as layers of a GL_TEXTURE_2D_ARRAY in textureID, 0 for a plain texture
+	int layers_filled; // the rest is still streaming in
+	Uint32* layer_delays;
+	uint64_t layer_bytes; // counted against ANIMATION_VRAM_BUDGET
+	int anim_frame; // layer on screen
+	uint64_t anim_time_ms; // when the frame on screen started, on the animation's own timeline
+	Uint32 anim_frame_delay; // of the frame on screen
+	Uint64 anim_start_ns; // wall clock at 0 on that timeline
+	TiledImage* tiled; // out-of-core images are drawn from the tile cache instead of textureID
+	bool opaque; // drawn with blending off
+	uint8_t channels; // of textureID, 1 to 4 as createTexture took them
+	SampleType sample; // of textureID
+	float peak; // brightest linear value of a SAMPLE_FLOAT16 texture
+	bool compressed; // textures replaced by block-compressed copies after leaving the window
+	bool reloading; // compressed and back in the window, the full decode is on its way
+} ResidentImage;
+
+typedef struct StringChunk {
+	struct StringChunk* next;
+	size_t used, size;
+	char data[];
+} StringChunk;
+
+// Paths live in large chunks that never move, a path pointer stays valid for the whole session
+typedef struct {
+	StringChunk* head;
+} StringArena;
+
+typedef enum {
+	SORT_BY_NAME,
+	SORT_BY_MTIME,
+	SORT_BY_SIZE,
+	SORT_BY_CAPTURE, // falls back to mtime until the header was probed
+	SORT_MODE_COUNT
+} SortMode;
+
+#define IMAGE_FLAG_STAT_KNOWN 0x01 // mtime and file size filled in
+#define IMAGE_FLAG_REWRITTEN 0x02 // written while the viewer runs, read with pread since it may be truncated again
+#define IMAGE_FLAG_UNCONFIRMED 0x04 // taken from the saved index, gone unless the listing finds it again
+#define IMAGE_FLAG_PROBED 0x08 // header read by the harvester, dimensions and capture time are as good as they get
+
+typedef struct {
+	ImageMetadata* items; // hot, never reordered, an item's index is its id for the whole session
+	const char** paths;   // cold, interned in `arena`
+	const char** sortKeys; // cold, natural-order key per id, interned next to the path
+	uint64_t* keyPrefix;  // first key bytes, settle most name comparisons without touching the keys
+	uint32_t* fileSizeKB; // cold
+	int64_t* mtime;       // cold, seconds since the epoch
+	int64_t* captureTime; // cold, 0 until known
+	uint8_t* orientation; // cold, EXIF 1..8
+	uint8_t* flags;       // IMAGE_FLAG_*
 	size_t size, capacity;
-} ImageList;
+	uint32_t* order;    // display position -> id, sorted by `sortMode`
+	uint32_t* position; // id -> display position, IMAGE_REMOVED once the file is gone
+	size_t count;       // images in the display order
+	SortMode sortMode;
+	uint32_t* nameIndex; // open-addressing hash of paths, id + 1 per slot, 0 when empty
+	size_t nameIndexCapacity;
+	StringArena arena;
+	ResidentImage* resident; // residency set, eviction walks this instead of every image
+	size_t residentCount, residentCapacity;
+} ImageCatalog;
 
 typedef struct {
 	int index; 
-	unsigned char* data;
+	unsigned char* data; // `channels` bytes per pixel, or one index per pixel with `palette`
+	uint8_t* palette; // 256 RGBA8 entries for indexed data, NULL otherwise
+	unsigned char* reduced; // RGBA8 at half the size of indexed data, NULL otherwise
+	YuvLayout* yuv; // planes of data for YCbCr images, NULL otherwise
+	JpegCoefficients* coefficients; // data holds int16_t DCT coefficients for the GPU decoder, NULL otherwise
 	int width, height; 
+	int channels; // 1 gray, 2 gray and alpha, 3 RGB, 4 RGBA
+	SampleType sample; // of data, 16-bit samples are uint16_t
+	float peak; // brightest linear value of SAMPLE_FLOAT16 data
+	bool opaque; // no pixel lets the background through
 	bool success; 
-	bool is_gif; 
+	TiledImage* tiled;
+	AnimStream* anim_stream;
+	int frameCount; // from the header probe, 0 when unknown
+	uint64_t fileSize;
+	int64_t captureTime; // from the header probe, 0 when unknown
 } LoadResult;
 
-typedef struct LoadResultNode {
-	LoadResult value; 
-	struct LoadResultNode* next; 
-} LoadResultNode;
-
-typedef struct {
-	LoadResultNode* head; 
-	LoadResultNode* tail; 
-	SDL_Mutex* mutex; 
-} LoadResultQueue;
-
 typedef struct {
 	SDL_Window* window;
 	SDL_GLContext glContext; 
 	int windowWidth, windowHeight; 
 	bool isFullscreen; 
-	GLuint shaderProgram, vao, vbo, ebo; GLint modelLoc, projLoc; 
+	GLuint shaderProgram, vao, vbo, ebo; GLint modelLoc, projLoc, layerLoc, indexedLoc, yuvLoc, yuvMatrixLoc, yuvOffsetLoc, linearLightLoc, exposureLoc, whitePointLoc; 
 	float zoom, offsetX, offsetY; 
+	float exposure; // stops, applied in the fragment shader
+	bool toneMapping; // highlights above white are rolled off instead of clipped
 	float projectionMatrix[16], modelMatrix[16]; 
 	bool modelDirty, projectionDirty; 
-	ImageList images; 
-	int currentIndex, activeTextureIndex; 
+	ImageCatalog images; 
+	int currentIndex, activeTextureIndex; // image ids, stable while the list grows and re-sorts
+	bool scanning; // directory still being enumerated in the background
+	int maxTextureSize;
+	int maxArrayLayers;
+	atomic_bool gpuJpeg; // SHARKPIX_GPU_JPEG=1 and the shader passes compiled
+	Uint64 refreshNs; // of the display the window is on, animation frames are timed for its vblanks
+	uint64_t animationVramBytes; // held by texture arrays of resident animations
 	bool isDragging; 
-	SDL_Thread* loader_thread; 
-	LoadResultQueue loader_results; 
-	SDL_Condition* loader_cv; 
-	SDL_Mutex* loader_mutex; 
 	atomic_bool loader_running; 
-	atomic_int loader_nextImageToLoad;
+	int navDirection; // +1 forward, -1 backward
 } AppState;
 
 extern AppState g_appState;
@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL3/SDL.h>
+
+typedef struct {
+	IndexCompare compare;
+	void* user;
+} SortContext;
+
+typedef struct {
+	const SortContext* context;
+	uint32_t* ids;
+	uint32_t* scratch;
+	size_t begin, middle, end; // sorts [begin, end), or merges [begin, middle) with [middle, end)
+} SortTask;
+
+static int compareEntries(const void* a, const void* b, void* data) {
+	const SortContext* context = (const SortContext*)data;
+	return context->compare(*(const uint32_t*)a, *(const uint32_t*)b, context->user);
+}
+
+static int sortSlice(void* data) {
+	SortTask* task = (SortTask*)data;
+	qsort_r(task->ids + task->begin, task->end - task->begin, sizeof(uint32_t), compareEntries, (void*)task->context);
+	return 0;
+}
+
+static int mergeSlices(void* data) {
+	SortTask* task = (SortTask*)data;
+	const SortContext* context = task->context;
+	size_t i = task->begin, j = task->middle, k = task->begin;
+	while (i < task->middle && j < task->end) {
+		if (context->compare(task->ids[j], task->ids[i], context->user) < 0) task->scratch[k++] = task->ids[j++];
+		else task->scratch[k++] = task->ids[i++];
+	}
+	memcpy(task->scratch + k, task->ids + i, (task->middle - i) * sizeof(uint32_t));
+	k += task->middle - i;
+	memcpy(task->scratch + k, task->ids + j, (task->end - j) * sizeof(uint32_t));
+	return 0;
+}
+
+// Power of two, so the merge rounds pair up evenly
+static int sliceCount(size_t count) {
+	int slices = 1;
+	int cores = SDL_GetNumLogicalCPUCores();
+	while (slices * 2 <= cores && slices * 2 <= PARALLEL_MAX_THREADS &&
+	       count / (size_t)(slices * 2) >= PARALLEL_MIN_COUNT / 2) {
+		slices *= 2;
+	}
+	return slices;
+}
+
+// Runs every task, the first one on the calling thread
+static void runTasks(SDL_ThreadFunction func, SortTask* tasks, int count) {
+	SDL_Thread* threads[PARALLEL_MAX_THREADS] = {0};
+	for (int i = 1; i < count; ++i) threads[i] = SDL_CreateThread(func, "Sort", &tasks[i]);
+	func(&tasks[0]);
+	for (int i = 1; i < count; ++i) {
+		if (threads[i]) SDL_WaitThread(threads[i], NULL);
+		else func(&tasks[i]);
+	}
+}
+
+void Parallel_sortIndices(uint32_t* ids, size_t count, IndexCompare compare, void* user) {
+	SortContext context = { compare, user };
+	int slices = sliceCount(count);
+	uint32_t* scratch = slices > 1 ? (uint32_t*)malloc(count * sizeof(uint32_t)) : NULL;
+	if (!scratch) {
+		qsort_r(ids, count, sizeof(uint32_t), compareEntries, &context);
+		return;
+	}
+
+	size_t bounds[PARALLEL_MAX_THREADS + 1];
+	for (int i = 0; i <= slices; ++i) bounds[i] = count * (size_t)i / (size_t)slices;
+	SortTask tasks[PARALLEL_MAX_THREADS];
+	for (int i = 0; i < slices; ++i) {
+		tasks[i] = (SortTask){ &context, ids, scratch, bounds[i], bounds[i], bounds[i + 1] };
+	}
+	runTasks(sortSlice, tasks, slices);
+
+	// Each round halves the number of sorted runs, ping-ponging between the two buffers
+	uint32_t* source = ids;
+	uint32_t* target = scratch;
+	for (int width = 1; width < slices; width *= 2) {
+		int merges = 0;
+		for (int i = 0; i < slices; i += 2 * width) {
+			tasks[merges++] = (SortTask){ &context, source, target, bounds[i], bounds[i + width], bounds[i + 2 * width] };
+		}
+		runTasks(mergeSlices, tasks, merges);
+		uint32_t* swap = source;
+		source = target;
+		target = swap;
+	}
+	if (source != ids) memcpy(ids, source, count * sizeof(uint32_t));
+	free(scratch);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define PARALLEL_MIN_COUNT 65536 // below this one thread is faster than starting more
+#define PARALLEL_MAX_THREADS 16
+
+typedef int (*IndexCompare)(uint32_t a, uint32_t b, void* user);
+
+// Sorts an index array: every thread sorts one slice, then slices are merged pairwise in parallel
+void Parallel_sortIndices(uint32_t* ids, size_t count, IndexCompare compare, void* user);
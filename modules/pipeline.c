@@ -0,0 +1,116 @@
+#include "pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool BoundedQueue_init(BoundedQueue* queue, int capacity) {
+	memset(queue, 0, sizeof(*queue));
+	queue->items = (void**)calloc((size_t)capacity, sizeof(void*));
+	if (!queue->items) return false;
+	queue->capacity = capacity;
+	queue->mutex = SDL_CreateMutex();
+	queue->notEmpty = SDL_CreateCondition();
+	queue->notFull = SDL_CreateCondition();
+	return true;
+}
+
+void BoundedQueue_destroy(BoundedQueue* queue) {
+	free(queue->items);
+	SDL_DestroyMutex(queue->mutex);
+	SDL_DestroyCondition(queue->notEmpty);
+	SDL_DestroyCondition(queue->notFull);
+	memset(queue, 0, sizeof(*queue));
+}
+
+bool BoundedQueue_push(BoundedQueue* queue, void* item) {
+	SDL_LockMutex(queue->mutex);
+	while (queue->count == queue->capacity && !queue->closed) {
+		SDL_WaitCondition(queue->notFull, queue->mutex);
+	}
+	if (queue->closed) {
+		SDL_UnlockMutex(queue->mutex);
+		return false;
+	}
+	queue->items[(queue->head + queue->count) % queue->capacity] = item;
+	queue->count++;
+	SDL_SignalCondition(queue->notEmpty);
+	SDL_UnlockMutex(queue->mutex);
+	return true;
+}
+
+static void* takeLocked(BoundedQueue* queue) {
+	void* item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	SDL_SignalCondition(queue->notFull);
+	return item;
+}
+
+bool BoundedQueue_pop(BoundedQueue* queue, void** item) {
+	SDL_LockMutex(queue->mutex);
+	while (queue->count == 0 && !queue->closed) {
+		SDL_WaitCondition(queue->notEmpty, queue->mutex);
+	}
+	if (queue->count == 0) {
+		SDL_UnlockMutex(queue->mutex);
+		return false;
+	}
+	*item = takeLocked(queue);
+	SDL_UnlockMutex(queue->mutex);
+	return true;
+}
+
+bool BoundedQueue_tryPop(BoundedQueue* queue, void** item) {
+	SDL_LockMutex(queue->mutex);
+	if (queue->count == 0) {
+		SDL_UnlockMutex(queue->mutex);
+		return false;
+	}
+	*item = takeLocked(queue);
+	SDL_UnlockMutex(queue->mutex);
+	return true;
+}
+
+void BoundedQueue_close(BoundedQueue* queue) {
+	SDL_LockMutex(queue->mutex);
+	queue->closed = true;
+	SDL_BroadcastCondition(queue->notEmpty);
+	SDL_BroadcastCondition(queue->notFull);
+	SDL_UnlockMutex(queue->mutex);
+}
+
+int BoundedQueue_count(BoundedQueue* queue) {
+	SDL_LockMutex(queue->mutex);
+	int count = queue->count;
+	SDL_UnlockMutex(queue->mutex);
+	return count;
+}
+
+static int stage_thread_func(void* data) {
+	Stage* stage = (Stage*)data;
+	void* item;
+	while (BoundedQueue_pop(stage->input, &item)) {
+		stage->process(item);
+	}
+	return 0;
+}
+
+void Stage_start(Stage* stage, const char* name, int threadCount, BoundedQueue* input, StageProcess process) {
+	memset(stage, 0, sizeof(*stage));
+	if (threadCount < 1) threadCount = 1;
+	if (threadCount > PIPELINE_MAX_STAGE_THREADS) threadCount = PIPELINE_MAX_STAGE_THREADS;
+	stage->name = name;
+	stage->input = input;
+	stage->process = process;
+	for (int i = 0; i < threadCount; ++i) {
+		stage->threads[i] = SDL_CreateThread(stage_thread_func, name, stage);
+		if (stage->threads[i]) stage->threadCount++;
+	}
+}
+
+void Stage_join(Stage* stage) {
+	for (int i = 0; i < stage->threadCount; ++i) {
+		SDL_WaitThread(stage->threads[i], NULL);
+	}
+	stage->threadCount = 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdbool.h>
+#include <SDL3/SDL.h>
+
+#define PIPELINE_MAX_STAGE_THREADS 64
+
+// Fixed-capacity FIFO between two stages, a full queue blocks the producer
+typedef struct {
+	void** items;
+	int capacity, head, count;
+	bool closed;
+	SDL_Mutex* mutex;
+	SDL_Condition* notEmpty;
+	SDL_Condition* notFull;
+} BoundedQueue;
+
+bool BoundedQueue_init(BoundedQueue* queue, int capacity);
+void BoundedQueue_destroy(BoundedQueue* queue);
+// Blocks while full, false once the queue is closed
+bool BoundedQueue_push(BoundedQueue* queue, void* item);
+// Blocks while empty, false once the queue is closed and drained
+bool BoundedQueue_pop(BoundedQueue* queue, void** item);
+bool BoundedQueue_tryPop(BoundedQueue* queue, void** item);
+// Wakes every waiter, producers fail from now on and consumers drain what is left
+void BoundedQueue_close(BoundedQueue* queue);
+int BoundedQueue_count(BoundedQueue* queue);
+
+typedef void (*StageProcess)(void* item);
+
+// A pool of threads feeding every item of one queue through `process`
+typedef struct {
+	const char* name;
+	BoundedQueue* input;
+	StageProcess process;
+	int threadCount;
+	SDL_Thread* threads[PIPELINE_MAX_STAGE_THREADS];
+} Stage;
+
+void Stage_start(Stage* stage, const char* name, int threadCount, BoundedQueue* input, StageProcess process);
+// Returns once the input queue is closed and every thread has drained it
+void Stage_join(Stage* stage);
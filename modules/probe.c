@@ -0,0 +1,547 @@
+#include "probe.h"
+
+#include <string.h>
+
+#define FOURCC(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+static uint16_t be16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static uint32_t be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+static uint64_t be64(const uint8_t* p) { return ((uint64_t)be32(p) << 32) | be32(p + 4); }
+static uint16_t le16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t le24(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16); }
+static uint32_t le32(const uint8_t* p) { return le24(p) | ((uint32_t)p[3] << 24); }
+static uint64_t le64(const uint8_t* p) { return le32(p) | ((uint64_t)le32(p + 4) << 32); }
+
+static bool isHeifBrand(uint32_t brand) {
+	return brand == FOURCC('h','e','i','c') || brand == FOURCC('h','e','i','x') || brand == FOURCC('h','e','v','c') ||
+	       brand == FOURCC('h','e','v','x') || brand == FOURCC('h','e','i','m') || brand == FOURCC('h','e','i','s') ||
+	       brand == FOURCC('m','i','f','1') || brand == FOURCC('m','s','f','1');
+}
+
+static ImageFormat sniffFtyp(const uint8_t* data, size_t size) {
+	uint32_t boxSize = be32(data);
+	if (boxSize < 16 || boxSize > size) boxSize = (uint32_t)(size < 16 ? 16 : size);
+	uint32_t major = be32(data + 8);
+	if (major == FOURCC('a','v','i','f') || major == FOURCC('a','v','i','s')) return IMAGE_FORMAT_AVIF;
+	// mif1 is shared, the compatible brands tell AVIF apart
+	for (size_t at = 16; at + 4 <= boxSize; at += 4) {
+		uint32_t brand = be32(data + at);
+		if (brand == FOURCC('a','v','i','f') || brand == FOURCC('a','v','i','s')) return IMAGE_FORMAT_AVIF;
+	}
+	return isHeifBrand(major) ? IMAGE_FORMAT_HEIF : IMAGE_FORMAT_NONE;
+}
+
+ImageFormat Probe_sniff(const uint8_t* data, size_t size) {
+	static const uint8_t png[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	static const uint8_t jxlContainer[12] = { 0, 0, 0, 12, 'J', 'X', 'L', ' ', '\r', '\n', 0x87, '\n' };
+	if (size >= 8 && memcmp(data, png, 8) == 0) return IMAGE_FORMAT_PNG;
+	if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) return IMAGE_FORMAT_JPEG;
+	if (size >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0)) return IMAGE_FORMAT_GIF;
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) return IMAGE_FORMAT_WEBP;
+	if (size >= 4 && (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0 ||
+	                  memcmp(data, "II+\0", 4) == 0 || memcmp(data, "MM\0+", 4) == 0)) return IMAGE_FORMAT_TIFF;
+	if (size >= 12 && memcmp(data + 4, "ftyp", 4) == 0) return sniffFtyp(data, size);
+	if ((size >= 2 && data[0] == 0xFF && data[1] == 0x0A) || (size >= 12 && memcmp(data, jxlContainer, 12) == 0)) return IMAGE_FORMAT_JXL;
+	if (size >= 26 && data[0] == 'B' && data[1] == 'M') {
+		uint32_t dib = le32(data + 14);
+		if (dib == 12 || dib == 40 || dib == 52 || dib == 56 || dib == 108 || dib == 124) return IMAGE_FORMAT_BMP;
+	}
+	return IMAGE_FORMAT_NONE;
+}
+
+// TIFF structure, shared by TIFF files and EXIF blocks
+
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	bool bigEndian;
+	bool bigTiff; // 64-bit offsets
+} TiffView;
+
+static uint16_t tiff16(const TiffView* t, uint64_t at) {
+	if (at + 2 > t->size) return 0;
+	return t->bigEndian ? be16(t->data + at) : le16(t->data + at);
+}
+
+static uint32_t tiff32(const TiffView* t, uint64_t at) {
+	if (at + 4 > t->size) return 0;
+	return t->bigEndian ? be32(t->data + at) : le32(t->data + at);
+}
+
+static uint64_t tiff64(const TiffView* t, uint64_t at) {
+	if (at + 8 > t->size) return 0;
+	return t->bigEndian ? be64(t->data + at) : le64(t->data + at);
+}
+
+static bool openTiff(const uint8_t* data, size_t size, TiffView* t, uint64_t* firstIfd) {
+	if (size < 8 || data[0] != data[1] || (data[0] != 'I' && data[0] != 'M')) return false;
+	t->data = data;
+	t->size = size;
+	t->bigEndian = data[0] == 'M';
+	uint16_t magic = tiff16(t, 2);
+	t->bigTiff = magic == 43;
+	if (magic != 42 && !t->bigTiff) return false;
+	*firstIfd = t->bigTiff ? tiff64(t, 8) : tiff32(t, 4);
+	return true;
+}
+
+static int64_t daysFromCivil(int year, int month, int day) {
+	year -= month <= 2;
+	int era = (year >= 0 ? year : year - 399) / 400;
+	int yearOfEra = year - era * 400;
+	int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return (int64_t)era * 146097 + dayOfEra - 719468;
+}
+
+// "YYYY:MM:DD HH:MM:SS", cameras leave unset dates blank or zeroed
+static int64_t parseExifDate(const uint8_t* text, size_t length) {
+	static const uint8_t digitAt[14] = { 0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18 };
+	if (length < 19) return 0;
+	int value[14];
+	for (int i = 0; i < 14; ++i) {
+		uint8_t c = text[digitAt[i]];
+		if (c < '0' || c > '9') return 0;
+		value[i] = c - '0';
+	}
+	int year = value[0] * 1000 + value[1] * 100 + value[2] * 10 + value[3];
+	int month = value[4] * 10 + value[5], day = value[6] * 10 + value[7];
+	int hour = value[8] * 10 + value[9], minute = value[10] * 10 + value[11], second = value[12] * 10 + value[13];
+	if (year == 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return 0;
+	return daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+#define TIFF_TAG_WIDTH 256
+#define TIFF_TAG_HEIGHT 257
+#define TIFF_TAG_BITS_PER_SAMPLE 258
+#define TIFF_TAG_ORIENTATION 274
+#define TIFF_TAG_SAMPLES_PER_PIXEL 277
+#define TIFF_TAG_EXIF_IFD 34665
+#define TIFF_TAG_DATE_TIME_ORIGINAL 36867
+
+#define TIFF_TYPE_SHORT 3
+#define TIFF_TYPE_LONG 4
+#define TIFF_TYPE_LONG8 16
+
+// Reads the tags we care about from one IFD, returns the Exif sub-IFD offset or 0
+static uint64_t readIfd(const TiffView* t, uint64_t offset, ImageProbe* probe) {
+	uint64_t exifIfd = 0;
+	size_t countBytes = t->bigTiff ? 8 : 2, entryBytes = t->bigTiff ? 20 : 12, inlineBytes = t->bigTiff ? 8 : 4;
+	if (offset == 0 || offset + countBytes > t->size) return 0;
+	uint64_t count = t->bigTiff ? tiff64(t, offset) : tiff16(t, offset);
+	uint64_t entry = offset + countBytes;
+	for (uint64_t i = 0; i < count && entry + entryBytes <= t->size; ++i, entry += entryBytes) {
+		uint16_t tag = tiff16(t, entry);
+		uint16_t type = tiff16(t, entry + 2);
+		uint64_t n = t->bigTiff ? tiff64(t, entry + 4) : tiff32(t, entry + 4);
+		uint64_t valueAt = entry + 4 + (t->bigTiff ? 8 : 4);
+		uint64_t value = type == TIFF_TYPE_SHORT ? tiff16(t, valueAt) : type == TIFF_TYPE_LONG8 ? tiff64(t, valueAt) : tiff32(t, valueAt);
+		uint64_t pointer = t->bigTiff ? tiff64(t, valueAt) : tiff32(t, valueAt);
+		switch (tag) {
+			case TIFF_TAG_WIDTH:
+				probe->width = (int)value;
+				break;
+			case TIFF_TAG_HEIGHT:
+				probe->height = (int)value;
+				break;
+			case TIFF_TAG_BITS_PER_SAMPLE:
+				probe->bitDepth = n * 2 <= inlineBytes ? tiff16(t, valueAt) : tiff16(t, pointer);
+				break;
+			case TIFF_TAG_SAMPLES_PER_PIXEL:
+				probe->channels = (int)value;
+				break;
+			case TIFF_TAG_ORIENTATION:
+				if (value >= 1 && value <= 8) probe->orientation = (int)value;
+				break;
+			case TIFF_TAG_EXIF_IFD:
+				exifIfd = value;
+				break;
+			case TIFF_TAG_DATE_TIME_ORIGINAL:
+				if (n > inlineBytes && pointer < t->size && n <= t->size - pointer) {
+					probe->captureTime = parseExifDate(t->data + pointer, (size_t)n);
+				}
+				break;
+		}
+	}
+	return exifIfd;
+}
+
+void Probe_exif(const uint8_t* data, size_t size, ImageProbe* probe) {
+	TiffView t;
+	uint64_t ifd;
+	if (!openTiff(data, size, &t, &ifd)) return;
+	// IFD0 of an EXIF block describes the thumbnail's parent, only orientation and the Exif IFD matter
+	ImageProbe scratch = *probe;
+	uint64_t exifIfd = readIfd(&t, ifd, &scratch);
+	if (exifIfd && exifIfd != ifd) readIfd(&t, exifIfd, &scratch);
+	probe->orientation = scratch.orientation;
+	probe->captureTime = scratch.captureTime;
+}
+
+static bool probeTiff(const uint8_t* data, size_t size, ImageProbe* probe) {
+	TiffView t;
+	uint64_t ifd;
+	if (!openTiff(data, size, &t, &ifd)) return false;
+	probe->channels = 1;
+	probe->bitDepth = 1;
+	uint64_t exifIfd = readIfd(&t, ifd, probe);
+	if (exifIfd && exifIfd != ifd) {
+		ImageProbe scratch = *probe;
+		readIfd(&t, exifIfd, &scratch);
+		probe->captureTime = scratch.captureTime;
+	}
+	return true;
+}
+
+static bool probePng(const uint8_t* data, size_t size, ImageProbe* probe) {
+	if (size < 33 || memcmp(data + 12, "IHDR", 4) != 0) return false;
+	probe->width = (int)be32(data + 16);
+	probe->height = (int)be32(data + 20);
+	probe->bitDepth = data[24];
+	switch (data[25]) {
+		case 0: probe->channels = 1; break;
+		case 2: probe->channels = 3; break;
+		case 3: probe->channels = 3; break; // palette
+		case 4: probe->channels = 2; break;
+		case 6: probe->channels = 4; break;
+		default: return false;
+	}
+	// Animation and EXIF chunks sit before the first IDAT
+	for (size_t at = 8; at + 12 <= size;) {
+		uint32_t length = be32(data + at);
+		uint32_t type = be32(data + at + 4);
+		if (type == FOURCC('I','D','A','T') || length > size - at - 12) break;
+		const uint8_t* body = data + at + 8;
+		if (type == FOURCC('a','c','T','L') && length >= 8) probe->frameCount = (int)be32(body);
+		else if (type == FOURCC('t','R','N','S') && probe->channels != 4) probe->channels = probe->channels == 1 ? 2 : 4;
+		else if (type == FOURCC('e','X','I','f')) Probe_exif(body, length, probe);
+		at += 12 + (size_t)length;
+	}
+	return true;
+}
+
+static bool probeJpeg(const uint8_t* data, size_t size, ImageProbe* probe) {
+	for (size_t at = 2; at + 4 <= size;) {
+		if (data[at] != 0xFF) return false;
+		uint8_t marker = data[at + 1];
+		if (marker == 0xFF) {
+			at++; // fill byte
+			continue;
+		}
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+			at += 2;
+			continue;
+		}
+		// Scan data follows, a frame header should have come before
+		if (marker == 0xDA || marker == 0xD9) return false;
+		size_t length = be16(data + at + 2);
+		if (length < 2 || length > size - at - 2) return false;
+		const uint8_t* body = data + at + 4;
+		size_t bodyLength = length - 2;
+		bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+		if (frame) {
+			if (bodyLength < 6) return false;
+			probe->bitDepth = body[0];
+			probe->height = be16(body + 1);
+			probe->width = be16(body + 3);
+			probe->channels = body[5];
+			return true;
+		}
+		if (marker == 0xE1 && bodyLength >= 6 && memcmp(body, "Exif\0\0", 6) == 0) Probe_exif(body + 6, bodyLength - 6, probe);
+		at += 2 + length;
+	}
+	return false;
+}
+
+static size_t skipGifSubBlocks(const uint8_t* data, size_t size, size_t at) {
+	while (at < size) {
+		uint8_t length = data[at++];
+		if (length == 0) break;
+		at += length;
+	}
+	return at;
+}
+
+// The frame count is not in the header, the blocks are skipped by their length bytes without decoding
+static bool probeGif(const uint8_t* data, size_t size, ImageProbe* probe) {
+	if (size < 13) return false;
+	probe->width = le16(data + 6);
+	probe->height = le16(data + 8);
+	probe->channels = 4; // palette with an optional transparent index
+	probe->bitDepth = 8;
+	size_t at = 13;
+	if (data[10] & 0x80) at += (size_t)3 << ((data[10] & 7) + 1);
+	int frames = 0;
+	while (at < size) {
+		uint8_t block = data[at++];
+		if (block == 0x3B) break;
+		if (block == 0x21) {
+			at = skipGifSubBlocks(data, size, at + 1);
+		} else if (block == 0x2C) {
+			if (at + 10 > size) break;
+			uint8_t flags = data[at + 8];
+			at += 9;
+			if (flags & 0x80) at += (size_t)3 << ((flags & 7) + 1);
+			at = skipGifSubBlocks(data, size, at + 1); // past the LZW code size
+			frames++;
+		} else {
+			break;
+		}
+	}
+	probe->frameCount = frames;
+	return frames > 0;
+}
+
+static bool probeWebP(const uint8_t* data, size_t size, ImageProbe* probe) {
+	bool extended = false, animated = false, found = false;
+	int frames = 0;
+	probe->bitDepth = 8;
+	for (size_t at = 12; at + 8 <= size;) {
+		uint32_t type = be32(data + at);
+		size_t length = le32(data + at + 4);
+		const uint8_t* body = data + at + 8;
+		size_t available = size - at - 8 < length ? size - at - 8 : length;
+		if (type == FOURCC('V','P','8','X') && available >= 10) {
+			extended = found = true;
+			animated = (body[0] & 0x02) != 0;
+			probe->channels = (body[0] & 0x10) ? 4 : 3;
+			probe->width = (int)le24(body + 4) + 1;
+			probe->height = (int)le24(body + 7) + 1;
+		} else if (type == FOURCC('V','P','8',' ') && available >= 10 && !extended) {
+			if (body[3] != 0x9D || body[4] != 0x01 || body[5] != 0x2A) return false;
+			found = true;
+			probe->channels = 3;
+			probe->width = le16(body + 6) & 0x3FFF;
+			probe->height = le16(body + 8) & 0x3FFF;
+		} else if (type == FOURCC('V','P','8','L') && available >= 5 && !extended) {
+			if (body[0] != 0x2F) return false;
+			uint32_t bits = le32(body + 1);
+			found = true;
+			probe->channels = (bits >> 28) & 1 ? 4 : 3;
+			probe->width = (int)(bits & 0x3FFF) + 1;
+			probe->height = (int)((bits >> 14) & 0x3FFF) + 1;
+		} else if (type == FOURCC('A','N','M','F')) {
+			frames++;
+		} else if (type == FOURCC('E','X','I','F')) {
+			Probe_exif(body, available, probe);
+		}
+		if (length > size - at - 8) break;
+		at += 8 + length + (length & 1);
+	}
+	probe->frameCount = animated ? (frames > 0 ? frames : 0) : 1;
+	return found;
+}
+
+static bool probeBmp(const uint8_t* data, size_t size, ImageProbe* probe) {
+	if (size < 26) return false;
+	int bitsPerPixel;
+	if (le32(data + 14) == 12) {
+		probe->width = le16(data + 18);
+		probe->height = le16(data + 20);
+		bitsPerPixel = le16(data + 24);
+	} else {
+		if (size < 30) return false;
+		int32_t height = (int32_t)le32(data + 22); // negative for top-down rows
+		probe->width = (int32_t)le32(data + 18);
+		probe->height = height < 0 ? -height : height;
+		bitsPerPixel = le16(data + 28);
+	}
+	probe->channels = bitsPerPixel == 32 ? 4 : 3;
+	probe->bitDepth = 8;
+	return true;
+}
+
+static bool probeTga(const uint8_t* data, size_t size, ImageProbe* probe) {
+	if (size < 18) return false;
+	uint8_t type = data[2];
+	if (type != 1 && type != 2 && type != 3 && type != 9 && type != 10 && type != 11) return false;
+	probe->width = le16(data + 12);
+	probe->height = le16(data + 14);
+	uint8_t bitsPerPixel = data[16];
+	probe->channels = bitsPerPixel == 32 ? 4 : (type == 3 || type == 11) ? 1 : 3;
+	probe->bitDepth = 8;
+	return true;
+}
+
+// ISO BMFF box in [*at, end), `body` is the payload after the header and *at moves past the box
+static bool nextBox(const uint8_t* data, size_t end, size_t* at, uint32_t* type, size_t* body) {
+	if (*at + 8 > end) return false;
+	uint64_t size = be32(data + *at);
+	*type = be32(data + *at + 4);
+	size_t header = 8;
+	if (size == 1) {
+		if (*at + 16 > end) return false;
+		size = be64(data + *at + 8);
+		header = 16;
+	} else if (size == 0) {
+		size = end - *at;
+	}
+	if (size < header || size > end - *at) return false;
+	*body = *at + header;
+	*at += (size_t)size;
+	return true;
+}
+
+// Item properties live in meta/iprp/ipco, the largest spatial extent is the primary image and not a thumbnail
+static bool probeHeif(const uint8_t* data, size_t size, ImageProbe* probe) {
+	probe->frameCount = be32(data + 8) == FOURCC('a','v','i','s') ? 0 : 1;
+	probe->channels = 3;
+	probe->bitDepth = 8;
+	uint32_t type;
+	size_t at = 0, body, metaEnd = 0, metaBody = 0;
+	while (nextBox(data, size, &at, &type, &body)) {
+		if (type == FOURCC('m','e','t','a')) {
+			metaBody = body + 4; // full box
+			metaEnd = at;
+			break;
+		}
+	}
+	if (!metaEnd) return false;
+	size_t ipcoBody = 0, ipcoEnd = 0;
+	at = metaBody;
+	while (nextBox(data, metaEnd, &at, &type, &body)) {
+		if (type != FOURCC('i','p','r','p')) continue;
+		size_t iprpEnd = at;
+		size_t inner = body;
+		while (nextBox(data, iprpEnd, &inner, &type, &body)) {
+			if (type == FOURCC('i','p','c','o')) {
+				ipcoBody = body;
+				ipcoEnd = inner;
+				break;
+			}
+		}
+		break;
+	}
+	if (!ipcoEnd) return false;
+	uint64_t largest = 0;
+	at = ipcoBody;
+	while (nextBox(data, ipcoEnd, &at, &type, &body)) {
+		size_t length = at - body;
+		if (type == FOURCC('i','s','p','e') && length >= 12) {
+			uint32_t width = be32(data + body + 4), height = be32(data + body + 8);
+			if ((uint64_t)width * height > largest) {
+				largest = (uint64_t)width * height;
+				probe->width = (int)width;
+				probe->height = (int)height;
+			}
+		} else if (type == FOURCC('p','i','x','i') && length >= 6) {
+			probe->channels = data[body + 4];
+			if (probe->channels > 0 && length >= 5 + (size_t)probe->channels) probe->bitDepth = data[body + 5];
+		} else if (type == FOURCC('i','r','o','t') && length >= 1) {
+			// Counter-clockwise quarter turns
+			static const int orientations[4] = { 1, 8, 3, 6 };
+			probe->orientation = orientations[data[body] & 3];
+		}
+	}
+	return largest > 0;
+}
+
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	size_t bit;
+} BitReader;
+
+static uint32_t readBits(BitReader* reader, int count) {
+	uint32_t value = 0;
+	for (int i = 0; i < count; ++i, ++reader->bit) {
+		size_t byte = reader->bit >> 3;
+		if (byte >= reader->size) return value;
+		value |= (uint32_t)((reader->data[byte] >> (reader->bit & 7)) & 1) << i;
+	}
+	return value;
+}
+
+// JPEG XL U32 field, a 2-bit selector picks one of four offset + bits distributions
+static uint32_t readU32(BitReader* reader, const uint32_t offsets[4], const int bits[4]) {
+	uint32_t selector = readBits(reader, 2);
+	return offsets[selector] + readBits(reader, bits[selector]);
+}
+
+static const uint32_t jxlRatios[8][2] = { {1, 1}, {1, 1}, {12, 10}, {4, 3}, {3, 2}, {16, 9}, {5, 4}, {2, 1} };
+
+static void readJxlSize(BitReader* reader, uint32_t* width, uint32_t* height) {
+	static const uint32_t offsets[4] = { 1, 1, 1, 1 };
+	static const int bits[4] = { 9, 13, 18, 30 };
+	bool small = readBits(reader, 1);
+	*height = small ? (readBits(reader, 5) + 1) * 8 : readU32(reader, offsets, bits);
+	uint32_t ratio = readBits(reader, 3);
+	if (ratio == 0) *width = small ? (readBits(reader, 5) + 1) * 8 : readU32(reader, offsets, bits);
+	else *width = (uint32_t)((uint64_t)*height * jxlRatios[ratio][0] / jxlRatios[ratio][1]);
+}
+
+static void skipJxlPreviewSize(BitReader* reader) {
+	static const uint32_t div8Offsets[4] = { 16, 32, 1, 33 };
+	static const int div8Bits[4] = { 0, 0, 5, 9 };
+	static const uint32_t offsets[4] = { 1, 65, 321, 1345 };
+	static const int bits[4] = { 6, 8, 10, 12 };
+	bool div8 = readBits(reader, 1);
+	if (div8) readU32(reader, div8Offsets, div8Bits);
+	else readU32(reader, offsets, bits);
+	if (readBits(reader, 3) == 0) {
+		if (div8) readU32(reader, div8Offsets, div8Bits);
+		else readU32(reader, offsets, bits);
+	}
+}
+
+static bool probeJxl(const uint8_t* data, size_t size, ImageProbe* probe) {
+	const uint8_t* codestream = data;
+	size_t codestreamSize = size;
+	if (data[0] == 0) {
+		// Container, the codestream is in jxlc or split over jxlp boxes
+		codestream = NULL;
+		uint32_t type;
+		size_t at = 0, body;
+		while (nextBox(data, size, &at, &type, &body)) {
+			if (type == FOURCC('j','x','l','c') && !codestream) {
+				codestream = data + body;
+				codestreamSize = at - body;
+			} else if (type == FOURCC('j','x','l','p') && !codestream && at - body > 4) {
+				codestream = data + body + 4;
+				codestreamSize = at - body - 4;
+			} else if (type == FOURCC('E','x','i','f') && at - body > 4) {
+				uint32_t offset = be32(data + body);
+				if (offset < at - body - 4) Probe_exif(data + body + 4 + offset, at - body - 4 - offset, probe);
+			}
+		}
+		if (!codestream || codestreamSize < 2 || codestream[0] != 0xFF || codestream[1] != 0x0A) return false;
+	}
+	BitReader reader = { codestream + 2, codestreamSize - 2, 0 };
+	uint32_t width, height;
+	readJxlSize(&reader, &width, &height);
+	probe->width = (int)width;
+	probe->height = (int)height;
+	// Bit depth and extra channels follow a long run of optional fields, they stay unknown
+	bool allDefault = readBits(&reader, 1);
+	if (!allDefault && readBits(&reader, 1)) {
+		probe->orientation = (int)readBits(&reader, 3) + 1;
+		if (readBits(&reader, 1)) readJxlSize(&reader, &width, &height); // intrinsic size
+		if (readBits(&reader, 1)) skipJxlPreviewSize(&reader);
+		if (readBits(&reader, 1)) probe->frameCount = 0;
+	}
+	return reader.bit <= (codestreamSize - 2) * 8;
+}
+
+bool Probe_image(const uint8_t* data, size_t size, ImageFormat hint, ImageProbe* probe) {
+	memset(probe, 0, sizeof(*probe));
+	probe->frameCount = 1;
+	probe->orientation = 1;
+	ImageFormat format = Probe_sniff(data, size);
+	if (format == IMAGE_FORMAT_NONE && hint == IMAGE_FORMAT_TGA) format = IMAGE_FORMAT_TGA;
+	probe->format = format;
+	bool ok = false;
+	switch (format) {
+		case IMAGE_FORMAT_PNG:  ok = probePng(data, size, probe); break;
+		case IMAGE_FORMAT_JPEG: ok = probeJpeg(data, size, probe); break;
+		case IMAGE_FORMAT_GIF:  ok = probeGif(data, size, probe); break;
+		case IMAGE_FORMAT_WEBP: ok = probeWebP(data, size, probe); break;
+		case IMAGE_FORMAT_TIFF: ok = probeTiff(data, size, probe); break;
+		case IMAGE_FORMAT_HEIF:
+		case IMAGE_FORMAT_AVIF: ok = probeHeif(data, size, probe); break;
+		case IMAGE_FORMAT_JXL:  ok = probeJxl(data, size, probe); break;
+		case IMAGE_FORMAT_BMP:  ok = probeBmp(data, size, probe); break;
+		case IMAGE_FORMAT_TGA:  ok = probeTga(data, size, probe); break;
+		default: break;
+	}
+	return ok && probe->width > 0 && probe->height > 0;
+}
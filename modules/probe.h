@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dir_scan.h"
+
+// What the header tells about an image without decoding it
+typedef struct {
+	ImageFormat format;
+	int width, height;
+	int channels;    // 0 when the header does not say
+	int bitDepth;    // per channel
+	int frameCount;  // 1 for stills, 0 when animated but only a full walk would count the frames
+	int orientation; // EXIF 1..8, 1 when absent
+	int64_t captureTime; // EXIF DateTimeOriginal in seconds since the epoch, camera local time, 0 when absent
+} ImageProbe;
+
+// Format from the magic bytes, IMAGE_FORMAT_NONE for content we do not recognize.
+// TGA has no magic and is never sniffed.
+ImageFormat Probe_sniff(const uint8_t* data, size_t size);
+// Parses the header of `data`, `hint` is the format from the file name and only matters for
+// content that cannot be sniffed. False for unknown content or a damaged header.
+bool Probe_image(const uint8_t* data, size_t size, ImageFormat hint, ImageProbe* probe);
+// Orientation and capture time from an EXIF block, which starts at the TIFF byte order mark
+void Probe_exif(const uint8_t* data, size_t size, ImageProbe* probe);
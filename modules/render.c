@@ -1,5 +1,13 @@
 #include "render.h"
 #include "main_structs.h"
+#include "loader.h"
+#include "catalog.h"
+#include "flipbook.h"
+#include "gpu_jpeg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 #define MAX_PATH_DISPLAY 512
 #define STR(x) #x
@@ -8,15 +16,27 @@
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
+#define TILE_POOL_SIZE 1024
+#define TILE_UPLOADS_PER_FRAME 24
+#define TILE_BASE_MAX_TILES 16
+
 extern AppState g_appState;
 
-void ImageMetadata_setFileSize(ImageMetadata* meta, uint64_t bytes) {
-	meta->fileSizeKB = (uint32_t)(bytes / 1024);
-}
+typedef struct {
+	GLuint textureID;
+	uint32_t level, tx, ty;
+	uint64_t lastUsed;
+	bool used;
+} TileTexture;
 
-float ImageMetadata_getFileSizeMB(const ImageMetadata* meta) {
-	return meta->fileSizeKB / 1024.0f;
-}
+// GL side of the tile cache, only the active tiled image keeps textures
+static struct {
+	const TiledImage* owner;
+	uint32_t* slots[TILE_CACHE_MAX_LEVELS]; // pool index + 1 per tile, 0 when not resident
+	TileTexture pool[TILE_POOL_SIZE];
+	uint32_t clockHand;
+	uint64_t frame;
+} tileView;
 
 void updateProjectionMatrix() {
 	memset(g_appState.projectionMatrix, 0, sizeof(g_appState.projectionMatrix));
@@ -61,29 +81,433 @@ void resetView(bool fitToWindow) {
 	g_appState.modelDirty = true;
 }
 
-void updateGifAnimation(ImageMetadata* img) {
-	if (!img->gif_animation || img->gif_animation->count <= 1) return;
-	Uint32 now = SDL_GetTicks();
-	if (now >= img->gif_next_frame_time) {
-		img->gif_current_frame = (img->gif_current_frame + 1) % img->gif_animation->count;
-		img->gif_next_frame_time = now + img->gif_animation->delays[img->gif_current_frame];
-		glBindTexture(GL_TEXTURE_2D, img->textureID);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 
-                       img->full_width, img->full_height,
-                       GL_RGBA, GL_UNSIGNED_BYTE, 
-                       img->gif_animation->frames[img->gif_current_frame]->pixels);
+// The current image replaced `previous` on screen. Flipbook frames keep the zoom and pan,
+// a detail is followed through the shot.
+void resetViewAfter(int previous) {
+	const ImageMetadata* img = &g_appState.images.items[g_appState.currentIndex];
+	if (Flipbook_active() && previous >= 0 && g_appState.images.items[previous].full_width == img->full_width &&
+		g_appState.images.items[previous].full_height == img->full_height) {
+		g_appState.modelDirty = true;
+		return;
+	}
+	resetView(true);
+}
+
+bool isAnimated(const ResidentImage* res) {
+	return res->layer_count > 0 || res->anim_stream;
+}
+
+// Animations that fit the budget live on the GPU whole, playback then only moves the layer uniform.
+// False leaves nothing behind and the caller falls back to a plain texture.
+bool createFrameArray(ImageMetadata* img, ResidentImage* res, int frameCount, const unsigned char* firstFrame) {
+	if (frameCount < 2 || frameCount > g_appState.maxArrayLayers) return false;
+	if (!res->anim_stream || !AnimStream_fullFrames(res->anim_stream)) return false;
+	uint64_t bytes = (uint64_t)img->full_width * img->full_height * 4 * frameCount;
+	if (g_appState.animationVramBytes + bytes > ANIMATION_VRAM_BUDGET) return false;
+	Uint32* delays = (Uint32*)malloc(sizeof(Uint32) * frameCount);
+	if (!delays) return false;
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	while (glGetError() != GL_NO_ERROR) {}
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, img->full_width, img->full_height, frameCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	if (glGetError() != GL_NO_ERROR) {
+		// Out of VRAM for all that, streaming still works
+		glDeleteTextures(1, &texture);
+		free(delays);
+		return false;
+	}
+	img->textureID = texture;
+	res->layer_count = frameCount;
+	res->layer_delays = delays;
+	res->layer_bytes = bytes;
+	g_appState.animationVramBytes += bytes;
+
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, img->full_width, img->full_height, 1,
+		GL_RGBA, GL_UNSIGNED_BYTE, firstFrame);
+	delays[0] = res->anim_frame_delay;
+	res->layers_filled = 1;
+	return true;
+}
+
+void releaseFrameArray(ResidentImage* res) {
+	if (res->layer_count == 0) return;
+	g_appState.animationVramBytes -= res->layer_bytes;
+	free(res->layer_delays);
+	res->layer_delays = NULL;
+	res->layer_count = res->layers_filled = 0;
+	res->layer_bytes = 0;
+}
+
+// One byte per pixel and a 256x1 palette, the fragment shader does the lookup and the filtering.
+// `reduced` becomes the mipmapped colors drawn when zoomed out, NULL leaves the lookup to alias.
+void createIndexedTexture(ImageMetadata* img, ResidentImage* res, const unsigned char* indices, const uint8_t* palette, const unsigned char* reduced) {
+	glGenTextures(1, &img->textureID);
+	glBindTexture(GL_TEXTURE_2D, img->textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// Rows of single bytes are not 4-byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, img->full_width, img->full_height, 0, GL_RED, GL_UNSIGNED_BYTE, indices);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	glGenTextures(1, &res->palette_texture);
+	glBindTexture(GL_TEXTURE_2D, res->palette_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, palette);
+
+	if (!reduced) return;
+	glGenTextures(1, &res->reduced_texture);
+	glBindTexture(GL_TEXTURE_2D, res->reduced_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, (img->full_width + 1) / 2, (img->full_height + 1) / 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, reduced);
+	glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+// Only the channels the image has, the swizzle fills in the rest when sampling
+void createTexture(ImageMetadata* img, ResidentImage* res, int channels, SampleType sample, const unsigned char* pixels) {
+	static const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+	static const GLenum internalFormats[][4] = {
+		{GL_R8, GL_RG8, GL_RGB8, GL_RGBA8},
+		{GL_R16, GL_RG16, GL_RGB16, GL_RGBA16},
+		{GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F}
+	};
+	static const GLenum types[] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_HALF_FLOAT};
+	static const GLint swizzles[][4] = {
+		{GL_RED, GL_RED, GL_RED, GL_ONE},
+		{GL_RED, GL_RED, GL_RED, GL_GREEN},
+		{GL_RED, GL_GREEN, GL_BLUE, GL_ONE},
+		{GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}
+	};
+	if (channels < 1 || channels > 4) channels = 4;
+	res->channels = (uint8_t)channels;
+	res->sample = sample;
+	glGenTextures(1, &img->textureID);
+	glBindTexture(GL_TEXTURE_2D, img->textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzles[channels - 1]);
+	
+	if (isAnimated(res)) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	} else {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	// Tightly packed rows of 1, 2 or 3 samples per pixel are rarely 4-byte aligned
+	bool aligned = ((size_t)img->full_width * channels * (sample == SAMPLE_UINT8 ? 1 : 2)) % 4 == 0;
+	if (!aligned) glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[sample][channels - 1], img->full_width, img->full_height, 0,
+		formats[channels - 1], types[sample], pixels);
+	if (!aligned) glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+static GLuint planeTexture(int width, int height, const unsigned char* plane) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, plane);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	return texture;
+}
+
+// Luma in textureID and each chroma plane at its own size, linear filtering does the chroma upsampling
+void createYuvTextures(ImageMetadata* img, ResidentImage* res, const unsigned char* planes, const YuvLayout* layout) {
+	img->textureID = planeTexture(layout->width[0], layout->height[0], planes + layout->offset[0]);
+	for (int p = 0; p < 2; ++p) {
+		res->chroma_textures[p] = planeTexture(layout->width[p + 1], layout->height[p + 1], planes + layout->offset[p + 1]);
+	}
+	res->yuv_matrix = layout->matrix;
+	res->yuv_full_range = layout->fullRange;
+}
+
+// Y'CbCr to R'G'B' for the fragment shader, limited range is stretched to full on the way
+static void setYuvUniforms(const ResidentImage* res) {
+	static const float kr[] = {0.299f, 0.2126f, 0.2627f};
+	static const float kb[] = {0.114f, 0.0722f, 0.0593f};
+	float r = kr[res->yuv_matrix], b = kb[res->yuv_matrix], g = 1.0f - r - b;
+	float ys = res->yuv_full_range ? 1.0f : 255.0f / 219.0f;
+	float cs = res->yuv_full_range ? 1.0f : 255.0f / 224.0f;
+	// Column-major, one column each for Y, Cb and Cr
+	const float matrix[9] = {
+		ys, ys, ys,
+		0.0f, -2.0f * b * (1.0f - b) / g * cs, 2.0f * (1.0f - b) * cs,
+		2.0f * (1.0f - r) * cs, -2.0f * r * (1.0f - r) / g * cs, 0.0f
+	};
+	const float offset[3] = {res->yuv_full_range ? 0.0f : 16.0f / 255.0f, 128.0f / 255.0f, 128.0f / 255.0f};
+	glUniformMatrix3fv(g_appState.yuvMatrixLoc, 1, GL_FALSE, matrix);
+	glUniform3fv(g_appState.yuvOffsetLoc, 1, offset);
+}
+
+// Exposure and tone mapping are only uniforms, changing them never decodes anything again
+static void setToneUniforms(const ResidentImage* res) {
+	float scale = exp2f(g_appState.exposure);
+	float peak = res->peak > 1.0f ? res->peak : 1.0f;
+	glUniform1i(g_appState.linearLightLoc, res->sample == SAMPLE_FLOAT16);
+	glUniform1f(g_appState.exposureLoc, scale);
+	glUniform1f(g_appState.whitePointLoc, g_appState.toneMapping ? peak * scale : 0.0f);
+}
+
+bool createCoefficientTexture(ImageMetadata* img, ResidentImage* res, const JpegCoefficients* coefficients, const int16_t* data) {
+	img->textureID = GpuJpeg_decode(coefficients, data, img->full_width, img->full_height);
+	if (!img->textureID) return false;
+	res->channels = 4;
+	glBindTexture(GL_TEXTURE_2D, img->textureID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	return true;
+}
+
+// Takes whatever the decoder has ready, ahead of playback, so the stream is done after one pass
+static void fillFrameArray(ImageMetadata* img, ResidentImage* res) {
+	AnimFrame frame;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, img->textureID);
+	while (res->layers_filled < res->layer_count && AnimStream_peek(res->anim_stream, &frame)) {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, frame.x, frame.y, res->layers_filled, frame.w, frame.h, 1,
+			GL_RGBA, GL_UNSIGNED_BYTE, frame.rgba);
+		res->layer_delays[res->layers_filled++] = (Uint32)frame.delayMs;
+		AnimStream_pop(res->anim_stream);
+	}
+	if (res->layers_filled == res->layer_count) {
+		AnimStream_close(res->anim_stream);
+		res->anim_stream = NULL;
+	}
+}
+
+void updateRefreshInterval(void) {
+	const SDL_DisplayMode* mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(g_appState.window));
+	float hz = mode && mode->refresh_rate > 0.0f ? mode->refresh_rate : 60.0f;
+	g_appState.refreshNs = (Uint64)(1e9 / hz);
+}
+
+// The frame on screen starts over now, for an image that just became visible
+void restartAnimationClock(ResidentImage* res) {
+	res->anim_start_ns = SDL_GetTicksNS() - res->anim_time_ms * 1000000;
+}
+
+// Frames follow the animation's own timeline rather than "now plus the delay", so rounding to vblanks
+// does not add up over a loop. Frames playback fell behind on are skipped, not shown late one by one.
+static void updateAnimation(ImageMetadata* img, ResidentImage* res) {
+	if (res->layer_count > 0 && res->anim_stream) fillFrameArray(img, res);
+	// What is drawn now reaches the screen at the coming vblank, half a refresh away on average
+	Uint64 present = SDL_GetTicksNS() + g_appState.refreshNs / 2;
+	uint64_t frameEnd = res->anim_time_ms + res->anim_frame_delay;
+	Uint64 due = res->anim_start_ns + frameEnd * 1000000;
+	if (present < due) return;
+	// A stall this long (a blocked window, a suspend) is not worth catching up on
+	if (present - due > ANIMATION_RESYNC_NS) res->anim_start_ns = present - frameEnd * 1000000;
+	uint64_t clock = (present - res->anim_start_ns) / 1000000;
+
+	if (res->layer_count > 0) {
+		int frame = res->anim_frame;
+		uint64_t start = res->anim_time_ms;
+		Uint32 delay = res->anim_frame_delay;
+		do {
+			int next = (frame + 1) % res->layer_count;
+			// Still streaming in, the frame on screen stays up until its successor arrives
+			if (next >= res->layers_filled) break;
+			start += delay;
+			frame = next;
+			delay = res->layer_delays[next];
+		} while (start + delay <= clock);
+		res->anim_frame = frame;
+		res->anim_time_ms = start;
+		res->anim_frame_delay = delay;
+	} else if (res->anim_stream) {
+		AnimStream_setClock(res->anim_stream, clock);
+		AnimFrame frame;
+		bool first = true;
+		// The decoder fell behind when nothing is queued, the frame on screen stays up until it catches up.
+		// Queued frames that are already over still go up, each rect builds on the ones before.
+		while (AnimStream_peek(res->anim_stream, &frame) && (first || frame.timeMs <= clock)) {
+			if (frame.w > 0 && frame.h > 0) {
+				glBindTexture(GL_TEXTURE_2D, img->textureID);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, frame.x, frame.y, frame.w, frame.h, GL_RGBA, GL_UNSIGNED_BYTE, frame.rgba);
+			}
+			res->anim_time_ms = frame.timeMs;
+			res->anim_frame_delay = (Uint32)frame.delayMs;
+			AnimStream_pop(res->anim_stream);
+			first = false;
+		}
+	}
+}
+
+void TileTextures_release(const TiledImage* tiled) {
+	if (!tiled || tileView.owner != tiled) return;
+	for (uint32_t i = 0; i < TILE_POOL_SIZE; ++i) {
+		if (tileView.pool[i].textureID != 0) glDeleteTextures(1, &tileView.pool[i].textureID);
+	}
+	for (uint32_t level = 0; level < TILE_CACHE_MAX_LEVELS; ++level) {
+		free(tileView.slots[level]);
+	}
+	memset(&tileView, 0, sizeof(tileView));
+}
+
+static bool bindTiledImage(const TiledImage* tiled) {
+	if (tileView.owner == tiled) return true;
+	TileTextures_release(tileView.owner);
+	for (uint32_t level = 0; level < tiled->levelCount; ++level) {
+		const TileLevel* l = &tiled->levels[level];
+		tileView.slots[level] = (uint32_t*)calloc((size_t)l->tilesX * l->tilesY, sizeof(uint32_t));
+		if (!tileView.slots[level]) {
+			tileView.owner = tiled;
+			TileTextures_release(tiled);
+			return false;
+		}
+	}
+	tileView.owner = tiled;
+	return true;
+}
+
+static GLuint tileTexture(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty, int* uploadBudget) {
+	uint32_t* slot = &tileView.slots[level][(size_t)ty * tiled->levels[level].tilesX + tx];
+	if (*slot != 0) {
+		TileTexture* tile = &tileView.pool[*slot - 1];
+		tile->lastUsed = tileView.frame;
+		return tile->textureID;
+	}
+	if (*uploadBudget <= 0) return 0;
+
+	// Clock sweep for a tile that was not drawn this frame
+	TileTexture* victim = NULL;
+	for (uint32_t n = 0; n < TILE_POOL_SIZE; ++n) {
+		TileTexture* candidate = &tileView.pool[tileView.clockHand];
+		tileView.clockHand = (tileView.clockHand + 1) % TILE_POOL_SIZE;
+		if (!candidate->used || candidate->lastUsed != tileView.frame) {
+			victim = candidate;
+			break;
+		}
+	}
+	if (!victim) return 0;
+	if (victim->used) {
+		tileView.slots[victim->level][(size_t)victim->ty * tiled->levels[victim->level].tilesX + victim->tx] = 0;
+	}
+	if (victim->textureID == 0) {
+		glGenTextures(1, &victim->textureID);
+		glBindTexture(GL_TEXTURE_2D, victim->textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	int w, h;
+	TiledImage_tileSize(tiled, level, tx, ty, &w, &h);
+	glBindTexture(GL_TEXTURE_2D, victim->textureID);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, TILE_SIZE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, TiledImage_tile(tiled, level, tx, ty));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	TiledImage_releaseTile(tiled, level, tx, ty);
+	--*uploadBudget;
+
+	victim->level = level;
+	victim->tx = tx;
+	victim->ty = ty;
+	victim->used = true;
+	victim->lastUsed = tileView.frame;
+	*slot = (uint32_t)(victim - tileView.pool) + 1;
+	return victim->textureID;
+}
+
+static void drawTileLevel(const TiledImage* tiled, uint32_t level, int* uploadBudget) {
+	const TileLevel* l = &tiled->levels[level];
+	float scale = g_appState.zoom * (float)(1u << level); // screen pixels per level pixel
+	float tileScreen = TILE_SIZE * scale;
+	int x0 = (int)SDL_floorf(-g_appState.offsetX / tileScreen);
+	int y0 = (int)SDL_floorf(-g_appState.offsetY / tileScreen);
+	int x1 = (int)SDL_floorf((g_appState.windowWidth - g_appState.offsetX) / tileScreen);
+	int y1 = (int)SDL_floorf((g_appState.windowHeight - g_appState.offsetY) / tileScreen);
+	x0 = MAX(x0, 0); y0 = MAX(y0, 0);
+	x1 = MIN(x1, (int)l->tilesX - 1); y1 = MIN(y1, (int)l->tilesY - 1);
+
+	float model[16] = {0};
+	model[10] = 1.0f;
+	model[15] = 1.0f;
+	for (int ty = y0; ty <= y1; ++ty) {
+		for (int tx = x0; tx <= x1; ++tx) {
+			GLuint texture = tileTexture(tiled, level, (uint32_t)tx, (uint32_t)ty, uploadBudget);
+			if (texture == 0) continue;
+			int w, h;
+			TiledImage_tileSize(tiled, level, (uint32_t)tx, (uint32_t)ty, &w, &h);
+			model[0] = w * scale;
+			model[5] = h * scale;
+			model[12] = g_appState.offsetX + tx * tileScreen;
+			model[13] = g_appState.offsetY + ty * tileScreen;
+			glUniformMatrix4fv(g_appState.modelLoc, 1, GL_FALSE, model);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		}
 	}
 }
 
+static void renderTiledImage(const TiledImage* tiled) {
+	if (!bindTiledImage(tiled)) return;
+	++tileView.frame;
+	int uploadBudget = TILE_UPLOADS_PER_FRAME;
+
+	// A coarse level covering the whole image goes first so tiles still uploading never leave holes
+	uint32_t base = tiled->levelCount - 1;
+	while (base > 0 && tiled->levels[base - 1].tilesX * tiled->levels[base - 1].tilesY <= TILE_BASE_MAX_TILES) --base;
+	int baseBudget = TILE_BASE_MAX_TILES;
+	drawTileLevel(tiled, base, &baseBudget);
+
+	uint32_t level = 0;
+	while (level + 1 < tiled->levelCount && g_appState.zoom * (float)(2u << level) <= 1.0f) ++level;
+	if (level < base) drawTileLevel(tiled, level, &uploadBudget);
+
+	// Tiles overwrite the model uniform
+	g_appState.modelDirty = true;
+}
+
 void renderFrame() {
 	glClear(GL_COLOR_BUFFER_BIT);
 	
 	if (g_appState.activeTextureIndex < 0) return;
 	
 	ImageMetadata* img = &g_appState.images.items[g_appState.activeTextureIndex];
-	if (img->state != IMAGE_STATE_LOADED || img->textureID == 0) return;
-	if (img->gif_animation) {
-		updateGifAnimation(img);
+	if (img->state != IMAGE_STATE_LOADED) return;
+	ResidentImage* res = ImageCatalog_resident(&g_appState.images, g_appState.activeTextureIndex);
+	if (res->tiled) {
+		glUseProgram(g_appState.shaderProgram);
+		if (g_appState.projectionDirty) {
+			updateProjectionMatrix();
+			glUniformMatrix4fv(g_appState.projLoc, 1, GL_FALSE, g_appState.projectionMatrix);
+		}
+		glUniform1f(g_appState.layerLoc, -1.0f);
+		glUniform1i(g_appState.indexedLoc, 0);
+		glUniform1i(g_appState.yuvLoc, 0);
+		setToneUniforms(res);
+		glActiveTexture(GL_TEXTURE0);
+		glBindVertexArray(g_appState.vao);
+		if (res->opaque) glDisable(GL_BLEND);
+		else glEnable(GL_BLEND);
+		renderTiledImage(res->tiled);
+		return;
+	}
+	if (img->textureID == 0) return;
+	if (isAnimated(res)) {
+		updateAnimation(img, res);
 	}
 	glUseProgram(g_appState.shaderProgram);
 	if (g_appState.projectionDirty) {
@@ -94,63 +518,199 @@ void renderFrame() {
 		updateModelMatrix();
 		glUniformMatrix4fv(g_appState.modelLoc, 1, GL_FALSE, g_appState.modelMatrix);
 	}
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, img->textureID);
+	if (res->layer_count > 0) {
+		// Arrays sit on their own unit, a name bound to one target cannot go to the other
+		glUniform1f(g_appState.layerLoc, (float)res->anim_frame);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, img->textureID);
+	} else {
+		glUniform1f(g_appState.layerLoc, -1.0f);
+		if (res->palette_texture) {
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_2D, res->palette_texture);
+			// Name 0 has no image, the shader sees a zero size and keeps to the lookup
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_2D, res->reduced_texture);
+		}
+		if (res->chroma_textures[0]) {
+			glActiveTexture(GL_TEXTURE3);
+			glBindTexture(GL_TEXTURE_2D, res->chroma_textures[0]);
+			glActiveTexture(GL_TEXTURE4);
+			glBindTexture(GL_TEXTURE_2D, res->chroma_textures[1]);
+			setYuvUniforms(res);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, img->textureID);
+	}
+	glUniform1i(g_appState.indexedLoc, res->palette_texture != 0);
+	glUniform1i(g_appState.yuvLoc, res->chroma_textures[0] != 0);
+	setToneUniforms(res);
 	glBindVertexArray(g_appState.vao);
+	// Nothing to blend with, the fragments simply replace the clear color
+	if (res->opaque) glDisable(GL_BLEND);
+	else glEnable(GL_BLEND);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 }
 
 void updateWindowTitle(void) {
 	if (g_appState.currentIndex < 0) {
-		SDL_SetWindowTitle(g_appState.window, "SharkPix");
+		SDL_SetWindowTitle(g_appState.window, g_appState.scanning ? "SharkPix | Scanning..." : "SharkPix");
 		return;
 	}
 	ImageMetadata* img = &g_appState.images.items[g_appState.currentIndex];
+	const char* path = ImageCatalog_path(&g_appState.images, g_appState.currentIndex);
+	int position = (int)g_appState.images.position[g_appState.currentIndex];
+	const char* more = g_appState.scanning ? "+" : ""; // the count still grows
 	char title[1024];
+	char size[32] = ""; // known from the header before the pixels
+	size_t length;
+	if (img->full_width > 0) snprintf(size, sizeof(size), " | %dx%d", img->full_width, img->full_height);
 	switch(img->state) {
 		case IMAGE_STATE_LOADED:
 			snprintf(title, sizeof(title),
-				"[%d/%zu] %." XSTR(MAX_PATH_DISPLAY) "s | %dx%d | %.2f MB",
-				g_appState.currentIndex + 1, g_appState.images.size,
-				img->path_utf8, img->full_width, img->full_height,
-				ImageMetadata_getFileSizeMB(img));
+				"[%d/%zu%s] %." XSTR(MAX_PATH_DISPLAY) "s | %dx%d | %.2f MB",
+				position + 1, g_appState.images.count, more,
+				path, img->full_width, img->full_height,
+				ImageCatalog_fileSizeMB(&g_appState.images, g_appState.currentIndex));
 			break;
 		case IMAGE_STATE_LOADING:
 			snprintf(title, sizeof(title),
-				"[%d/%zu] %." XSTR(MAX_PATH_DISPLAY) "s | Loading...",
-				g_appState.currentIndex + 1, g_appState.images.size,
-				img->path_utf8);
+				"[%d/%zu%s] %." XSTR(MAX_PATH_DISPLAY) "s%s | Loading...",
+				position + 1, g_appState.images.count, more,
+				path, size);
 			break;
 		default:
 			snprintf(title, sizeof(title),
-				"[%d/%zu] %." XSTR(MAX_PATH_DISPLAY) "s | Failed or Unloaded",
-				g_appState.currentIndex + 1, g_appState.images.size,
-				img->path_utf8);
+				"[%d/%zu%s] %." XSTR(MAX_PATH_DISPLAY) "s%s | Failed or Unloaded",
+				position + 1, g_appState.images.count, more,
+				path, size);
+	}
+	length = strlen(title);
+	if (g_appState.images.sortMode != SORT_BY_NAME && length < sizeof(title)) {
+		snprintf(title + length, sizeof(title) - length, " | by %s", SortMode_name(g_appState.images.sortMode));
+	}
+	length = strlen(title);
+	if (g_appState.exposure != 0.0f && length < sizeof(title)) {
+		snprintf(title + length, sizeof(title) - length, " | %+.1f EV", g_appState.exposure);
+	}
+	length = strlen(title);
+	if (!g_appState.toneMapping && length < sizeof(title)) {
+		snprintf(title + length, sizeof(title) - length, " | Highlights clipped");
 	}
+	length = strlen(title);
+	if (length < sizeof(title)) Flipbook_describe(title + length, sizeof(title) - length);
 	SDL_SetWindowTitle(g_appState.window, title);
 }
 
+bool isInPrefetchWindow(int index) {
+	int size = (int)g_appState.images.count;
+	if (g_appState.currentIndex < 0 || index < 0 || index >= (int)g_appState.images.size) return false;
+	if (g_appState.images.position[index] == IMAGE_REMOVED) return false;
+	if (Flipbook_active()) return Flipbook_inWindow(index);
+	int distance = abs((int)g_appState.images.position[index] - (int)g_appState.images.position[g_appState.currentIndex]);
+	if (size - distance < distance) distance = size - distance; // navigation wraps around
+	return distance <= PREFETCH_RADIUS;
+}
+
+// Id of the image at a display position, wrapping around the ends
+static int imageAt(int position) {
+	int size = (int)g_appState.images.count;
+	return (int)g_appState.images.order[((position % size) + size) % size];
+}
+
 void loader_request_load(int index) {
-	SDL_LockMutex(g_appState.loader_mutex);
-	atomic_store(&g_appState.loader_nextImageToLoad, index);
-	SDL_SignalCondition(g_appState.loader_cv);
-	SDL_UnlockMutex(g_appState.loader_mutex);
+	// The current image first, then neighbors alternating ahead and behind.
+	// Images already LOADING are still queued or in flight from an earlier window.
+	int wanted[LOADER_MAX_WANTED];
+	int wantedCount = 0;
+	int window[LOADER_MAX_WANTED];
+	int count = 0;
+	int position = (int)g_appState.images.position[index];
+	int readahead[READAHEAD_COUNT];
+	int readaheadCount = 0;
+	if (Flipbook_active()) {
+		// The frames about to be shown in playback order, however far that is in the display order
+		const int* frames;
+		wantedCount = Flipbook_window(&frames);
+		memcpy(wanted, frames, sizeof(int) * wantedCount);
+		readaheadCount = Flipbook_readahead(&frames);
+		memcpy(readahead, frames, sizeof(int) * readaheadCount);
+	} else {
+		wanted[wantedCount++] = index;
+		for (int d = 1; d <= PREFETCH_RADIUS; ++d) {
+			int candidates[2] = { imageAt(position + d), imageAt(position - d) };
+			for (int c = 0; c < 2; ++c) {
+				bool duplicate = false;
+				for (int i = 0; i < wantedCount && !duplicate; ++i) duplicate = wanted[i] == candidates[c];
+				if (!duplicate) wanted[wantedCount++] = candidates[c];
+			}
+		}
+	}
+	for (int i = 0; i < wantedCount; ++i) {
+		ImageMetadata* img = &g_appState.images.items[wanted[i]];
+		ResidentImage* res = img->state == IMAGE_STATE_LOADED ? ImageCatalog_resident(&g_appState.images, wanted[i]) : NULL;
+		if (res && res->compressed && !res->reloading) {
+			// Shown compressed until the full quality decode replaces it, the image stays LOADED meanwhile
+			res->reloading = true;
+			window[count++] = wanted[i];
+			continue;
+		}
+		if (img->state != IMAGE_STATE_UNLOADED) continue;
+		ImageCatalog_setState(&g_appState.images, wanted[i], IMAGE_STATE_LOADING);
+		window[count++] = wanted[i];
+	}
+	// Loads abandoned with the previous window, the pipeline drops them on its own.
+	// Backwards because leaving the residency set swaps the last member into the slot.
+	for (size_t i = g_appState.images.residentCount; i-- > 0;) {
+		ResidentImage* res = &g_appState.images.resident[i];
+		int id = (int)res->id;
+		if (isInPrefetchWindow(id)) continue;
+		// So are full decodes of compressed images
+		res->reloading = false;
+		if (g_appState.images.items[id].state == IMAGE_STATE_LOADING) {
+			ImageCatalog_setState(&g_appState.images, id, IMAGE_STATE_UNLOADED);
+		}
+	}
+
+	int direction = g_appState.navDirection < 0 ? -1 : 1;
+	for (int k = 1; !Flipbook_active() && k <= READAHEAD_COUNT && k + PREFETCH_RADIUS < (int)g_appState.images.count / 2; ++k) {
+		int candidate = imageAt(position + direction * (PREFETCH_RADIUS + k));
+		if (g_appState.images.items[candidate].state == IMAGE_STATE_UNLOADED) readahead[readaheadCount++] = candidate;
+	}
+	loader_submit(wanted, wantedCount, window, count, readahead, readaheadCount);
 }
 
 void setCurrentImage(int newIndex) {
-	if (g_appState.images.size == 0) return;
-	if (newIndex >= (int)g_appState.images.size) newIndex = 0;
-	else if (newIndex < 0) newIndex = (int)g_appState.images.size - 1;
+	if (newIndex < 0 || newIndex >= (int)g_appState.images.size) return;
+	if (g_appState.images.position[newIndex] == IMAGE_REMOVED) return;
 	if (g_appState.currentIndex == newIndex) return;
+	if (g_appState.currentIndex >= 0) {
+		int step = (int)g_appState.images.position[newIndex] - (int)g_appState.images.position[g_appState.currentIndex];
+		if (abs(step) > (int)g_appState.images.count / 2) step = -step; // wrapped around the ends
+		g_appState.navDirection = step < 0 ? -1 : 1;
+	}
 	g_appState.currentIndex = newIndex;
 	ImageMetadata* img = &g_appState.images.items[newIndex];
-	if (img->state != IMAGE_STATE_LOADED) {
-		img->state = IMAGE_STATE_LOADING;
-		loader_request_load(newIndex);
+	// Going to an image that failed tries it once more, list updates around it do not
+	if (img->state == IMAGE_STATE_FAILED) ImageCatalog_setState(&g_appState.images, newIndex, IMAGE_STATE_UNLOADED);
+	if (img->state == IMAGE_STATE_LOADED) {
+		// Prefetched neighbor, show it right away
+		int previous = g_appState.activeTextureIndex;
+		g_appState.activeTextureIndex = newIndex;
+		ResidentImage* res = ImageCatalog_resident(&g_appState.images, newIndex);
+		if (isAnimated(res)) restartAnimationClock(res);
+		resetViewAfter(previous);
 	}
+	loader_request_load(newIndex);
 	updateWindowTitle();
 }
 
+// Moves through the display order, the current image is an id and not a position
+static void stepCurrentImage(int step) {
+	if (g_appState.currentIndex < 0 || g_appState.images.count == 0) return;
+	setCurrentImage(imageAt((int)g_appState.images.position[g_appState.currentIndex] + step));
+}
+
 GLuint compileShader(GLenum type, const char* source) {
 	GLuint shader = glCreateShader(type);
 	glShaderSource(shader, 1, &source, NULL);
@@ -166,6 +726,23 @@ GLuint compileShader(GLenum type, const char* source) {
 }
 
 //controls
+// Thirds of a stop, rounded so repeated steps land back on 0 exactly
+static void adjustExposure(float stops) {
+	float exposure = roundf((g_appState.exposure + stops) * 3.0f) / 3.0f;
+	if (exposure > EXPOSURE_MAX_STOPS) exposure = EXPOSURE_MAX_STOPS;
+	if (exposure < -EXPOSURE_MAX_STOPS) exposure = -EXPOSURE_MAX_STOPS;
+	g_appState.exposure = exposure;
+	updateWindowTitle();
+}
+
+// Name, date modified, size and date taken in turn, the current image stays and its neighbors change
+static void cycleSortMode(void) {
+	ImageCatalog* catalog = &g_appState.images;
+	ImageCatalog_setSortMode(catalog, (SortMode)((catalog->sortMode + 1) % SORT_MODE_COUNT));
+	if (g_appState.currentIndex >= 0) loader_request_load(g_appState.currentIndex);
+	updateWindowTitle();
+}
+
 void handleEvents() {
 	SDL_Event event;
 	while (SDL_PollEvent(&event)) {
@@ -173,6 +750,9 @@ void handleEvents() {
 			case SDL_EVENT_QUIT:
 				atomic_store(&g_appState.loader_running, false);
 				break;
+			case SDL_EVENT_WINDOW_DISPLAY_CHANGED:
+				updateRefreshInterval();
+				break;
 			case SDL_EVENT_WINDOW_RESIZED:
 				SDL_GetWindowSize(g_appState.window, &g_appState.windowWidth, &g_appState.windowHeight);
 				glViewport(0, 0, g_appState.windowWidth, g_appState.windowHeight);
@@ -186,14 +766,39 @@ void handleEvents() {
 						atomic_store(&g_appState.loader_running, false);
 						break;
 					case SDLK_RIGHT: case SDLK_KP_6:
-						setCurrentImage(g_appState.currentIndex + 1);
+						if (Flipbook_active()) Flipbook_stepFrames(1);
+						else stepCurrentImage(1);
 						break;
 					case SDLK_LEFT: case SDLK_KP_4:
-						setCurrentImage(g_appState.currentIndex - 1);
+						if (Flipbook_active()) Flipbook_stepFrames(-1);
+						else stepCurrentImage(-1);
+						break;
+					case SDLK_P:
+						if (Flipbook_active()) Flipbook_stop();
+						else if (!Flipbook_start(g_appState.currentIndex)) SDL_Log("Not part of a numbered image sequence");
+						break;
+					case SDLK_SPACE:
+						Flipbook_togglePause();
 						break;
 					case SDLK_R:
 						if (g_appState.currentIndex != -1) resetView(true);
 						break;
+					case SDLK_S:
+						cycleSortMode();
+						break;
+					case SDLK_EQUALS: case SDLK_KP_PLUS:
+						adjustExposure(1.0f / 3.0f);
+						break;
+					case SDLK_MINUS: case SDLK_KP_MINUS:
+						adjustExposure(-1.0f / 3.0f);
+						break;
+					case SDLK_0:
+						adjustExposure(-g_appState.exposure);
+						break;
+					case SDLK_T:
+						g_appState.toneMapping = !g_appState.toneMapping;
+						updateWindowTitle();
+						break;
 					case SDLK_F:
 						g_appState.isFullscreen = !g_appState.isFullscreen;
 						SDL_SetWindowFullscreen(g_appState.window, g_appState.isFullscreen);
@@ -214,7 +819,7 @@ void handleEvents() {
 					g_appState.modelDirty = true;
 					updateWindowTitle();
 				} else {
-					setCurrentImage(g_appState.currentIndex - (int)event.wheel.y);
+					stepCurrentImage(-(int)event.wheel.y);
 				}
 					break;
 			}
@@ -3,14 +3,27 @@
 #include "glad.h"
 #include "main_structs.h"
 
-void ImageMetadata_setFileSize(ImageMetadata* meta, uint64_t bytes);
-float ImageMetadata_getFileSizeMB(const ImageMetadata* meta);
 void updateProjectionMatrix(void);
 void updateModelMatrix(void);
 GLuint compileShader(GLenum type, const char* source);
 void resetView(bool fitToWindow);
+void resetViewAfter(int previous);
 void renderFrame(void);
+void TileTextures_release(const TiledImage* tiled);
+bool isAnimated(const ResidentImage* res);
+bool createFrameArray(ImageMetadata* img, ResidentImage* res, int frameCount, const unsigned char* firstFrame);
+void releaseFrameArray(ResidentImage* res);
+void updateRefreshInterval(void);
+void restartAnimationClock(ResidentImage* res);
+void createIndexedTexture(ImageMetadata* img, ResidentImage* res, const unsigned char* indices, const uint8_t* palette, const unsigned char* reduced);
+// `channels` samples per pixel, gray and gray with alpha are swizzled out to RGBA
+void createTexture(ImageMetadata* img, ResidentImage* res, int channels, SampleType sample, const unsigned char* pixels);
+// Three single-channel textures, the fragment shader converts to RGB
+void createYuvTextures(ImageMetadata* img, ResidentImage* res, const unsigned char* planes, const YuvLayout* layout);
+// Finishes a JPEG decode on the GPU, false when it could not
+bool createCoefficientTexture(ImageMetadata* img, ResidentImage* res, const JpegCoefficients* coefficients, const int16_t* data);
 void updateWindowTitle(void);
+bool isInPrefetchWindow(int index);
 void loader_request_load(int index);
 void setCurrentImage(int newIndex);
 void handleEvents(void);
@@ -0,0 +1,36 @@
+#include "sort_key.h"
+
+#include <string.h>
+
+static int isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+size_t SortKey_build(const char* name, size_t length, char* key) {
+	size_t out = 0;
+	for (size_t i = 0; i < length;) {
+		if (!isDigit(name[i])) {
+			key[out++] = name[i++];
+			continue;
+		}
+		size_t start = i;
+		while (i < length && isDigit(name[i])) ++i;
+		// Leading zeros do not change the value, a run of zeros keeps one
+		while (start + 1 < i && name[start] == '0') ++start;
+		size_t digits = i - start;
+		key[out++] = '0';
+		key[out++] = (char)(digits > 255 ? 255 : digits);
+		memcpy(key + out, name + start, digits);
+		out += digits;
+	}
+	key[out] = '\0';
+	return out;
+}
+
+uint64_t SortKey_prefix(const char* key, size_t length) {
+	uint64_t prefix = 0;
+	for (size_t i = 0; i < 8; ++i) {
+		prefix = (prefix << 8) | (i < length ? (uint8_t)key[i] : 0);
+	}
+	return prefix;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Upper bound of the key size for a name of `length` bytes, a lone digit grows to three bytes
+#define SORT_KEY_MAX_BYTES(length) (3 * (length) + 1)
+
+// Natural-order key computed once per name: every digit run becomes a '0' marker, the count of
+// its significant digits and the digits, so "img9" < "img10" under plain byte comparison.
+// The key never contains a zero byte and is NUL-terminated, returns its length.
+size_t SortKey_build(const char* name, size_t length, char* key);
+// First eight key bytes big-endian, equal prefixes fall back to comparing the whole key
+uint64_t SortKey_prefix(const char* key, size_t length);
@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include "stat_pass.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <SDL3/SDL.h>
+
+struct StatPass {
+	const char** paths;
+	StatResult* results;
+	size_t count;
+	atomic_size_t next;
+	atomic_int running;
+	atomic_bool stopping;
+	int threadCount;
+	SDL_Thread* threads[STAT_PASS_MAX_THREADS];
+};
+
+static void statRemaining(StatPass* pass) {
+	for (;;) {
+		size_t i = atomic_fetch_add(&pass->next, 1);
+		if (i >= pass->count || atomic_load(&pass->stopping)) break;
+		StatResult* result = &pass->results[i];
+		struct stat st;
+		result->ok = stat(pass->paths[i], &st) == 0;
+		if (result->ok) {
+			result->mtime = (int64_t)st.st_mtime;
+			result->size = (uint64_t)st.st_size;
+		}
+	}
+	atomic_fetch_sub(&pass->running, 1);
+}
+
+// Several threads keep a network filesystem busy, one stat at a time would wait on every round trip
+static int statThread(void* data) {
+	SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_LOW);
+	statRemaining((StatPass*)data);
+	return 0;
+}
+
+StatPass* StatPass_start(const ImageCatalog* catalog, const uint32_t* ids, size_t count) {
+	StatPass* pass = (StatPass*)calloc(1, sizeof(StatPass));
+	if (!pass) return NULL;
+	pass->paths = (const char**)malloc((count ? count : 1) * sizeof(const char*));
+	pass->results = (StatResult*)calloc(count ? count : 1, sizeof(StatResult));
+	if (!pass->paths || !pass->results) {
+		free(pass->paths);
+		free(pass->results);
+		free(pass);
+		return NULL;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		pass->paths[i] = catalog->paths[ids[i]];
+		pass->results[i].id = ids[i];
+	}
+	pass->count = count;
+	int threads = (int)(count / STAT_PASS_MIN_PER_THREAD) + 1;
+	if (threads > STAT_PASS_MAX_THREADS) threads = STAT_PASS_MAX_THREADS;
+	atomic_store(&pass->running, threads);
+	for (int i = 0; i < threads; ++i) {
+		pass->threads[pass->threadCount] = SDL_CreateThread(statThread, "StatPass", pass);
+		if (pass->threads[pass->threadCount]) pass->threadCount++;
+		else atomic_fetch_sub(&pass->running, 1);
+	}
+	// Without any thread the pass still completes, on the caller
+	if (pass->threadCount == 0) {
+		atomic_store(&pass->running, 1);
+		statRemaining(pass);
+	}
+	return pass;
+}
+
+bool StatPass_finished(StatPass* pass) {
+	return atomic_load(&pass->running) == 0;
+}
+
+const StatResult* StatPass_results(const StatPass* pass, size_t* count) {
+	*count = pass->count;
+	return pass->results;
+}
+
+void StatPass_stop(StatPass* pass) {
+	if (!pass) return;
+	atomic_store(&pass->stopping, true);
+	for (int i = 0; i < pass->threadCount; ++i) SDL_WaitThread(pass->threads[i], NULL);
+	free(pass->paths);
+	free(pass->results);
+	free(pass);
+}
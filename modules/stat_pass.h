@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "main_structs.h"
+
+// One background pass stat'ing a set of images, the listing itself never stats
+#define STAT_PASS_MAX_THREADS 8
+#define STAT_PASS_MIN_PER_THREAD 256
+
+typedef struct {
+	uint32_t id;
+	bool ok;
+	int64_t mtime;
+	uint64_t size;
+} StatResult;
+
+typedef struct StatPass StatPass;
+
+// The catalog's path strings never move, the pass keeps pointers to them. NULL when out of memory.
+StatPass* StatPass_start(const ImageCatalog* catalog, const uint32_t* ids, size_t count);
+bool StatPass_finished(StatPass* pass);
+// One result per id in the order given, only once finished
+const StatResult* StatPass_results(const StatPass* pass, size_t* count);
+// Abandons what is left and waits for the threads, NULL is fine
+void StatPass_stop(StatPass* pass);
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include "tile_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <SDL3/SDL.h>
+
+#define TILE_CACHE_MAGIC "SPXTILE1"
+#define TILE_CACHE_VERSION 2
+#define TILE_CACHE_HEADER_BYTES 4096
+#define TILE_CACHE_SOURCE_BYTES 3072 // longer source paths are not recorded, only the budget removes their pyramids
+#define TILE_CACHE_ABANDONED_SECONDS (24 * 60 * 60) // a temporary file this old is from a build that never finished
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t complete;
+	uint64_t sourceSize;
+	int64_t sourceMtimeSec, sourceMtimeNsec;
+	uint32_t width, height;
+	uint32_t tileSize, levelCount;
+	TileLevel levels[TILE_CACHE_MAX_LEVELS];
+	char source[TILE_CACHE_SOURCE_BYTES]; // absolute path, checked when the cache is trimmed
+} TileCacheHeader;
+
+_Static_assert(sizeof(TileCacheHeader) <= TILE_CACHE_HEADER_BYTES, "tile cache header does not fit its page");
+
+typedef struct {
+	TiledImage* tiled;
+	uint32_t flushedRows; // level 0 tile rows already handed to writeback
+	const atomic_bool* keepRunning;
+} BuildContext;
+
+bool TileCache_shouldUse(int width, int height, int maxTextureSize) {
+	if (width <= 0 || height <= 0) return false;
+	if (maxTextureSize > 0 && (width > maxTextureSize || height > maxTextureSize)) return true;
+	return (uint64_t)width * (uint64_t)height * 4 > TILE_CACHE_MIN_BYTES;
+}
+
+static bool makeDirectories(char* path) {
+	for (char* p = path + 1; *p; ++p) {
+		if (*p != '/') continue;
+		*p = '\0';
+		if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+			*p = '/';
+			return false;
+		}
+		*p = '/';
+	}
+	return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+static bool cacheDirectory(bool create, char* out, size_t size) {
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int n;
+	if (xdg && *xdg) n = snprintf(out, size, "%s/sharkpix/tiles", xdg);
+	else if (home && *home) n = snprintf(out, size, "%s/.cache/sharkpix/tiles", home);
+	else return false;
+	if (n < 0 || (size_t)n >= size) return false;
+	return !create || makeDirectories(out);
+}
+
+// `resolved` receives the absolute path of the source, PATH_MAX bytes
+static bool cacheFilePath(const char* path, bool create, char* resolved, char* out, size_t size) {
+	if (!realpath(path, resolved)) return false;
+	char dir[PATH_MAX];
+	if (!cacheDirectory(create, dir, sizeof(dir))) return false;
+
+	// FNV-1a of the absolute path, size and mtime are validated by the header
+	uint64_t hash = 1469598103934665603ull;
+	for (const char* p = resolved; *p; ++p) {
+		hash ^= (uint8_t)*p;
+		hash *= 1099511628211ull;
+	}
+	int n = snprintf(out, size, "%s/%016llx.spt", dir, (unsigned long long)hash);
+	return n > 0 && (size_t)n < size;
+}
+
+static uint64_t layoutLevels(TiledImage* tiled) {
+	uint64_t offset = TILE_CACHE_HEADER_BYTES;
+	uint32_t w = tiled->width, h = tiled->height;
+	uint32_t n = 0;
+	for (;;) {
+		TileLevel* level = &tiled->levels[n++];
+		level->width = w;
+		level->height = h;
+		level->tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+		level->tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+		level->offset = offset;
+		offset += (uint64_t)level->tilesX * level->tilesY * TILE_BYTES;
+		if ((w <= TILE_SIZE && h <= TILE_SIZE) || n == TILE_CACHE_MAX_LEVELS) break;
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	tiled->levelCount = n;
+	return offset;
+}
+
+static uint8_t* tileData(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty) {
+	const TileLevel* l = &tiled->levels[level];
+	return tiled->map + l->offset + ((uint64_t)ty * l->tilesX + tx) * TILE_BYTES;
+}
+
+const uint8_t* TiledImage_tile(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty) {
+	return tileData(tiled, level, tx, ty);
+}
+
+void TiledImage_tileSize(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty, int* w, int* h) {
+	const TileLevel* l = &tiled->levels[level];
+	*w = (int)MIN((uint32_t)TILE_SIZE, l->width - tx * TILE_SIZE);
+	*h = (int)MIN((uint32_t)TILE_SIZE, l->height - ty * TILE_SIZE);
+}
+
+void TiledImage_releaseTile(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty) {
+	madvise(tileData(tiled, level, tx, ty), TILE_BYTES, MADV_DONTNEED);
+}
+
+// Starts writeback for finished tile rows and unmaps their pages so RSS stays at a few tile rows
+static void flushTileRows(TiledImage* tiled, uint32_t level, uint32_t firstRow, uint32_t endRow) {
+	if (endRow <= firstRow) return;
+	const TileLevel* l = &tiled->levels[level];
+	size_t rowBytes = (size_t)l->tilesX * TILE_BYTES;
+	uint64_t offset = l->offset + (uint64_t)firstRow * rowBytes;
+	size_t length = (size_t)(endRow - firstRow) * rowBytes;
+	sync_file_range(tiled->fd, (off64_t)offset, (off64_t)length, SYNC_FILE_RANGE_WRITE);
+	madvise(tiled->map + offset, length, MADV_DONTNEED);
+}
+
+static bool writeRect(void* user, int x, int y, int w, int h, const uint8_t* rgba, ptrdiff_t stride) {
+	BuildContext* ctx = (BuildContext*)user;
+	TiledImage* tiled = ctx->tiled;
+	if (!atomic_load(ctx->keepRunning)) return false;
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 ||
+	    (uint32_t)(x + w) > tiled->width || (uint32_t)(y + h) > tiled->height) return false;
+
+	for (int row = 0; row < h; ++row) {
+		const uint8_t* src = rgba + (ptrdiff_t)row * stride;
+		uint32_t iy = (uint32_t)(y + row);
+		int col = 0;
+		while (col < w) {
+			uint32_t ix = (uint32_t)(x + col);
+			uint32_t px = ix % TILE_SIZE;
+			int run = (int)MIN((uint32_t)(w - col), TILE_SIZE - px);
+			uint8_t* dst = tileData(tiled, 0, ix / TILE_SIZE, iy / TILE_SIZE) + ((size_t)(iy % TILE_SIZE) * TILE_SIZE + px) * 4;
+			memcpy(dst, src + (size_t)col * 4, (size_t)run * 4);
+			col += run;
+		}
+	}
+
+	// Every streamer delivers tile rows top to bottom, so rows above the current one are done
+	uint32_t doneRows = (uint32_t)y / TILE_SIZE;
+	if (doneRows > ctx->flushedRows) {
+		flushTileRows(tiled, 0, ctx->flushedRows, doneRows);
+		ctx->flushedRows = doneRows;
+	}
+	return true;
+}
+
+static inline const uint8_t* levelPixel(const TiledImage* tiled, uint32_t level, uint32_t x, uint32_t y) {
+	return tileData(tiled, level, x / TILE_SIZE, y / TILE_SIZE) + ((size_t)(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * 4;
+}
+
+static void downsampleTile(TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty) {
+	const TileLevel* src = &tiled->levels[level - 1];
+	int w, h;
+	TiledImage_tileSize(tiled, level, tx, ty, &w, &h);
+	uint8_t* out = tileData(tiled, level, tx, ty);
+	for (int y = 0; y < h; ++y) {
+		uint32_t sy0 = (ty * TILE_SIZE + (uint32_t)y) * 2;
+		uint32_t sy1 = MIN(sy0 + 1, src->height - 1);
+		uint8_t* dst = out + (size_t)y * TILE_SIZE * 4;
+		for (int x = 0; x < w; ++x) {
+			uint32_t sx0 = (tx * TILE_SIZE + (uint32_t)x) * 2;
+			uint32_t sx1 = MIN(sx0 + 1, src->width - 1);
+			const uint8_t* a = levelPixel(tiled, level - 1, sx0, sy0);
+			const uint8_t* b = levelPixel(tiled, level - 1, sx1, sy0);
+			const uint8_t* c = levelPixel(tiled, level - 1, sx0, sy1);
+			const uint8_t* d = levelPixel(tiled, level - 1, sx1, sy1);
+			for (int ch = 0; ch < 4; ++ch) {
+				dst[x * 4 + ch] = (uint8_t)((a[ch] + b[ch] + c[ch] + d[ch] + 2) >> 2);
+			}
+		}
+	}
+}
+
+static bool buildLevels(TiledImage* tiled, const atomic_bool* keepRunning) {
+	for (uint32_t level = 1; level < tiled->levelCount; ++level) {
+		const TileLevel* l = &tiled->levels[level];
+		for (uint32_t ty = 0; ty < l->tilesY; ++ty) {
+			if (!atomic_load(keepRunning)) return false;
+			for (uint32_t tx = 0; tx < l->tilesX; ++tx) {
+				downsampleTile(tiled, level, tx, ty);
+			}
+			flushTileRows(tiled, level, ty, ty + 1);
+			flushTileRows(tiled, level - 1, ty * 2, MIN(ty * 2 + 2, tiled->levels[level - 1].tilesY));
+		}
+	}
+	return true;
+}
+
+static bool headerValid(const TileCacheHeader* header) {
+	return memcmp(header->magic, TILE_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+	       header->version == TILE_CACHE_VERSION &&
+	       header->complete == 1 &&
+	       header->tileSize == TILE_SIZE &&
+	       header->levelCount > 0 && header->levelCount <= TILE_CACHE_MAX_LEVELS;
+}
+
+static bool headerMatches(const TileCacheHeader* header, const struct stat* st) {
+	return headerValid(header) &&
+	       header->sourceSize == (uint64_t)st->st_size &&
+	       header->sourceMtimeSec == (int64_t)st->st_mtim.tv_sec &&
+	       header->sourceMtimeNsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+// The pyramid can never be found again: damaged, from another version, or its source changed or was deleted.
+// A source whose folder is gone as a whole, e.g. on an unmounted drive, keeps its pyramid for when it returns.
+static bool isStale(int dirFd, const char* name) {
+	TileCacheHeader header;
+	int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+	bool whole = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+	close(fd);
+	if (!whole || !headerValid(&header)) return true;
+	header.source[TILE_CACHE_SOURCE_BYTES - 1] = '\0';
+	if (header.source[0] != '/') return false;
+	struct stat st;
+	if (stat(header.source, &st) == 0) return !headerMatches(&header, &st);
+	if (errno != ENOENT && errno != ENOTDIR) return false;
+	char* slash = strrchr(header.source, '/');
+	if (slash == header.source) return true;
+	*slash = '\0';
+	return stat(header.source, &st) == 0;
+}
+
+typedef struct {
+	char name[NAME_MAX + 1];
+	uint64_t bytes;
+	int64_t lastUse;
+} CacheEntry;
+
+static int compareLastUse(const void* a, const void* b) {
+	int64_t x = ((const CacheEntry*)a)->lastUse, y = ((const CacheEntry*)b)->lastUse;
+	return (x > y) - (x < y);
+}
+
+// Runs after every build, the only time the cache grows. `keep` is the pyramid just built.
+static void trimCache(const char* keep) {
+	char dir[PATH_MAX];
+	if (!cacheDirectory(false, dir, sizeof(dir))) return;
+	DIR* d = opendir(dir);
+	if (!d) return;
+	int dirFd = dirfd(d);
+	CacheEntry* entries = NULL;
+	size_t count = 0, capacity = 0;
+	uint64_t total = 0;
+	time_t now = time(NULL);
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL) {
+		const char* ext = strstr(e->d_name, ".spt");
+		struct stat st;
+		if (!ext || fstatat(dirFd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+		uint64_t bytes = (uint64_t)st.st_blocks * 512;
+		if (ext[4] != '\0') {
+			// mkstemp suffix, another instance may still be writing it
+			if (now - st.st_mtime > TILE_CACHE_ABANDONED_SECONDS) unlinkat(dirFd, e->d_name, 0);
+			else total += bytes;
+			continue;
+		}
+		if (strcmp(e->d_name, keep) == 0) {
+			total += bytes;
+			continue;
+		}
+		if (isStale(dirFd, e->d_name)) {
+			unlinkat(dirFd, e->d_name, 0);
+			continue;
+		}
+		if (count == capacity) {
+			size_t grown = capacity ? capacity * 2 : 64;
+			CacheEntry* larger = (CacheEntry*)realloc(entries, grown * sizeof(CacheEntry));
+			if (!larger) break;
+			entries = larger;
+			capacity = grown;
+		}
+		CacheEntry* entry = &entries[count++];
+		snprintf(entry->name, sizeof(entry->name), "%s", e->d_name);
+		entry->bytes = bytes;
+		// TileCache_find touches atime, mtime is when it was built
+		entry->lastUse = (int64_t)(st.st_atime > st.st_mtime ? st.st_atime : st.st_mtime);
+		total += bytes;
+	}
+	if (total > TILE_CACHE_MAX_TOTAL_BYTES) {
+		qsort(entries, count, sizeof(CacheEntry), compareLastUse);
+		for (size_t i = 0; i < count && total > TILE_CACHE_MAX_TOTAL_BYTES; ++i) {
+			if (unlinkat(dirFd, entries[i].name, 0) == 0) total -= entries[i].bytes;
+		}
+	}
+	free(entries);
+	closedir(d);
+}
+
+TiledImage* TileCache_find(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) return NULL;
+	char resolved[PATH_MAX], cachePath[PATH_MAX];
+	if (!cacheFilePath(path, false, resolved, cachePath, sizeof(cachePath))) return NULL;
+	int fd = open(cachePath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+
+	TileCacheHeader header;
+	struct stat cacheStat;
+	if (fstat(fd, &cacheStat) != 0 ||
+	    pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+	    !headerMatches(&header, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	TiledImage* tiled = (TiledImage*)calloc(1, sizeof(TiledImage));
+	if (!tiled) {
+		close(fd);
+		return NULL;
+	}
+	tiled->width = header.width;
+	tiled->height = header.height;
+	uint64_t expected = layoutLevels(tiled);
+	if (tiled->levelCount != header.levelCount || (uint64_t)cacheStat.st_size != expected ||
+	    memcmp(tiled->levels, header.levels, sizeof(TileLevel) * tiled->levelCount) != 0) {
+		free(tiled);
+		close(fd);
+		return NULL;
+	}
+
+	void* map = mmap(NULL, (size_t)expected, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		free(tiled);
+		close(fd);
+		return NULL;
+	}
+	madvise(map, (size_t)expected, MADV_RANDOM);
+	// Marks it used for trimCache, noatime mounts never would
+	futimens(fd, (const struct timespec[2]){ { 0, UTIME_NOW }, { 0, UTIME_OMIT } });
+	tiled->fd = fd;
+	tiled->map = (uint8_t*)map;
+	tiled->mapSize = (size_t)expected;
+	return tiled;
+}
+
+TiledImage* TileCache_build(const char* path, const FileSource* src, int width, int height, ImageStreamer stream, const atomic_bool* keepRunning) {
+	if (width <= 0 || height <= 0 || !stream) return NULL;
+	struct stat st;
+	if (fstat(src->fd, &st) != 0) return NULL;
+	char resolved[PATH_MAX], cachePath[PATH_MAX], tmpPath[PATH_MAX + 8];
+	if (!cacheFilePath(path, true, resolved, cachePath, sizeof(cachePath))) return NULL;
+	// Unique per build, two instances opening the same image never write into one file
+	snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", cachePath);
+
+	TiledImage tiled = {0};
+	tiled.fd = -1;
+	tiled.width = (uint32_t)width;
+	tiled.height = (uint32_t)height;
+	uint64_t total = layoutLevels(&tiled);
+	bool ok = false;
+
+	tiled.fd = mkostemp(tmpPath, O_CLOEXEC);
+	if (tiled.fd < 0) return NULL;
+	struct statvfs vfs;
+	if (fstatvfs(tiled.fd, &vfs) == 0 && (uint64_t)vfs.f_bavail * vfs.f_frsize < total) {
+		SDL_Log("Not enough disk space for the tile cache of %s (%llu MB needed)",
+			path, (unsigned long long)(total >> 20));
+		goto cleanup;
+	}
+	if (ftruncate(tiled.fd, (off_t)total) != 0) goto cleanup;
+	void* map = mmap(NULL, (size_t)total, PROT_READ | PROT_WRITE, MAP_SHARED, tiled.fd, 0);
+	if (map == MAP_FAILED) goto cleanup;
+	tiled.map = (uint8_t*)map;
+	tiled.mapSize = (size_t)total;
+
+	BuildContext ctx = { &tiled, 0, keepRunning };
+	if (!stream(src, writeRect, &ctx)) goto cleanup;
+	flushTileRows(&tiled, 0, ctx.flushedRows, tiled.levels[0].tilesY);
+	if (!buildLevels(&tiled, keepRunning)) goto cleanup;
+	if (fdatasync(tiled.fd) != 0) goto cleanup;
+
+	// The header is written last so an interrupted build never validates
+	TileCacheHeader header = {0};
+	memcpy(header.magic, TILE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = TILE_CACHE_VERSION;
+	header.complete = 1;
+	header.sourceSize = (uint64_t)st.st_size;
+	header.sourceMtimeSec = (int64_t)st.st_mtim.tv_sec;
+	header.sourceMtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+	header.width = tiled.width;
+	header.height = tiled.height;
+	header.tileSize = TILE_SIZE;
+	header.levelCount = tiled.levelCount;
+	memcpy(header.levels, tiled.levels, sizeof(header.levels));
+	if (strlen(resolved) < sizeof(header.source)) memcpy(header.source, resolved, strlen(resolved) + 1);
+	if (pwrite(tiled.fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) goto cleanup;
+	if (fdatasync(tiled.fd) != 0) goto cleanup;
+	ok = rename(tmpPath, cachePath) == 0;
+
+cleanup:
+	if (tiled.map) munmap(tiled.map, tiled.mapSize);
+	close(tiled.fd);
+	if (!ok) {
+		unlink(tmpPath);
+		return NULL;
+	}
+	trimCache(strrchr(cachePath, '/') + 1);
+	return TileCache_find(path);
+}
+
+void TiledImage_close(TiledImage* tiled) {
+	if (!tiled) return;
+	if (tiled->map) munmap(tiled->map, tiled->mapSize);
+	if (tiled->fd >= 0) close(tiled->fd);
+	free(tiled);
+}
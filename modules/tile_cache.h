@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "image_loaders.h"
+
+#define TILE_SIZE 256
+#define TILE_BYTES ((size_t)TILE_SIZE * TILE_SIZE * 4)
+#define TILE_CACHE_MAX_LEVELS 24
+#define TILE_CACHE_MIN_BYTES ((uint64_t)512 * 1024 * 1024) // decoded size above which images go out-of-core
+#define TILE_CACHE_MAX_TOTAL_BYTES ((uint64_t)16 * 1024 * 1024 * 1024) // all pyramids together, the least recently opened go first
+
+typedef struct {
+	uint32_t width, height;
+	uint32_t tilesX, tilesY;
+	uint64_t offset; // first tile of the level, tiles are stored row-major
+} TileLevel;
+
+typedef struct {
+	int fd;
+	uint8_t* map;
+	size_t mapSize;
+	uint32_t width, height;
+	uint32_t levelCount;
+	TileLevel levels[TILE_CACHE_MAX_LEVELS];
+} TiledImage;
+
+bool TileCache_shouldUse(int width, int height, int maxTextureSize);
+// Returns a previously built cache for this file or NULL, never decodes
+TiledImage* TileCache_find(const char* path);
+// Decodes the image once through `stream` into a tiled multi-resolution cache file.
+// Pyramids of sources that changed or were deleted are removed then, so are the oldest beyond the budget.
+TiledImage* TileCache_build(const char* path, const FileSource* src, int width, int height, ImageStreamer stream, const atomic_bool* keepRunning);
+void TiledImage_close(TiledImage* tiled);
+
+// Tiles are always TILE_SIZE wide in memory, edge tiles only use part of it
+const uint8_t* TiledImage_tile(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty);
+void TiledImage_tileSize(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty, int* w, int* h);
+// Drops the tile pages from our address space once they are uploaded, the page cache still keeps them
+void TiledImage_releaseTile(const TiledImage* tiled, uint32_t level, uint32_t tx, uint32_t ty);
@@ -0,0 +1,386 @@
+#include "transcode.h"
+#include "main_structs.h"
+#include "render.h"
+#include "catalog.h"
+#include "pipeline.h"
+#include "flipbook.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb/stb_dxt.h>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#define TRANSCODE_MAX_LEVELS 16
+
+typedef struct {
+	int width, height;
+	int channels; // as read back, 4 only when the alpha is used
+	size_t offset; // into the readback buffer
+	GLint swizzle[4]; // of the source texture, the copy samples the same way
+	int levels;
+	size_t levelOffset[TRANSCODE_MAX_LEVELS]; // into the blocks
+	size_t levelSize[TRANSCODE_MAX_LEVELS];
+} TranscodePlane;
+
+typedef struct {
+	int id;
+	int planeCount; // 3 for luma and chroma textures
+	TranscodePlane planes[3];
+	GLuint sources[3]; // swapped out only while the image still holds these
+	GLuint pbo;
+	size_t pixelBytes;
+	GLsync fence; // readback done
+	const uint8_t* pixels; // the mapped buffer, read by the compression thread
+	uint8_t* blocks; // every level of every plane
+	size_t blockBytes;
+	bool compressing; // owned by the compression thread until it comes back on `done`
+	bool cancelled; // forgotten meanwhile, dropped once it is back
+	bool ok;
+} TranscodeJob;
+
+typedef struct {
+	int id;
+	uint64_t bytes;
+} CachedImage;
+
+static struct {
+	bool started;
+	bool s3tc; // BC1 and BC3 for color, BC4 and BC5 are core
+	TranscodeJob* jobs[TRANSCODE_MAX_JOBS];
+	int jobCount;
+	BoundedQueue input, done;
+	Stage stage;
+	CachedImage* cached; // oldest first
+	size_t cachedCount, cachedCapacity;
+	uint64_t cachedBytes;
+} transcoder;
+
+static const GLenum readFormats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+static const GLenum compressedFormats[] = {
+	GL_COMPRESSED_RED_RGTC1, // BC4
+	GL_COMPRESSED_RG_RGTC2, // BC5
+	GL_COMPRESSED_RGB_S3TC_DXT1_EXT, // BC1
+	GL_COMPRESSED_RGBA_S3TC_DXT5_EXT // BC3
+};
+
+static int blockBytes(int channels) {
+	return channels == 1 || channels == 3 ? 8 : 16;
+}
+
+static int half(int size) {
+	return size > 1 ? size / 2 : 1;
+}
+
+// Box filter over 2x2 blocks, an odd last row or column is dropped and a side of 1 is read twice
+static void halve(const uint8_t* src, int width, int height, int channels, uint8_t* dst) {
+	int w = half(width), h = half(height);
+	for (int y = 0; y < h; ++y) {
+		const uint8_t* row0 = src + (size_t)(2 * y < height ? 2 * y : height - 1) * width * channels;
+		const uint8_t* row1 = src + (size_t)(2 * y + 1 < height ? 2 * y + 1 : height - 1) * width * channels;
+		for (int x = 0; x < w; ++x) {
+			int x0 = (2 * x < width ? 2 * x : width - 1) * channels;
+			int x1 = (2 * x + 1 < width ? 2 * x + 1 : width - 1) * channels;
+			for (int c = 0; c < channels; ++c) {
+				*dst++ = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+			}
+		}
+	}
+}
+
+// Blocks in row order, edge blocks repeat the last row and column
+static void compressLevel(const uint8_t* pixels, int width, int height, int channels, uint8_t* out) {
+	uint8_t block[64];
+	for (int by = 0; by < height; by += 4) {
+		for (int bx = 0; bx < width; bx += 4) {
+			for (int y = 0; y < 4; ++y) {
+				const uint8_t* row = pixels + (size_t)(by + y < height ? by + y : height - 1) * width * channels;
+				for (int x = 0; x < 4; ++x) {
+					const uint8_t* p = row + (size_t)(bx + x < width ? bx + x : width - 1) * channels;
+					int i = y * 4 + x;
+					if (channels == 1) {
+						block[i] = p[0];
+					} else if (channels == 2) {
+						block[i * 2] = p[0];
+						block[i * 2 + 1] = p[1];
+					} else {
+						block[i * 4] = p[0];
+						block[i * 4 + 1] = p[1];
+						block[i * 4 + 2] = p[2];
+						block[i * 4 + 3] = channels == 4 ? p[3] : 255;
+					}
+				}
+			}
+			if (channels == 1) stb_compress_bc4_block(out, block);
+			else if (channels == 2) stb_compress_bc5_block(out, block);
+			else stb_compress_dxt_block(out, block, channels == 4, STB_DXT_HIGHQUAL);
+			out += blockBytes(channels);
+		}
+	}
+}
+
+static bool compressPlane(const TranscodePlane* plane, const uint8_t* pixels, uint8_t* blocks) {
+	int width = plane->width, height = plane->height;
+	uint8_t* level = NULL; // level 0 is compressed straight from the mapped buffer
+	for (int l = 0; l < plane->levels; ++l) {
+		if (l > 0) {
+			uint8_t* next = (uint8_t*)malloc((size_t)half(width) * half(height) * plane->channels);
+			if (!next) {
+				free(level);
+				return false;
+			}
+			halve(pixels, width, height, plane->channels, next);
+			free(level);
+			pixels = level = next;
+			width = half(width);
+			height = half(height);
+		}
+		compressLevel(pixels, width, height, plane->channels, blocks + plane->levelOffset[l]);
+	}
+	free(level);
+	return true;
+}
+
+// Compression thread
+static void compressStage(void* item) {
+	TranscodeJob* job = (TranscodeJob*)item;
+	job->ok = true;
+	for (int p = 0; p < job->planeCount && job->ok; ++p) {
+		job->ok = compressPlane(&job->planes[p], job->pixels + job->planes[p].offset, job->blocks);
+	}
+	// Holds every job there can be, never blocks
+	BoundedQueue_push(&transcoder.done, job);
+}
+
+static void releaseJob(TranscodeJob* job) {
+	if (job->fence) glDeleteSync(job->fence);
+	if (job->pixels) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &job->pbo);
+	free(job->blocks);
+	free(job);
+}
+
+static void removeJob(TranscodeJob* job) {
+	for (int i = 0; i < transcoder.jobCount; ++i) {
+		if (transcoder.jobs[i] != job) continue;
+		transcoder.jobs[i] = transcoder.jobs[--transcoder.jobCount];
+		break;
+	}
+	releaseJob(job);
+}
+
+void Transcoder_start(void) {
+	memset(&transcoder, 0, sizeof(transcoder));
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i) {
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) transcoder.s3tc = true;
+	}
+	if (!transcoder.s3tc) SDL_Log("No S3TC texture compression, only gray images are kept compressed");
+	if (!BoundedQueue_init(&transcoder.input, TRANSCODE_MAX_JOBS)) return;
+	if (!BoundedQueue_init(&transcoder.done, TRANSCODE_MAX_JOBS)) {
+		BoundedQueue_destroy(&transcoder.input);
+		return;
+	}
+	Stage_start(&transcoder.stage, "Transcode", TRANSCODE_THREADS, &transcoder.input, compressStage);
+	transcoder.started = true;
+}
+
+void Transcoder_stop(void) {
+	if (!transcoder.started) return;
+	// The thread compresses what is still queued before it exits, every job is then released here
+	BoundedQueue_close(&transcoder.input);
+	Stage_join(&transcoder.stage);
+	for (int i = 0; i < transcoder.jobCount; ++i) releaseJob(transcoder.jobs[i]);
+	BoundedQueue_destroy(&transcoder.input);
+	BoundedQueue_destroy(&transcoder.done);
+	free(transcoder.cached);
+	memset(&transcoder, 0, sizeof(transcoder));
+}
+
+bool Transcoder_pending(int id) {
+	for (int i = 0; i < transcoder.jobCount; ++i) {
+		if (transcoder.jobs[i]->id == id && !transcoder.jobs[i]->cancelled) return true;
+	}
+	return false;
+}
+
+// Reads level 0 back into a pixel buffer, the fence tells when it can be mapped without a stall
+bool Transcoder_begin(int id) {
+	if (!transcoder.started || transcoder.jobCount == TRANSCODE_MAX_JOBS || Flipbook_active()) return false;
+	ImageMetadata* img = &g_appState.images.items[id];
+	ResidentImage* res = ImageCatalog_resident(&g_appState.images, id);
+	// Palettes are compact already, animations and tiles are not one texture
+	if (!res || res->compressed || !img->textureID || res->tiled || isAnimated(res) || res->palette_texture) return false;
+	// Block compression would throw away what 16-bit and HDR textures are kept for
+	if (res->sample != SAMPLE_UINT8) return false;
+	if (!res->chroma_textures[0] && (res->channels < 1 || res->channels > 4)) return false;
+	TranscodeJob* job = (TranscodeJob*)calloc(1, sizeof(TranscodeJob));
+	if (!job) return false;
+	job->id = id;
+	job->planeCount = res->chroma_textures[0] ? 3 : 1;
+	job->sources[0] = img->textureID;
+	job->sources[1] = res->chroma_textures[0];
+	job->sources[2] = res->chroma_textures[1];
+	for (int p = 0; p < job->planeCount; ++p) {
+		TranscodePlane* plane = &job->planes[p];
+		// An opaque alpha channel is left behind, BC1 takes half the space of BC3
+		plane->channels = job->planeCount == 3 ? 1 : res->channels == 4 && res->opaque ? 3 : res->channels;
+		if (plane->channels >= 3 && !transcoder.s3tc) {
+			free(job);
+			return false;
+		}
+		glBindTexture(GL_TEXTURE_2D, job->sources[p]);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &plane->width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &plane->height);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, plane->swizzle);
+		plane->offset = job->pixelBytes;
+		job->pixelBytes += (size_t)plane->width * plane->height * plane->channels;
+		int width = plane->width, height = plane->height;
+		for (plane->levels = 0; plane->levels < TRANSCODE_MAX_LEVELS; ++plane->levels) {
+			plane->levelOffset[plane->levels] = job->blockBytes;
+			plane->levelSize[plane->levels] = (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(plane->channels);
+			job->blockBytes += plane->levelSize[plane->levels];
+			if (width == 1 && height == 1) break;
+			width = half(width);
+			height = half(height);
+		}
+		plane->levels++;
+	}
+	// One image would push out most of the others
+	if (job->pixelBytes == 0 || job->blockBytes > TRANSCODE_CACHE_BYTES / 2) {
+		free(job);
+		return false;
+	}
+	job->blocks = (uint8_t*)malloc(job->blockBytes);
+	if (!job->blocks) {
+		free(job);
+		return false;
+	}
+	glGenBuffers(1, &job->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)job->pixelBytes, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (int p = 0; p < job->planeCount; ++p) {
+		glBindTexture(GL_TEXTURE_2D, job->sources[p]);
+		glGetTexImage(GL_TEXTURE_2D, 0, readFormats[job->planes[p].channels - 1], GL_UNSIGNED_BYTE, (void*)job->planes[p].offset);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	transcoder.jobs[transcoder.jobCount++] = job;
+	return true;
+}
+
+// The compressed copies replace the textures the image holds, only while nothing needs it at full quality
+static void swapIn(TranscodeJob* job) {
+	int id = job->id;
+	ImageMetadata* img = &g_appState.images.items[id];
+	ResidentImage* res = ImageCatalog_resident(&g_appState.images, id);
+	if (img->state != IMAGE_STATE_LOADED || !res || id == g_appState.activeTextureIndex || isInPrefetchWindow(id)) return;
+	GLuint* targets[3] = {&img->textureID, &res->chroma_textures[0], &res->chroma_textures[1]};
+	for (int p = 0; p < job->planeCount; ++p) {
+		if (*targets[p] != job->sources[p]) return;
+	}
+	if (transcoder.cachedCount == transcoder.cachedCapacity) {
+		size_t n = transcoder.cachedCapacity ? transcoder.cachedCapacity * 2 : 16;
+		CachedImage* grown = (CachedImage*)realloc(transcoder.cached, n * sizeof(CachedImage));
+		// Untracked it would never be evicted, the full texture stays
+		if (!grown) return;
+		transcoder.cached = grown;
+		transcoder.cachedCapacity = n;
+	}
+	uint64_t bytes = 0;
+	for (int p = 0; p < job->planeCount; ++p) {
+		const TranscodePlane* plane = &job->planes[p];
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, plane->levels - 1);
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, plane->swizzle);
+		int width = plane->width, height = plane->height;
+		for (int l = 0; l < plane->levels; ++l) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, l, compressedFormats[plane->channels - 1], width, height, 0,
+				(GLsizei)plane->levelSize[l], job->blocks + plane->levelOffset[l]);
+			bytes += plane->levelSize[l];
+			width = half(width);
+			height = half(height);
+		}
+		glDeleteTextures(1, targets[p]);
+		*targets[p] = texture;
+	}
+	res->compressed = true;
+	transcoder.cached[transcoder.cachedCount++] = (CachedImage){ id, bytes };
+	transcoder.cachedBytes += bytes;
+}
+
+void Transcoder_update(void) {
+	if (!transcoder.started) return;
+	for (int i = 0; i < transcoder.jobCount; ++i) {
+		TranscodeJob* job = transcoder.jobs[i];
+		if (job->compressing) continue;
+		GLenum status = glClientWaitSync(job->fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) continue;
+		glDeleteSync(job->fence);
+		job->fence = NULL;
+		if (status != GL_WAIT_FAILED) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+			job->pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)job->pixelBytes, GL_MAP_READ_BIT);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		if (job->pixels && BoundedQueue_push(&transcoder.input, job)) {
+			job->compressing = true;
+			continue;
+		}
+		removeJob(job);
+		--i;
+	}
+	void* item;
+	while (BoundedQueue_tryPop(&transcoder.done, &item)) {
+		TranscodeJob* job = (TranscodeJob*)item;
+		if (job->ok && !job->cancelled) swapIn(job);
+		removeJob(job);
+	}
+}
+
+void Transcoder_forget(int id) {
+	for (int i = transcoder.jobCount; i-- > 0;) {
+		TranscodeJob* job = transcoder.jobs[i];
+		if (job->id != id) continue;
+		// The compression thread still reads the mapped buffer
+		if (job->compressing) job->cancelled = true;
+		else removeJob(job);
+	}
+	for (size_t i = 0; i < transcoder.cachedCount; ++i) {
+		if (transcoder.cached[i].id != id) continue;
+		transcoder.cachedBytes -= transcoder.cached[i].bytes;
+		memmove(&transcoder.cached[i], &transcoder.cached[i + 1], (transcoder.cachedCount - i - 1) * sizeof(CachedImage));
+		transcoder.cachedCount--;
+		break;
+	}
+}
+
+int Transcoder_overBudget(void) {
+	if (transcoder.cachedBytes <= TRANSCODE_CACHE_BYTES) return -1;
+	for (size_t i = 0; i < transcoder.cachedCount; ++i) {
+		int id = transcoder.cached[i].id;
+		if (id != g_appState.activeTextureIndex && !isInPrefetchWindow(id)) return id;
+	}
+	return -1;
+}
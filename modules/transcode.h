@@ -0,0 +1,22 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Images that leave the prefetch window stay resident as block-compressed textures instead of being unloaded,
+// going back to them shows the compressed copy at once while the full quality one is decoded again
+#define TRANSCODE_CACHE_BYTES ((uint64_t)256 * 1024 * 1024) // compressed textures kept outside the window
+#define TRANSCODE_MAX_JOBS 2 // images read back or compressed at once, each keeps its full texture meanwhile
+#define TRANSCODE_THREADS 1
+
+// Detects the block formats the driver takes and starts the compression thread, main thread with GL up
+void Transcoder_start(void);
+void Transcoder_stop(void);
+// Starts compressing the textures of `id`, false when they cannot be and the image should be unloaded instead
+bool Transcoder_begin(int id);
+bool Transcoder_pending(int id);
+// Moves finished readbacks to the compression thread and swaps in what it compressed, main thread once per frame
+void Transcoder_update(void);
+// The textures of `id` are being unloaded, drops its job and its share of the cache
+void Transcoder_forget(int id);
+// The least recently compressed image outside the window while the cache is over budget, -1 otherwise
+int Transcoder_overBudget(void);
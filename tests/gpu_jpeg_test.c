@@ -0,0 +1,205 @@
+// Decodes generated JPEGs with the GPU passes and with libjpeg-turbo and compares every pixel.
+// Needs an OpenGL 3.3 context from EGL, Mesa gives one without a display on its surfaceless platform.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <EGL/egl.h>
+#include <jpeglib.h>
+
+#include "glad.h"
+#include "gpu_jpeg.h"
+
+#define SKIP_CODE 77 // CTest SKIP_RETURN_CODE, no GPU to test on
+
+typedef struct {
+	const char* name;
+	int width, height;
+	int components;
+	int hSamp, vSamp; // luma sampling factors, chroma is 1x1
+	int quality;
+} Case;
+
+static const Case cases[] = {
+	{"gray", 61, 37, 1, 1, 1, 90},
+	{"4:4:4", 64, 48, 3, 1, 1, 90},
+	{"4:2:2", 77, 29, 3, 2, 1, 85},
+	{"4:4:0", 45, 53, 3, 1, 2, 85},
+	{"4:2:0", 123, 67, 3, 2, 2, 75},
+	{"4:2:0 odd", 9, 7, 3, 2, 2, 95},
+	{"4:2:0 q100", 50, 50, 3, 2, 2, 100}, // large coefficients, exercises the range limit
+};
+
+// The GPU passes and the renderer share this helper, the test links no renderer
+GLuint compileShader(GLenum type, const char* source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		char infoLog[512];
+		glGetShaderInfoLog(shader, 512, NULL, infoLog);
+		fprintf(stderr, "Shader Compilation Failed:\n%s\n", infoLog);
+	}
+	return shader;
+}
+
+static bool createContext(void) {
+	setenv("EGL_PLATFORM", "surfaceless", 0);
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) return false;
+	EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+	EGLConfig config;
+	EGLint count;
+	if (!eglChooseConfig(display, configAttribs, &config, 1, &count) || count == 0) return false;
+	EGLint surfaceAttribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+	if (!eglBindAPI(EGL_OPENGL_API)) return false;
+	EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) return false;
+	return gladLoadGLLoader((GLADloadproc)eglGetProcAddress) != 0;
+}
+
+// Smooth gradients with noise on top, so both flat and busy blocks come up
+static uint8_t* makePixels(const Case* c) {
+	uint8_t* pixels = malloc((size_t)c->width * c->height * c->components);
+	uint32_t seed = 12345;
+	for (int y = 0; y < c->height; ++y) {
+		for (int x = 0; x < c->width; ++x) {
+			for (int k = 0; k < c->components; ++k) {
+				seed = seed * 1664525u + 1013904223u;
+				int noise = (int)(seed >> 26) - 32;
+				int value = (x * 255 / c->width + y * 255 / c->height * (k + 1)) / (k + 2) + noise;
+				pixels[((size_t)y * c->width + x) * c->components + k] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+			}
+		}
+	}
+	return pixels;
+}
+
+static unsigned char* encode(const Case* c, unsigned long* size) {
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	unsigned char* jpeg = NULL;
+	*size = 0;
+	jpeg_mem_dest(&cinfo, &jpeg, size);
+	cinfo.image_width = (JDIMENSION)c->width;
+	cinfo.image_height = (JDIMENSION)c->height;
+	cinfo.input_components = c->components;
+	cinfo.in_color_space = c->components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, c->quality, TRUE);
+	cinfo.comp_info[0].h_samp_factor = c->hSamp;
+	cinfo.comp_info[0].v_samp_factor = c->vSamp;
+	uint8_t* pixels = makePixels(c);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = pixels + (size_t)cinfo.next_scanline * c->width * c->components;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(pixels);
+	return jpeg;
+}
+
+// Islow IDCT and fancy upsampling are the libjpeg-turbo defaults the shaders reproduce
+static uint8_t* decodeReference(const unsigned char* jpeg, unsigned long size, int components) {
+	struct jpeg_decompress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, jpeg, size);
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.dct_method = JDCT_ISLOW;
+	cinfo.do_fancy_upsampling = TRUE;
+	cinfo.out_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+	size_t stride = (size_t)cinfo.output_width * cinfo.output_components;
+	uint8_t* pixels = malloc(stride * cinfo.output_height);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = pixels + stride * cinfo.output_scanline;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return pixels;
+}
+
+static bool runCase(const Case* c) {
+	unsigned long size;
+	unsigned char* jpeg = encode(c, &size);
+	uint8_t* expected = decodeReference(jpeg, size, c->components);
+
+	FileSource src = {.data = jpeg, .size = size, .fd = -1, .mapped = false};
+	JpegCoefficients coefficients;
+	int width, height;
+	int16_t* data = loadImage_JpegTurboCoefficients(&src, &width, &height, &coefficients);
+	if (!data) {
+		printf("%-12s FAIL: coefficients were not read\n", c->name);
+		free(jpeg);
+		free(expected);
+		return false;
+	}
+	GLuint texture = GpuJpeg_decode(&coefficients, data, width, height);
+	bool ok = texture != 0;
+	int mismatches = 0, worst = 0, firstX = -1, firstY = -1;
+	if (ok) {
+		uint8_t* actual = malloc((size_t)width * height * 4);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, actual);
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				for (int k = 0; k < 3; ++k) {
+					int want = expected[((size_t)y * width + x) * c->components + (c->components == 1 ? 0 : k)];
+					int got = actual[((size_t)y * width + x) * 4 + k];
+					int diff = abs(want - got);
+					if (diff == 0) continue;
+					if (mismatches++ == 0) {
+						firstX = x;
+						firstY = y;
+					}
+					if (diff > worst) worst = diff;
+				}
+			}
+		}
+		free(actual);
+		glDeleteTextures(1, &texture);
+		ok = mismatches == 0;
+	}
+	if (!texture) {
+		printf("%-12s FAIL: GPU decode failed\n", c->name);
+	} else if (!ok) {
+		printf("%-12s FAIL: %d samples differ, by up to %d, first at %d,%d\n", c->name, mismatches, worst, firstX, firstY);
+	} else {
+		printf("%-12s ok\n", c->name);
+	}
+	free(data);
+	free(expected);
+	free(jpeg);
+	return ok;
+}
+
+int main(void) {
+	if (!createContext()) {
+		printf("No OpenGL 3.3 context, skipping\n");
+		return SKIP_CODE;
+	}
+	if (!GpuJpeg_init()) {
+		printf("GPU JPEG passes did not link\n");
+		return 1;
+	}
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		if (!runCase(&cases[i])) ++failed;
+	}
+	return failed ? 1 : 0;
+}